@@ -15,6 +15,8 @@
  *
  */
 
+#define LOG_MODULE LOG_MODULE_CLIENT
+
 #include "client.h"
 #include "deque.h"
 #include "ipc.h"
@@ -25,6 +27,8 @@
 #include <assert.h>
 #include <errno.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -37,6 +41,8 @@ static struct ipc_duplex duplex;
 static struct ipc_queue client_msg_queue;
 static struct ipc_queue client_discard_queue;
 
+static bool disconnected;
+
 int init_client(){
   
   LOG_INFO("initializing client...");
@@ -51,16 +57,14 @@ int init_client(){
 
   init_ipc_queue(&client_msg_queue, &alloc);
   init_ipc_queue(&client_discard_queue, &alloc);
+  disconnected = false;
   
   LOG_INFO("client initialized");
 
   return 0;
 }
 
-int start_client(){
-
-  LOG_INFO("starting client...");
-  
+int connect_to_server(){
   LOG_INFO("attempting to connect to server at host %s and port %s", DEFAULT_SERVER_HOST, DEFAULT_SERVER_PORT);
 
   struct addrinfo hints;
@@ -77,19 +81,17 @@ int start_client(){
   if(getaddrinfo(DEFAULT_SERVER_HOST, DEFAULT_SERVER_PORT, &hints, &result)){
     LOG_ERROR("could not find suitable service for host %s and port %s", DEFAULT_SERVER_HOST, DEFAULT_SERVER_PORT);
     set_status(STATUS_NO_SERVER_ADDRESS);
-    dispose_ipc_duplex(&duplex);
-    dispose_ipc_alloc(&alloc);
     return -1;
   }
 
-  client_socket = -1;
+  int fd = -1;
   struct addrinfo * addr;
   for(addr = result; addr != NULL; addr = addr->ai_next){
-    client_socket = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
-    if(client_socket != -1){
-      if(connect(client_socket, addr->ai_addr, addr->ai_addrlen) == -1){
-	close(client_socket);
-	client_socket = -1;
+    fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if(fd != -1){
+      if(connect(fd, addr->ai_addr, addr->ai_addrlen) == -1){
+	close(fd);
+	fd = -1;
       }else{
 	break;
       }
@@ -98,9 +100,44 @@ int start_client(){
 
   freeaddrinfo(result);
 
-  if(client_socket == -1){
+  // messages are written field by field, without this they wait for the server's delayed acknowledgement
+  int opt_val = 1;
+  if(fd != -1 && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt_val, sizeof(opt_val)) == -1){
+    LOG_WARNING("could not disable coalescing on client socket: %s", strerror(errno));
+  }
+
+  if(fd == -1){
     LOG_ERROR("could not connect to service for host %s and port %s", DEFAULT_SERVER_HOST, DEFAULT_SERVER_PORT);
     set_status(STATUS_NO_SERVER_ADDRESS);
+  }
+  return fd;
+}
+
+static int close_client_socket(){
+  int result = 0;
+  
+  // the socket is no longer connected if the server dropped the connection
+  if(shutdown(client_socket, SHUT_RDWR) && errno != ENOTCONN){
+    LOG_ERROR("could not shut down client socket: %s", strerror(errno));
+    result = -1;
+  }
+
+  if(close(client_socket)){
+    LOG_ERROR("could not close client socket: %s",  strerror(errno));
+    result = -1;
+  }
+
+  client_socket = -1;
+  return result;
+}
+
+int start_client(){
+
+  LOG_INFO("starting client...");
+  
+  client_socket = connect_to_server();
+
+  if(client_socket == -1){
     dispose_ipc_duplex(&duplex);
     dispose_ipc_alloc(&alloc);
     return -1;
@@ -111,6 +148,7 @@ int start_client(){
     close(client_socket);
     dispose_ipc_duplex(&duplex);
     dispose_ipc_alloc(&alloc);
+    return -1;
   }
 
   LOG_INFO("client started");
@@ -118,19 +156,45 @@ int start_client(){
   return 0;
 }
 
+int reconnect_client(){
+
+  LOG_INFO("reconnecting client...");
+
+  if(client_socket != -1){
+    int result = detach_ipc_duplex(&duplex);
+    if(close_client_socket()){
+      result = -1;
+    }
+    if(result){
+      return -1;
+    }
+  }
+
+  int fd = connect_to_server();
+  if(fd == -1){
+    return -1;
+  }
+
+  if(attach_ipc_duplex(&duplex, fd)){
+    shutdown(fd, SHUT_RDWR);
+    close(fd);
+    return -1;
+  }
+  client_socket = fd;
+  disconnected = false;
+
+  LOG_INFO("client reconnected");
+
+  return 0;
+}
+
 int stop_client(){
 
   LOG_INFO("stopping client...");
   
   int result = close_ipc_duplex(&duplex);
 
-  if(shutdown(client_socket, SHUT_RDWR)){
-    LOG_ERROR("could not shut down client socket: %s", strerror(errno));
-    result = -1;
-  }
-
-  if(close(client_socket)){
-    LOG_ERROR("could not close client socket: %s",  strerror(errno));
+  if(client_socket != -1 && close_client_socket()){
     result = -1;
   }
 
@@ -148,10 +212,6 @@ int dispose_client(){
     result = -1;
   }
   
-  if(dispose_ipc_alloc(&alloc)){
-    result = -1;
-  }
-
   if(dispose_ipc_queue(&client_msg_queue)){
     result = -1;
   }
@@ -160,17 +220,64 @@ int dispose_client(){
     result = -1;
   }
 
+  if(dispose_ipc_alloc(&alloc)){
+    result = -1;
+  }
+
   LOG_INFO("client disposed");
 
   return result;
 }
 
+/**
+ * Connection loss is reported through is_client_disconnected, not as a message
+ */
+static void accept_client_msg(struct ipc_msg * msg){
+  if(msg->type == IPC_MSG_TYPE_DISCONNECTED){
+    LOG_WARNING("client: connection to server lost");
+    disconnected = true;
+    push_onto_ipc_queue(&client_discard_queue, msg);
+  }else{
+    push_onto_ipc_queue(&client_msg_queue, msg);
+  }
+}
+
 int receive_client_messages(){
   if(clear_ipc_queue(&client_discard_queue)){
     return -1;
   }
   
-  return try_receive_all_from_ipc_duplex(&client_msg_queue, &duplex);
+  struct ipc_queue received;
+  init_ipc_queue(&received, &alloc);
+  int result = try_receive_all_from_ipc_duplex(&received, &duplex);
+  
+  struct ipc_msg * msg;
+  while((msg = pop_from_ipc_queue(&received)) != NULL){
+    accept_client_msg(msg);
+  }
+  return result;
+}
+
+int wait_for_client_messages(const struct timespec * deadline){
+  if(clear_ipc_queue(&client_discard_queue)){
+    return -1;
+  }
+
+  struct ipc_msg * msg;
+  int result = deadline == NULL ? receive_from_ipc_duplex(&msg, &duplex) : timed_receive_from_ipc_duplex(&msg, &duplex, deadline);
+  if(result){
+    return result;
+  }
+  if(msg == NULL){
+    return 0;
+  }
+  accept_client_msg(msg);
+  // whatever arrived together with the first message is handled in the same update
+  return receive_client_messages();
+}
+
+bool is_client_disconnected(){
+  return disconnected;
 }
 
 struct ipc_msg * get_received_client_msg(){
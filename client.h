@@ -20,12 +20,30 @@
 
 #include "ipc.h"
 
+#include <stdbool.h>
+#include <time.h>
+
 int init_client();
 
+/**
+ * Opens a socket connected to the server, returns -1 on failure
+ */
+int connect_to_server();
+
 int start_client();
 
+int reconnect_client();
+
 int receive_client_messages();
 
+/**
+ * Blocks until at least one message arrived or the deadline (CLOCK_MONOTONIC) passed, NULL waits without limit
+ * Returns non zero with status STATUS_IPC_QUEUE_STOPPED once the client is stopped
+ */
+int wait_for_client_messages(const struct timespec * deadline);
+
+bool is_client_disconnected();
+
 struct ipc_msg * get_received_client_msg();
 
 struct ipc_msg * create_client_msg();
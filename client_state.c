@@ -15,33 +15,113 @@
  *
  */
 
+#define LOG_MODULE LOG_MODULE_CLIENT
+
 #include "client.h"
 #include "client_state.h"
 #include "game.h"
 #include "ipc.h"
 #include "logger.h"
+#include "memory.h"
 #include "unicode.h"
+#include "world.h"
 
+#include <stdint.h>
 #include <string.h>
+#include <time.h>
+
+#define CLIENT_STATE_COUNT 10
 
-#define CLIENT_STATE_COUNT 9
+/**
+ * Seconds between two attempts to reconnect to the server
+ */
+#define CLIENT_RECONNECT_DELAY 1
 
-typedef int (*client_transition_fn)();
+/**
+ * Maximum number of local events waiting to be dispatched
+ */
+#define CLIENT_EVENT_QUEUE_LEN 16
 
 enum client_player_state{
   CLIENT_PLAYER_STATE_UNAUTHORIZED,
   CLIENT_PLAYER_STATE_AUTHORIZING,
+  CLIENT_PLAYER_STATE_RESUMING,
   CLIENT_PLAYER_STATE_REJECTED,
   CLIENT_PLAYER_STATE_AUTHORIZED
 };
 
+#define CLIENT_PLAYER_STATE_COUNT 5
+
+/**
+ * Received messages and timers are turned into events,
+ * nothing happens while there are no events
+ */
+enum client_event_type{
+		       CLIENT_EVENT_CONNECTED,
+		       CLIENT_EVENT_AUTH_RES,
+		       CLIENT_EVENT_RESUME_RES,
+		       CLIENT_EVENT_WORLD_MSG,
+		       CLIENT_EVENT_DISCONNECTED,
+		       CLIENT_EVENT_RECONNECT_TIMER
+};
+
+#define CLIENT_EVENT_COUNT 6
+
+enum client_timer{
+		  CLIENT_TIMER_RECONNECT
+};
+
+#define CLIENT_TIMER_COUNT 1
+
+/**
+ * msg is the received message, NULL for local events
+ */
+struct client_event{
+  enum client_event_type type;
+  const struct protocol_msg * msg;
+};
+
 struct client_player{
   char32_t name[GAME_MAX_PLAYER_NAME_LEN + 1];
   int id;
   enum client_player_state state;
+  char token[PROTOCOL_SESSION_TOKEN_LEN + 1];
+  int last_seq;
+  unsigned int correlation_id;
 };
 
-static client_transition_fn transitions[CLIENT_STATE_COUNT];
+/**
+ * An entity as last reported by the server
+ */
+struct client_entity{
+  unsigned int id;
+  /**
+   * Bit i is set while the entity is visible to local player i, the server tracks interest per player
+   */
+  uint32_t viewers;
+  int owner;
+  double x;
+  double y;
+  double vx;
+  double vy;
+  int health;
+};
+
+struct client_timer_state{
+  bool armed;
+  struct timespec due;
+};
+
+typedef int (*client_event_fn)(const struct client_event * event);
+
+typedef int (*client_player_event_fn)(struct client_player * p, const struct client_event * event);
+
+/**
+ * Handlers by state and event, events without a handler are ignored
+ */
+static client_event_fn handlers[CLIENT_STATE_COUNT][CLIENT_EVENT_COUNT];
+
+static client_player_event_fn player_handlers[CLIENT_PLAYER_STATE_COUNT][CLIENT_EVENT_COUNT];
 
 static const char * state_labels[] =  {
 				       "STARTED",
@@ -50,18 +130,44 @@ static const char * state_labels[] =  {
 				       "REJECTED",
 				       "INITIALIZING",
 				       "READY",
+				       "RECONNECTING",
 				       "STOPPING",
 				       "STOPPED",
 				       "ERROR"
 };
 
+static const char * event_labels[] = {
+				      "CONNECTED",
+				      "AUTH RES",
+				      "RESUME RES",
+				      "WORLD MSG",
+				      "DISCONNECTED",
+				      "RECONNECT TIMER"
+};
+
+static const enum client_event_type timer_events[] = {
+						      CLIENT_EVENT_RECONNECT_TIMER
+};
 
 static enum client_state state;
 
 static struct client_player players[GAME_MAX_PLAYER_COUNT];
 static int player_count;
 
-static int add_player(char * name){
+// visible entities, indexed by the slot part of the entity id
+static struct client_entity * entities;
+static size_t entity_cap;
+static size_t visible_entity_count;
+
+static struct client_event event_queue[CLIENT_EVENT_QUEUE_LEN];
+static size_t event_queue_start;
+static size_t event_queue_len;
+
+static struct client_timer_state timers[CLIENT_TIMER_COUNT];
+
+static unsigned int next_correlation_id;
+
+static int add_player(const char * name){
   if(player_count == GAME_MAX_PLAYER_COUNT){
     return -1;
   }
@@ -70,119 +176,497 @@ static int add_player(char * name){
   str_to_unicode_str_checked(p->name, GAME_MAX_PLAYER_NAME_LEN, name);
   p->id = -1;
   p->state = CLIENT_PLAYER_STATE_UNAUTHORIZED;
+  p->token[0] = '\0';
+  p->last_seq = 0;
   ++player_count;
+  
   return 0;
 }
 
-static int at_client_started(){
-  //TEST CODE: add 1 player
-  add_player("player1");
-  state = CLIENT_STATE_UNAUTHORIZED;
+static int queue_event(enum client_event_type type){
+  if(event_queue_len == CLIENT_EVENT_QUEUE_LEN){
+    LOG_ERROR("client: event queue is full, dropping %s", event_labels[(int)type]);
+    return -1;
+  }
+  struct client_event * e = &event_queue[(event_queue_start + event_queue_len) % CLIENT_EVENT_QUEUE_LEN];
+  e->type = type;
+  e->msg = NULL;
+  ++event_queue_len;
   return 0;
 }
 
+static void arm_timer(enum client_timer timer, time_t delay){
+  struct client_timer_state * t = &timers[(int)timer];
+  clock_gettime(CLOCK_MONOTONIC, &t->due);
+  t->due.tv_sec += delay;
+  t->armed = true;
+}
 
-static int at_client_unauthorized(){
+/**
+ * Turns the timers that are due into events
+ */
+static void queue_due_timers(){
+  struct timespec now;
+  bool have_now = false;
+  for(int i = 0; i < CLIENT_TIMER_COUNT; ++i){
+    struct client_timer_state * t = &timers[i];
+    if(!t->armed){
+      continue;
+    }
+    if(!have_now){
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      have_now = true;
+    }
+    if(now.tv_sec > t->due.tv_sec || (now.tv_sec == t->due.tv_sec && now.tv_nsec >= t->due.tv_nsec)){
+      t->armed = false;
+      queue_event(timer_events[i]);
+    }
+  }
+}
 
+static struct client_player * find_player(int id){
   for(size_t i = 0; i < player_count; ++i){
+    if(players[i].id == id){
+      return &players[i];
+    }
+  }
+  return NULL;
+}
 
-    if(players[i].state == CLIENT_PLAYER_STATE_UNAUTHORIZED){
-      
-      struct ipc_msg * msg = create_client_msg();
-      if(msg == NULL){
-	return -1;
-      }
-      
-      init_protocol_auth_req(&msg->payload, players[i].name);
-      send_client_msg(msg);
-      players[i].state = CLIENT_PLAYER_STATE_AUTHORIZING;
+/**
+ * Finds the player waiting for the response to the request with the correlation id
+ */
+static struct client_player * find_waiting_player(enum client_player_state waiting_state, unsigned int correlation_id){
+  for(size_t i = 0; i < player_count; ++i){
+    if(players[i].state == waiting_state && players[i].correlation_id == correlation_id){
+      return &players[i];
     }
   }
-  
-  state = CLIENT_STATE_AUTHORIZING;
-  
+  return NULL;
+}
+
+/**
+ * Remembers the last session message received by a player so that
+ * only missed messages are sent again after a reconnect
+ */
+static void track_session_msg(const struct protocol_msg * msg){
+  if(msg->seq == 0){
+    return;
+  }
+  struct client_player * p = find_player(msg->player);
+  if(p != NULL && msg->seq > p->last_seq){
+    p->last_seq = msg->seq;
+  }
+}
+
+static struct client_entity * get_entity_slot(unsigned int id){
+  size_t slot = id & WORLD_ENTITY_INDEX_MASK;
+  if(slot >= entity_cap){
+    size_t cap = entity_cap == 0 ? WORLD_INITIAL_CAPACITY : entity_cap;
+    while(cap <= slot){
+      cap *= 2;
+    }
+    struct client_entity * data = realloc_checked(entities, sizeof(struct client_entity) * cap);
+    if(data == NULL){
+      LOG_ERROR("client: could not store entity");
+      return NULL;
+    }
+    memset(data + entity_cap, 0, sizeof(struct client_entity) * (cap - entity_cap));
+    entities = data;
+    entity_cap = cap;
+  }
+  return &entities[slot];
+}
+
+static void set_entity(struct client_entity * e, const struct protocol_entity * body){
+  e->id = body->id;
+  e->owner = body->owner;
+  e->x = body->x;
+  e->y = body->y;
+  e->vx = body->vx;
+  e->vy = body->vy;
+  e->health = body->health;
+}
+
+static bool is_viewer_id(int player){
+  return player >= 0 && player < GAME_MAX_PLAYER_COUNT;
+}
+
+static void remove_entity_viewers(struct client_entity * e, uint32_t viewers){
+  if(e->viewers != 0 && (e->viewers & ~viewers) == 0){
+    --visible_entity_count;
+  }
+  e->viewers &= ~viewers;
+}
+
+static void handle_entity_enter(int player, const struct protocol_entity * body){
+  if(!is_viewer_id(player)){
+    return;
+  }
+  struct client_entity * e = get_entity_slot(body->id);
+  if(e == NULL){
+    return;
+  }
+  // the slot was reused by the server, nobody can still see the entity that had it
+  if(e->id != body->id){
+    remove_entity_viewers(e, e->viewers);
+  }
+  if(e->viewers == 0){
+    ++visible_entity_count;
+  }
+  set_entity(e, body);
+  e->viewers |= ((uint32_t)1) << player;
+}
+
+static void handle_entity_update(const struct protocol_entity * body){
+  size_t slot = body->id & WORLD_ENTITY_INDEX_MASK;
+  if(slot < entity_cap && entities[slot].viewers != 0 && entities[slot].id == body->id){
+    set_entity(&entities[slot], body);
+  }
+}
+
+static void handle_entity_leave(int player, const struct protocol_entity_leave * body){
+  size_t slot = body->id & WORLD_ENTITY_INDEX_MASK;
+  if(is_viewer_id(player) && slot < entity_cap && entities[slot].id == body->id){
+    remove_entity_viewers(&entities[slot], ((uint32_t)1) << player);
+  }
+}
+
+/**
+ * Forgets what a player could see, entities other local players see stay visible
+ */
+static void clear_player_view(int player){
+  if(!is_viewer_id(player)){
+    return;
+  }
+  for(size_t i = 0; i < entity_cap; ++i){
+    remove_entity_viewers(&entities[i], ((uint32_t)1) << player);
+  }
+}
+
+static int send_auth_req(struct client_player * p){
+  struct ipc_msg * msg = create_client_msg();
+  if(msg == NULL){
+    return -1;
+  }
+  p->correlation_id = next_correlation_id++;
+  init_protocol_auth_req(&msg->payload, p->correlation_id, p->name);
+  if(send_client_msg(msg)){
+    return -1;
+  }
+  p->state = CLIENT_PLAYER_STATE_AUTHORIZING;
   return 0;
 }
 
+static int send_resume_req(struct client_player * p){
+  struct ipc_msg * msg = create_client_msg();
+  if(msg == NULL){
+    return -1;
+  }
+  p->correlation_id = next_correlation_id++;
+  init_protocol_resume_req(&msg->payload, p->correlation_id, p->token, p->last_seq);
+  if(send_client_msg(msg)){
+    return -1;
+  }
+  p->state = CLIENT_PLAYER_STATE_RESUMING;
+  return 0;
+}
 
-static int at_client_authorizing(){
+/**
+ * Players without a session authenticate, every request is sent at once
+ */
+static int on_player_connected_unauthorized(struct client_player * p, const struct client_event * event){
+  return send_auth_req(p);
+}
 
-  struct ipc_msg * msg;
-  while((msg = get_received_client_msg()) != NULL){
-    if(msg->payload.type == PROTOCOL_MSG_TYPE_AUTH_RES){
-      struct protocol_auth_res * body = &msg->payload.auth_res;
-      if(body->id == -1){
-	LOG_DEBUG("client: authentication rejected by server: %s", body->reason);
-	players[0].state = CLIENT_PLAYER_STATE_REJECTED;
-	state = CLIENT_STATE_REJECTED;
-      }else{
-	LOG_DEBUG("client: authentication accepted for player %d", body->id);
-	players[0].id = body->id;
-	players[0].state = CLIENT_PLAYER_STATE_AUTHORIZED;
-	state = CLIENT_STATE_INITIALIZING;
-      }
-    }else{
-      LOG_ERROR("client: unexpected message received: %s", get_protocol_msg_type_label(msg->payload.type));
-    }
-    destroy_client_msg(msg);
+/**
+ * Players with a session resume it, this includes players whose resume request was lost with the connection
+ */
+static int on_player_connected_authorized(struct client_player * p, const struct client_event * event){
+  return send_resume_req(p);
+}
+
+static int on_player_auth_res(struct client_player * p, const struct client_event * event){
+  const struct protocol_auth_res * body = &event->msg->auth_res;
+  if(body->id == -1){
+    LOG_DEBUG("client: authentication rejected by server: %s", body->reason);
+    p->state = CLIENT_PLAYER_STATE_REJECTED;
+  }else{
+    LOG_DEBUG("client: authentication accepted for player %d", body->id);
+    p->id = body->id;
+    p->state = CLIENT_PLAYER_STATE_AUTHORIZED;
+    strcpy(p->token, body->token);
+    p->last_seq = 0;
   }
-  
   return 0;
 }
 
-static int at_client_rejected(){
+static int on_player_resume_res(struct client_player * p, const struct client_event * event){
+  const struct protocol_resume_res * body = &event->msg->resume_res;
+  if(body->id == -1){
+    // the session is gone, the player has to authenticate again
+    LOG_DEBUG("client: session resumption rejected by server: %s", body->reason);
+    p->id = -1;
+    return send_auth_req(p);
+  }
+  LOG_DEBUG("client: session resumed for player %d", body->id);
+  // the server sends everything this player can see again, but only for this player
+  clear_player_view(body->id);
+  p->state = CLIENT_PLAYER_STATE_AUTHORIZED;
   return 0;
 }
 
+static int dispatch_player_event(struct client_player * p, const struct client_event * event){
+  client_player_event_fn handler = player_handlers[(int)p->state][(int)event->type];
+  if(handler == NULL){
+    return 0;
+  }
+  return (*handler)(p, event);
+}
 
-static int at_client_initializing(){
+/**
+ * Derives the client state from the players once no more responses are expected
+ */
+static void update_authorization_state(){
+  bool authorized = false;
+  for(size_t i = 0; i < player_count; ++i){
+    switch(players[i].state){
+    case CLIENT_PLAYER_STATE_AUTHORIZING:
+    case CLIENT_PLAYER_STATE_RESUMING:
+      state = CLIENT_STATE_AUTHORIZING;
+      return;
+    case CLIENT_PLAYER_STATE_AUTHORIZED:
+      authorized = true;
+      break;
+    default:
+      break;
+    }
+  }
+  if(!authorized){
+    state = CLIENT_STATE_REJECTED;
+  }else if(visible_entity_count > 0){
+    state = CLIENT_STATE_READY;
+  }else{
+    state = CLIENT_STATE_INITIALIZING;
+  }
+}
+
+static int on_started_connected(const struct client_event * event){
+  for(size_t i = 0; i < player_count; ++i){
+    if(dispatch_player_event(&players[i], event)){
+      return -1;
+    }
+  }
+  update_authorization_state();
   return 0;
 }
 
-static int at_client_ready(){
+static int on_auth_res(const struct client_event * event){
+  struct client_player * p = find_waiting_player(CLIENT_PLAYER_STATE_AUTHORIZING, event->msg->auth_res.correlation_id);
+  if(p == NULL){
+    // a response to a request that was lost with an earlier connection
+    LOG_WARNING("client: authentication response received without pending request");
+    return 0;
+  }
+  if(dispatch_player_event(p, event)){
+    return -1;
+  }
+  update_authorization_state();
   return 0;
 }
 
-static int at_client_stopping(){
+static int on_resume_res(const struct client_event * event){
+  struct client_player * p = find_waiting_player(CLIENT_PLAYER_STATE_RESUMING, event->msg->resume_res.correlation_id);
+  if(p == NULL){
+    LOG_WARNING("client: resume response received without pending request");
+    return 0;
+  }
+  if(dispatch_player_event(p, event)){
+    return -1;
+  }
+  update_authorization_state();
+  return 0;
+}
+
+static int on_world_msg(const struct client_event * event){
+  const struct protocol_msg * msg = event->msg;
+  switch(msg->type){
+  case PROTOCOL_MSG_TYPE_ENTITY_ENTER:
+    handle_entity_enter(msg->player, &msg->entity_enter);
+    break;
+  case PROTOCOL_MSG_TYPE_ENTITY_UPDATE:
+    handle_entity_update(&msg->entity_update);
+    break;
+  case PROTOCOL_MSG_TYPE_ENTITY_LEAVE:
+    handle_entity_leave(msg->player, &msg->entity_leave);
+    break;
+  default:
+    break;
+  }
+  // the player's own units are always visible, so the first world update completes initialization
+  if(state == CLIENT_STATE_INITIALIZING && visible_entity_count > 0){
+    state = CLIENT_STATE_READY;
+  }
   return 0;
 }
 
-static int at_client_stopped(){
+static int on_disconnected(const struct client_event * event){
+  state = CLIENT_STATE_RECONNECTING;
+  arm_timer(CLIENT_TIMER_RECONNECT, 0);
   return 0;
 }
 
-static int at_client_error(){
+static int on_reconnect_timer(const struct client_event * event){
+  if(reconnect_client()){
+    LOG_WARNING("client: could not reconnect to server");
+    arm_timer(CLIENT_TIMER_RECONNECT, CLIENT_RECONNECT_DELAY);
+    return 0;
+  }
+  
+  struct client_event connected = {CLIENT_EVENT_CONNECTED, NULL};
+  for(size_t i = 0; i < player_count; ++i){
+    if(dispatch_player_event(&players[i], &connected)){
+      return -1;
+    }
+  }
+  update_authorization_state();
   return 0;
 }
 
-void init_client_state(){
-  memset(transitions, 0, sizeof(transitions));
-  transitions[CLIENT_STATE_STARTED] = at_client_started;
-  transitions[CLIENT_STATE_UNAUTHORIZED] = at_client_unauthorized;
-  transitions[CLIENT_STATE_AUTHORIZING] = at_client_authorizing;
-  transitions[CLIENT_STATE_REJECTED] = at_client_rejected;
-  transitions[CLIENT_STATE_INITIALIZING] = at_client_initializing;
-  transitions[CLIENT_STATE_READY] = at_client_ready;
-  transitions[CLIENT_STATE_STOPPING] = at_client_stopping;
-  transitions[CLIENT_STATE_STOPPED] = at_client_stopped;
-  transitions[CLIENT_STATE_ERROR] = at_client_error;
+static int dispatch_event(const struct client_event * event){
+  enum client_state last_state = state;
+  client_event_fn handler = handlers[(int)state][(int)event->type];
+  if(handler == NULL){
+    if(event->msg != NULL){
+      LOG_ERROR("client: unexpected message received in state %s: %s", state_labels[(int)state], get_protocol_msg_type_label(event->msg->type));
+    }
+    return 0;
+  }
+  int result = (*handler)(event);
+  if(result){
+    LOG_ERROR("client: handling %s in state %s has encountered an error", event_labels[(int)event->type], state_labels[(int)last_state]);
+  }else if(state != last_state){
+    LOG_DEBUG("client state transitioned from %s to %s on %s", state_labels[(int)last_state], state_labels[(int)state], event_labels[(int)event->type]);
+  }
+  return result;
+}
+
+static enum client_event_type get_msg_event_type(const struct protocol_msg * msg){
+  switch(msg->type){
+  case PROTOCOL_MSG_TYPE_AUTH_RES:
+    return CLIENT_EVENT_AUTH_RES;
+  case PROTOCOL_MSG_TYPE_RESUME_RES:
+    return CLIENT_EVENT_RESUME_RES;
+  default:
+    return CLIENT_EVENT_WORLD_MSG;
+  }
+}
+
+static void set_handler(enum client_state s, enum client_event_type e, client_event_fn handler){
+  handlers[(int)s][(int)e] = handler;
+}
+
+static void init_handlers(){
+  memset(handlers, 0, sizeof(handlers));
+  set_handler(CLIENT_STATE_STARTED, CLIENT_EVENT_CONNECTED, on_started_connected);
+  
+  set_handler(CLIENT_STATE_AUTHORIZING, CLIENT_EVENT_AUTH_RES, on_auth_res);
+  set_handler(CLIENT_STATE_AUTHORIZING, CLIENT_EVENT_RESUME_RES, on_resume_res);
+  // messages for players that are already authorized can arrive while others are still authorizing
+  set_handler(CLIENT_STATE_AUTHORIZING, CLIENT_EVENT_WORLD_MSG, on_world_msg);
+  set_handler(CLIENT_STATE_INITIALIZING, CLIENT_EVENT_WORLD_MSG, on_world_msg);
+  set_handler(CLIENT_STATE_READY, CLIENT_EVENT_WORLD_MSG, on_world_msg);
+
+  set_handler(CLIENT_STATE_STARTED, CLIENT_EVENT_DISCONNECTED, on_disconnected);
+  set_handler(CLIENT_STATE_AUTHORIZING, CLIENT_EVENT_DISCONNECTED, on_disconnected);
+  set_handler(CLIENT_STATE_REJECTED, CLIENT_EVENT_DISCONNECTED, on_disconnected);
+  set_handler(CLIENT_STATE_INITIALIZING, CLIENT_EVENT_DISCONNECTED, on_disconnected);
+  set_handler(CLIENT_STATE_READY, CLIENT_EVENT_DISCONNECTED, on_disconnected);
+  set_handler(CLIENT_STATE_RECONNECTING, CLIENT_EVENT_RECONNECT_TIMER, on_reconnect_timer);
+
+  memset(player_handlers, 0, sizeof(player_handlers));
+  player_handlers[CLIENT_PLAYER_STATE_UNAUTHORIZED][CLIENT_EVENT_CONNECTED] = on_player_connected_unauthorized;
+  // the request was lost with the connection
+  player_handlers[CLIENT_PLAYER_STATE_AUTHORIZING][CLIENT_EVENT_CONNECTED] = on_player_connected_unauthorized;
+  player_handlers[CLIENT_PLAYER_STATE_AUTHORIZED][CLIENT_EVENT_CONNECTED] = on_player_connected_authorized;
+  player_handlers[CLIENT_PLAYER_STATE_RESUMING][CLIENT_EVENT_CONNECTED] = on_player_connected_authorized;
+  player_handlers[CLIENT_PLAYER_STATE_AUTHORIZING][CLIENT_EVENT_AUTH_RES] = on_player_auth_res;
+  player_handlers[CLIENT_PLAYER_STATE_RESUMING][CLIENT_EVENT_RESUME_RES] = on_player_resume_res;
+}
+
+void init_client_state(const char * const * player_names, size_t name_count){
+  init_handlers();
   state = CLIENT_STATE_STARTED;
 
   memset(&players, 0, sizeof(players));
   player_count = 0;
+  for(size_t i = 0; i < name_count; ++i){
+    add_player(player_names[i]);
+  }
+
+  entities = NULL;
+  entity_cap = 0;
+  visible_entity_count = 0;
+
+  event_queue_start = 0;
+  event_queue_len = 0;
+  memset(timers, 0, sizeof(timers));
+  next_correlation_id = 0;
+  
+  // the client is connected once it has been started
+  queue_event(CLIENT_EVENT_CONNECTED);
 }
 
 int update_client_state(){
-  enum client_state last_state = state;
-  int result = (*transitions[(int)state])();
-  if(result){
-    LOG_ERROR("client state transition from %s has encountered an error", state_labels[(int)last_state]);
-  }else if(state != last_state){
-    LOG_DEBUG("client state transitioned from %s to %s", state_labels[(int)last_state], state_labels[(int)state]);
+  int result = 0;
+  
+  struct ipc_msg * msg;
+  while((msg = get_received_client_msg()) != NULL){
+    struct client_event event = {get_msg_event_type(&msg->payload), &msg->payload};
+    if(dispatch_event(&event)){
+      result = -1;
+    }
+    // tracked after dispatching, an authentication response only tells which player it belongs to once handled
+    track_session_msg(&msg->payload);
+    destroy_client_msg(msg);
+  }
+
+  // messages received before the connection was lost have been handled first
+  if(is_client_disconnected() && state != CLIENT_STATE_RECONNECTING){
+    queue_event(CLIENT_EVENT_DISCONNECTED);
+  }
+  queue_due_timers();
+  
+  while(event_queue_len > 0){
+    struct client_event event = event_queue[event_queue_start];
+    event_queue_start = (event_queue_start + 1) % CLIENT_EVENT_QUEUE_LEN;
+    --event_queue_len;
+    if(dispatch_event(&event)){
+      result = -1;
+    }
   }
   return result;
 }
 
-void dispose_client_state(){}
-
+bool get_client_state_deadline(struct timespec * deadline){
+  // queued events are handled right away
+  if(event_queue_len > 0){
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    return true;
+  }
+  bool armed = false;
+  for(int i = 0; i < CLIENT_TIMER_COUNT; ++i){
+    const struct timespec * due = &timers[i].due;
+    if(timers[i].armed && (!armed || due->tv_sec < deadline->tv_sec || (due->tv_sec == deadline->tv_sec && due->tv_nsec < deadline->tv_nsec))){
+      *deadline = *due;
+      armed = true;
+    }
+  }
+  return armed;
+}
 
+void dispose_client_state(){
+  free(entities);
+  entities = NULL;
+  entity_cap = 0;
+}
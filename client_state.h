@@ -18,6 +18,9 @@
 #ifndef CLIENT_STATE_H
 #define CLIENT_STATE_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
 #include <uchar.h>
 
 enum client_state{
@@ -27,15 +30,25 @@ enum client_state{
 		  CLIENT_STATE_REJECTED,
 		  CLIENT_STATE_INITIALIZING,
 		  CLIENT_STATE_READY,
+		  CLIENT_STATE_RECONNECTING,
 		  CLIENT_STATE_STOPPING,
 		  CLIENT_STATE_STOPPED,
 		  CLIENT_STATE_ERROR
 };
 
-void init_client_state();
+/**
+ * The client authenticates every named player over its connection, the names must outlive the client state
+ */
+void init_client_state(const char * const * player_names, size_t name_count);
 
 int update_client_state();
 
+/**
+ * Sets the time the client state has to be updated even if no message arrives
+ * Returns false if only a message can change the state
+ */
+bool get_client_state_deadline(struct timespec * deadline);
+
 void dispose_client_state();
 
 #endif
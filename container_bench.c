@@ -0,0 +1,517 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * Stand alone benchmark of the container implementations
+ * Build with 'make container_bench'
+ *
+ * Compares the type erased ptr_hash_map and deque, which call hash and equality functions
+ * through pointers and use a runtime element size, with the variants generated by
+ * DEFINE_HASH_MAP and DEFINE_DEQUE, and measures ptr_hash_map with string and pointer keys
+ * at load factors from 0.5 to 0.875.
+ */
+
+#include "deque.h"
+#include "hash_map.h"
+#include "logger.h"
+#include "status.h"
+
+#include <assert.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_BENCH_COUNT 100000
+
+#define DEFAULT_BENCH_ROUNDS 10
+
+#define BENCH_KEY_LEN 32
+
+struct bench_settings{
+  size_t count;
+  size_t rounds;
+  unsigned int seed;
+};
+
+struct bench_elem{
+  double x;
+  double y;
+  int id;
+};
+
+static size_t hash_str_key(const char * key){
+  return hash_map_hash_str(key);
+}
+
+static bool eq_str_key(const char * first, const char * second){
+  return strcmp(first, second) == 0;
+}
+
+static size_t hash_int_key(int key){
+  return (size_t)(unsigned int)key * 2654435761u;
+}
+
+static bool eq_int_key(int first, int second){
+  return first == second;
+}
+
+DEFINE_HASH_MAP(str_map, const char *, int, hash_str_key, eq_str_key)
+
+DEFINE_HASH_MAP(int_map, int, int, hash_int_key, eq_int_key)
+
+DEFINE_DEQUE(elem_deque, struct bench_elem)
+
+/**
+ * Keeps the optimizer from removing the measured loops
+ */
+static volatile size_t sink;
+
+static double get_seconds(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void print_result(const char * name, size_t ops, double seconds, double baseline){
+  double ns = seconds * 1e9 / ops;
+  if(baseline > 0){
+    printf("%-32s %12zu %10.2f %9.2fx\n", name, ops, ns, baseline / ns);
+  }else{
+    printf("%-32s %12zu %10.2f %10s\n", name, ops, ns, "-");
+  }
+}
+
+static void shuffle(size_t * order, size_t count){
+  for(size_t i = 0; i < count; ++i){
+    order[i] = i;
+  }
+  for(size_t i = count; i > 1; --i){
+    size_t j = (size_t)rand() % i;
+    size_t t = order[i - 1];
+    order[i - 1] = order[j];
+    order[j] = t;
+  }
+}
+
+static int bench_str_maps(const struct bench_settings * settings, const size_t * order){
+  size_t count = settings->count;
+  char (*keys)[BENCH_KEY_LEN] = malloc(sizeof(*keys) * count);
+  char (*missing)[BENCH_KEY_LEN] = malloc(sizeof(*missing) * count);
+  int * values = malloc(sizeof(int) * count);
+  if(keys == NULL || missing == NULL || values == NULL){
+    free(keys);
+    free(missing);
+    free(values);
+    set_status(STATUS_MALLOC_FAILED);
+    return -1;
+  }
+  for(size_t i = 0; i < count; ++i){
+    snprintf(keys[i], BENCH_KEY_LEN, "label.%zu", i);
+    snprintf(missing[i], BENCH_KEY_LEN, "missing.%zu", i);
+    values[i] = (int)i;
+  }
+
+  struct ptr_hash_map pmap;
+  struct str_map tmap;
+  if(init_ptr_hash_map(&pmap, hash_map_hash_str, hash_map_eq_str, 0)){
+    free(keys);
+    free(missing);
+    free(values);
+    return -1;
+  }
+  if(init_str_map(&tmap, 0)){
+    dispose_ptr_hash_map(&pmap);
+    free(keys);
+    free(missing);
+    free(values);
+    return -1;
+  }
+
+  double start = get_seconds();
+  for(size_t i = 0; i < count; ++i){
+    insert_new_into_ptr_hash_map(&pmap, keys[order[i]], &values[order[i]]);
+  }
+  double ptr_insert = get_seconds() - start;
+  start = get_seconds();
+  for(size_t i = 0; i < count; ++i){
+    insert_new_into_str_map(&tmap, keys[order[i]], values[order[i]]);
+  }
+  double typed_insert = get_seconds() - start;
+
+  size_t ops = count * settings->rounds;
+  size_t found = 0;
+  start = get_seconds();
+  for(size_t r = 0; r < settings->rounds; ++r){
+    for(size_t i = 0; i < count; ++i){
+      found += get_from_ptr_hash_map(&pmap, keys[order[i]]) != NULL;
+    }
+  }
+  double ptr_hit = get_seconds() - start;
+  start = get_seconds();
+  for(size_t r = 0; r < settings->rounds; ++r){
+    for(size_t i = 0; i < count; ++i){
+      found += get_from_str_map(&tmap, keys[order[i]]) != NULL;
+    }
+  }
+  double typed_hit = get_seconds() - start;
+  start = get_seconds();
+  for(size_t r = 0; r < settings->rounds; ++r){
+    for(size_t i = 0; i < count; ++i){
+      found += get_from_ptr_hash_map(&pmap, missing[i]) != NULL;
+    }
+  }
+  double ptr_miss = get_seconds() - start;
+  start = get_seconds();
+  for(size_t r = 0; r < settings->rounds; ++r){
+    for(size_t i = 0; i < count; ++i){
+      found += get_from_str_map(&tmap, missing[i]) != NULL;
+    }
+  }
+  double typed_miss = get_seconds() - start;
+  sink = found;
+
+  print_result("string insert ptr_hash_map", count, ptr_insert, 0);
+  print_result("string insert typed", count, typed_insert, ptr_insert * 1e9 / count);
+  print_result("string hit ptr_hash_map", ops, ptr_hit, 0);
+  print_result("string hit typed", ops, typed_hit, ptr_hit * 1e9 / ops);
+  print_result("string miss ptr_hash_map", ops, ptr_miss, 0);
+  print_result("string miss typed", ops, typed_miss, ptr_miss * 1e9 / ops);
+
+  int result = found == 2 * ops ? 0 : -1;
+  dispose_str_map(&tmap);
+  dispose_ptr_hash_map(&pmap);
+  free(keys);
+  free(missing);
+  free(values);
+  return result;
+}
+
+static int bench_int_maps(const struct bench_settings * settings, const size_t * order){
+  size_t count = settings->count;
+  int * keys = malloc(sizeof(int) * count);
+  if(keys == NULL){
+    set_status(STATUS_MALLOC_FAILED);
+    return -1;
+  }
+  for(size_t i = 0; i < count; ++i){
+    keys[i] = (int)(i * 7);
+  }
+
+  struct ptr_hash_map pmap;
+  struct int_map tmap;
+  if(init_ptr_hash_map(&pmap, hash_map_hash_int, hash_map_eq_int, 0)){
+    free(keys);
+    return -1;
+  }
+  if(init_int_map(&tmap, 0)){
+    dispose_ptr_hash_map(&pmap);
+    free(keys);
+    return -1;
+  }
+
+  double start = get_seconds();
+  for(size_t i = 0; i < count; ++i){
+    insert_new_into_ptr_hash_map(&pmap, &keys[order[i]], &keys[order[i]]);
+  }
+  double ptr_insert = get_seconds() - start;
+  start = get_seconds();
+  for(size_t i = 0; i < count; ++i){
+    insert_new_into_int_map(&tmap, keys[order[i]], (int)order[i]);
+  }
+  double typed_insert = get_seconds() - start;
+
+  size_t ops = count * settings->rounds;
+  size_t found = 0;
+  start = get_seconds();
+  for(size_t r = 0; r < settings->rounds; ++r){
+    for(size_t i = 0; i < count; ++i){
+      found += get_from_ptr_hash_map(&pmap, &keys[order[i]]) != NULL;
+    }
+  }
+  double ptr_hit = get_seconds() - start;
+  start = get_seconds();
+  for(size_t r = 0; r < settings->rounds; ++r){
+    for(size_t i = 0; i < count; ++i){
+      found += get_from_int_map(&tmap, keys[order[i]]) != NULL;
+    }
+  }
+  double typed_hit = get_seconds() - start;
+  sink = found;
+
+  print_result("int insert ptr_hash_map", count, ptr_insert, 0);
+  print_result("int insert typed", count, typed_insert, ptr_insert * 1e9 / count);
+  print_result("int hit ptr_hash_map", ops, ptr_hit, 0);
+  print_result("int hit typed", ops, typed_hit, ptr_hit * 1e9 / ops);
+
+  int result = found == 2 * ops ? 0 : -1;
+  dispose_int_map(&tmap);
+  dispose_ptr_hash_map(&pmap);
+  free(keys);
+  return result;
+}
+
+static int bench_deques(const struct bench_settings * settings, const size_t * order){
+  size_t count = settings->count;
+  struct deque d;
+  struct elem_deque td;
+  init_deque(&d, sizeof(struct bench_elem), 0, NULL);
+  init_elem_deque(&td, 0, NULL);
+
+  double start = get_seconds();
+  for(size_t i = 0; i < count; ++i){
+    struct bench_elem * e = emplace_onto_deque(&d);
+    if(e == NULL){
+      return -1;
+    }
+    e->x = (double)i;
+    e->y = 0.5 * i;
+    e->id = (int)i;
+  }
+  double plain_emplace = get_seconds() - start;
+  start = get_seconds();
+  for(size_t i = 0; i < count; ++i){
+    struct bench_elem * e = emplace_onto_elem_deque(&td);
+    if(e == NULL){
+      return -1;
+    }
+    e->x = (double)i;
+    e->y = 0.5 * i;
+    e->id = (int)i;
+  }
+  double typed_emplace = get_seconds() - start;
+
+  size_t ops = count * settings->rounds;
+  double sum = 0;
+  start = get_seconds();
+  for(size_t r = 0; r < settings->rounds; ++r){
+    struct deque_iter i;
+    for(init_deque_iter(&i, &d); has_next_deque_iter(&i); next_deque_iter(&i)){
+      const struct bench_elem * e = get_deque_iter(&i);
+      sum += e->x + e->y;
+    }
+  }
+  double iter_scan = get_seconds() - start;
+  start = get_seconds();
+  for(size_t r = 0; r < settings->rounds; ++r){
+    struct bench_elem * data;
+    size_t len;
+    for(size_t b = 0; (len = get_elem_deque_block(&td, b, &data)) > 0; ++b){
+      for(size_t i = 0; i < len; ++i){
+	sum += data[i].x + data[i].y;
+      }
+    }
+  }
+  double block_scan = get_seconds() - start;
+  start = get_seconds();
+  for(size_t r = 0; r < settings->rounds; ++r){
+    for(size_t i = 0; i < count; ++i){
+      const struct bench_elem * e = get_deque_at(&d, order[i]);
+      sum += e->x;
+    }
+  }
+  double plain_index = get_seconds() - start;
+  start = get_seconds();
+  for(size_t r = 0; r < settings->rounds; ++r){
+    for(size_t i = 0; i < count; ++i){
+      sum += get_elem_deque_at(&td, order[i])->x;
+    }
+  }
+  double typed_index = get_seconds() - start;
+  sink = (size_t)sum;
+
+  print_result("deque emplace", count, plain_emplace, 0);
+  print_result("deque emplace typed", count, typed_emplace, plain_emplace * 1e9 / count);
+  print_result("deque scan iterator", ops, iter_scan, 0);
+  print_result("deque scan typed blocks", ops, block_scan, iter_scan * 1e9 / ops);
+  print_result("deque random index", ops, plain_index, 0);
+  print_result("deque random index typed", ops, typed_index, plain_index * 1e9 / ops);
+
+  dispose_elem_deque(&td);
+  dispose_deque(&d);
+  return 0;
+}
+
+static size_t hash_ptr_key(const void * key){
+  return (size_t)(uintptr_t)key;
+}
+
+static bool eq_ptr_key(const void * first, const void * second){
+  return first == second;
+}
+
+/**
+ * Times inserts, hits and misses of a ptr_hash_map filled up to a load factor without growing
+ */
+static int bench_load_factor(const char * kind, hash_map_hash hash, hash_map_eq eq, void ** keys, void ** missing, size_t cap, double load, const struct bench_settings * settings, const size_t * order){
+  size_t count = (size_t)(cap * load);
+  struct ptr_hash_map map;
+  if(init_ptr_hash_map(&map, hash, eq, cap)){
+    return -1;
+  }
+
+  double start = get_seconds();
+  for(size_t i = 0; i < count; ++i){
+    insert_new_into_ptr_hash_map(&map, keys[i], keys[i]);
+  }
+  double insert = get_seconds() - start;
+  assert(map.cap == cap);
+
+  size_t ops = count * settings->rounds;
+  size_t found = 0;
+  start = get_seconds();
+  for(size_t r = 0; r < settings->rounds; ++r){
+    for(size_t i = 0; i < count; ++i){
+      found += get_from_ptr_hash_map(&map, keys[order[i] % count]) != NULL;
+    }
+  }
+  double hit = get_seconds() - start;
+  start = get_seconds();
+  for(size_t r = 0; r < settings->rounds; ++r){
+    for(size_t i = 0; i < count; ++i){
+      found += get_from_ptr_hash_map(&map, missing[i]) != NULL;
+    }
+  }
+  double miss = get_seconds() - start;
+  sink = found;
+
+  char name[64];
+  snprintf(name, sizeof(name), "%s load %.3f insert", kind, load);
+  print_result(name, count, insert, 0);
+  snprintf(name, sizeof(name), "%s load %.3f hit", kind, load);
+  print_result(name, ops, hit, 0);
+  snprintf(name, sizeof(name), "%s load %.3f miss", kind, load);
+  print_result(name, ops, miss, 0);
+
+  dispose_ptr_hash_map(&map);
+  return found == ops ? 0 : -1;
+}
+
+static int bench_load_factors(const struct bench_settings * settings, const size_t * order){
+  static const double loads[] = {0.5, 0.625, 0.75, 0.875};
+
+  // the largest table the keys can fill up to the highest load factor
+  size_t cap = 16;
+  while(cap * 2 * loads[3] <= settings->count){
+    cap *= 2;
+  }
+  size_t count = (size_t)(cap * loads[3]);
+  char (*strs)[BENCH_KEY_LEN] = malloc(sizeof(*strs) * count * 2);
+  int * objs = malloc(sizeof(int) * count * 2);
+  void ** keys = malloc(sizeof(void *) * count * 4);
+  if(strs == NULL || objs == NULL || keys == NULL){
+    free(strs);
+    free(objs);
+    free(keys);
+    set_status(STATUS_MALLOC_FAILED);
+    return -1;
+  }
+  for(size_t i = 0; i < count * 2; ++i){
+    snprintf(strs[i], BENCH_KEY_LEN, "%s.%zu", i < count ? "label" : "missing", i);
+    keys[i] = strs[i];
+    keys[count * 2 + i] = &objs[i];
+  }
+
+  int result = 0;
+  for(size_t i = 0; i < sizeof(loads) / sizeof(loads[0]) && result == 0; ++i){
+    result = bench_load_factor("string", hash_map_hash_str, hash_map_eq_str, keys, keys + count, cap, loads[i], settings, order);
+  }
+  for(size_t i = 0; i < sizeof(loads) / sizeof(loads[0]) && result == 0; ++i){
+    result = bench_load_factor("pointer", hash_ptr_key, eq_ptr_key, keys + count * 2, keys + count * 3, cap, loads[i], settings, order);
+  }
+  free(strs);
+  free(objs);
+  free(keys);
+  return result;
+}
+
+static void print_usage(const char * name){
+  fprintf(stderr,
+	  "usage: %s [options]\n"
+	  "  -n, --count N       elements per container (default %d)\n"
+	  "  -r, --rounds N      lookup rounds (default %d)\n"
+	  "  -s, --seed N        random seed\n",
+	  name, DEFAULT_BENCH_COUNT, DEFAULT_BENCH_ROUNDS);
+}
+
+static int parse_args(struct bench_settings * settings, int arg_count, char * const args[]){
+  struct option options[] = {
+			     {"count", required_argument, NULL, 'n'},
+			     {"rounds", required_argument, NULL, 'r'},
+			     {"seed", required_argument, NULL, 's'},
+			     {NULL, 0, NULL, 0}
+  };
+
+  int index = 0;
+  while(true){
+    int c = getopt_long(arg_count, args, "n:r:s:", options, &index);
+    if(c == -1){
+      break;
+    }else if(c == 'n'){
+      settings->count = strtoul(optarg, NULL, 10);
+    }else if(c == 'r'){
+      settings->rounds = strtoul(optarg, NULL, 10);
+    }else if(c == 's'){
+      settings->seed = strtoul(optarg, NULL, 10);
+    }else{
+      return -1;
+    }
+  }
+  if(settings->count == 0 || settings->rounds == 0){
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char * const args[]){
+  struct bench_settings settings = {DEFAULT_BENCH_COUNT, DEFAULT_BENCH_ROUNDS, (unsigned int)time(NULL)};
+  if(parse_args(&settings, argc, args)){
+    print_usage(args[0]);
+    return EXIT_FAILURE;
+  }
+  if(start_logger(stderr)){
+    fputs("unable to start logger\n", stderr);
+    return EXIT_FAILURE;
+  }
+  srand(settings.seed);
+
+  size_t * order = malloc(sizeof(size_t) * settings.count);
+  if(order == NULL){
+    fputs("out of memory\n", stderr);
+    return EXIT_FAILURE;
+  }
+  shuffle(order, settings.count);
+
+  printf("seed: %u\n", settings.seed);
+  printf("%-32s %12s %10s %10s\n", "benchmark", "ops", "ns/op", "speedup");
+  int result = 0;
+  if(bench_str_maps(&settings, order) || bench_int_maps(&settings, order)
+     || bench_load_factors(&settings, order) || bench_deques(&settings, order)){
+    result = -1;
+  }
+  free(order);
+  stop_logger();
+
+  if(result){
+    fprintf(stderr, "container bench failed: %s\n", get_status_msg(get_status()));
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -17,114 +17,263 @@
 
 #include "deque.h"
 #include "memory.h"
+#include "slab.h"
 #include "status.h"
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 
 #define DEQUE_DEFAULT_BLOCK_CAP 8
 
-void init_deque(struct deque * deque, size_t elem_size, size_t block_cap){
+/**
+ * Blocks stop growing at this size so they are still taken from slabs
+ */
+#define DEQUE_MAX_BLOCK_SIZE SLAB_MAX_SIZE
+
+#define DEQUE_INITIAL_DIR_CAP 8
+
+static struct slab_pool default_pool = SLAB_POOL_INITIALIZER("deque", false);
+
+void init_deque(struct deque * deque, size_t elem_size, size_t block_cap, struct slab_pool * pool){
   assert(deque != NULL);
   assert(elem_size != 0);
   
-  deque->head = NULL;
-  deque->tail = NULL;
+  deque->blocks = NULL;
+  deque->block_count = 0;
+  deque->dir_cap = 0;
   deque->elem_size = elem_size;
   deque->len = 0;
+  deque->cap = 0;
+  deque->free_list = NULL;
+  deque->free_count = 0;
+  deque->pool = pool == NULL ? &default_pool : pool;
   if(block_cap == 0){
-    deque->block_cap = DEQUE_DEFAULT_BLOCK_CAP;
-    deque->block_len = DEQUE_DEFAULT_BLOCK_CAP;
-  }else{
-    deque->block_cap = block_cap;
-    deque->block_len = block_cap;
+    block_cap = DEQUE_DEFAULT_BLOCK_CAP;
+  }
+  deque->base_shift = 0;
+  while(((size_t)1 << deque->base_shift) < block_cap){
+    ++deque->base_shift;
+  }
+  deque->max_shift = deque->base_shift;
+  while((((size_t)2 << deque->max_shift) * elem_size) <= DEQUE_MAX_BLOCK_SIZE){
+    ++deque->max_shift;
+  }
+}
+
+static size_t get_deque_block_cap(const struct deque * deque, size_t block){
+  size_t shift = deque->base_shift + block;
+  return (size_t)1 << (shift < deque->max_shift ? shift : deque->max_shift);
+}
+
+static size_t get_deque_block_start(const struct deque * deque, size_t block){
+  size_t geometric_blocks = deque->max_shift - deque->base_shift;
+  if(block <= geometric_blocks){
+    return (((size_t)1 << block) - 1) << deque->base_shift;
   }
+  return ((((size_t)1 << geometric_blocks) - 1) << deque->base_shift) + ((block - geometric_blocks) << deque->max_shift);
 }
 
 static bool ensure_cap(struct deque * deque){
   assert(deque != NULL);
-  if(deque->block_len == deque->block_cap){
-    struct deque_block * block = malloc_checked(sizeof(struct deque_block));
-    if(block == NULL){
+  if(deque->len < deque->cap){
+    return false;
+  }
+  if(deque->block_count == deque->dir_cap){
+    size_t dir_cap = deque->dir_cap == 0 ? DEQUE_INITIAL_DIR_CAP : 2 * deque->dir_cap;
+    char ** blocks = alloc_from_slab_pool(deque->pool, sizeof(char *) * dir_cap);
+    if(blocks == NULL){
       return true;
     }
-    
-    assert(deque->block_cap != 0);
-    assert(deque->elem_size != 0);
-    void * data = malloc_checked(deque->elem_size * deque->block_cap);
-    if(data == NULL){
-      free(block);
-      return true;
+    for(size_t i = 0; i < deque->block_count; ++i){
+      blocks[i] = deque->blocks[i];
     }
-    block->data = data;
-    
-    block->prev = deque->tail;
-    block->next = NULL;   
-    if(deque->head == NULL){
-      deque->head = block;
-    }else{
-      deque->tail->next = block;
+    if(deque->blocks != NULL){
+      free_to_slab_pool(deque->pool, deque->blocks, sizeof(char *) * deque->dir_cap);
     }
-    deque->tail = block;
-    deque->block_len = 0;
+    deque->blocks = blocks;
+    deque->dir_cap = dir_cap;
+  }
+  size_t block_cap = get_deque_block_cap(deque, deque->block_count);
+  char * data = alloc_from_slab_pool(deque->pool, deque->elem_size * block_cap);
+  if(data == NULL){
+    return true;
   }
+  deque->blocks[deque->block_count++] = data;
+  deque->cap += block_cap;
   return false;
 }
 
 void * emplace_onto_deque(struct deque * deque){
   assert(deque != NULL);
-  
+
+  if(deque->free_list != NULL){
+    void * elem = deque->free_list;
+    memcpy(&deque->free_list, elem, sizeof(void *));
+    --deque->free_count;
+    return elem;
+  }
   if(ensure_cap(deque)){
     return NULL;
   }
-  size_t i = deque->block_len;
-  ++deque->block_len;
   ++deque->len;
-  return deque->tail->data + (i * deque->elem_size); 
+  return get_deque_at(deque, deque->len - 1);
+}
+
+void remove_from_deque(struct deque * deque, void * elem){
+  assert(deque != NULL);
+  assert(elem != NULL);
+  assert(deque->elem_size >= sizeof(void *));
+
+  memcpy(elem, &deque->free_list, sizeof(void *));
+  deque->free_list = elem;
+  ++deque->free_count;
+}
+
+/**
+ * Returns the index of an element, the directory is searched from the last block because that is where most removals happen
+ */
+static size_t find_deque_index(const struct deque * deque, const char * elem){
+  for(size_t b = deque->block_count; b > 0; --b){
+    const char * data = deque->blocks[b - 1];
+    if(elem >= data && elem < data + get_deque_block_cap(deque, b - 1) * deque->elem_size){
+      return get_deque_block_start(deque, b - 1) + (size_t)(elem - data) / deque->elem_size;
+    }
+  }
+  assert(false);
+  return SIZE_MAX;
+}
+
+/**
+ * Frees the blocks after the one holding the last element
+ */
+static void trim_deque(struct deque * deque){
+  while(deque->block_count > 0 && get_deque_block_start(deque, deque->block_count - 1) >= deque->len){
+    --deque->block_count;
+    size_t block_cap = get_deque_block_cap(deque, deque->block_count);
+    free_to_slab_pool(deque->pool, deque->blocks[deque->block_count], deque->elem_size * block_cap);
+    deque->cap -= block_cap;
+  }
+}
+
+int compact_deque(struct deque * deque, size_t * remap){
+  assert(deque != NULL);
+
+  if(remap != NULL){
+    for(size_t i = 0; i < deque->len; ++i){
+      remap[i] = i;
+    }
+  }
+  if(deque->free_count == 0){
+    trim_deque(deque);
+    return 0;
+  }
+
+  size_t word_count = (deque->len + 63) / 64;
+  uint64_t * removed = malloc_checked(sizeof(uint64_t) * word_count);
+  if(removed == NULL){
+    return -1;
+  }
+  memset(removed, 0, sizeof(uint64_t) * word_count);
+  for(char * elem = deque->free_list; elem != NULL; ){
+    size_t index = find_deque_index(deque, elem);
+    removed[index / 64] |= (uint64_t)1 << (index % 64);
+    if(remap != NULL){
+      remap[index] = SIZE_MAX;
+    }
+    memcpy(&elem, elem, sizeof(void *));
+  }
+
+  // fill the first free slot with the last element until all elements are in front of the free slots
+  size_t live = deque->len - deque->free_count;
+  size_t last = deque->len;
+  for(size_t i = 0; i < live; ++i){
+    if(!(removed[i / 64] & ((uint64_t)1 << (i % 64)))){
+      continue;
+    }
+    do{
+      --last;
+    }while(removed[last / 64] & ((uint64_t)1 << (last % 64)));
+    memcpy(get_deque_at(deque, i), get_deque_at(deque, last), deque->elem_size);
+    if(remap != NULL){
+      remap[last] = i;
+    }
+  }
+  free(removed);
+
+  deque->len = live;
+  deque->free_list = NULL;
+  deque->free_count = 0;
+  trim_deque(deque);
+  return 0;
+}
+
+size_t get_deque_block(const struct deque * deque, size_t block, void ** data){
+  assert(deque != NULL);
+  assert(data != NULL);
+
+  if(block >= deque->block_count){
+    return 0;
+  }
+  size_t start = get_deque_block_start(deque, block);
+  if(start >= deque->len){
+    return 0;
+  }
+  *data = deque->blocks[block];
+  size_t len = deque->len - start;
+  size_t cap = get_deque_block_cap(deque, block);
+  return len < cap ? len : cap;
 }
 
 void init_deque_iter(struct deque_iter * iter, struct deque * deque){
   assert(iter != NULL);
   assert(deque != NULL);
   iter->deque = deque;
-  iter->block = deque->head;
+  iter->block = 0;
   iter->index = 0;
+  void * data = NULL;
+  iter->block_len = get_deque_block(deque, 0, &data);
+  iter->data = data;
 }
 
 bool has_next_deque_iter(struct deque_iter * i){
   assert(i != NULL);
-  return (i->block != NULL) && (i->block != i->deque->tail || i->index != i->deque->block_len);
+  return i->index < i->block_len;
 }
 
 void * get_deque_iter(struct deque_iter * i){
   assert(i != NULL);
-  assert(i->block != NULL);
-  assert(i->block != i->deque->tail || i->index < i->deque->block_len);
-  return i->block->data + (i->index * i->deque->elem_size);
+  assert(i->index < i->block_len);
+  return i->data + (i->index * i->deque->elem_size);
 }
 
 void next_deque_iter(struct deque_iter * i){
   assert(i != NULL);
-  size_t next = i->index + 1;
-  if(next == i->deque->block_cap){
-    i->block = i->block->next;
+  ++i->index;
+  if(i->index == i->block_len){
+    ++i->block;
     i->index = 0;
-  }else if(i->block == i->deque->tail && next == i->deque->block_len){
-    i->block = NULL;
-    i->index = 0;
-  }else{
-    ++i->index;
+    void * data = NULL;
+    i->block_len = get_deque_block(i->deque, i->block, &data);
+    i->data = data;
   }
 }
 
 void dispose_deque(struct deque * deque){
   assert(deque != NULL);
 
-  struct deque_block * b = deque->head;
-  while(b != NULL){
-    free(b->data);
-    struct deque_block * n = b->next;
-    free(b);
-    b = n;
+  for(size_t i = 0; i < deque->block_count; ++i){
+    free_to_slab_pool(deque->pool, deque->blocks[i], deque->elem_size * get_deque_block_cap(deque, i));
+  }
+  if(deque->blocks != NULL){
+    free_to_slab_pool(deque->pool, deque->blocks, sizeof(char *) * deque->dir_cap);
   }
+  deque->blocks = NULL;
+  deque->block_count = 0;
+  deque->dir_cap = 0;
+  deque->len = 0;
+  deque->cap = 0;
+  deque->free_list = NULL;
+  deque->free_count = 0;
 }
@@ -18,34 +18,105 @@
 #ifndef DEQUE_H
 #define DEQUE_H
 
+#include <assert.h>
 #include <stdbool.h>
 #include <stdlib.h>
 
-struct deque_block{
-  struct deque_block * prev;
-  struct deque_block * next;
-  void * data;
-};
+struct slab_pool;
 
+/**
+ * A sequence of elements in blocks that never move, so pointers to elements stay valid
+ * Blocks double in size until they reach a fixed size, a directory of blocks gives constant time indexing
+ */
 struct deque{
-  struct deque_block * head;
-  struct deque_block * tail;
+  /**
+   * Block i holds 1 << min(base_shift + i, max_shift) elements
+   */
+  char ** blocks;
+  size_t block_count;
+  size_t dir_cap;
   size_t elem_size;
+  /**
+   * Number of slots in use, including removed elements
+   */
   size_t len;
-  size_t block_len;
-  size_t block_cap;
+  size_t cap;
+  /**
+   * Removed elements, linked through their first bytes
+   */
+  void * free_list;
+  size_t free_count;
+  unsigned int base_shift;
+  unsigned int max_shift;
+  struct slab_pool * pool;
 };
 
 struct deque_iter{
   struct deque * deque;
-  struct deque_block * block;
+  size_t block;
   size_t index;
+  size_t block_len;
+  char * data;
 };
 
-void init_deque(struct deque * deque, size_t elem_size, size_t block_cap);
+/**
+ * Initializes a deque whose blocks are allocated from the pool, NULL selects the pool shared by all deques
+ * The first block holds block_cap elements rounded up to a power of two, zero selects the default
+ */
+void init_deque(struct deque * deque, size_t elem_size, size_t block_cap, struct slab_pool * pool);
 
+/**
+ * Adds an element, reusing the slot of a removed element if there is one
+ */
 void * emplace_onto_deque(struct deque * deque);
 
+/**
+ * Removes an element, elements must be at least as large as a pointer
+ * Iteration still visits removed elements, so a deque with removed elements should be compacted before iterating it
+ */
+void remove_from_deque(struct deque * deque, void * elem);
+
+/**
+ * Moves the last elements into the slots of removed elements and frees the blocks that are no longer needed
+ * If remap is not NULL it must hold len entries, it receives the new index of every element or SIZE_MAX for removed elements
+ * Pointers to moved elements are no longer valid afterwards
+ */
+int compact_deque(struct deque * deque, size_t * remap);
+
+/**
+ * Returns the number of elements in the block with the given index and its data, zero if there is no such block
+ * Loops over the elements of a block do not have to check for the end of the block
+ */
+size_t get_deque_block(const struct deque * deque, size_t block, void ** data);
+
+/**
+ * Finds the block of an element and its position in that block
+ */
+static inline void locate_deque_index(const struct deque * deque, size_t index, size_t * block, size_t * offset){
+  assert(deque != NULL);
+  assert(index < deque->len);
+
+  // the blocks up to the first block of the max size hold 2^k - 1 times the size of the first block
+  size_t geometric_blocks = deque->max_shift - deque->base_shift;
+  size_t geometric_len = (((size_t)1 << geometric_blocks) - 1) << deque->base_shift;
+  if(index < geometric_len){
+    size_t q = (index >> deque->base_shift) + 1;
+    *block = (size_t)(8 * sizeof(unsigned long long) - 1 - __builtin_clzll(q));
+    *offset = index - ((((size_t)1 << *block) - 1) << deque->base_shift);
+  }else{
+    size_t rest = index - geometric_len;
+    *block = geometric_blocks + (rest >> deque->max_shift);
+    *offset = rest & (((size_t)1 << deque->max_shift) - 1);
+  }
+}
+
+static inline void * get_deque_at(const struct deque * deque, size_t index){
+  size_t block;
+  size_t offset;
+  locate_deque_index(deque, index, &block, &offset);
+  return deque->blocks[block] + offset * deque->elem_size;
+}
+
 void init_deque_iter(struct deque_iter * iter, struct deque * deque);
 
 bool has_next_deque_iter(struct deque_iter * i);
@@ -56,4 +127,51 @@ void next_deque_iter(struct deque_iter * i);
 
 void dispose_deque(struct deque * deque);
 
+/**
+ * Defines a deque of T whose element size is known at compile time, a thin typed layer over struct deque
+ * Indexing and emplacing without growing are inlined, loops over get_name_block see a plain T array
+ */
+#define DEFINE_DEQUE(name, T)						\
+  struct name{								\
+    struct deque deque;							\
+  };									\
+									\
+  static inline void init_##name(struct name * d, size_t block_cap, struct slab_pool * pool){ \
+    init_deque(&d->deque, sizeof(T), block_cap, pool);			\
+  }									\
+									\
+  static inline T * get_##name##_at(const struct name * d, size_t index){ \
+    size_t block;							\
+    size_t offset;							\
+    locate_deque_index(&d->deque, index, &block, &offset);		\
+    return (T *)d->deque.blocks[block] + offset;			\
+  }									\
+									\
+  static inline T * emplace_onto_##name(struct name * d){		\
+    if(d->deque.free_list == NULL && d->deque.len < d->deque.cap){	\
+      ++d->deque.len;							\
+      return get_##name##_at(d, d->deque.len - 1);			\
+    }									\
+    return (T *)emplace_onto_deque(&d->deque);				\
+  }									\
+									\
+  static inline size_t get_##name##_block(const struct name * d, size_t block, T ** data){ \
+    void * p = NULL;							\
+    size_t len = get_deque_block(&d->deque, block, &p);			\
+    *data = (T *)p;							\
+    return len;								\
+  }									\
+									\
+  static inline void remove_from_##name(struct name * d, T * elem){	\
+    remove_from_deque(&d->deque, elem);					\
+  }									\
+									\
+  static inline int compact_##name(struct name * d, size_t * remap){	\
+    return compact_deque(&d->deque, remap);				\
+  }									\
+									\
+  static inline void dispose_##name(struct name * d){			\
+    dispose_deque(&d->deque);						\
+  }
+
 #endif
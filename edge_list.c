@@ -15,23 +15,28 @@
  *
  */
 
+#define LOG_MODULE LOG_MODULE_VORONOI
+
 #include "edge_list.h"
 #include "linear.h"
+#include "logger.h"
+#include "slab.h"
 #include "status.h"
 
 #include <assert.h>
-#include <stdio.h>
 
 #define EDGE_LIST_BLOCK_CAP 10
 
 #define TOLERANCE 0.001
 
+static struct slab_pool edge_list_pool = SLAB_POOL_INITIALIZER("edge list", false);
+
 void init_edge_list(struct edge_list * el){
   assert(el != NULL);
   
-  init_deque(&el->vertices, sizeof(struct vertex), EDGE_LIST_BLOCK_CAP);
-  init_deque(&el->half_edges, sizeof(struct half_edge), EDGE_LIST_BLOCK_CAP);
-  init_deque(&el->faces, sizeof(struct face), EDGE_LIST_BLOCK_CAP);
+  init_deque(&el->vertices, sizeof(struct vertex), EDGE_LIST_BLOCK_CAP, &edge_list_pool);
+  init_deque(&el->half_edges, sizeof(struct half_edge), EDGE_LIST_BLOCK_CAP, &edge_list_pool);
+  init_deque(&el->faces, sizeof(struct face), EDGE_LIST_BLOCK_CAP, &edge_list_pool);
 
   el->head = NULL;
   el->tail = NULL;
@@ -41,6 +46,7 @@ struct vertex * emplace_vertex(struct edge_list * el){
   assert(el != NULL);
   struct vertex * v = (struct vertex *)emplace_onto_deque(&el->vertices);
   if(v != NULL){
+    v->id = el->vertices.len - 1;
     v->x = 0;
     v->y = 0;
   }
@@ -51,6 +57,7 @@ struct half_edge * emplace_half_edge(struct edge_list * el){
   assert(el != NULL);
   struct half_edge * he = (struct half_edge *)emplace_onto_deque(&el->half_edges);
   if(he != NULL){
+    he->id = el->half_edges.len - 1;
     he->vertex = NULL;
     he->twin = NULL;
     he->face = NULL;
@@ -79,6 +86,7 @@ struct face * emplace_face(struct edge_list * el){
   assert(el != NULL);
   struct face * f = (struct face *)emplace_onto_deque(&el->faces);
   if(f != NULL){
+    f->id = el->faces.len - 1;
     f->x = 0;
     f->y = 0;
     f->head = NULL;
@@ -298,7 +306,7 @@ bool close_face_with_bounds(struct edge_list * el, struct face * face, double wi
 }  
 
 
-static void print_half_edge(const struct half_edge * he){
+static void log_half_edge(const struct half_edge * he){
   assert(he != NULL);
   struct half_edge * twin = he->twin;
   assert(twin != NULL);
@@ -306,34 +314,37 @@ static void print_half_edge(const struct half_edge * he){
   struct vertex * tv = twin->vertex;
   if(v == NULL){
     if(tv == NULL){
-      fputs("\thalf edge NONE -> NONE\n", stdout);
+      LOG_DEBUG("\thalf edge NONE -> NONE");
     }else{
-      printf("\thalf edge NONE -> (%.2f, %.2f)\n", tv->x, tv->y);
+      LOG_DEBUG("\thalf edge NONE -> (%.2f, %.2f)", tv->x, tv->y);
     }
   }else if(tv == NULL){
-    printf("\thalf edge (%.2f, %.2f) -> NONE\n", v->x, v->y);
+    LOG_DEBUG("\thalf edge (%.2f, %.2f) -> NONE", v->x, v->y);
   }else{
-    printf("\thalf edge (%.2f, %.2f) -> (%.2f, %.2f)\n", v->x, v->y, tv->x, tv->y);
+    LOG_DEBUG("\thalf edge (%.2f, %.2f) -> (%.2f, %.2f)", v->x, v->y, tv->x, tv->y);
   }
 }
 
-static void print_face(const struct face * face){
+static void log_face(const struct face * face){
   assert(face != NULL);
 
-  printf("face:\n\tsite(%.2f, %.2f)\n", face->x, face->y);
+  LOG_DEBUG("face: site(%.2f, %.2f)", face->x, face->y);
   struct half_edge * he = face->head;
   if(he != NULL){
     do{
-      print_half_edge(he);
+      log_half_edge(he);
       he = he->next;
     }while(he != face->head && he != NULL);
   }
 }
 
-void print_edge_list(const struct edge_list * el){
+void log_edge_list(const struct edge_list * el){
   assert(el != NULL);
+  if(!LOG_ENABLED(LOG_PRIORITY_DEBUG)){
+    return;
+  }
   for(struct face * f = el->head; f != NULL; f = f->next){
-    print_face(f);
+    log_face(f);
   };
 }
 
@@ -21,6 +21,7 @@
 #include "deque.h"
 
 struct vertex{
+  size_t id;
   double x;
   double y;
 };
@@ -28,6 +29,7 @@ struct vertex{
 struct face;
 
 struct half_edge{
+  size_t id;
   struct vertex * vertex;
   struct half_edge * twin;
   struct face * face;
@@ -36,6 +38,7 @@ struct half_edge{
 };
 
 struct face{
+  size_t id;
   double x;
   double y;
   struct half_edge * head;
@@ -62,7 +65,10 @@ struct half_edge * emplace_edge(struct edge_list * el);
 
 struct face * emplace_face(struct edge_list * el);
 
-void print_edge_list(const struct edge_list * el);
+/**
+ * Logs the faces and their half edges at debug level
+ */
+void log_edge_list(const struct edge_list * el);
 
 void dispose_edge_list(struct edge_list * el);
 
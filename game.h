@@ -32,4 +32,10 @@
  */
 #define GAME_MAX_PLAYER_NAME_LEN 64
 
+/**
+ * Size of the map
+ */
+#define GAME_MAP_WIDTH 1000.0
+#define GAME_MAP_HEIGHT 1000.0
+
 #endif
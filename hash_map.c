@@ -20,14 +20,15 @@
 #include "status.h"
 
 #include <assert.h>
-#include <math.h>
+#include <stdint.h>
 #include <string.h>
+#include <uchar.h>
 
-#define DEFAULT_HASH_MAP_MASK 0x7
+#define DEFAULT_HASH_MAP_MASK 0xF
 
-#define DEFAULT_HASH_MAP_MIN_CAP 8
+#define DEFAULT_HASH_MAP_MIN_CAP 16
 
-#define MAX_HASH_MAP_RATIO 0.7
+#define MIN_HASH_MAP_RATIO 0.15
 
 struct ptr_hash_map_bucket{
   void * key;
@@ -46,6 +47,20 @@ void calc_cap(size_t min_cap, size_t * cap, size_t * mask){
   *mask = m;
 }
 
+/**
+ * Allocates the buckets and the control bytes in one block
+ * The control bytes are followed by a copy of the first group, so a group starting at any bucket can be loaded at once
+ */
+static struct ptr_hash_map_bucket * alloc_buckets(size_t cap, uint8_t ** ctrl){
+  struct ptr_hash_map_bucket * data = malloc_checked(cap * sizeof(struct ptr_hash_map_bucket) + cap + HASH_MAP_GROUP_SIZE - 1);
+  if(data == NULL){
+    return NULL;
+  }
+  *ctrl = (uint8_t *)(data + cap);
+  memset(*ctrl, HASH_MAP_CTRL_EMPTY, cap + HASH_MAP_GROUP_SIZE - 1);
+  return data;
+}
+
 int init_ptr_hash_map(struct ptr_hash_map * map, hash_map_hash hash, hash_map_eq eq, size_t cap){
   assert(map != NULL);
   assert(hash != NULL);
@@ -59,47 +74,44 @@ int init_ptr_hash_map(struct ptr_hash_map * map, hash_map_hash hash, hash_map_eq
   }else{
     calc_cap(cap, &map->cap, &map->mask);
   }
+  map->min_cap = map->cap;
+  map->shrink = false;
 
-  size_t size = sizeof(struct ptr_hash_map_bucket) * map->cap;
-  map->data = malloc_checked(size);
+  map->data = alloc_buckets(map->cap, &map->ctrl);
   if(map->data == NULL){
     return -1;
   }
-  memset(map->data, 0, size);
   map->count = 0;
   return 0;
 }
 
-static bool is_empty(const struct ptr_hash_map_bucket * b){
-  return b->key == NULL;
+static bool is_empty(const struct ptr_hash_map * map, size_t pos){
+  return map->ctrl[pos] & HASH_MAP_CTRL_EMPTY;
 }
 
-static bool is_key(const struct ptr_hash_map * map, const struct ptr_hash_map_bucket * b, const void * key){
-  return (*map->eq)(b->key, key);
-}
-
-static int grow(struct ptr_hash_map * map, size_t ncap, size_t nmask){
-  assert(ncap > map->cap);
-  size_t size = ncap * sizeof(struct ptr_hash_map_bucket);
-  struct ptr_hash_map_bucket * ndata = malloc_checked(size);
+/**
+ * Moves all entries into a new bucket array, the cached hashes are used so keys are not hashed again
+ */
+static int resize(struct ptr_hash_map * map, size_t ncap, size_t nmask){
+  assert(ncap > map->count);
+  uint8_t * nctrl;
+  struct ptr_hash_map_bucket * ndata = alloc_buckets(ncap, &nctrl);
   if(ndata == NULL){
     return -1;
   }
-  memset(ndata, 0, size);
 
   for(size_t pos = 0; pos < map->cap; ++pos){
-    struct ptr_hash_map_bucket * b = map->data + pos;
-    if(!is_empty(b)){
-      size_t npos = b->hash & nmask;
-      while(!is_empty(ndata + npos)){
-	npos = (npos + 1) & nmask;
-      }
+    if(!is_empty(map, pos)){
+      struct ptr_hash_map_bucket * b = map->data + pos;
+      size_t npos = hash_map_find_empty(nctrl, nmask, hash_map_home(b->hash, nmask));
+      hash_map_set_ctrl(nctrl, ncap, npos, map->ctrl[pos]);
       memcpy(ndata + npos,  b, sizeof(struct ptr_hash_map_bucket));
     }
   }
 
   free(map->data);
   map->data = ndata;
+  map->ctrl = nctrl;
   map->cap = ncap;
   map->mask = nmask;
   
@@ -108,12 +120,51 @@ static int grow(struct ptr_hash_map * map, size_t ncap, size_t nmask){
 
 static int ensure_cap(struct ptr_hash_map * map){
   double ratio = ((double)(map->count + 1)) / map->cap;
-  if(ratio > MAX_HASH_MAP_RATIO){
-    return grow(map, map->cap << 1, (map->mask << 1) | 0x1);
+  if(ratio > HASH_MAP_MAX_RATIO){
+    return resize(map, map->cap << 1, (map->mask << 1) | 0x1);
   }
   return 0;
 }
 
+/**
+ * Finds the bucket containing the key or the empty bucket ending its probe sequence
+ * The key is only compared for buckets whose control byte matches its hash fragment
+ */
+static size_t find_bucket(const struct ptr_hash_map * map, const void * key, size_t hash){
+  uint8_t fragment = hash_map_fragment(hash);
+  size_t pos = hash_map_home(hash, map->mask);
+  while(true){
+    unsigned int match;
+    unsigned int empty;
+    hash_map_probe_group(map->ctrl + pos, fragment, &match, &empty);
+    if(empty != 0){
+      // buckets after the first empty one are not part of the probe sequence
+      match &= (empty & -empty) - 1;
+    }
+    while(match != 0){
+      size_t candidate = (pos + __builtin_ctz(match)) & map->mask;
+      const struct ptr_hash_map_bucket * b = map->data + candidate;
+      if(b->hash == hash && (*map->eq)(b->key, key)){
+	return candidate;
+      }
+      match &= match - 1;
+    }
+    if(empty != 0){
+      return (pos + __builtin_ctz(empty)) & map->mask;
+    }
+    pos = (pos + HASH_MAP_GROUP_SIZE) & map->mask;
+  }
+}
+
+static void fill_bucket(struct ptr_hash_map * map, size_t pos, void * key, void * value, size_t hash){
+  struct ptr_hash_map_bucket * b = map->data + pos;
+  b->key = key;
+  b->value = value;
+  b->hash = hash;
+  hash_map_set_ctrl(map->ctrl, map->cap, pos, hash_map_fragment(hash));
+  ++map->count;
+}
+
 int insert_new_into_ptr_hash_map(struct ptr_hash_map * map, void * key, void * value){
   assert(map != NULL);
   assert(key != NULL);
@@ -122,41 +173,105 @@ int insert_new_into_ptr_hash_map(struct ptr_hash_map * map, void * key, void * v
     return -1;
   }
 
-  size_t hash = (*map->hash)(key);
-  size_t pos = hash & map->mask;
-  while(true){
+  size_t hash = hash_map_mix((*map->hash)(key));
+  size_t pos = find_bucket(map, key, hash);
+  if(!is_empty(map, pos)){
+    set_status(STATUS_DUPLICATE_KEY);
+    return -1;
+  }
+  fill_bucket(map, pos, key, value, hash);
+  return 0;
+}
+
+int insert_or_update_ptr_hash_map(struct ptr_hash_map * map, void * key, void * value, void ** old_value){
+  assert(map != NULL);
+  assert(key != NULL);
+
+  size_t hash = hash_map_mix((*map->hash)(key));
+  size_t pos = find_bucket(map, key, hash);
+  if(!is_empty(map, pos)){
     struct ptr_hash_map_bucket * b = map->data + pos;
-    if(is_empty(b)){
-      b->key = key;
-      b->value = value;
-      b->hash = hash;
-      ++map->count;
-      return 0;
-    }else if(is_key(map, b, key)){
-      set_status(STATUS_DUPLICATE_KEY);
-      return -1;
-    }else{
-      pos = (pos + 1) & map->mask;
+    if(old_value != NULL){
+      *old_value = b->value;
     }
+    b->key = key;
+    b->value = value;
+    return 0;
+  }
+  size_t cap = map->cap;
+  if(ensure_cap(map)){
+    return -1;
+  }
+  if(map->cap != cap){
+    pos = find_bucket(map, key, hash);
+  }
+  fill_bucket(map, pos, key, value, hash);
+  if(old_value != NULL){
+    *old_value = NULL;
   }
+  return 0;
 }
 
 void * get_from_ptr_hash_map(const struct ptr_hash_map * map, const void * key){
   assert(map != NULL);
   assert(key != NULL);
 
-  size_t hash = (*map->hash)(key);
-  size_t pos = hash & map->mask;
-  while(true){
-    const struct ptr_hash_map_bucket * b = map->data + pos;
-    if(is_empty(b)){
-      return NULL;
-    }else if(is_key(map, b, key)){
-      return b->value;
-    }else{
-      pos = (pos + 1) & map->mask;
+  size_t pos = find_bucket(map, key, hash_map_mix((*map->hash)(key)));
+  return is_empty(map, pos) ? NULL : map->data[pos].value;
+}
+
+void * remove_from_ptr_hash_map(struct ptr_hash_map * map, const void * key){
+  assert(map != NULL);
+  assert(key != NULL);
+
+  size_t pos = find_bucket(map, key, hash_map_mix((*map->hash)(key)));
+  if(is_empty(map, pos)){
+    return NULL;
+  }
+  void * value = map->data[pos].value;
+
+  size_t hole = pos;
+  size_t next = (pos + 1) & map->mask;
+  while(!is_empty(map, next)){
+    size_t home = hash_map_home(map->data[next].hash, map->mask);
+    // the entry can fill the hole if the hole lies between its home bucket and its position
+    if(((next - home) & map->mask) >= ((next - hole) & map->mask)){
+      map->data[hole] = map->data[next];
+      hash_map_set_ctrl(map->ctrl, map->cap, hole, map->ctrl[next]);
+      hole = next;
     }
+    next = (next + 1) & map->mask;
+  }
+  hash_map_set_ctrl(map->ctrl, map->cap, hole, HASH_MAP_CTRL_EMPTY);
+  --map->count;
+
+  if(map->shrink && map->cap > map->min_cap && (double)map->count / map->cap < MIN_HASH_MAP_RATIO){
+    // a failed shrink leaves a valid map that is just larger than needed
+    shrink_ptr_hash_map(map);
   }
+  return value;
+}
+
+int shrink_ptr_hash_map(struct ptr_hash_map * map){
+  assert(map != NULL);
+
+  size_t cap;
+  size_t mask;
+  // leaving the map half empty keeps the next inserts from growing it right away
+  calc_cap(map->count * 2, &cap, &mask);
+  if(cap < map->min_cap){
+    cap = map->min_cap;
+    mask = cap - 1;
+  }
+  if(cap >= map->cap){
+    return 0;
+  }
+  return resize(map, cap, mask);
+}
+
+void set_ptr_hash_map_shrink(struct ptr_hash_map * map, bool shrink){
+  assert(map != NULL);
+  map->shrink = shrink;
 }
 
 void dispose_ptr_hash_map(struct ptr_hash_map * map){
@@ -166,8 +281,7 @@ void dispose_ptr_hash_map(struct ptr_hash_map * map){
 
 static size_t get_next_filled(struct ptr_hash_map * map, size_t pos){
   while(pos < map->cap){
-    struct ptr_hash_map_bucket * b = map->data + pos;
-    if(is_empty(b)){
+    if(is_empty(map, pos)){
       ++pos;
     }else{
       return pos;
@@ -203,17 +317,3 @@ void next_ptr_hash_map_iter(struct ptr_hash_map_iter * i){
   assert(i != NULL);
   i->pos = get_next_filled(i->map, i->pos + 1);
 }
-
-size_t hash_map_hash_str(const void * key){
-  const char * str = (const char *)key;
-  size_t hash = 5381;
-  while(*str){
-    hash = ((hash << 5) + hash) + *str;
-    ++str;
-  }
-  return hash;
-}
-
-bool hash_map_eq_str(const void * first, const void * second){
-  return strcmp((const char *)first, (const char *)second) == 0;
-}
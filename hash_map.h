@@ -18,8 +18,19 @@
 #ifndef HASH_MAP_H
 #define HASH_MAP_H
 
+#include "memory.h"
+#include "status.h"
+
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uchar.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 typedef size_t (*hash_map_hash)(const void *);
 
@@ -31,17 +42,45 @@ struct ptr_hash_map{
   hash_map_hash hash;
   hash_map_eq eq;
   struct ptr_hash_map_bucket * data;
+  /**
+   * One byte per bucket, probed a group at a time so most buckets that cannot hold the key are skipped without comparing keys
+   */
+  uint8_t * ctrl;
   size_t cap;
   size_t mask;
   size_t count;
+  size_t min_cap;
+  bool shrink;
 };
 
 int init_ptr_hash_map(struct ptr_hash_map * map, hash_map_hash hash, hash_map_eq eq, size_t cap);
 
 int insert_new_into_ptr_hash_map(struct ptr_hash_map * map, void * key, void * value);
 
+/**
+ * Inserts a key or replaces the key and value of an equal key already in the map
+ * The replaced value, or NULL if the key is new, is stored in old_value unless it is NULL
+ */
+int insert_or_update_ptr_hash_map(struct ptr_hash_map * map, void * key, void * value, void ** old_value);
+
 void * get_from_ptr_hash_map(const struct ptr_hash_map * map, const void * key);
 
+/**
+ * Removes a key and returns its value, or NULL if the map does not contain the key
+ * The entries after it are shifted back, so lookups never have to skip deleted buckets
+ */
+void * remove_from_ptr_hash_map(struct ptr_hash_map * map, const void * key);
+
+/**
+ * Shrinks the bucket array to the smallest size that is at most half full, but never below the initial capacity
+ */
+int shrink_ptr_hash_map(struct ptr_hash_map * map);
+
+/**
+ * Lets remove_from_ptr_hash_map shrink the map once it is mostly empty, disabled by default
+ */
+void set_ptr_hash_map_shrink(struct ptr_hash_map * map, bool shrink);
+
 void dispose_ptr_hash_map(struct ptr_hash_map * map);
 
 struct ptr_hash_map_iter{
@@ -61,10 +100,271 @@ void next_ptr_hash_map_iter(struct ptr_hash_map_iter * i);
 
 /*
  * Basic utility functions for use in hash tables
+ * They are defined here so that typed maps can inline them
+ */
+
+static inline size_t hash_map_hash_str(const void * key){
+  const char * str = (const char *)key;
+  size_t hash = 5381;
+  while(*str){
+    hash = ((hash << 5) + hash) + *str;
+    ++str;
+  }
+  return hash;
+}
+
+static inline bool hash_map_eq_str(const void * first, const void * second){
+  return strcmp((const char *)first, (const char *)second) == 0;
+}
+
+static inline size_t hash_map_hash_unicode_str(const void * key){
+  const char32_t * str = (const char32_t *)key;
+  size_t hash = 5381;
+  while(*str){
+    hash = ((hash << 5) + hash) + *str;
+    ++str;
+  }
+  return hash;
+}
+
+static inline bool hash_map_eq_unicode_str(const void * first, const void * second){
+  const char32_t * f = (const char32_t *)first;
+  const char32_t * s = (const char32_t *)second;
+  while(*f != 0 && *f == *s){
+    ++f;
+    ++s;
+  }
+  return *f == *s;
+}
+
+static inline size_t hash_map_hash_int(const void * key){
+  // the multiplication spreads consecutive values over the buckets
+  return (size_t)(unsigned int)*(const int *)key * 2654435761u;
+}
+
+static inline bool hash_map_eq_int(const void * first, const void * second){
+  return *(const int *)first == *(const int *)second;
+}
+
+/*
+ * Probing shared by ptr_hash_map and the typed maps
+ * Every bucket has a control byte, HASH_MAP_CTRL_EMPTY or the low 7 bits of the mixed hash of its key,
+ * and the control bytes are compared a group at a time so most buckets are skipped without comparing keys
+ * Probing is linear per bucket, groups only speed up the scan, so entries can be removed by backward shifting
  */
 
-bool hash_map_eq_str(const void * first, const void * second);
+#define HASH_MAP_GROUP_SIZE 16
+
+#define HASH_MAP_CTRL_EMPTY 0x80
+
+#define HASH_MAP_MAX_RATIO 0.875
+
+/**
+ * Mixes the result of a hash function so both the home bucket and the control byte get well distributed bits
+ */
+static inline size_t hash_map_mix(size_t hash){
+  uint64_t h = hash;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return (size_t)h;
+}
+
+static inline size_t hash_map_home(size_t hash, size_t mask){
+  return (hash >> 7) & mask;
+}
+
+static inline uint8_t hash_map_fragment(size_t hash){
+  return hash & 0x7F;
+}
 
-size_t hash_map_hash_str(const void * str);
+/**
+ * The control bytes are followed by a copy of the first group, so a group starting at any bucket can be loaded at once
+ */
+static inline void hash_map_set_ctrl(uint8_t * ctrl, size_t cap, size_t pos, uint8_t c){
+  ctrl[pos] = c;
+  if(pos < HASH_MAP_GROUP_SIZE - 1){
+    ctrl[cap + pos] = c;
+  }
+}
+
+/**
+ * Compares a group of control bytes against a hash fragment
+ * Bit i of match is set if byte i equals the fragment, bit i of empty if byte i is empty
+ */
+static inline void hash_map_probe_group(const uint8_t * ctrl, uint8_t fragment, unsigned int * match, unsigned int * empty){
+#ifdef __SSE2__
+  __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+  *match = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)fragment)));
+  *empty = (unsigned int)_mm_movemask_epi8(group);
+#else
+  unsigned int m = 0;
+  unsigned int e = 0;
+  for(unsigned int i = 0; i < HASH_MAP_GROUP_SIZE; ++i){
+    m |= (unsigned int)(ctrl[i] == fragment) << i;
+    e |= (unsigned int)(ctrl[i] >> 7) << i;
+  }
+  *match = m;
+  *empty = e;
+#endif
+}
+
+/**
+ * Returns the first empty bucket at or after the position
+ */
+static inline size_t hash_map_find_empty(const uint8_t * ctrl, size_t mask, size_t pos){
+  while(true){
+    unsigned int match;
+    unsigned int empty;
+    hash_map_probe_group(ctrl + pos, 0, &match, &empty);
+    if(empty != 0){
+      return (pos + __builtin_ctz(empty)) & mask;
+    }
+    pos = (pos + HASH_MAP_GROUP_SIZE) & mask;
+  }
+}
+
+/**
+ * Defines a map from K to V specialized at compile time, with the same control bytes and probing as ptr_hash_map
+ * hash is called as hash(K) and eq as eq(K, K), keys are copied into the map
+ * Defines struct name with init_name, insert_new_into_name, get_from_name, remove_from_name and dispose_name
+ */
+#define DEFINE_HASH_MAP(name, K, V, hash, eq)				\
+  struct name##_bucket{							\
+    K key;								\
+    V value;								\
+    size_t hash;							\
+  };									\
+									\
+  struct name{								\
+    struct name##_bucket * data;					\
+    uint8_t * ctrl;							\
+    size_t mask;							\
+    size_t count;							\
+  };									\
+									\
+  static inline struct name##_bucket * alloc_##name##_buckets(size_t cap, uint8_t ** ctrl){ \
+    struct name##_bucket * data = malloc_checked(sizeof(struct name##_bucket) * cap + cap + HASH_MAP_GROUP_SIZE - 1); \
+    if(data == NULL){							\
+      return NULL;							\
+    }									\
+    *ctrl = (uint8_t *)(data + cap);					\
+    memset(*ctrl, HASH_MAP_CTRL_EMPTY, cap + HASH_MAP_GROUP_SIZE - 1);	\
+    return data;							\
+  }									\
+									\
+  static inline int init_##name(struct name * map, size_t cap){		\
+    size_t c = HASH_MAP_GROUP_SIZE;					\
+    while(c < cap){							\
+      c <<= 1;								\
+    }									\
+    map->data = alloc_##name##_buckets(c, &map->ctrl);			\
+    if(map->data == NULL){						\
+      return -1;							\
+    }									\
+    map->mask = c - 1;							\
+    map->count = 0;							\
+    return 0;								\
+  }									\
+									\
+  static inline int grow_##name(struct name * map){			\
+    size_t nmask = (map->mask << 1) | 1;				\
+    uint8_t * nctrl;							\
+    struct name##_bucket * ndata = alloc_##name##_buckets(nmask + 1, &nctrl); \
+    if(ndata == NULL){							\
+      return -1;							\
+    }									\
+    for(size_t pos = 0; pos <= map->mask; ++pos){			\
+      if(!(map->ctrl[pos] & HASH_MAP_CTRL_EMPTY)){			\
+	size_t npos = hash_map_find_empty(nctrl, nmask, hash_map_home(map->data[pos].hash, nmask)); \
+	hash_map_set_ctrl(nctrl, nmask + 1, npos, map->ctrl[pos]);	\
+	ndata[npos] = map->data[pos];					\
+      }									\
+    }									\
+    free(map->data);							\
+    map->data = ndata;							\
+    map->ctrl = nctrl;							\
+    map->mask = nmask;							\
+    return 0;								\
+  }									\
+									\
+  /* returns the bucket holding the key or the empty bucket ending its probe sequence */ \
+  static inline size_t find_in_##name(const struct name * map, K key, size_t h){ \
+    uint8_t fragment = hash_map_fragment(h);				\
+    size_t pos = hash_map_home(h, map->mask);				\
+    while(true){							\
+      unsigned int match;						\
+      unsigned int empty;						\
+      hash_map_probe_group(map->ctrl + pos, fragment, &match, &empty);	\
+      if(empty != 0){							\
+	match &= (empty & -empty) - 1;					\
+      }									\
+      while(match != 0){						\
+	size_t candidate = (pos + __builtin_ctz(match)) & map->mask;	\
+	if(map->data[candidate].hash == h && (eq(map->data[candidate].key, key))){ \
+	  return candidate;						\
+	}								\
+	match &= match - 1;						\
+      }									\
+      if(empty != 0){							\
+	return (pos + __builtin_ctz(empty)) & map->mask;		\
+      }									\
+      pos = (pos + HASH_MAP_GROUP_SIZE) & map->mask;			\
+    }									\
+  }									\
+									\
+  static inline int insert_new_into_##name(struct name * map, K key, V value){ \
+    if((double)(map->count + 1) / (map->mask + 1) > HASH_MAP_MAX_RATIO && grow_##name(map)){ \
+      return -1;							\
+    }									\
+    size_t h = hash_map_mix((size_t)(hash(key)));			\
+    size_t pos = find_in_##name(map, key, h);				\
+    if(!(map->ctrl[pos] & HASH_MAP_CTRL_EMPTY)){			\
+      set_status(STATUS_DUPLICATE_KEY);					\
+      return -1;							\
+    }									\
+    map->data[pos].key = key;						\
+    map->data[pos].value = value;					\
+    map->data[pos].hash = h;						\
+    hash_map_set_ctrl(map->ctrl, map->mask + 1, pos, hash_map_fragment(h)); \
+    ++map->count;							\
+    return 0;								\
+  }									\
+									\
+  static inline V * get_from_##name(const struct name * map, K key){	\
+    size_t pos = find_in_##name(map, key, hash_map_mix((size_t)(hash(key)))); \
+    return (map->ctrl[pos] & HASH_MAP_CTRL_EMPTY) ? NULL : &map->data[pos].value; \
+  }									\
+									\
+  static inline bool remove_from_##name(struct name * map, K key, V * value){ \
+    size_t pos = find_in_##name(map, key, hash_map_mix((size_t)(hash(key)))); \
+    if(map->ctrl[pos] & HASH_MAP_CTRL_EMPTY){				\
+      return false;							\
+    }									\
+    if(value != NULL){							\
+      *value = map->data[pos].value;					\
+    }									\
+    size_t hole = pos;							\
+    size_t next = (pos + 1) & map->mask;				\
+    while(!(map->ctrl[next] & HASH_MAP_CTRL_EMPTY)){			\
+      size_t home = hash_map_home(map->data[next].hash, map->mask);	\
+      if(((next - home) & map->mask) >= ((next - hole) & map->mask)){	\
+	map->data[hole] = map->data[next];				\
+	hash_map_set_ctrl(map->ctrl, map->mask + 1, hole, map->ctrl[next]); \
+	hole = next;							\
+      }									\
+      next = (next + 1) & map->mask;					\
+    }									\
+    hash_map_set_ctrl(map->ctrl, map->mask + 1, hole, HASH_MAP_CTRL_EMPTY); \
+    --map->count;							\
+    return true;							\
+  }									\
+									\
+  static inline void dispose_##name(struct name * map){			\
+    free(map->data);							\
+    map->data = NULL;							\
+  }
 
 #endif
@@ -0,0 +1,212 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "interest.h"
+#include "memory.h"
+
+#include <assert.h>
+
+static uint32_t get_player_mask(int player){
+  assert(player >= 0 && player < GAME_MAX_PLAYER_COUNT);
+  return ((uint32_t)1) << player;
+}
+
+int init_interest(struct interest * in, const struct spatial_index * si){
+  assert(in != NULL);
+  assert(si != NULL);
+
+  in->face_count = si->face_count;
+  in->face_owners = malloc_checked(sizeof(uint32_t) * si->face_count);
+  in->face_viewers = malloc_checked(sizeof(uint32_t) * si->face_count);
+  in->slot_cap = 0;
+  in->tracked = NULL;
+  in->viewers = NULL;
+  in->sent = NULL;
+  if(in->face_owners == NULL || in->face_viewers == NULL){
+    dispose_interest(in);
+    return -1;
+  }
+  return 0;
+}
+
+static int ensure_slot_cap(struct interest * in, size_t count){
+  if(count <= in->slot_cap){
+    return 0;
+  }
+  size_t cap = in->slot_cap == 0 ? WORLD_INITIAL_CAPACITY : in->slot_cap;
+  while(cap < count){
+    cap *= 2;
+  }
+  unsigned int * tracked = realloc_checked(in->tracked, sizeof(unsigned int) * cap);
+  if(tracked == NULL){
+    return -1;
+  }
+  in->tracked = tracked;
+  uint32_t * viewers = realloc_checked(in->viewers, sizeof(uint32_t) * cap);
+  if(viewers == NULL){
+    return -1;
+  }
+  in->viewers = viewers;
+  struct protocol_entity * sent = realloc_checked(in->sent, sizeof(struct protocol_entity) * cap);
+  if(sent == NULL){
+    return -1;
+  }
+  in->sent = sent;
+  for(size_t i = in->slot_cap; i < cap; ++i){
+    in->tracked[i] = WORLD_NULL_ENTITY;
+    in->viewers[i] = 0;
+  }
+  in->slot_cap = cap;
+  return 0;
+}
+
+static void update_face_viewers(struct interest * in, const struct spatial_index * si, const struct world * w){
+  for(size_t f = 0; f < in->face_count; ++f){
+    in->face_owners[f] = 0;
+  }
+  for(size_t i = 0; i < w->count; ++i){
+    int owner = w->owner[i];
+    if(owner >= 0 && owner < GAME_MAX_PLAYER_COUNT){
+      in->face_owners[si->entity_faces[i]] |= get_player_mask(owner);
+    }
+  }
+  for(size_t f = 0; f < in->face_count; ++f){
+    uint32_t viewers = in->face_owners[f];
+    size_t count;
+    const size_t * neighbours = get_spatial_index_neighbours(si, f, &count);
+    for(size_t n = 0; n < count; ++n){
+      viewers |= in->face_owners[neighbours[n]];
+    }
+    in->face_viewers[f] = viewers;
+  }
+}
+
+static int send_leave(uint32_t players, unsigned int id, interest_send_fn send){
+  struct protocol_msg msg;
+  init_protocol_entity_leave(&msg, -1, id);
+  return send(players, &msg);
+}
+
+static bool has_entity_changed(const struct protocol_entity * sent, const struct protocol_entity * cur){
+  // positions follow from the velocity, so they are not compared
+  return sent->owner != cur->owner || sent->vx != cur->vx || sent->vy != cur->vy || sent->health != cur->health;
+}
+
+static int update_entity_interest(struct interest * in, const struct world * w, size_t index, uint32_t visible, interest_send_fn send){
+  unsigned int entity = w->entities[index];
+  unsigned int slot = entity & WORLD_ENTITY_INDEX_MASK;
+
+  if(in->tracked[slot] != entity){
+    // the slot was reused since the last update, so the previous entity is gone
+    if(in->viewers[slot] != 0 && send_leave(in->viewers[slot], in->tracked[slot], send)){
+      return -1;
+    }
+    in->tracked[slot] = entity;
+    in->viewers[slot] = 0;
+  }
+
+  struct protocol_entity cur = {entity, w->owner[index], w->x[index], w->y[index], w->vx[index], w->vy[index], w->health[index]};
+  uint32_t known = in->viewers[slot];
+  uint32_t entered = visible & ~known;
+  uint32_t left = known & ~visible;
+  uint32_t stayed = known & visible;
+  struct protocol_msg msg;
+
+  if(entered != 0){
+    init_protocol_entity_enter(&msg, -1, &cur);
+    if(send(entered, &msg)){
+      return -1;
+    }
+  }
+  if(left != 0 && send_leave(left, entity, send)){
+    return -1;
+  }
+  if(stayed != 0 && has_entity_changed(&in->sent[slot], &cur)){
+    init_protocol_entity_update(&msg, -1, &cur);
+    if(send(stayed, &msg)){
+      return -1;
+    }
+  }
+  in->sent[slot] = cur;
+  in->viewers[slot] = visible;
+  return 0;
+}
+
+int update_interest(struct interest * in, const struct spatial_index * si, const struct world * w, interest_send_fn send){
+  assert(in != NULL);
+  assert(si != NULL);
+  assert(w != NULL);
+  assert(send != NULL);
+  assert(si->entity_count == w->count);
+  assert(si->face_count == in->face_count);
+
+  if(ensure_slot_cap(in, w->slot_count)){
+    return -1;
+  }
+
+  update_face_viewers(in, si, w);
+
+  int result = 0;
+  for(size_t i = 0; i < w->count; ++i){
+    if(update_entity_interest(in, w, i, in->face_viewers[si->entity_faces[i]], send)){
+      result = -1;
+    }
+  }
+
+  // entities destroyed since the last update
+  for(size_t slot = 0; slot < w->slot_count; ++slot){
+    if(in->viewers[slot] != 0 && !is_world_entity_alive(w, in->tracked[slot])){
+      if(send_leave(in->viewers[slot], in->tracked[slot], send)){
+	result = -1;
+      }
+      in->viewers[slot] = 0;
+    }
+  }
+  return result;
+}
+
+void reset_interest_player(struct interest * in, int player){
+  assert(in != NULL);
+
+  uint32_t mask = ~get_player_mask(player);
+  for(size_t slot = 0; slot < in->slot_cap; ++slot){
+    in->viewers[slot] &= mask;
+  }
+}
+
+bool is_face_visible(const struct interest * in, size_t face, int player){
+  assert(in != NULL);
+  assert(face < in->face_count);
+
+  return (in->face_viewers[face] & get_player_mask(player)) != 0;
+}
+
+void dispose_interest(struct interest * in){
+  assert(in != NULL);
+
+  free(in->face_owners);
+  free(in->face_viewers);
+  free(in->tracked);
+  free(in->viewers);
+  free(in->sent);
+  in->face_owners = NULL;
+  in->face_viewers = NULL;
+  in->tracked = NULL;
+  in->viewers = NULL;
+  in->sent = NULL;
+  in->slot_cap = 0;
+}
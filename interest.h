@@ -0,0 +1,71 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef INTEREST_H
+#define INTEREST_H
+
+#include "game.h"
+#include "protocol.h"
+#include "spatial_index.h"
+#include "world.h"
+
+#include <stdint.h>
+
+#if GAME_MAX_PLAYER_COUNT > 32
+#error "interest management stores the players that see a face or entity in 32 bit masks"
+#endif
+
+/**
+ * Sends a message to every player in the mask
+ */
+typedef int (*interest_send_fn)(uint32_t players, const struct protocol_msg * msg);
+
+/**
+ * Tracks which players see which faces and entities
+ * A player sees the faces that contain one of its own entities and the neighbours of those faces
+ * For every entity slot the players that were told about the entity are remembered,
+ * so only enter, leave and update events need to be sent
+ */
+struct interest{
+  size_t face_count;
+  uint32_t * face_owners;
+  uint32_t * face_viewers;
+
+  size_t slot_cap;
+  unsigned int * tracked;
+  uint32_t * viewers;
+  struct protocol_entity * sent;
+};
+
+int init_interest(struct interest * in, const struct spatial_index * si);
+
+/**
+ * Recomputes visibility and sends the resulting events
+ * The entity buckets of the spatial index must be up to date with the world
+ */
+int update_interest(struct interest * in, const struct spatial_index * si, const struct world * w, interest_send_fn send);
+
+/**
+ * Forgets everything a player was told, so that all visible entities are sent again on the next update
+ */
+void reset_interest_player(struct interest * in, int player);
+
+bool is_face_visible(const struct interest * in, size_t face, int player);
+
+void dispose_interest(struct interest * in);
+
+#endif
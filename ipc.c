@@ -15,18 +15,28 @@
  *
  */
 
+#define LOG_MODULE LOG_MODULE_IPC
+
 #include "ipc.h"
 #include "logger.h"
+#include "slab.h"
 #include "status.h"
 #include "thread_utils.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
 
 
 #define IPC_MSG_BLOCK_LEN 32
 
+/**
+ * Messages are recycled by their allocator, so this pool only holds the blocks of the allocators
+ */
+static struct slab_pool msg_pool = SLAB_POOL_INITIALIZER("ipc", false);
+
 static int init_ipc_mt_queue(struct ipc_mt_queue * q, struct ipc_alloc * alloc);
 
 static int push_onto_ipc_mt_queue(struct ipc_mt_queue * q, struct ipc_msg * msg);
@@ -37,6 +47,8 @@ static int pop_from_ipc_mt_queue(struct ipc_msg ** dest, struct ipc_mt_queue * s
 
 static int try_pop_from_ipc_mt_queue(struct ipc_msg ** dest, struct ipc_mt_queue * src);
 
+static int timed_pop_from_ipc_mt_queue(struct ipc_msg ** dest, struct ipc_mt_queue * src, const struct timespec * deadline);
+
 static int move_from_ipc_mt_queue(struct ipc_queue * dest, struct ipc_mt_queue * src);
 
 static int try_move_from_ipc_mt_queue(struct ipc_queue * dest, struct ipc_mt_queue * src);
@@ -67,7 +79,7 @@ int init_ipc_alloc(struct ipc_alloc * alloc){
     return -1;
   }
   
-  init_deque(&alloc->deque, sizeof(struct ipc_msg), IPC_MSG_BLOCK_LEN);
+  init_deque(&alloc->deque, sizeof(struct ipc_msg), IPC_MSG_BLOCK_LEN, &msg_pool);
   init_ipc_queue(&alloc->recycle_queue, alloc);
   
   return 0;
@@ -105,6 +117,9 @@ struct ipc_msg * create_ipc_msg(struct ipc_alloc * alloc){
       msg->alloc = alloc;
     }
   }
+  if(msg != NULL){
+    msg->type = IPC_MSG_TYPE_PROTOCOL;
+  }
 
   if(unlock_named_mutex(&alloc->mutex, "ipc_alloc")){
     push_onto_ipc_queue(&alloc->recycle_queue, msg);
@@ -239,12 +254,23 @@ static int init_ipc_mt_queue(struct ipc_mt_queue * q, struct ipc_alloc * alloc){
   if(init_named_mutex(&q->mutex, "ipc mt queue")){
     return -1;
   }
-  if(pthread_cond_init(&q->cond, NULL)){
+  // timed waits use the monotonic clock so deadlines are not affected by wall clock changes
+  pthread_condattr_t attr;
+  if(pthread_condattr_init(&attr)){
+    set_status(STATUS_CREATE_CV_FAILED);
+    LOG_ERROR("could not create condition variable attributes for ipc mt queue");
+    dispose_named_mutex(&q->mutex, "ipc mt queue");
+    return -1;
+  }
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  if(pthread_cond_init(&q->cond, &attr)){
     set_status(STATUS_CREATE_CV_FAILED);
     LOG_ERROR("could not create condition variable for ipc mt queue");
+    pthread_condattr_destroy(&attr);
     dispose_named_mutex(&q->mutex, "ipc mt queue");
     return -1;
   }
+  pthread_condattr_destroy(&attr);
   
   init_ipc_queue(&q->queue, alloc);
   q->active = false;
@@ -328,6 +354,7 @@ static int pop_from_ipc_mt_queue(struct ipc_msg ** dest, struct ipc_mt_queue * s
 
     if(pthread_cond_wait(&src->cond, &src->mutex)){
       LOG_ERROR("could not wait on ipc msg queue");
+      unlock_named_mutex(&src->mutex, "ipc mt queue");
       set_status(STATUS_WAIT_CV_FAILED);
       return -1;
     }
@@ -360,6 +387,51 @@ static int try_pop_from_ipc_mt_queue(struct ipc_msg ** dest, struct ipc_mt_queue
   return 0;
 }
 
+static int timed_pop_from_ipc_mt_queue(struct ipc_msg ** dest, struct ipc_mt_queue * src, const struct timespec * deadline){
+  assert(dest != NULL);
+  assert(src != NULL);
+  assert(deadline != NULL);
+
+  if(lock_named_mutex(&src->mutex, "ipc mt queue")){
+    return -1;
+  }
+  
+  while(true){
+
+    if(!src->active){
+      if(unlock_named_mutex(&src->mutex, "ipc mt queue")){
+	return -1;
+      }
+      set_status(STATUS_IPC_QUEUE_STOPPED);
+      *dest = NULL;
+      return 1;
+    }
+    
+    struct ipc_msg * msg = pop_from_ipc_queue(&src->queue);
+    if(msg != NULL){
+      if(unlock_named_mutex(&src->mutex, "ipc mt queue")){
+	return -1;
+      }
+      *dest = msg;
+      return 0;
+    }
+
+    int result = pthread_cond_timedwait(&src->cond, &src->mutex, deadline);
+    if(result == ETIMEDOUT){
+      if(unlock_named_mutex(&src->mutex, "ipc mt queue")){
+	return -1;
+      }
+      *dest = NULL;
+      return 0;
+    }else if(result){
+      LOG_ERROR("could not wait on ipc msg queue");
+      unlock_named_mutex(&src->mutex, "ipc mt queue");
+      set_status(STATUS_WAIT_CV_FAILED);
+      return -1;
+    }
+  }
+}
+
 static int move_from_ipc_mt_queue(struct ipc_queue * dest, struct ipc_mt_queue * src){
   assert(dest != NULL);
   assert(src != NULL);
@@ -392,6 +464,8 @@ static int move_from_ipc_mt_queue(struct ipc_queue * dest, struct ipc_mt_queue *
     
     if(pthread_cond_wait(&src->cond, &src->mutex)){
       LOG_ERROR("could not wait on ipc msg queue");
+      unlock_named_mutex(&src->mutex, "ipc mt queue");
+      set_status(STATUS_WAIT_CV_FAILED);
       return -1;
     }
     
@@ -521,6 +595,7 @@ static int init_ipc_channel(struct ipc_channel * ch, int id, struct ipc_mt_queue
 
   struct ipc_alloc * alloc = receive_queue->queue.alloc;
   
+  ch->id = id;
   ch->state = IPC_STATE_INACTIVE;
   ch->fd = -1;
   if(init_named_mutex(&ch->mutex, "ipc channel")){
@@ -551,7 +626,7 @@ static bool is_running(struct ipc_channel * ch){
     unlock_named_mutex(&ch->mutex, "ipc channel");
     return true;
   }
-  lock_named_mutex(&ch->mutex, "ipc channel");
+  unlock_named_mutex(&ch->mutex, "ipc channel");
   return false;
 }
 
@@ -568,10 +643,27 @@ static void * produce_ipc_msg(void * arg){
       break;
     }
     
-    ch->receive_msg = create_ipc_msg(alloc);
+    if(ch->receive_msg == NULL){
+      ch->receive_msg = create_ipc_msg(alloc);
+      if(ch->receive_msg == NULL){
+	break;
+      }
+    }
+    ch->receive_msg->sender = ch->id;
     ch->receive_msg->recipient = ch->id;
-    
+
     if(read_protocol_msg(&ch->protocol, &ch->receive_msg->payload, ch->fd)){
+      if(get_status() == STATUS_END_OF_STREAM){
+	// peer closed the connection, nothing more will arrive
+	LOG_INFO("ipc channel %d closed by peer", ch->id);
+	ch->receive_msg->type = IPC_MSG_TYPE_DISCONNECTED;
+	if(push_onto_ipc_mt_queue(ch->receive_queue, ch->receive_msg)){
+	  LOG_ERROR("could not push disconnect message onto receive queue");
+	}else{
+	  ch->receive_msg = NULL;
+	}
+	break;
+      }
       LOG_ERROR("error while reading ipc message");
     }else{
       if(push_onto_ipc_mt_queue(ch->receive_queue, ch->receive_msg)){
@@ -596,7 +688,11 @@ static void * consume_ipc_msg(void * arg){
       break;
     }
     
-    if(pop_from_ipc_mt_queue(&ch->send_msg, &ch->send_queue)){
+    int result = pop_from_ipc_mt_queue(&ch->send_msg, &ch->send_queue);
+    if(result == 1){
+      // send queue stopped, the channel is shutting down
+      break;
+    }else if(result){
       LOG_ERROR("could not pop message from send queue");
       break;
     }
@@ -827,6 +923,14 @@ int try_receive_from_ipc_duplex(struct ipc_msg ** dest, struct ipc_duplex * src)
   return try_pop_from_ipc_mt_queue(dest, &src->receive_queue);
 }
 
+int timed_receive_from_ipc_duplex(struct ipc_msg ** dest, struct ipc_duplex * src, const struct timespec * deadline){
+  assert(dest != NULL);
+  assert(src != NULL);
+  assert(deadline != NULL);
+
+  return timed_pop_from_ipc_mt_queue(dest, &src->receive_queue, deadline);
+}
+
 int receive_all_from_ipc_duplex(struct ipc_queue * dest, struct ipc_duplex * src){
   assert(dest != NULL);
   assert(src != NULL);
@@ -841,10 +945,43 @@ int try_receive_all_from_ipc_duplex(struct ipc_queue * dest, struct ipc_duplex *
   return try_move_from_ipc_mt_queue(dest, &src->receive_queue);
 }
 
+int detach_ipc_duplex(struct ipc_duplex * d){
+  assert(d != NULL);
+
+  // the receive queue stays open so the owner can keep polling while reconnecting
+  int result = 0;
+  if(d->channel.state == IPC_STATE_ACTIVE){
+    result = stop_ipc_channel(&d->channel);
+  }
+  d->channel.fd = -1;
+  return result;
+}
+
+int attach_ipc_duplex(struct ipc_duplex * d, int fd){
+  assert(d != NULL);
+  assert(fd != -1);
+
+  if(d->channel.fd != -1){
+    set_status(STATUS_INVALID_IPC_STATE);
+    LOG_ERROR("ipc duplex already attached");
+    return -1;
+  }
+
+  if(start_ipc_channel(&d->channel, fd)){
+    d->channel.fd = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
 int close_ipc_duplex(struct ipc_duplex * d){
   assert(d != NULL);
   
-  int result = stop_ipc_channel(&d->channel);
+  int result = 0;
+  if(d->channel.state == IPC_STATE_ACTIVE){
+    result = stop_ipc_channel(&d->channel);
+  }
   d->channel.fd = -1;
   
   if(stop_ipc_mt_queue(&d->receive_queue)){
@@ -898,7 +1035,7 @@ static int release_disposed_channel(struct ipc_multiplex * m, int id){
   if(lock_named_mutex(&m->mutex, "ipc multiplex")){
      return -1;
    }
-   assert(m->acquired[id] == false);
+   assert(m->acquired[id]);
    m->acquired[id] = false;
    
    if(unlock_named_mutex(&m->mutex, "ipc multiplex")){
@@ -996,6 +1133,14 @@ int try_receive_from_ipc_multiplex(struct ipc_msg ** dest, struct ipc_multiplex
 
   return try_pop_from_ipc_mt_queue(dest, &src->receive_queue);
 }
+
+int timed_receive_from_ipc_multiplex(struct ipc_msg ** dest, struct ipc_multiplex * src, const struct timespec * deadline){
+  assert(dest != NULL);
+  assert(src != NULL);
+  assert(deadline != NULL);
+
+  return timed_pop_from_ipc_mt_queue(dest, &src->receive_queue, deadline);
+}
  
 int receive_all_from_ipc_multiplex(struct ipc_queue * dest, struct ipc_multiplex * src){
   assert(dest != NULL);
@@ -23,12 +23,26 @@
 
 #include <pthread.h>
 
-#define MAX_IPC_CHANNELS 32
+/**
+ * Connections are not limited to players, so a multiplex serves more channels than there are players
+ */
+#define MAX_IPC_CHANNELS 256
+
+/**
+ * ipc message type
+ * disconnected messages are generated locally when the peer of a channel
+ * has closed its connection and carry no payload
+ */
+enum ipc_msg_type{
+		  IPC_MSG_TYPE_PROTOCOL,
+		  IPC_MSG_TYPE_DISCONNECTED
+};
 
 /**
  * basic ipc message
  */
 struct ipc_msg{
+  enum ipc_msg_type type;
   int sender;
   int recipient;
   struct protocol_msg payload;
@@ -155,10 +169,20 @@ int receive_from_ipc_duplex(struct ipc_msg ** dest, struct ipc_duplex * src);
 
 int try_receive_from_ipc_duplex(struct ipc_msg ** dest, struct ipc_duplex * src);
 
+/**
+ * Waits for a message until the deadline (CLOCK_MONOTONIC) passes
+ * dest is set to NULL if no message arrived in time
+ */
+int timed_receive_from_ipc_duplex(struct ipc_msg ** dest, struct ipc_duplex * src, const struct timespec * deadline);
+
 int receive_all_from_ipc_duplex(struct ipc_queue * dest, struct ipc_duplex * src);
 
 int try_receive_all_from_ipc_duplex(struct ipc_queue * dest, struct ipc_duplex * src);
 
+int detach_ipc_duplex(struct ipc_duplex * d);
+
+int attach_ipc_duplex(struct ipc_duplex * d, int fd);
+
 int close_ipc_duplex(struct ipc_duplex * d);
 
 int dispose_ipc_duplex(struct ipc_duplex * d);
@@ -176,6 +200,12 @@ int receive_from_ipc_multiplex(struct ipc_msg ** dest, struct ipc_multiplex * sr
 
 int try_receive_from_ipc_multiplex(struct ipc_msg ** dest, struct ipc_multiplex * src);
 
+/**
+ * Waits for a message until the deadline (CLOCK_MONOTONIC) passes
+ * dest is set to NULL if no message arrived in time
+ */
+int timed_receive_from_ipc_multiplex(struct ipc_msg ** dest, struct ipc_multiplex * src, const struct timespec * deadline);
+
 int receive_all_from_ipc_multiplex(struct ipc_queue * dest, struct ipc_multiplex * src);
 
 int try_receive_all_from_ipc_multiplex(struct ipc_queue * dest, struct ipc_multiplex * src);
@@ -0,0 +1,280 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#define LOG_MODULE LOG_MODULE_SERVER
+
+#include "journal.h"
+#include "logger.h"
+#include "memory.h"
+#include "status.h"
+
+#include <assert.h>
+#include <string.h>
+
+#define JOURNAL_MAGIC "GAMEJRNL"
+
+#define JOURNAL_BYTE_ORDER 0x01020304u
+
+/**
+ * Size of the stdio buffer, large enough to hold a few seconds of traffic
+ */
+#define JOURNAL_BUFFER_SIZE (1 << 16)
+
+struct journal_header{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t msg_size;
+  uint32_t reserved;
+  int64_t start_sec;
+  int64_t start_nsec;
+};
+
+/**
+ * MSG records are followed by the payload, TOKEN records by the token
+ */
+struct journal_record_header{
+  uint32_t type;
+  uint32_t msg_type;
+  int32_t channel;
+  uint32_t reserved;
+  uint64_t seq;
+  int64_t sec;
+  int64_t nsec;
+};
+
+static int write_journal_bytes(struct journal_writer * w, const void * data, size_t size){
+  if(fwrite(data, size, 1, w->file) != 1){
+    LOG_ERROR("could not write journal");
+    set_status(STATUS_IO_ERROR);
+    return -1;
+  }
+  return 0;
+}
+
+static int write_journal_record_header(struct journal_writer * w, enum journal_record_type type, const struct timespec * time, int channel, enum ipc_msg_type msg_type){
+  struct journal_record_header header;
+  memset(&header, 0, sizeof(header));
+  header.type = type;
+  header.msg_type = msg_type;
+  header.channel = channel;
+  header.seq = w->next_seq;
+  if(time != NULL){
+    header.sec = time->tv_sec;
+    header.nsec = time->tv_nsec;
+  }
+  ++w->next_seq;
+  return write_journal_bytes(w, &header, sizeof(header));
+}
+
+int open_journal_writer(struct journal_writer * w, const char * path, const struct timespec * start){
+  assert(w != NULL);
+  assert(path != NULL);
+  assert(start != NULL);
+
+  w->buffer = malloc_checked(JOURNAL_BUFFER_SIZE);
+  if(w->buffer == NULL){
+    return -1;
+  }
+  w->file = fopen(path, "wb");
+  if(w->file == NULL){
+    LOG_ERROR("could not open journal %s", path);
+    set_status(STATUS_IO_ERROR);
+    free(w->buffer);
+    return -1;
+  }
+  setvbuf(w->file, w->buffer, _IOFBF, JOURNAL_BUFFER_SIZE);
+  w->next_seq = 0;
+
+  struct journal_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+  header.version = JOURNAL_VERSION;
+  header.byte_order = JOURNAL_BYTE_ORDER;
+  header.msg_size = sizeof(struct protocol_msg);
+  header.start_sec = start->tv_sec;
+  header.start_nsec = start->tv_nsec;
+  if(write_journal_bytes(w, &header, sizeof(header))){
+    close_journal_writer(w);
+    return -1;
+  }
+  return 0;
+}
+
+int append_journal_msg(struct journal_writer * w, const struct ipc_msg * msg, const struct timespec * time){
+  assert(w != NULL);
+  assert(msg != NULL);
+  assert(time != NULL);
+
+  if(write_journal_record_header(w, JOURNAL_RECORD_MSG, time, msg->sender, msg->type)){
+    return -1;
+  }
+  return write_journal_bytes(w, &msg->payload, sizeof(msg->payload));
+}
+
+int append_journal_tick(struct journal_writer * w, const struct timespec * time){
+  assert(w != NULL);
+  assert(time != NULL);
+
+  return write_journal_record_header(w, JOURNAL_RECORD_TICK, time, -1, IPC_MSG_TYPE_PROTOCOL);
+}
+
+int append_journal_token(struct journal_writer * w, const char * token){
+  assert(w != NULL);
+  assert(token != NULL);
+  assert(strlen(token) <= PROTOCOL_SESSION_TOKEN_LEN);
+
+  char buffer[PROTOCOL_SESSION_TOKEN_LEN + 1];
+  memset(buffer, 0, sizeof(buffer));
+  strcpy(buffer, token);
+  if(write_journal_record_header(w, JOURNAL_RECORD_TOKEN, NULL, -1, IPC_MSG_TYPE_PROTOCOL)){
+    return -1;
+  }
+  return write_journal_bytes(w, buffer, sizeof(buffer));
+}
+
+int flush_journal_writer(struct journal_writer * w){
+  assert(w != NULL);
+  
+  if(fflush(w->file)){
+    LOG_ERROR("could not flush journal");
+    set_status(STATUS_IO_ERROR);
+    return -1;
+  }
+  return 0;
+}
+
+int close_journal_writer(struct journal_writer * w){
+  assert(w != NULL);
+  assert(w->file != NULL);
+
+  int result = 0;
+  if(fclose(w->file)){
+    LOG_ERROR("could not close journal");
+    set_status(STATUS_IO_ERROR);
+    result = -1;
+  }
+  w->file = NULL;
+  // the buffer is in use by the stream until it is closed
+  free(w->buffer);
+  w->buffer = NULL;
+  return result;
+}
+
+int open_journal_reader(struct journal_reader * r, const char * path){
+  assert(r != NULL);
+  assert(path != NULL);
+
+  r->buffer = malloc_checked(JOURNAL_BUFFER_SIZE);
+  if(r->buffer == NULL){
+    return -1;
+  }
+  r->file = fopen(path, "rb");
+  if(r->file == NULL){
+    LOG_ERROR("could not open journal %s", path);
+    set_status(STATUS_IO_ERROR);
+    free(r->buffer);
+    return -1;
+  }
+  setvbuf(r->file, r->buffer, _IOFBF, JOURNAL_BUFFER_SIZE);
+  r->next_seq = 0;
+
+  struct journal_header header;
+  if(fread(&header, sizeof(header), 1, r->file) != 1
+     || memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0
+     || header.version != JOURNAL_VERSION
+     || header.byte_order != JOURNAL_BYTE_ORDER
+     || header.msg_size != sizeof(struct protocol_msg)){
+    LOG_ERROR("%s is not a valid journal for this build", path);
+    set_status(STATUS_INVALID_JOURNAL);
+    close_journal_reader(r);
+    return -1;
+  }
+  r->start.tv_sec = header.start_sec;
+  r->start.tv_nsec = header.start_nsec;
+  return 0;
+}
+
+/**
+ * Returns 1 if the journal ends before the bytes could be read
+ */
+static int read_journal_bytes(struct journal_reader * r, void * dest, size_t size){
+  if(fread(dest, size, 1, r->file) == 1){
+    return 0;
+  }
+  if(ferror(r->file)){
+    LOG_ERROR("could not read journal");
+    set_status(STATUS_IO_ERROR);
+    return -1;
+  }
+  LOG_WARNING("journal ends with an incomplete record");
+  return 1;
+}
+
+int read_journal_record(struct journal_reader * r, struct journal_record * dest){
+  assert(r != NULL);
+  assert(dest != NULL);
+
+  // a clean end of the journal is only possible between records
+  int c = fgetc(r->file);
+  if(c == EOF && !ferror(r->file)){
+    return 1;
+  }
+  ungetc(c, r->file);
+
+  struct journal_record_header header;
+  int result = read_journal_bytes(r, &header, sizeof(header));
+  if(result){
+    return result;
+  }
+  if(header.seq != r->next_seq || header.type > JOURNAL_RECORD_TOKEN || header.msg_type > IPC_MSG_TYPE_DISCONNECTED){
+    LOG_ERROR("journal record %llu is invalid", (unsigned long long)r->next_seq);
+    set_status(STATUS_INVALID_JOURNAL);
+    return -1;
+  }
+  ++r->next_seq;
+
+  dest->type = (enum journal_record_type)header.type;
+  dest->seq = header.seq;
+  dest->time.tv_sec = header.sec;
+  dest->time.tv_nsec = header.nsec;
+  dest->channel = header.channel;
+  dest->msg_type = (enum ipc_msg_type)header.msg_type;
+  if(dest->type == JOURNAL_RECORD_MSG){
+    return read_journal_bytes(r, &dest->payload, sizeof(dest->payload));
+  }else if(dest->type == JOURNAL_RECORD_TOKEN){
+    result = read_journal_bytes(r, dest->token, sizeof(dest->token));
+    if(result == 0 && dest->token[PROTOCOL_SESSION_TOKEN_LEN] != '\0'){
+      LOG_ERROR("journal record %llu contains an invalid token", (unsigned long long)header.seq);
+      set_status(STATUS_INVALID_JOURNAL);
+      return -1;
+    }
+    return result;
+  }
+  return 0;
+}
+
+void close_journal_reader(struct journal_reader * r){
+  assert(r != NULL);
+
+  if(r->file != NULL){
+    fclose(r->file);
+    r->file = NULL;
+  }
+  free(r->buffer);
+  r->buffer = NULL;
+}
@@ -0,0 +1,95 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "ipc.h"
+#include "protocol.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define JOURNAL_VERSION 2
+
+/**
+ * A journal is a header followed by the inputs of the server loop in the order they were applied
+ * Feeding the records back through the server state reproduces the run,
+ * provided the server starts from the same initial state
+ */
+enum journal_record_type{
+			 JOURNAL_RECORD_MSG,
+			 JOURNAL_RECORD_TICK,
+			 JOURNAL_RECORD_TOKEN
+};
+
+/**
+ * A single journal record
+ * MSG records carry an inbound message, TICK records a wake up without a message
+ * and TOKEN records a session token handed out while handling the preceding message
+ */
+struct journal_record{
+  enum journal_record_type type;
+  uint64_t seq;
+  struct timespec time;
+  int channel;
+  enum ipc_msg_type msg_type;
+  struct protocol_msg payload;
+  char token[PROTOCOL_SESSION_TOKEN_LEN + 1];
+};
+
+struct journal_writer{
+  FILE * file;
+  char * buffer;
+  uint64_t next_seq;
+};
+
+struct journal_reader{
+  FILE * file;
+  char * buffer;
+  struct timespec start;
+  uint64_t next_seq;
+};
+
+/**
+ * Creates a journal, start is the time the server state was initialized at
+ * Records are buffered and only reach the file when the buffer is full or the journal is flushed
+ */
+int open_journal_writer(struct journal_writer * w, const char * path, const struct timespec * start);
+
+int append_journal_msg(struct journal_writer * w, const struct ipc_msg * msg, const struct timespec * time);
+
+int append_journal_tick(struct journal_writer * w, const struct timespec * time);
+
+int append_journal_token(struct journal_writer * w, const char * token);
+
+int flush_journal_writer(struct journal_writer * w);
+
+int close_journal_writer(struct journal_writer * w);
+
+int open_journal_reader(struct journal_reader * r, const char * path);
+
+/**
+ * Reads the next record
+ * Returns 1 at the end of the journal, a record cut off by a crash also ends the journal
+ */
+int read_journal_record(struct journal_reader * r, struct journal_record * dest);
+
+void close_journal_reader(struct journal_reader * r);
+
+#endif
@@ -15,17 +15,19 @@
  *
  */
 
+#define LOG_MODULE LOG_MODULE_VORONOI
+
 #include "linear.h"
+#include "logger.h"
 #include "status.h"
 
 #include <assert.h>
-#include <stdio.h>
 
-void print_linear2(const struct linear2 * sys){
+void log_linear2(const struct linear2 * sys){
   assert(sys != NULL);
-  printf("%.4f x + %.4f y + %.4f = 0\n", sys->coefs[0], sys->coefs[1], sys->coefs[2]);
-  printf("%.4f x + %.4f y + %.4f = 0\n", sys->coefs[3], sys->coefs[4], sys->coefs[5]);
-  printf("x: %.4f, y: %4f\n", sys->vars[0], sys->vars[0]);
+  LOG_DEBUG("%.4f x + %.4f y + %.4f = 0", sys->coefs[0], sys->coefs[1], sys->coefs[2]);
+  LOG_DEBUG("%.4f x + %.4f y + %.4f = 0", sys->coefs[3], sys->coefs[4], sys->coefs[5]);
+  LOG_DEBUG("x: %.4f, y: %.4f", sys->vars[0], sys->vars[1]);
 }
 
 void set_linear2_col(struct linear2 * sys, size_t index, double x, double y){
@@ -26,7 +26,10 @@ struct linear2{
   double vars[2];
 };
 
-void print_linear2(const struct linear2 * sys);
+/**
+ * Logs the system at debug level
+ */
+void log_linear2(const struct linear2 * sys);
 
 void set_linear2_row(struct linear2 * sys, size_t index, double a, double b, double c);
 
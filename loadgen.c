@@ -0,0 +1,479 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#define LOG_MODULE LOG_MODULE_CLIENT
+
+#include "client.h"
+#include "client_state.h"
+#include "game.h"
+#include "ipc.h"
+#include "loadgen.h"
+#include "logger.h"
+#include "memory.h"
+#include "status.h"
+#include "thread_utils.h"
+#include "unicode.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Time a worker sleeps when none of its connections has work
+ * Round trip latencies include up to this much polling delay
+ */
+#define LOADGEN_POLL_NSEC 200000L
+
+#define LOADGEN_INITIAL_LATENCY_CAP 1024
+
+/**
+ * A connection goes through the same states as the client, except that it does not reconnect
+ * The transitions are mirrored here because client_state.c drives the single connection owned by client.c
+ */
+struct loadgen_connection{
+  size_t index;
+  int fd;
+  struct ipc_duplex duplex;
+  enum client_state state;
+  int player;
+  double next_ping;
+};
+
+struct loadgen_worker{
+  pthread_t thread;
+  struct ipc_alloc alloc;
+  struct loadgen_connection * connections;
+  size_t connection_count;
+  double ping_interval;
+  double * latencies;
+  size_t latency_count;
+  size_t latency_cap;
+  size_t sent_count;
+  size_t received_count;
+  size_t ready_count;
+  size_t rejected_count;
+  size_t failed_count;
+  int result;
+};
+
+static struct loadgen_worker workers[LOADGEN_THREAD_COUNT];
+static size_t worker_count;
+static size_t total_connection_count;
+
+static pthread_mutex_t loadgen_mutex;
+static bool running;
+
+/**
+ * Set while the workers exist, a load generator that failed to start is already stopped
+ */
+static bool started;
+
+static struct timespec started_at;
+
+static double get_loadgen_time(){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static bool is_loadgen_running(){
+  bool result = false;
+  if(lock_named_mutex(&loadgen_mutex, "loadgen") == 0){
+    result = running;
+    unlock_named_mutex(&loadgen_mutex, "loadgen");
+  }
+  return result;
+}
+
+static int send_loadgen_msg(struct loadgen_worker * w, struct loadgen_connection * c, struct ipc_msg * msg){
+  if(send_to_ipc_duplex(&c->duplex, msg)){
+    destroy_ipc_msg(msg);
+    return -1;
+  }
+  ++w->sent_count;
+  return 0;
+}
+
+static int send_loadgen_auth_req(struct loadgen_worker * w, struct loadgen_connection * c){
+  struct ipc_msg * msg = create_ipc_msg(&w->alloc);
+  if(msg == NULL){
+    return -1;
+  }
+  char name[GAME_MAX_PLAYER_NAME_LEN + 1];
+  char32_t unicode_name[GAME_MAX_PLAYER_NAME_LEN + 1];
+  snprintf(name, sizeof(name), "loadgen%zu", c->index);
+  str_to_unicode_str_checked(unicode_name, GAME_MAX_PLAYER_NAME_LEN, name);
+  init_protocol_auth_req(&msg->payload, (unsigned int)c->index, unicode_name);
+  return send_loadgen_msg(w, c, msg);
+}
+
+static int send_loadgen_ping(struct loadgen_worker * w, struct loadgen_connection * c, double now){
+  struct ipc_msg * msg = create_ipc_msg(&w->alloc);
+  if(msg == NULL){
+    return -1;
+  }
+  init_protocol_ping_req(&msg->payload, now);
+  return send_loadgen_msg(w, c, msg);
+}
+
+static int add_loadgen_latency(struct loadgen_worker * w, double latency){
+  if(w->latency_count == w->latency_cap){
+    size_t cap = w->latency_cap == 0 ? LOADGEN_INITIAL_LATENCY_CAP : w->latency_cap * 2;
+    double * latencies = realloc_checked(w->latencies, cap * sizeof(double));
+    if(latencies == NULL){
+      return -1;
+    }
+    w->latencies = latencies;
+    w->latency_cap = cap;
+  }
+  w->latencies[w->latency_count++] = latency;
+  return 0;
+}
+
+static int handle_loadgen_msg(struct loadgen_worker * w, struct loadgen_connection * c, const struct ipc_msg * msg, double now){
+  if(msg->type == IPC_MSG_TYPE_DISCONNECTED){
+    LOG_WARNING("loadgen: connection %zu lost", c->index);
+    c->state = CLIENT_STATE_ERROR;
+    ++w->failed_count;
+    return 0;
+  }
+  ++w->received_count;
+  switch(msg->payload.type){
+  case PROTOCOL_MSG_TYPE_PING_RES:
+    return add_loadgen_latency(w, now - msg->payload.ping_res.time);
+  case PROTOCOL_MSG_TYPE_AUTH_RES:
+    if(c->state != CLIENT_STATE_AUTHORIZING || msg->payload.auth_res.correlation_id != c->index){
+      LOG_WARNING("loadgen: connection %zu received an unexpected authentication response", c->index);
+      break;
+    }
+    if(msg->payload.auth_res.id == -1){
+      LOG_DEBUG("loadgen: connection %zu rejected: %s", c->index, msg->payload.auth_res.reason);
+      c->state = CLIENT_STATE_REJECTED;
+      ++w->rejected_count;
+    }else{
+      c->player = msg->payload.auth_res.id;
+      c->state = CLIENT_STATE_INITIALIZING;
+    }
+    break;
+  case PROTOCOL_MSG_TYPE_ENTITY_ENTER:
+  case PROTOCOL_MSG_TYPE_ENTITY_UPDATE:
+  case PROTOCOL_MSG_TYPE_ENTITY_LEAVE:
+    if(c->state == CLIENT_STATE_INITIALIZING){
+      c->state = CLIENT_STATE_READY;
+      ++w->ready_count;
+    }
+    break;
+  default:
+    break;
+  }
+  return 0;
+}
+
+/**
+ * Handles the received messages and sends what is due, returns 1 if the connection had work
+ */
+static int update_loadgen_connection(struct loadgen_worker * w, struct loadgen_connection * c){
+  if(c->state == CLIENT_STATE_ERROR){
+    return 0;
+  }
+  if(c->state == CLIENT_STATE_STARTED){
+    if(send_loadgen_auth_req(w, c)){
+      return -1;
+    }
+    c->state = CLIENT_STATE_AUTHORIZING;
+  }
+  
+  struct ipc_queue received;
+  init_ipc_queue(&received, &w->alloc);
+  if(try_receive_all_from_ipc_duplex(&received, &c->duplex)){
+    clear_ipc_queue(&received);
+    return -1;
+  }
+  double now = get_loadgen_time();
+  int result = 0;
+  struct ipc_msg * msg;
+  while((msg = pop_from_ipc_queue(&received)) != NULL){
+    result = 1;
+    if(handle_loadgen_msg(w, c, msg, now)){
+      result = -1;
+    }
+    destroy_ipc_msg(msg);
+  }
+  if(result == -1 || c->state == CLIENT_STATE_ERROR){
+    return result;
+  }
+  
+  // pings are sent in every state, the server answers them without a session
+  if(w->ping_interval > 0.0 && now >= c->next_ping){
+    if(send_loadgen_ping(w, c, now)){
+      return -1;
+    }
+    c->next_ping += w->ping_interval;
+    if(c->next_ping < now){
+      // the worker fell behind, the missed pings are not sent
+      c->next_ping = now + w->ping_interval;
+    }
+    result = 1;
+  }
+  return result;
+}
+
+static void open_loadgen_connection(struct loadgen_worker * w, struct loadgen_connection * c){
+  c->fd = connect_to_server();
+  if(c->fd == -1 || open_ipc_duplex(&c->duplex, c->fd)){
+    LOG_ERROR("loadgen: could not open connection %zu", c->index);
+    if(c->fd != -1){
+      close(c->fd);
+      c->fd = -1;
+    }
+    c->state = CLIENT_STATE_ERROR;
+    ++w->failed_count;
+    return;
+  }
+  // spread the pings of the connections over the interval
+  c->next_ping = get_loadgen_time() + w->ping_interval * c->index / total_connection_count;
+}
+
+static int close_loadgen_connection(struct loadgen_connection * c){
+  int result = close_ipc_duplex(&c->duplex);
+  if(c->fd != -1){
+    if(shutdown(c->fd, SHUT_RDWR) && errno != ENOTCONN){
+      LOG_ERROR("loadgen: could not shut down socket: %s", strerror(errno));
+      result = -1;
+    }
+    if(close(c->fd)){
+      LOG_ERROR("loadgen: could not close socket: %s", strerror(errno));
+      result = -1;
+    }
+    c->fd = -1;
+  }
+  return result;
+}
+
+static void * run_loadgen_worker(void * arg){
+  struct loadgen_worker * w = arg;
+
+  init_thread();
+
+  for(size_t i = 0; i < w->connection_count; ++i){
+    open_loadgen_connection(w, &w->connections[i]);
+  }
+
+  const struct timespec poll_interval = {0, LOADGEN_POLL_NSEC};
+  while(w->result == 0 && is_loadgen_running()){
+    bool idle = true;
+    for(size_t i = 0; i < w->connection_count; ++i){
+      int result = update_loadgen_connection(w, &w->connections[i]);
+      if(result == -1){
+	LOG_ERROR("loadgen: worker will exit due to an error");
+	w->result = -1;
+	break;
+      }else if(result == 1){
+	idle = false;
+      }
+    }
+    if(idle){
+      nanosleep(&poll_interval, NULL);
+    }
+  }
+
+  for(size_t i = 0; i < w->connection_count; ++i){
+    if(w->connections[i].fd != -1 && close_loadgen_connection(&w->connections[i])){
+      w->result = -1;
+    }
+  }
+  return NULL;
+}
+
+static void dispose_loadgen_worker(struct loadgen_worker * w){
+  for(size_t i = 0; i < w->connection_count; ++i){
+    dispose_ipc_duplex(&w->connections[i].duplex);
+  }
+  free(w->connections);
+  free(w->latencies);
+  dispose_ipc_alloc(&w->alloc);
+}
+
+static int init_loadgen_worker(struct loadgen_worker * w, size_t first, size_t connection_count, double ping_rate){
+  memset(w, 0, sizeof(struct loadgen_worker));
+  w->ping_interval = ping_rate > 0.0 ? 1.0 / ping_rate : 0.0;
+  if(init_ipc_alloc(&w->alloc)){
+    return -1;
+  }
+  w->connections = malloc_checked(connection_count * sizeof(struct loadgen_connection));
+  if(w->connections == NULL){
+    dispose_ipc_alloc(&w->alloc);
+    return -1;
+  }
+  for(size_t i = 0; i < connection_count; ++i){
+    struct loadgen_connection * c = &w->connections[i];
+    if(init_ipc_duplex(&c->duplex, &w->alloc)){
+      dispose_loadgen_worker(w);
+      return -1;
+    }
+    ++w->connection_count;
+    c->index = first + i;
+    c->fd = -1;
+    c->state = CLIENT_STATE_STARTED;
+    c->player = -1;
+  }
+  return 0;
+}
+
+int start_loadgen(size_t connection_count, double ping_rate){
+  assert(connection_count > 0);
+  assert(ping_rate >= 0.0);
+
+  LOG_INFO("starting load generator with %zu connections...", connection_count);
+  if(connection_count > GAME_MAX_PLAYER_COUNT){
+    LOG_WARNING("loadgen: the server admits %d players, the other connections will be rejected", GAME_MAX_PLAYER_COUNT);
+  }
+  
+  if(init_named_mutex(&loadgen_mutex, "loadgen")){
+    return -1;
+  }
+  running = true;
+  started = true;
+  total_connection_count = connection_count;
+  clock_gettime(CLOCK_MONOTONIC, &started_at);
+
+  worker_count = connection_count < LOADGEN_THREAD_COUNT ? connection_count : LOADGEN_THREAD_COUNT;
+  size_t first = 0;
+  for(size_t i = 0; i < worker_count; ++i){
+    size_t count = connection_count / worker_count + (i < connection_count % worker_count ? 1 : 0);
+    struct loadgen_worker * w = &workers[i];
+    int result = init_loadgen_worker(w, first, count, ping_rate);
+    if(result == 0 && pthread_create(&w->thread, NULL, run_loadgen_worker, w)){
+      LOG_ERROR("could not start load generator thread");
+      set_status(STATUS_CREATE_THREAD_FAILED);
+      dispose_loadgen_worker(w);
+      result = -1;
+    }
+    if(result){
+      worker_count = i;
+      stop_loadgen();
+      return -1;
+    }
+    first += count;
+  }
+
+  LOG_INFO("load generator started");
+  return 0;
+}
+
+static int compare_latencies(const void * first, const void * second){
+  double a = *(const double *)first;
+  double b = *(const double *)second;
+  return (a > b) - (a < b);
+}
+
+static double get_percentile(const double * sorted, size_t count, double percentile){
+  size_t index = (size_t)(percentile / 100.0 * (count - 1) + 0.5);
+  return sorted[index];
+}
+
+static void print_loadgen_report(double elapsed){
+  size_t connection_count = 0;
+  size_t latency_count = 0;
+  size_t sent_count = 0;
+  size_t received_count = 0;
+  size_t ready_count = 0;
+  size_t rejected_count = 0;
+  size_t failed_count = 0;
+  for(size_t i = 0; i < worker_count; ++i){
+    connection_count += workers[i].connection_count;
+    latency_count += workers[i].latency_count;
+    sent_count += workers[i].sent_count;
+    received_count += workers[i].received_count;
+    ready_count += workers[i].ready_count;
+    rejected_count += workers[i].rejected_count;
+    failed_count += workers[i].failed_count;
+  }
+
+  printf("loadgen: %zu connections: %zu ready, %zu rejected, %zu failed\n", connection_count, ready_count, rejected_count, failed_count);
+  printf("loadgen: %.3f s: sent %zu messages (%.0f/s), received %zu messages (%.0f/s)\n",
+	 elapsed, sent_count, sent_count / elapsed, received_count, received_count / elapsed);
+
+  double * latencies = latency_count == 0 ? NULL : malloc_checked(latency_count * sizeof(double));
+  if(latencies == NULL){
+    printf("loadgen: no round trips measured\n");
+    return;
+  }
+  size_t pos = 0;
+  for(size_t i = 0; i < worker_count; ++i){
+    memcpy(latencies + pos, workers[i].latencies, workers[i].latency_count * sizeof(double));
+    pos += workers[i].latency_count;
+  }
+  qsort(latencies, latency_count, sizeof(double), compare_latencies);
+  printf("loadgen: round trip over %zu pings: p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+	 latency_count,
+	 get_percentile(latencies, latency_count, 50.0) * 1e3,
+	 get_percentile(latencies, latency_count, 90.0) * 1e3,
+	 get_percentile(latencies, latency_count, 99.0) * 1e3,
+	 latencies[latency_count - 1] * 1e3);
+  free(latencies);
+}
+
+int stop_loadgen(){
+  if(!started){
+    return 0;
+  }
+  
+  LOG_INFO("stopping load generator...");
+
+  int result = 0;
+  if(lock_named_mutex(&loadgen_mutex, "loadgen")){
+    result = -1;
+  }
+  running = false;
+  if(unlock_named_mutex(&loadgen_mutex, "loadgen")){
+    result = -1;
+  }
+
+  for(size_t i = 0; i < worker_count; ++i){
+    if(pthread_join(workers[i].thread, NULL)){
+      LOG_ERROR("could not join load generator thread");
+      set_status(STATUS_JOIN_THREAD_FAILED);
+      result = -1;
+    }
+    if(workers[i].result){
+      result = -1;
+    }
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  print_loadgen_report((now.tv_sec - started_at.tv_sec) + (now.tv_nsec - started_at.tv_nsec) / 1e9);
+
+  for(size_t i = 0; i < worker_count; ++i){
+    dispose_loadgen_worker(&workers[i]);
+  }
+  worker_count = 0;
+  started = false;
+  if(dispose_named_mutex(&loadgen_mutex, "loadgen")){
+    result = -1;
+  }
+  
+  LOG_INFO("load generator stopped");
+  return result;
+}
@@ -0,0 +1,39 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#include <stddef.h>
+
+/**
+ * Number of threads driving the load generator connections
+ */
+#define LOADGEN_THREAD_COUNT 4
+
+/**
+ * Opens connection_count connections to the server, each authenticating a player
+ * and sending ping_rate pings per second until the load generator is stopped
+ */
+int start_loadgen(size_t connection_count, double ping_rate);
+
+/**
+ * Closes all connections and prints the message rates and round trip latencies
+ */
+int stop_loadgen();
+
+#endif
@@ -0,0 +1,174 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * Decodes a binary log written with --binary_log into the regular text format or JSON lines
+ */
+
+#include "log_format.h"
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LOG_MSG_LEN 4096
+
+/**
+ * The formats defined so far, indexed by their id
+ */
+struct format_table{
+  char ** formats;
+  size_t count;
+};
+
+static void print_usage(const char * name){
+  fprintf(stderr,
+	  "usage: %s [options] FILE\n"
+	  "  -j, --json   print one JSON object per message\n",
+	  name);
+}
+
+static int read_header(FILE * file){
+  struct log_file_header header;
+  if(fread(&header, sizeof(header), 1, file) != 1){
+    fputs("log_decode: missing header\n", stderr);
+    return -1;
+  }
+  if(memcmp(header.magic, LOG_FILE_MAGIC, sizeof(header.magic)) != 0 || header.version != LOG_FILE_VERSION){
+    fputs("log_decode: not a binary log or unsupported version\n", stderr);
+    return -1;
+  }
+  if(header.byte_order != LOG_FILE_BYTE_ORDER || header.args_size > LOG_RECORD_ARGS_SIZE){
+    fputs("log_decode: log was written on an incompatible platform\n", stderr);
+    return -1;
+  }
+  return 0;
+}
+
+static int define_format(struct format_table * table, FILE * file, const struct log_file_entry * entry){
+  if(entry->format_id != table->count){
+    fputs("log_decode: formats out of order\n", stderr);
+    return -1;
+  }
+  char * format = malloc(entry->size + 1);
+  char ** formats = realloc(table->formats, sizeof(char *) * (table->count + 1));
+  if(format == NULL || formats == NULL){
+    free(format);
+    if(formats != NULL){
+      table->formats = formats;
+    }
+    fputs("log_decode: out of memory\n", stderr);
+    return -1;
+  }
+  table->formats = formats;
+  if(entry->size > 0 && fread(format, entry->size, 1, file) != 1){
+    free(format);
+    return 1;
+  }
+  format[entry->size] = '\0';
+  table->formats[table->count++] = format;
+  return 0;
+}
+
+static int print_record(const struct format_table * table, FILE * file, const struct log_file_entry * entry, bool json){
+  unsigned char args[LOG_RECORD_ARGS_SIZE];
+  if(entry->format_id >= table->count || entry->size > LOG_RECORD_ARGS_SIZE || entry->priority > LOG_PRIORITY_ERROR || entry->module >= LOG_MODULE_COUNT){
+    fputs("log_decode: invalid record\n", stderr);
+    return -1;
+  }
+  if(entry->size > 0 && fread(args, entry->size, 1, file) != 1){
+    return 1;
+  }
+  char text[MAX_LOG_MSG_LEN];
+  format_log_args(text, MAX_LOG_MSG_LEN, table->formats[entry->format_id], args, entry->size, entry->truncated);
+  if(json){
+    char line[MAX_LOG_JSON_LEN];
+    size_t len = format_log_json(line, entry->time, entry->thread_id, entry->module, entry->priority, text);
+    fwrite(line, len, 1, stdout);
+  }else{
+    printf("%s: %s\n", get_log_priority_label(entry->priority), text);
+  }
+  return 0;
+}
+
+/**
+ * Prints all records, returns 1 if the log was cut off
+ */
+static int decode_log(FILE * file, bool json){
+  struct format_table table = {NULL, 0};
+  int result = 0;
+  while(result == 0){
+    struct log_file_entry entry;
+    size_t read = fread(&entry, 1, sizeof(entry), file);
+    if(read == 0){
+      break;
+    }else if(read != sizeof(entry)){
+      result = 1;
+    }else if(entry.type == LOG_FILE_ENTRY_FORMAT){
+      result = define_format(&table, file, &entry);
+    }else if(entry.type == LOG_FILE_ENTRY_RECORD){
+      result = print_record(&table, file, &entry, json);
+    }else{
+      fputs("log_decode: invalid entry type\n", stderr);
+      result = -1;
+    }
+  }
+  for(size_t i = 0; i < table.count; ++i){
+    free(table.formats[i]);
+  }
+  free(table.formats);
+  if(result == 1){
+    // the last records are lost when the program did not stop the logger
+    fputs("log_decode: log is truncated\n", stderr);
+  }
+  return result;
+}
+
+int main(int argc, char * const args[]){
+  struct option options[] = {
+			     {"json", no_argument, NULL, 'j'},
+			     {NULL, 0, NULL, 0}
+  };
+  bool json = false;
+  int c;
+  while((c = getopt_long(argc, args, "j", options, NULL)) != -1){
+    if(c == 'j'){
+      json = true;
+    }else{
+      print_usage(args[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if(optind != argc - 1){
+    print_usage(args[0]);
+    return EXIT_FAILURE;
+  }
+  const char * path = args[optind];
+  FILE * file = fopen(path, "rb");
+  if(file == NULL){
+    fprintf(stderr, "log_decode: could not open %s\n", path);
+    return EXIT_FAILURE;
+  }
+  int result = read_header(file);
+  if(result == 0){
+    result = decode_log(file, json);
+  }
+  fclose(file);
+  return result < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,576 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * Like the logger, this compilation unit has no dependencies
+ * so that it can be shared with the log decoder
+ */
+
+#include "log_format.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TRUNCATION_MARK "..."
+
+enum log_length{
+		LOG_LENGTH_NONE,
+		LOG_LENGTH_HH,
+		LOG_LENGTH_H,
+		LOG_LENGTH_L,
+		LOG_LENGTH_LL,
+		LOG_LENGTH_J,
+		LOG_LENGTH_Z,
+		LOG_LENGTH_T,
+		LOG_LENGTH_LONG_DOUBLE
+};
+
+/**
+ * A single conversion specification of a format
+ */
+struct log_conversion{
+  /**
+   * The flags, width and precision including the leading '%'
+   */
+  const char * prefix;
+  size_t prefix_len;
+  
+  /**
+   * Number of '*' in width and precision
+   */
+  int stars;
+  
+  /**
+   * Literal precision, -1 if there is none or it is given by an argument
+   */
+  int precision;
+  enum log_length length;
+  char conversion;
+};
+
+static const char * log_priority_labels[] = {"DEBUG  ", "INFO   ", "WARNING", "ERROR  "};
+
+static const char * log_priority_names[] = {"debug", "info", "warning", "error"};
+
+static const char * log_module_names[] = {"general", "ipc", "protocol", "resource", "server", "client", "voronoi"};
+
+const char * get_log_priority_label(enum log_priority priority){
+  assert(priority >= LOG_PRIORITY_DEBUG && priority <= LOG_PRIORITY_ERROR);
+  return log_priority_labels[(int)priority];
+}
+
+const char * get_log_module_name(enum log_module module){
+  assert(module >= 0 && module < LOG_MODULE_COUNT);
+  return log_module_names[module];
+}
+
+int find_log_module(const char * name){
+  assert(name != NULL);
+  for(int i = 0; i < LOG_MODULE_COUNT; ++i){
+    if(strcmp(log_module_names[i], name) == 0){
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Parses the conversion starting at the '%', returns a pointer past its end
+ */
+static const char * parse_log_conversion(const char * format, struct log_conversion * c){
+  assert(*format == '%');
+  
+  const char * p = format + 1;
+  c->prefix = format;
+  c->stars = 0;
+  c->precision = -1;
+  while(*p != '\0' && strchr("-+ #0'", *p) != NULL){
+    ++p;
+  }
+  if(*p == '*'){
+    ++c->stars;
+    ++p;
+  }else{
+    while(*p >= '0' && *p <= '9'){
+      ++p;
+    }
+  }
+  if(*p == '.'){
+    ++p;
+    if(*p == '*'){
+      ++c->stars;
+      ++p;
+    }else{
+      c->precision = 0;
+      while(*p >= '0' && *p <= '9'){
+	c->precision = c->precision * 10 + (*p - '0');
+	++p;
+      }
+    }
+  }
+  c->prefix_len = p - format;
+  c->length = LOG_LENGTH_NONE;
+  if(p[0] == 'h' && p[1] == 'h'){
+    c->length = LOG_LENGTH_HH;
+    p += 2;
+  }else if(p[0] == 'l' && p[1] == 'l'){
+    c->length = LOG_LENGTH_LL;
+    p += 2;
+  }else if(*p == 'h'){
+    c->length = LOG_LENGTH_H;
+    ++p;
+  }else if(*p == 'l'){
+    c->length = LOG_LENGTH_L;
+    ++p;
+  }else if(*p == 'j'){
+    c->length = LOG_LENGTH_J;
+    ++p;
+  }else if(*p == 'z'){
+    c->length = LOG_LENGTH_Z;
+    ++p;
+  }else if(*p == 't'){
+    c->length = LOG_LENGTH_T;
+    ++p;
+  }else if(*p == 'L'){
+    c->length = LOG_LENGTH_LONG_DOUBLE;
+    ++p;
+  }
+  c->conversion = *p;
+  return *p == '\0' ? p : p + 1;
+}
+
+static bool put_log_arg(struct log_record * record, const void * data, size_t size){
+  if(record->size + size > LOG_RECORD_ARGS_SIZE){
+    record->truncated = true;
+    return false;
+  }
+  memcpy(record->args + record->size, data, size);
+  record->size += size;
+  return true;
+}
+
+static bool put_log_string(struct log_record * record, const char * str, int precision){
+  if(str == NULL){
+    str = "(null)";
+  }
+  size_t len = precision < 0 ? strlen(str) : strnlen(str, precision);
+  size_t available = LOG_RECORD_ARGS_SIZE - record->size;
+  if(available < sizeof(uint16_t) + len){
+    // keep as much of the string as possible, the arguments after it are lost
+    if(available <= sizeof(uint16_t)){
+      record->truncated = true;
+      return false;
+    }
+    len = available - sizeof(uint16_t);
+    record->truncated = true;
+  }
+  uint16_t stored_len = len;
+  put_log_arg(record, &stored_len, sizeof(uint16_t));
+  put_log_arg(record, str, len);
+  return !record->truncated;
+}
+
+static int64_t get_signed_log_arg(enum log_length length, va_list * args){
+  switch(length){
+  case LOG_LENGTH_L:
+    return va_arg(*args, long);
+  case LOG_LENGTH_LL:
+    return va_arg(*args, long long);
+  case LOG_LENGTH_J:
+    return va_arg(*args, intmax_t);
+  case LOG_LENGTH_Z:
+    return (int64_t)va_arg(*args, size_t);
+  case LOG_LENGTH_T:
+    return va_arg(*args, ptrdiff_t);
+  default:
+    return va_arg(*args, int);
+  }
+}
+
+static uint64_t get_unsigned_log_arg(enum log_length length, va_list * args){
+  switch(length){
+  case LOG_LENGTH_L:
+    return va_arg(*args, unsigned long);
+  case LOG_LENGTH_LL:
+    return va_arg(*args, unsigned long long);
+  case LOG_LENGTH_J:
+    return va_arg(*args, uintmax_t);
+  case LOG_LENGTH_Z:
+    return va_arg(*args, size_t);
+  case LOG_LENGTH_T:
+    return (uint64_t)va_arg(*args, ptrdiff_t);
+  default:
+    return va_arg(*args, unsigned int);
+  }
+}
+
+/**
+ * Copies the arguments of a single conversion, returns false if the remaining arguments can not be encoded
+ */
+static bool encode_log_conversion(struct log_record * record, const struct log_conversion * c, va_list * args){
+  int star_precision = -1;
+  for(int i = 0; i < c->stars; ++i){
+    int32_t value = va_arg(*args, int);
+    // only the last star can be a precision
+    star_precision = value;
+    if(!put_log_arg(record, &value, sizeof(int32_t))){
+      return false;
+    }
+  }
+  bool has_star_precision = c->stars > 0 && memchr(c->prefix, '.', c->prefix_len) != NULL;
+  
+  switch(c->conversion){
+  case '%':
+    return true;
+  case 'd':
+  case 'i':{
+    int64_t value = get_signed_log_arg(c->length, args);
+    return put_log_arg(record, &value, sizeof(int64_t));
+  }
+  case 'u':
+  case 'o':
+  case 'x':
+  case 'X':{
+    uint64_t value = get_unsigned_log_arg(c->length, args);
+    return put_log_arg(record, &value, sizeof(uint64_t));
+  }
+  case 'c':
+    if(c->length == LOG_LENGTH_L){
+      // wide characters are not supported
+      va_arg(*args, unsigned int);
+      return true;
+    }else{
+      int64_t value = va_arg(*args, int);
+      return put_log_arg(record, &value, sizeof(int64_t));
+    }
+  case 'f':
+  case 'F':
+  case 'e':
+  case 'E':
+  case 'g':
+  case 'G':
+  case 'a':
+  case 'A':{
+    double value = c->length == LOG_LENGTH_LONG_DOUBLE ? (double)va_arg(*args, long double) : va_arg(*args, double);
+    return put_log_arg(record, &value, sizeof(double));
+  }
+  case 's':
+    if(c->length == LOG_LENGTH_L){
+      // wide strings are not supported
+      va_arg(*args, void *);
+      return true;
+    }
+    return put_log_string(record, va_arg(*args, const char *), has_star_precision ? star_precision : c->precision);
+  case 'p':{
+    uint64_t value = (uintptr_t)va_arg(*args, void *);
+    return put_log_arg(record, &value, sizeof(uint64_t));
+  }
+  case 'n':
+    va_arg(*args, void *);
+    return true;
+  default:
+    // the type of the argument is unknown, so nothing after it can be read
+    record->truncated = true;
+    return false;
+  }
+}
+
+void encode_log_record(struct log_record * record, enum log_module module, enum log_priority priority, const char * format, va_list args){
+  assert(record != NULL);
+  assert(format != NULL);
+
+  record->format = format;
+  record->module = module;
+  record->priority = priority;
+  record->size = 0;
+  record->truncated = false;
+
+  va_list copy;
+  va_copy(copy, args);
+  const char * p = format;
+  while((p = strchr(p, '%')) != NULL){
+    struct log_conversion c;
+    p = parse_log_conversion(p, &c);
+    if(!encode_log_conversion(record, &c, &copy)){
+      break;
+    }
+  }
+  va_end(copy);
+}
+
+/**
+ * Output buffer of the formatter
+ */
+struct log_text{
+  char * dest;
+  size_t size;
+  size_t len;
+};
+
+static void append_log_text(struct log_text * text, const char * src, size_t len){
+  size_t available = text->size - 1 - text->len;
+  if(len > available){
+    len = available;
+  }
+  memcpy(text->dest + text->len, src, len);
+  text->len += len;
+  text->dest[text->len] = '\0';
+}
+
+/**
+ * Adds the result of snprintf to the text
+ */
+static void commit_log_text(struct log_text * text, int len){
+  if(len > 0){
+    size_t available = text->size - 1 - text->len;
+    text->len += (size_t)len > available ? available : (size_t)len;
+  }
+  text->dest[text->len] = '\0';
+}
+
+/**
+ * Formats a single value, passing the width and precision arguments if the conversion has any
+ */
+#define FORMAT_LOG_VALUE(text, spec, stars, star_values, value)		\
+  do{									\
+    char * dest = (text)->dest + (text)->len;				\
+    size_t size = (text)->size - (text)->len;				\
+    int result;								\
+    if((stars) == 0){							\
+      result = snprintf(dest, size, spec, value);			\
+    }else if((stars) == 1){						\
+      result = snprintf(dest, size, spec, (star_values)[0], value);	\
+    }else{								\
+      result = snprintf(dest, size, spec, (star_values)[0], (star_values)[1], value); \
+    }									\
+    commit_log_text(text, result);					\
+  }while(false)
+
+static bool get_log_arg(const unsigned char ** args, const unsigned char * end, void * dest, size_t size){
+  if((size_t)(end - *args) < size){
+    return false;
+  }
+  memcpy(dest, *args, size);
+  *args += size;
+  return true;
+}
+
+/**
+ * Builds the conversion specification passed to snprintf, integers are always passed as long long
+ */
+static void build_log_spec(char * spec, const struct log_conversion * c, bool wide_integer){
+  memcpy(spec, c->prefix, c->prefix_len);
+  size_t len = c->prefix_len;
+  if(wide_integer){
+    spec[len++] = 'l';
+    spec[len++] = 'l';
+  }
+  spec[len++] = c->conversion;
+  spec[len] = '\0';
+}
+
+static long long narrow_signed_log_arg(enum log_length length, int64_t value){
+  switch(length){
+  case LOG_LENGTH_HH:
+    return (signed char)value;
+  case LOG_LENGTH_H:
+    return (short)value;
+  case LOG_LENGTH_NONE:
+    return (int)value;
+  default:
+    return value;
+  }
+}
+
+static unsigned long long narrow_unsigned_log_arg(enum log_length length, uint64_t value){
+  switch(length){
+  case LOG_LENGTH_HH:
+    return (unsigned char)value;
+  case LOG_LENGTH_H:
+    return (unsigned short)value;
+  case LOG_LENGTH_NONE:
+    return (unsigned int)value;
+  default:
+    return value;
+  }
+}
+
+/**
+ * Formats a single conversion, returns false if its arguments are missing
+ */
+static bool format_log_conversion(struct log_text * text, const struct log_conversion * c, const unsigned char ** args, const unsigned char * end){
+  char spec[64];
+  if(c->prefix_len + 4 > sizeof(spec)){
+    // nothing sensible can be this long, the arguments can no longer be matched
+    return false;
+  }
+  int32_t star_values[2] = {0, 0};
+  for(int i = 0; i < c->stars; ++i){
+    if(!get_log_arg(args, end, &star_values[i], sizeof(int32_t))){
+      return false;
+    }
+  }
+
+  switch(c->conversion){
+  case '%':
+    append_log_text(text, "%", 1);
+    return true;
+  case 'd':
+  case 'i':{
+    int64_t value;
+    if(!get_log_arg(args, end, &value, sizeof(int64_t))){
+      return false;
+    }
+    build_log_spec(spec, c, true);
+    FORMAT_LOG_VALUE(text, spec, c->stars, star_values, narrow_signed_log_arg(c->length, value));
+    return true;
+  }
+  case 'u':
+  case 'o':
+  case 'x':
+  case 'X':{
+    uint64_t value;
+    if(!get_log_arg(args, end, &value, sizeof(uint64_t))){
+      return false;
+    }
+    build_log_spec(spec, c, true);
+    FORMAT_LOG_VALUE(text, spec, c->stars, star_values, narrow_unsigned_log_arg(c->length, value));
+    return true;
+  }
+  case 'c':{
+    int64_t value;
+    if(c->length == LOG_LENGTH_L){
+      append_log_text(text, "?", 1);
+      return true;
+    }else if(!get_log_arg(args, end, &value, sizeof(int64_t))){
+      return false;
+    }
+    build_log_spec(spec, c, false);
+    FORMAT_LOG_VALUE(text, spec, c->stars, star_values, (int)value);
+    return true;
+  }
+  case 'f':
+  case 'F':
+  case 'e':
+  case 'E':
+  case 'g':
+  case 'G':
+  case 'a':
+  case 'A':{
+    double value;
+    if(!get_log_arg(args, end, &value, sizeof(double))){
+      return false;
+    }
+    build_log_spec(spec, c, false);
+    FORMAT_LOG_VALUE(text, spec, c->stars, star_values, value);
+    return true;
+  }
+  case 's':{
+    if(c->length == LOG_LENGTH_L){
+      append_log_text(text, "?", 1);
+      return true;
+    }
+    uint16_t len;
+    char value[LOG_RECORD_ARGS_SIZE + 1];
+    if(!get_log_arg(args, end, &len, sizeof(uint16_t)) || len > LOG_RECORD_ARGS_SIZE || !get_log_arg(args, end, value, len)){
+      return false;
+    }
+    value[len] = '\0';
+    build_log_spec(spec, c, false);
+    FORMAT_LOG_VALUE(text, spec, c->stars, star_values, value);
+    return true;
+  }
+  case 'p':{
+    uint64_t value;
+    if(!get_log_arg(args, end, &value, sizeof(uint64_t))){
+      return false;
+    }
+    build_log_spec(spec, c, false);
+    FORMAT_LOG_VALUE(text, spec, c->stars, star_values, (void *)(uintptr_t)value);
+    return true;
+  }
+  case 'n':
+    return true;
+  default:
+    return false;
+  }
+}
+
+size_t format_log_args(char * dest, size_t dest_size, const char * format, const unsigned char * args, size_t size, bool truncated){
+  assert(dest != NULL);
+  assert(dest_size > 0);
+  assert(format != NULL);
+  assert(args != NULL || size == 0);
+
+  struct log_text text = {dest, dest_size, 0};
+  const unsigned char * end = args + size;
+  dest[0] = '\0';
+  const char * p = format;
+  while(true){
+    const char * next = strchr(p, '%');
+    if(next == NULL){
+      append_log_text(&text, p, strlen(p));
+      break;
+    }
+    append_log_text(&text, p, next - p);
+    struct log_conversion c;
+    p = parse_log_conversion(next, &c);
+    if(!format_log_conversion(&text, &c, &args, end)){
+      truncated = true;
+      break;
+    }
+  }
+  if(truncated){
+    append_log_text(&text, TRUNCATION_MARK, strlen(TRUNCATION_MARK));
+  }
+  return text.len;
+}
+
+size_t format_log_json(char * dest, uint64_t time, uint32_t thread_id, enum log_module module, enum log_priority priority, const char * text){
+  assert(dest != NULL);
+  assert(module >= 0 && module < LOG_MODULE_COUNT);
+  assert(priority >= LOG_PRIORITY_DEBUG && priority <= LOG_PRIORITY_ERROR);
+  assert(text != NULL);
+
+  int len = snprintf(dest, MAX_LOG_JSON_LEN, "{\"time\":%llu.%09llu,\"thread\":%u,\"module\":\"%s\",\"level\":\"%s\",\"msg\":\"",
+		     (unsigned long long)(time / 1000000000u), (unsigned long long)(time % 1000000000u),
+		     thread_id, log_module_names[module], log_priority_names[priority]);
+  assert(len > 0 && len < MAX_LOG_JSON_LEN);
+  
+  // leave room for the closing quote and brace, the newline and the terminator
+  size_t end = MAX_LOG_JSON_LEN - 4;
+  size_t pos = len;
+  for(const unsigned char * c = (const unsigned char *)text; *c != '\0' && pos + 6 <= end; ++c){
+    if(*c == '"' || *c == '\\'){
+      dest[pos++] = '\\';
+      dest[pos++] = *c;
+    }else if(*c == '\n'){
+      dest[pos++] = '\\';
+      dest[pos++] = 'n';
+    }else if(*c == '\t'){
+      dest[pos++] = '\\';
+      dest[pos++] = 't';
+    }else if(*c < 0x20){
+      pos += snprintf(dest + pos, 7, "\\u%04x", *c);
+    }else{
+      dest[pos++] = *c;
+    }
+  }
+  memcpy(dest + pos, "\"}\n", 4);
+  return pos + 3;
+}
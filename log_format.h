@@ -0,0 +1,122 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include "logger.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Number of bytes available for the arguments of a single record
+ */
+#define LOG_RECORD_ARGS_SIZE 112
+
+#define LOG_FILE_MAGIC "GAMELOG"
+
+#define LOG_FILE_VERSION 2
+
+#define LOG_FILE_BYTE_ORDER 0x01020304u
+
+/**
+ * Max length of a JSON line of a single message, every character of the text can take six
+ */
+#define MAX_LOG_JSON_LEN 2048
+
+/**
+ * A log message whose formatting is deferred
+ * The format must have static storage duration, the arguments are copied:
+ * integers and pointers as 64 bit values, floating point numbers as doubles
+ * and strings as a 16 bit length followed by the characters
+ */
+struct log_record{
+  const char * format;
+
+  /**
+   * CLOCK_MONOTONIC time in nanoseconds at which the message was logged
+   */
+  uint64_t time;
+
+  /**
+   * Kernel id of the thread that logged the message
+   */
+  uint32_t thread_id;
+  uint16_t size;
+  uint8_t priority;
+  uint8_t module;
+  bool truncated;
+  unsigned char args[LOG_RECORD_ARGS_SIZE];
+};
+
+/**
+ * A binary log file is a header followed by entries
+ * A FORMAT entry defines the format with the given id and is followed by its characters,
+ * a RECORD entry is followed by the arguments of a message using a previously defined format
+ */
+struct log_file_header{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t args_size;
+  uint32_t reserved;
+};
+
+enum log_file_entry_type{
+			 LOG_FILE_ENTRY_FORMAT = 1,
+			 LOG_FILE_ENTRY_RECORD = 2
+};
+
+/**
+ * Time, thread id and module are only used by RECORD entries
+ */
+struct log_file_entry{
+  uint8_t type;
+  uint8_t priority;
+  uint8_t truncated;
+  uint8_t module;
+  uint32_t format_id;
+  uint32_t size;
+  uint32_t thread_id;
+  uint64_t time;
+};
+
+const char * get_log_priority_label(enum log_priority priority);
+
+/**
+ * Copies the arguments of a message into the record
+ * Arguments that do not fit are left out and mark the record as truncated
+ * The caller sets the time and thread id
+ */
+void encode_log_record(struct log_record * record, enum log_module module, enum log_priority priority, const char * format, va_list args);
+
+/**
+ * Formats the encoded arguments according to the format
+ * The result is always null terminated, returns the length of the text
+ */
+size_t format_log_args(char * dest, size_t dest_size, const char * format, const unsigned char * args, size_t size, bool truncated);
+
+/**
+ * Writes a message as a single JSON object followed by a newline
+ * dest must hold at least MAX_LOG_JSON_LEN characters, returns the length of the line
+ */
+size_t format_log_json(char * dest, uint64_t time, uint32_t thread_id, enum log_module module, enum log_priority priority, const char * text);
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * Like the logger, this compilation unit has no dependencies
+ * so that every other unit can utilize logging
+ */
+
+#include "log_sink.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/**
+ * Max length of the path of a rotated file
+ */
+#define MAX_LOG_PATH_LEN 4096
+
+/**
+ * Writes all buffers, retrying after partial writes
+ */
+static int write_log_sink(struct log_sink * sink, struct iovec * iov, int count){
+  while(count > 0){
+    ssize_t written = writev(sink->fd, iov, count);
+    if(written < 0){
+      if(errno == EINTR){
+	continue;
+      }
+      return -1;
+    }
+    while(count > 0 && (size_t)written >= iov->iov_len){
+      written -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if(count > 0){
+      iov->iov_base = (char *)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  if(sink->fsync_policy == LOG_FSYNC_BATCH && sink->path != NULL && fsync(sink->fd)){
+    return -1;
+  }
+  return 0;
+}
+
+static int rotate_fd_log_sink(struct log_sink * sink){
+  return 0;
+}
+
+static void close_fd_log_sink(struct log_sink * sink){
+}
+
+void init_fd_log_sink(struct log_sink * sink, int fd){
+  assert(sink != NULL);
+  assert(fd >= 0);
+  
+  sink->write = write_log_sink;
+  sink->rotate = rotate_fd_log_sink;
+  sink->close = close_fd_log_sink;
+  sink->fd = fd;
+  sink->path = NULL;
+  sink->keep = 0;
+  sink->fsync_policy = LOG_FSYNC_NEVER;
+}
+
+static int open_log_file(const char * path, bool truncate){
+  return open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (truncate ? O_TRUNC : 0), 0644);
+}
+
+/**
+ * Shifts path.1 ... path.keep-1 up by one and moves the file to path.1
+ */
+static void shift_log_files(const char * path, unsigned int keep){
+  char from[MAX_LOG_PATH_LEN];
+  char to[MAX_LOG_PATH_LEN];
+  for(unsigned int i = keep; i > 1; --i){
+    snprintf(from, MAX_LOG_PATH_LEN, "%s.%u", path, i - 1);
+    snprintf(to, MAX_LOG_PATH_LEN, "%s.%u", path, i);
+    rename(from, to);
+  }
+  snprintf(to, MAX_LOG_PATH_LEN, "%s.1", path);
+  rename(path, to);
+}
+
+static int rotate_file_log_sink(struct log_sink * sink){
+  if(sink->fsync_policy != LOG_FSYNC_NEVER){
+    fsync(sink->fd);
+  }
+  close(sink->fd);
+  if(sink->keep > 0){
+    shift_log_files(sink->path, sink->keep);
+  }
+  // without rotated files to keep the file simply starts over
+  sink->fd = open_log_file(sink->path, true);
+  return sink->fd < 0 ? -1 : 0;
+}
+
+static void close_file_log_sink(struct log_sink * sink){
+  if(sink->fd >= 0){
+    if(sink->fsync_policy != LOG_FSYNC_NEVER){
+      fsync(sink->fd);
+    }
+    close(sink->fd);
+    sink->fd = -1;
+  }
+}
+
+int init_file_log_sink(struct log_sink * sink, const char * path, unsigned int keep, enum log_fsync_policy fsync_policy){
+  assert(sink != NULL);
+  assert(path != NULL);
+
+  // every run starts with a fresh file, the previous one is kept like a rotated file
+  if(keep > 0){
+    shift_log_files(path, keep);
+  }
+  sink->fd = open_log_file(path, true);
+  if(sink->fd < 0){
+    return -1;
+  }
+  sink->write = write_log_sink;
+  sink->rotate = rotate_file_log_sink;
+  sink->close = close_file_log_sink;
+  sink->path = path;
+  sink->keep = keep;
+  sink->fsync_policy = fsync_policy;
+  return 0;
+}
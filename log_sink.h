@@ -0,0 +1,75 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOG_SINK_H
+#define LOG_SINK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+/**
+ * When the data written to a sink is synced to disk
+ */
+enum log_fsync_policy{
+		      LOG_FSYNC_NEVER,
+		      LOG_FSYNC_ROTATE,
+		      LOG_FSYNC_BATCH
+};
+
+/**
+ * The destination of the log output, only used by the sink thread of the logger
+ */
+struct log_sink{
+  /**
+   * Writes a batch of buffers, the logger never passes more than IOV_MAX of them
+   * Returns 0 on success and -1 on failure
+   */
+  int (*write)(struct log_sink * sink, struct iovec * iov, int count);
+
+  /**
+   * Starts a new output, returns 0 on success and -1 on failure
+   */
+  int (*rotate)(struct log_sink * sink);
+
+  void (*close)(struct log_sink * sink);
+
+  int fd;
+
+  /**
+   * The path of the file, NULL if the sink does not own its file descriptor
+   */
+  const char * path;
+
+  /**
+   * Number of rotated files that are kept as path.1, path.2, ...
+   */
+  unsigned int keep;
+  enum log_fsync_policy fsync_policy;
+};
+
+/**
+ * Initializes a sink that writes to a file descriptor it does not own, it can not be rotated
+ */
+void init_fd_log_sink(struct log_sink * sink, int fd);
+
+/**
+ * Initializes a sink that appends to a file, rotating moves it to path.1
+ */
+int init_file_log_sink(struct log_sink * sink, const char * path, unsigned int keep, enum log_fsync_policy fsync_policy);
+
+#endif
@@ -17,102 +17,194 @@
 
 /**
  * This compilation unit should have no dependencies whatsoever so that
- * every other unit can utilize logging
+ * every other unit can utilize logging, log_format is dependency free as well
+ *
+ * Every thread that logs owns a single producer ring buffer, so logging never
+ * takes a lock: the caller copies the format and its raw arguments into the next
+ * free slot and publishes it. Formatting is deferred to the worker thread, which
+ * drains all rings in batches, it is only woken up early when a ring fills up or
+ * an error is logged. When the ring of the calling thread is full, the message is
+ * dropped or the caller waits for the worker, depending on the overflow policy.
+ * The number of rings is bounded and the worker frees the rings of exited threads when idle.
  */
 
+#include "log_format.h"
+#include "log_sink.h"
 #include "logger.h"
+#include "slab.h"
 
 #include <assert.h>
 #include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
 /**
- * Arbitrary max length of a log message
+ * Arbitrary max length of a formatted log message
  */
 #define MAX_LOG_MSG_LEN 255
 
 /**
- * Number of messages that are allocated at once on the heap
+ * Size of the buffers handed from the worker to the sink thread
  */
-#define LOG_MSG_BLOCK_SIZE 32
+#define LOG_BUFFER_SIZE (1 << 16)
 
 /**
- * Used to store log entries until they can be written to the output file
+ * Number of buffers, when all of them are waiting to be written new messages are lost
  */
-struct log_msg{
+#define LOG_BUFFER_COUNT 8
 
-  /**
-   * The priority of the message
-   * Note that log levels are set per thread, 
-   * so this is only used for display purposes
-   */
-  enum log_priority priority;
+/**
+ * Number of messages in the ring of a single thread, must be a power of two
+ */
+#define LOG_RING_SIZE 64
+
+/**
+ * Number of pending messages in a ring at which the worker is woken up
+ */
+#define LOG_RING_WAKEUP_THRESHOLD (LOG_RING_SIZE / 2)
+
+/**
+ * Time in milliseconds the worker sleeps between two drains
+ */
+#define LOG_DRAIN_INTERVAL_MS 10
+
+/**
+ * Time in seconds between two attempts of the worker to free unused rings
+ */
+#define LOG_SHRINK_INTERVAL 1
+
+/**
+ * Default max number of rings, every ring takes about 9 KiB
+ */
+#define DEFAULT_MAX_LOG_RINGS 128
+
+/**
+ * Maps a format to its id in a binary log
+ */
+struct log_format_id{
+  const char * format;
+  uint32_t id;
+};
+
+/**
+ * Output of the worker waiting to be written by the sink thread
+ */
+struct log_buffer{
+  char data[LOG_BUFFER_SIZE];
+  size_t len;
 
   /**
-   * The text of the message
+   * Number of messages in this buffer
    */
-  char text[MAX_LOG_MSG_LEN];
+  size_t count;
 
   /**
-   * Pointer to next message in a single linked queue
+   * Whether the sink has to be rotated before this buffer is written
    */
-  struct log_msg * next;
+  bool rotate;
+  struct log_buffer * next;
 };
 
 /**
- * A block of messages to be allocated at once
+ * A single producer, single consumer queue of messages
+ * The producer is the thread that owns the ring, the consumer is the worker thread
  */
-struct log_msg_block{
+struct log_ring{
   /**
-   * The array of messages
+   * The messages
+   * Note that log levels are set per thread,
+   * so their priority is only used for display purposes
    */
-  struct log_msg messages[LOG_MSG_BLOCK_SIZE];
+  struct log_record messages[LOG_RING_SIZE];
 
   /**
-   * A link to the next block
+   * The number of messages ever written to this ring, only changed by the producer
    */
-  struct log_msg_block * next;
+  atomic_size_t head;
+
+  /**
+   * The number of messages ever read from this ring, only changed by the worker
+   */
+  atomic_size_t tail;
+
+  /**
+   * Whether a thread currently owns this ring
+   * Rings of threads that have exited are claimed by new threads
+   */
+  atomic_bool owned;
+
+  /**
+   * Link to the next ring
+   * Only the worker unlinks rings, while holding the ring mutex
+   */
+  struct log_ring * next;
 };
 
 /**
- * Labels for the log priorities as they appear in the output
+ * A single linked list of all rings
+ * Threads claim and add rings while holding the ring mutex, the worker drains them without it
  */
-static const char * log_priority_labels[] = {"DEBUG  ", "INFO   ", "WARNING", "ERROR  "};
+static _Atomic(struct log_ring *) rings = NULL;
 
 /**
- * A single linked list of allocated message blocks
+ * Number of rings in the list, protected by the ring mutex
  */
-static struct log_msg_block * block = NULL;
+static size_t ring_count = 0;
 
 /**
- * The index of the next unused message in the current bloc;
+ * Protects claiming, adding and freeing rings
+ * The condition variable is broadcast by the worker after every drain
+ * so that threads waiting for space in a ring or for a ring can retry
  */
-static size_t next_msg_index = LOG_MSG_BLOCK_SIZE;
+static pthread_mutex_t ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t space_cond = PTHREAD_COND_INITIALIZER;
 
 /**
- * A single linked list of messages waiting to be printed
+ * Number of threads waiting on the space condition variable
  */
-static struct log_msg * in_head = NULL;
-static struct log_msg * in_tail = NULL;
+static atomic_int space_waiters = 0;
+
+static size_t max_rings = DEFAULT_MAX_LOG_RINGS;
+
+/**
+ * The slab allocator must not log when it fails, the ring mutex is held while allocating
+ */
+static struct slab_pool ring_pool = SLAB_POOL_INITIALIZER("log", false);
+
+static enum log_overflow_policy overflow_policy = LOG_OVERFLOW_DROP;
 
 /**
- * A mutex and condition variable to synchronize access to the in queue
+ * Number of messages dropped because a ring was full
  */
-static pthread_cond_t in_cond = PTHREAD_COND_INITIALIZER;
-static pthread_mutex_t in_mutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_size_t dropped = 0;
 
 /**
- * A single linked list of messages waiting to be re-used
+ * Key used to release the ring of a thread when it exits
  */
-static struct log_msg * out_head = NULL;
+static pthread_key_t ring_key;
 
 /**
- * A mutex to synchronize access to the out queue
+ * Incremented every time the logger starts, invalidates rings of a previous run
  */
-static pthread_mutex_t out_mutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_uint generation = 0;
+
+/**
+ * A mutex and condition variable used to put the worker thread to sleep
+ */
+static pthread_cond_t wakeup_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t wakeup_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Tracks whether the worker is waiting for the drain interval to pass
+ */
+static atomic_bool sleeping = false;
 
 /**
  * The worker thread that will print the messages
@@ -122,279 +214,746 @@ static pthread_t worker;
 /**
  * tracks whether the logger is still running
  */
-static bool running = false;
+static atomic_bool running = false;
+
+/**
+ * The sink of this logger, only used by the sink thread
+ */
+static struct log_sink * sink;
+
+/**
+ * Sink used by start_logger
+ */
+static struct log_sink fd_sink;
+
+/**
+ * The sink thread writes the buffers so that file I/O never blocks the worker
+ */
+static pthread_t sink_worker;
+
+static struct log_buffer buffers[LOG_BUFFER_COUNT];
+
+/**
+ * Free buffers and buffers waiting to be written, the sink mutex protects both lists and sink_running
+ */
+static struct log_buffer * free_buffers = NULL;
+static struct log_buffer * pending_head = NULL;
+static struct log_buffer * pending_tail = NULL;
+static bool sink_running = false;
+static pthread_cond_t sink_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t sink_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Number of messages lost because no buffer was available or the sink failed
+ */
+static atomic_size_t lost = 0;
+
+/**
+ * How records are written to the sink
+ */
+static enum log_output_format output_format;
+
+/**
+ * The buffer the worker is filling
+ */
+static struct log_buffer * output = NULL;
+
+/**
+ * Rotation limits, zero disables them
+ */
+static size_t rotate_size;
+static unsigned int rotate_interval;
+
+/**
+ * Bytes written to and start of the current output of the sink, only used by the worker
+ */
+static size_t output_size;
+static struct timespec output_start;
+
+/**
+ * Whether the next buffer starts a new output
+ */
+static bool output_rotated;
 
 /**
- * The output file for this logger
- * Note that the logger does not close the file,
- * this should be handled by the caller
+ * Whether the current output still needs a binary log header
  */
-static FILE * file;
+static bool needs_header;
+
+/**
+ * Open addressing table of the formats written to the binary log so far, only used by the worker
+ */
+static struct log_format_id * format_ids = NULL;
+static size_t format_ids_size = 0;
+static uint32_t format_count = 0;
 
 /**
  * Thread local variable specifying the minimul log priority of the thread
  */
 __thread enum log_priority min_priority = LOG_PRIORITY_ERROR;
 
+__thread enum log_priority log_module_min_priorities[LOG_MODULE_COUNT] = {[0 ... LOG_MODULE_COUNT - 1] = LOG_PRIORITY_ERROR};
+
+/**
+ * Module priorities that override the minimum priority of the thread, -1 if the module has none
+ */
+static atomic_int module_priorities[LOG_MODULE_COUNT] = {[0 ... LOG_MODULE_COUNT - 1] = -1};
+
+atomic_uint log_module_priority_generation = 0;
+
+__thread unsigned int log_module_priority_seen = 0;
+
+/**
+ * The ring of the current thread and the logger generation it belongs to
+ */
+static __thread struct log_ring * thread_ring = NULL;
+static __thread unsigned int thread_ring_generation = 0;
+
+/**
+ * Kernel id of the current thread, zero until the thread logs for the first time
+ */
+static __thread uint32_t thread_id = 0;
+
+/**
+ * Releases the ring of an exiting thread so that another thread can claim it
+ */
+static void release_log_ring(void * arg){
+  struct log_ring * ring = arg;
+  atomic_store_explicit(&ring->owned, false, memory_order_release);
+  // other destructors may still log, they have to claim a new ring
+  thread_ring = NULL;
+}
+
 /**
- * Returns a pointer to a message that can be used for logging
- * This function will try to reuse recycled messages and allocate new messages
- * only when needed.
+ * Wakes up the worker thread if it is sleeping
  */
-static struct log_msg * get_log_msg(){
-  if(pthread_mutex_lock(&out_mutex)){
+static void wake_logger(){
+  if(atomic_load_explicit(&sleeping, memory_order_relaxed)){
+    pthread_cond_signal(&wakeup_cond);
+  }
+}
+
+/**
+ * Waits until the worker has drained the rings, the ring mutex has to be held
+ * Gives up after a drain interval so that the caller can check whether the logger still runs
+ */
+static void wait_for_log_space(){
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_nsec += LOG_DRAIN_INTERVAL_MS * 1000000L;
+  if(deadline.tv_nsec >= 1000000000L){
+    deadline.tv_nsec -= 1000000000L;
+    ++deadline.tv_sec;
+  }
+  atomic_fetch_add(&space_waiters, 1);
+  wake_logger();
+  pthread_cond_timedwait(&space_cond, &ring_mutex, &deadline);
+  atomic_fetch_sub(&space_waiters, 1);
+}
+
+/**
+ * Claims a ring released by an exited thread or adds a new one, the ring mutex has to be held
+ * Returns NULL if there is no free ring and no more rings may be added
+ */
+static struct log_ring * claim_log_ring(){
+  struct log_ring * ring = atomic_load_explicit(&rings, memory_order_acquire);
+  while(ring != NULL){
+    bool expected = false;
+    if(atomic_compare_exchange_strong_explicit(&ring->owned, &expected, true, memory_order_acq_rel, memory_order_relaxed)){
+      return ring;
+    }
+    ring = ring->next;
+  }
+  if(ring_count >= max_rings){
+    return NULL;
+  }
+  ring = alloc_from_slab_pool(&ring_pool, sizeof(struct log_ring));
+  if(ring == NULL){
     // no way to recover from this
     return NULL;
   }
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->owned, true);
+  ring->next = atomic_load_explicit(&rings, memory_order_relaxed);
+  atomic_store_explicit(&rings, ring, memory_order_release);
+  ++ring_count;
+  return ring;
+}
 
-  struct log_msg * msg;
-  
-  if(out_head == NULL){
-    if(next_msg_index == LOG_MSG_BLOCK_SIZE){
-      struct log_msg_block * new_block = malloc(sizeof(struct log_msg_block));
-      memset(new_block->messages, 0, sizeof(new_block->messages));
-      if(new_block == NULL){
-	// no way to recover from this
-	pthread_mutex_unlock(&out_mutex);
-	return NULL;
+/**
+ * Returns the ring of the current thread, claiming or allocating one if needed
+ */
+static struct log_ring * get_log_ring(){
+  unsigned int current = atomic_load_explicit(&generation, memory_order_acquire);
+  if(thread_ring != NULL && thread_ring_generation == current){
+    return thread_ring;
+  }
+
+  if(pthread_mutex_lock(&ring_mutex)){
+    return NULL;
+  }
+  struct log_ring * ring = claim_log_ring();
+  while(ring == NULL && overflow_policy == LOG_OVERFLOW_BLOCK && ring_count >= max_rings
+	&& atomic_load_explicit(&running, memory_order_acquire)){
+    // wait for a thread to exit, the worker frees or hands out its ring
+    wait_for_log_space();
+    ring = claim_log_ring();
+  }
+  pthread_mutex_unlock(&ring_mutex);
+  if(ring == NULL){
+    return NULL;
+  }
+  pthread_setspecific(ring_key, ring);
+  thread_ring = ring;
+  thread_ring_generation = current;
+  return ring;
+}
+
+/**
+ * Frees the rings of exited threads that have been drained
+ */
+static void shrink_log_rings(){
+  if(pthread_mutex_lock(&ring_mutex)){
+    return;
+  }
+  struct log_ring * prev = NULL;
+  struct log_ring * ring = atomic_load_explicit(&rings, memory_order_acquire);
+  while(ring != NULL){
+    struct log_ring * next = ring->next;
+    if(!atomic_load_explicit(&ring->owned, memory_order_acquire)
+       && atomic_load_explicit(&ring->head, memory_order_relaxed) == atomic_load_explicit(&ring->tail, memory_order_relaxed)){
+      if(prev == NULL){
+	atomic_store_explicit(&rings, next, memory_order_release);
+      }else{
+	prev->next = next;
       }
-      new_block->next = block;
-      block = new_block;
-      next_msg_index = 0;
+      free_to_slab_pool(&ring_pool, ring, sizeof(struct log_ring));
+      --ring_count;
+    }else{
+      prev = ring;
     }
-    msg = block->messages + next_msg_index;
-    ++next_msg_index;
-  }else{
-    msg = out_head;
-    out_head = out_head->next;
+    ring = next;
+  }
+  pthread_mutex_unlock(&ring_mutex);
+}
+
+/**
+ * Lets threads waiting for space in their ring or for a ring retry
+ */
+static void signal_log_space(){
+  if(atomic_load(&space_waiters) > 0){
+    pthread_mutex_lock(&ring_mutex);
+    pthread_cond_broadcast(&space_cond);
+    pthread_mutex_unlock(&ring_mutex);
   }
-  if(pthread_mutex_unlock(&out_mutex)){
+}
+
+static struct log_buffer * take_log_buffer(){
+  if(pthread_mutex_lock(&sink_mutex)){
     return NULL;
   }
-  msg->next = NULL;
-  return msg;
+  struct log_buffer * buffer = free_buffers;
+  if(buffer != NULL){
+    free_buffers = buffer->next;
+  }
+  pthread_mutex_unlock(&sink_mutex);
+  if(buffer != NULL){
+    buffer->len = 0;
+    buffer->count = 0;
+    buffer->rotate = false;
+    buffer->next = NULL;
+  }
+  return buffer;
 }
 
 /**
- * Prints the messages in this queue to the output
+ * Hands the current buffer to the sink thread
  */
-static void print_messages(struct log_msg * head){
-  assert(head != NULL);
-  while(head != NULL){
-    fprintf(file, "%s: %s\n", log_priority_labels[(int)head->priority], head->text);
-    head = head->next;
+static void submit_log_buffer(){
+  if(output == NULL || output->len == 0){
+    return;
+  }
+  if(pthread_mutex_lock(&sink_mutex)){
+    return;
   }
+  if(pending_tail == NULL){
+    pending_head = output;
+  }else{
+    pending_tail->next = output;
+  }
+  pending_tail = output;
+  pthread_cond_signal(&sink_cond);
+  pthread_mutex_unlock(&sink_mutex);
+  output = NULL;
+}
+
+static void write_log_header(){
+  struct log_file_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, LOG_FILE_MAGIC, sizeof(header.magic));
+  header.version = LOG_FILE_VERSION;
+  header.byte_order = LOG_FILE_BYTE_ORDER;
+  header.args_size = LOG_RECORD_ARGS_SIZE;
+  memcpy(output->data, &header, sizeof(header));
+  output->len = sizeof(header);
+  output_size += sizeof(header);
+  needs_header = false;
+}
+
+/**
+ * Returns room for len bytes of output, or NULL if the sink thread has not returned a buffer yet
+ */
+static char * reserve_log_output(size_t len){
+  assert(len + sizeof(struct log_file_header) <= LOG_BUFFER_SIZE);
   
-  // flush the file to ensure log messages appear in a timely fashion
-  fflush(file);
+  if(output != NULL && LOG_BUFFER_SIZE - output->len < len){
+    submit_log_buffer();
+  }
+  if(output == NULL){
+    output = take_log_buffer();
+    if(output == NULL){
+      return NULL;
+    }
+    output->rotate = output_rotated;
+    output_rotated = false;
+    if(needs_header){
+      write_log_header();
+    }
+  }
+  return output->data + output->len;
+}
+
+static void commit_log_output(size_t len, size_t count){
+  output->len += len;
+  output->count += count;
+  output_size += len;
 }
 
 /**
- * Recycles the messages in this queue so that they can be reused later on
+ * Starts a new output when it has grown too large or too old
  */
-static int recycle_messages(struct log_msg * head, struct log_msg * tail){
-  assert(head != NULL);
-  assert(tail != NULL);
-  assert(tail->next == NULL);
+static void check_log_rotation(){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if((rotate_size == 0 || output_size < rotate_size)
+     && (rotate_interval == 0 || now.tv_sec - output_start.tv_sec < (time_t)rotate_interval)){
+    return;
+  }
+  submit_log_buffer();
+  output_rotated = true;
+  output_size = 0;
+  output_start = now;
+  // a binary log has to be readable on its own, so formats are defined again
+  needs_header = output_format == LOG_OUTPUT_BINARY;
+  if(format_ids != NULL){
+    memset(format_ids, 0, sizeof(struct log_format_id) * format_ids_size);
+  }
+  format_count = 0;
+}
+
+static size_t hash_log_format(const char * format){
+  return ((uintptr_t)format >> 3) * 2654435761u;
+}
 
-  if(pthread_mutex_lock(&out_mutex)){
-    // no way to recover from this -> message memory is lost
+static int grow_log_format_ids(){
+  size_t size = format_ids_size == 0 ? 256 : format_ids_size * 2;
+  struct log_format_id * ids = calloc(size, sizeof(struct log_format_id));
+  if(ids == NULL){
     return -1;
   }
-  if(out_head != NULL){
-    tail->next = out_head;
+  for(size_t i = 0; i < format_ids_size; ++i){
+    if(format_ids[i].format != NULL){
+      size_t j = hash_log_format(format_ids[i].format) & (size - 1);
+      while(ids[j].format != NULL){
+	j = (j + 1) & (size - 1);
+      }
+      ids[j] = format_ids[i];
+    }
   }
-  out_head = head;
-  if(pthread_mutex_unlock(&out_mutex)){
-    //no way to recover from this
+  free(format_ids);
+  format_ids = ids;
+  format_ids_size = size;
+  return 0;
+}
+
+/**
+ * Returns the id of the format, defining it in the binary log the first time it is used
+ */
+static int get_log_format_id(const char * format, uint32_t * id){
+  if(2 * (format_count + 1) > format_ids_size && grow_log_format_ids()){
     return -1;
   }
+  size_t i = hash_log_format(format) & (format_ids_size - 1);
+  while(format_ids[i].format != NULL){
+    if(format_ids[i].format == format){
+      *id = format_ids[i].id;
+      return 0;
+    }
+    i = (i + 1) & (format_ids_size - 1);
+  }
+  size_t len = strnlen(format, MAX_LOG_MSG_LEN * 4);
+  struct log_file_entry entry = {LOG_FILE_ENTRY_FORMAT, 0, 0, 0, format_count, len};
+  char * dest = reserve_log_output(sizeof(entry) + len);
+  if(dest == NULL){
+    return -1;
+  }
+  memcpy(dest, &entry, sizeof(entry));
+  memcpy(dest + sizeof(entry), format, len);
+  commit_log_output(sizeof(entry) + len, 0);
+  format_ids[i].format = format;
+  format_ids[i].id = format_count;
+  *id = format_count++;
   return 0;
 }
 
 /**
- * convenience function that prints and recycles a queue of messages
+ * Writes a record to the output
  */
-static int print_and_recycle_messages(struct log_msg * head, struct log_msg * tail){
-  if(head != NULL){
-    assert(tail != NULL);
-    print_messages(head);
-    if(recycle_messages(head, tail)){
-      return -1;
+static void write_log_record(const struct log_record * record){
+  if(output_format == LOG_OUTPUT_BINARY){
+    uint32_t id;
+    struct log_file_entry entry;
+    char * dest;
+    if(get_log_format_id(record->format, &id) || (dest = reserve_log_output(sizeof(entry) + record->size)) == NULL){
+      atomic_fetch_add_explicit(&lost, 1, memory_order_relaxed);
+      return;
+    }
+    entry = (struct log_file_entry){LOG_FILE_ENTRY_RECORD, record->priority, record->truncated, record->module, id, record->size, record->thread_id, record->time};
+    memcpy(dest, &entry, sizeof(entry));
+    memcpy(dest + sizeof(entry), record->args, record->size);
+    commit_log_output(sizeof(entry) + record->size, 1);
+  }else if(output_format == LOG_OUTPUT_JSON){
+    char * dest = reserve_log_output(MAX_LOG_JSON_LEN);
+    if(dest == NULL){
+      atomic_fetch_add_explicit(&lost, 1, memory_order_relaxed);
+      return;
+    }
+    char text[MAX_LOG_MSG_LEN];
+    format_log_args(text, MAX_LOG_MSG_LEN, record->format, record->args, record->size, record->truncated);
+    commit_log_output(format_log_json(dest, record->time, record->thread_id, record->module, record->priority, text), 1);
+  }else{
+    const char * label = get_log_priority_label(record->priority);
+    size_t label_len = strlen(label);
+    char * dest = reserve_log_output(label_len + 3 + MAX_LOG_MSG_LEN);
+    if(dest == NULL){
+      atomic_fetch_add_explicit(&lost, 1, memory_order_relaxed);
+      return;
     }
+    memcpy(dest, label, label_len);
+    memcpy(dest + label_len, ": ", 2);
+    size_t len = label_len + 2;
+    len += format_log_args(dest + len, MAX_LOG_MSG_LEN, record->format, record->args, record->size, record->truncated);
+    dest[len++] = '\n';
+    commit_log_output(len, 1);
   }
-  return 0;
 }
 
 /**
- * The main function for the worker thread
+ * Returns the CLOCK_MONOTONIC time in nanoseconds, a vDSO call on Linux
  */
-static void * run_logger(void * arg){
+static uint64_t get_log_time(){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
 
-  // lock mutex before starting
-  
-  if(pthread_mutex_lock(&in_mutex)){
-    return NULL;;
+static uint32_t get_log_thread_id(){
+  if(thread_id == 0){
+    thread_id = (uint32_t)syscall(SYS_gettid);
   }
-  
-  while(true){
+  return thread_id;
+}
 
-    /*
-     * keep cycling until the in queue is empty
-     * every time when the mutex is unlocked during printing, additional messages
-     * could be added to the queue that need to be handled
-     * if we do not do this the thread may not wake up to print them until the next message
-     * is pushed on the queue
-     */
-    while(in_head != NULL){
-      
-      struct log_msg * head = in_head;
-      struct log_msg * tail = in_tail;
-      in_head = NULL;
-      in_tail = NULL;
-      
-      /*
-       * unlock in mutex and print messages
-       * note that more log messages can be pushed on the queue while
-       * the mutex is unlocked but the idea is to ensure other threads are not blocked
-       * trying to log messages while we are printing them
-       */
-      if(pthread_mutex_unlock(&in_mutex)){
-	return NULL;
-      }
-      
-      if(print_and_recycle_messages(head, tail)){
-	pthread_mutex_unlock(&in_mutex);
-	return NULL;
-      }
+/**
+ * Writes a message of the logger itself
+ */
+static void write_logger_msg(enum log_priority priority, const char * format, ...){
+  struct log_record record;
+  va_list args;
+  va_start(args, format);
+  encode_log_record(&record, LOG_MODULE_GENERAL, priority, format, args);
+  va_end(args);
+  record.time = get_log_time();
+  record.thread_id = get_log_thread_id();
+  write_log_record(&record);
+}
 
-      // lock the mutex again so that we can check the in queue again
-      
-      if(pthread_mutex_lock(&in_mutex)){
-	return NULL;
+/**
+ * Writes all pending messages of a ring and returns the number of messages written
+ */
+static size_t drain_log_ring(struct log_ring * ring){
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  for(size_t i = tail; i != head; ++i){
+    write_log_record(&ring->messages[i & (LOG_RING_SIZE - 1)]);
+  }
+  // hand the slots back to the producer only after they have been written
+  atomic_store_explicit(&ring->tail, head, memory_order_release);
+  return head - tail;
+}
+
+/**
+ * Messages the logger already reported as dropped or lost
+ */
+struct log_loss_report{
+  size_t dropped;
+  size_t lost;
+};
+
+/**
+ * Writes the pending messages of all rings and reports dropped messages
+ * All output of a drain is handed to the sink thread as a single batch
+ */
+static void drain_log_rings(struct log_loss_report * report){
+  check_log_rotation();
+  struct log_ring * ring = atomic_load_explicit(&rings, memory_order_acquire);
+  while(ring != NULL){
+    drain_log_ring(ring);
+    ring = ring->next;
+  }
+  size_t drops = atomic_load_explicit(&dropped, memory_order_relaxed);
+  if(drops != report->dropped){
+    write_logger_msg(LOG_PRIORITY_WARNING, "logger dropped %zu messages", drops - report->dropped);
+    report->dropped = drops;
+  }
+  size_t losses = atomic_load_explicit(&lost, memory_order_relaxed);
+  if(losses != report->lost){
+    write_logger_msg(LOG_PRIORITY_WARNING, "log sink lost %zu messages", losses - report->lost);
+    report->lost = losses;
+  }
+  submit_log_buffer();
+}
+
+/**
+ * Writes a batch of buffers, rotating the sink where requested
+ */
+static void write_log_batch(struct log_buffer * batch){
+  struct iovec iov[LOG_BUFFER_COUNT];
+  int count = 0;
+  size_t msg_count = 0;
+  for(struct log_buffer * buffer = batch; buffer != NULL; buffer = buffer->next){
+    if(buffer->rotate){
+      if(count > 0 && sink->write(sink, iov, count)){
+	atomic_fetch_add_explicit(&lost, msg_count, memory_order_relaxed);
       }
+      count = 0;
+      msg_count = 0;
+      // after a failed rotation the writes fail as well and the messages are reported lost
+      sink->rotate(sink);
     }
+    iov[count].iov_base = buffer->data;
+    iov[count].iov_len = buffer->len;
+    ++count;
+    msg_count += buffer->count;
+  }
+  if(count > 0 && sink->write(sink, iov, count)){
+    atomic_fetch_add_explicit(&lost, msg_count, memory_order_relaxed);
+  }
+}
 
-    // check if logging system is still running  
-    if(running){
-      // wait for more messages
-      if(pthread_cond_wait(&in_cond, &in_mutex)){
-	break;
-      }
-    }else{
-      /*
-       * logger has been stopped, loop should print remaining messages and stop
-       * it should do this while holding the in mutex, to ensure that no more
-       * messages can be pushed onto the queue until after the logging system has stopped
-       * note that there can be no deadlock with the out mutex,
-       * as that one is never held by any other thread that also holds the in mutex
-       */
-      print_and_recycle_messages(in_head, in_tail);
-      in_head = NULL;
-      in_tail = NULL;
-      
-      // unlock the in mutex and break the loop
-      pthread_mutex_unlock(&in_mutex);
+/**
+ * The main function of the sink thread
+ */
+static void * run_log_sink(void * arg){
+  if(pthread_mutex_lock(&sink_mutex)){
+    return NULL;
+  }
+  while(true){
+    while(pending_head == NULL && sink_running){
+      pthread_cond_wait(&sink_cond, &sink_mutex);
+    }
+    if(pending_head == NULL){
+      // stopped and all output has been written
       break;
     }
+    struct log_buffer * batch = pending_head;
+    pending_head = NULL;
+    pending_tail = NULL;
+    pthread_mutex_unlock(&sink_mutex);
+
+    write_log_batch(batch);
+    
+    if(pthread_mutex_lock(&sink_mutex)){
+      return NULL;
+    }
+    while(batch != NULL){
+      struct log_buffer * next = batch->next;
+      batch->next = free_buffers;
+      free_buffers = batch;
+      batch = next;
+    }
   }
+  pthread_mutex_unlock(&sink_mutex);
   return NULL;
 }
 
-int start_logger(FILE * output_file){
-  assert(output_file != NULL);
-
-  /*
-   * lock the in mutex to ensure no one logs anything
-   * while we are starting up
-   */
-  if(pthread_mutex_lock(&in_mutex)){
-    return -1;
+/**
+ * The main function for the worker thread
+ */
+static void * run_logger(void * arg){
+  struct log_loss_report report = {atomic_load_explicit(&dropped, memory_order_relaxed), atomic_load_explicit(&lost, memory_order_relaxed)};
+  if(needs_header){
+    // a binary log without messages is still a valid log
+    reserve_log_output(0);
   }
+  
+  struct timespec last_shrink;
+  clock_gettime(CLOCK_MONOTONIC, &last_shrink);
+  while(atomic_load_explicit(&running, memory_order_acquire)){
+    drain_log_rings(&report);
+    signal_log_space();
 
-  if(running){
-    // log system already up => unlock and return
-    pthread_mutex_unlock(&in_mutex); 
-    return -1;
-  }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if(now.tv_sec - last_shrink.tv_sec >= LOG_SHRINK_INTERVAL){
+      shrink_log_rings();
+      last_shrink = now;
+    }
 
-  // set up parameters and create worker thread
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += LOG_DRAIN_INTERVAL_MS * 1000000L;
+    if(deadline.tv_nsec >= 1000000000L){
+      deadline.tv_nsec -= 1000000000L;
+      ++deadline.tv_sec;
+    }
+    if(pthread_mutex_lock(&wakeup_mutex)){
+      break;
+    }
+    atomic_store_explicit(&sleeping, true, memory_order_relaxed);
+    // a missed wake up only delays the next drain until the deadline
+    if(atomic_load_explicit(&running, memory_order_acquire)){
+      pthread_cond_timedwait(&wakeup_cond, &wakeup_mutex, &deadline);
+    }
+    atomic_store_explicit(&sleeping, false, memory_order_relaxed);
+    pthread_mutex_unlock(&wakeup_mutex);
+  }
   
-  file = output_file;
-  running = true;
+  // print the messages that were logged while stopping
+  drain_log_rings(&report);
+  signal_log_space();
+  return NULL;
+}
 
-  if(pthread_create(&worker, NULL, run_logger, NULL)){
-    return -1;
-  }
+/**
+ * Stops the sink thread after it has written all pending output
+ */
+static void stop_log_sink(){
+  pthread_mutex_lock(&sink_mutex);
+  sink_running = false;
+  pthread_cond_signal(&sink_cond);
+  pthread_mutex_unlock(&sink_mutex);
+  pthread_join(sink_worker, NULL);
+}
 
-  // unlock in mutex so that worker thread can start
-  if(pthread_mutex_unlock(&in_mutex)){
+int set_log_ring_policy(size_t rings, enum log_overflow_policy policy){
+  if(rings == 0 || atomic_load(&running)){
     return -1;
   }
-
+  max_rings = rings;
+  overflow_policy = policy;
   return 0;
 }
 
-/**
- * push log message on the in queue
- */
-static int push_log_msg(struct log_msg * msg){
-  assert(msg != NULL);
-  assert(msg->next == NULL);
+int start_sink_logger(struct log_sink * log_sink, enum log_output_format format, size_t max_size, unsigned int max_age){
+  assert(log_sink != NULL);
   
-  if(pthread_mutex_lock(&in_mutex)){
+  if(atomic_load(&running)){
+    // log system already up
     return -1;
   }
 
-  if(in_tail == NULL){
-    assert(in_head == NULL);
-    in_head = msg;
-    in_tail = msg;
-  }else{
-    in_tail->next = msg;
-    in_tail = msg;
+  // set up parameters and create the sink and worker threads
+  
+  sink = log_sink;
+  output_format = format;
+  rotate_size = max_size;
+  rotate_interval = max_age;
+  output = NULL;
+  output_size = 0;
+  output_rotated = false;
+  needs_header = output_format == LOG_OUTPUT_BINARY;
+  clock_gettime(CLOCK_MONOTONIC, &output_start);
+  free_buffers = NULL;
+  for(size_t i = 0; i < LOG_BUFFER_COUNT; ++i){
+    buffers[i].next = free_buffers;
+    free_buffers = &buffers[i];
   }
-
-  if(pthread_mutex_unlock(&in_mutex)){
+  pending_head = NULL;
+  pending_tail = NULL;
+  sink_running = true;
+  if(pthread_create(&sink_worker, NULL, run_log_sink, NULL)){
+    return -1;
+  }
+  
+  if(pthread_key_create(&ring_key, release_log_ring)){
+    stop_log_sink();
     return -1;
   }
+  atomic_fetch_add(&generation, 1);
+  atomic_store(&running, true);
 
-  if(pthread_cond_signal(&in_cond)){
+  if(pthread_create(&worker, NULL, run_logger, NULL)){
+    atomic_store(&running, false);
+    pthread_key_delete(ring_key);
+    stop_log_sink();
     return -1;
   }
-  
+
   return 0;
 }
 
+int start_logger(FILE * output_file){
+  assert(output_file != NULL);
+
+  // anything buffered by stdio has to come before the log output
+  fflush(output_file);
+  init_fd_log_sink(&fd_sink, fileno(output_file));
+  return start_sink_logger(&fd_sink, LOG_OUTPUT_TEXT, 0, 0);
+}
+
 /**
  * create and send a log message
  */
-int log_msg(enum log_priority priority, const char * format, ...){
-  struct log_msg * msg = get_log_msg();
-  if(msg == NULL){
+int log_msg(enum log_module module, enum log_priority priority, const char * format, ...){
+  if(!atomic_load_explicit(&running, memory_order_acquire)){
     return -1;
   }
-  
-  va_list args;
-  va_start(args, format);
-  msg->priority = priority;
-  int len = vsnprintf(msg->text, MAX_LOG_MSG_LEN, format, args);
-  if(len < 0){
-    recycle_messages(msg, msg);
+  struct log_ring * ring = get_log_ring();
+  if(ring == NULL){
     return -1;
-  }else if(len < MAX_LOG_MSG_LEN){
-    msg->text[len] = '\0';
-  }else{
-    msg->text[MAX_LOG_MSG_LEN - 1] = '\0'; 
   }
-  va_end(args);
 
-  if(push_log_msg(msg)){
-    // unable to push the messages => recycle it and return error
-    recycle_messages(msg, msg);
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if(head - tail == LOG_RING_SIZE && overflow_policy == LOG_OVERFLOW_BLOCK && pthread_mutex_lock(&ring_mutex) == 0){
+    while(head - tail == LOG_RING_SIZE && atomic_load_explicit(&running, memory_order_acquire)){
+      wait_for_log_space();
+      tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    }
+    pthread_mutex_unlock(&ring_mutex);
+  }
+  if(head - tail == LOG_RING_SIZE){
+    // the worker reports the number of dropped messages
+    atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+    wake_logger();
     return -1;
   }
+  
+  struct log_record * record = &ring->messages[head & (LOG_RING_SIZE - 1)];
+  va_list args;
+  va_start(args, format);
+  encode_log_record(record, module, priority, format, args);
+  va_end(args);
+  record->time = get_log_time();
+  record->thread_id = get_log_thread_id();
 
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  
+  if(priority == LOG_PRIORITY_ERROR || head + 1 - tail >= LOG_RING_WAKEUP_THRESHOLD){
+    wake_logger();
+  }
   return 0;
 }
 
@@ -403,6 +962,16 @@ int log_msg(enum log_priority priority, const char * format, ...){
  */
 void set_min_log_priority(enum log_priority priority){
   min_priority = priority;
+  refresh_log_module_priorities();
+}
+
+void refresh_log_module_priorities(){
+  // read first, a change made while deriving is picked up on the next message
+  log_module_priority_seen = atomic_load_explicit(&log_module_priority_generation, memory_order_acquire);
+  for(int i = 0; i < LOG_MODULE_COUNT; ++i){
+    int priority = atomic_load_explicit(&module_priorities[i], memory_order_relaxed);
+    log_module_min_priorities[i] = priority >= 0 ? (enum log_priority)priority : min_priority;
+  }
 }
 
 
@@ -413,68 +982,61 @@ enum log_priority get_min_log_priority(){
   return min_priority;
 }
 
+void set_log_module_priority(enum log_module module, enum log_priority priority){
+  assert(module >= 0 && module < LOG_MODULE_COUNT);
+  atomic_store_explicit(&module_priorities[module], (int)priority, memory_order_relaxed);
+  atomic_fetch_add_explicit(&log_module_priority_generation, 1, memory_order_release);
+}
+
+size_t get_dropped_log_msg_count(){
+  return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
+
 /**
  * stops the logger
  */
 int stop_logger(){
-  /*
-   * lock the in mutex to ensure no one logs while we are
-   * giving the signal to shut down
-   */
-  if(pthread_mutex_lock(&in_mutex)){
+  bool expected = true;
+  if(!atomic_compare_exchange_strong(&running, &expected, false)){
+    // not running
     return -1;
   }
 
-  // if we are not running => unlock and return error
-  if(running == false){
-    pthread_mutex_unlock(&in_mutex);
+  // wake up the worker thread if it is asleep
+  if(pthread_mutex_lock(&wakeup_mutex)){
     return -1;
   }
-
-  running = false;
-
-  // unlock the mutex so that logging can continue for the moment
-  if(pthread_mutex_unlock(&in_mutex)){
+  pthread_cond_signal(&wakeup_cond);
+  if(pthread_mutex_unlock(&wakeup_mutex)){
     return -1;
   }
 
-  // send a signal to wake up the worker thread if it is asleep
-  if(pthread_cond_signal(&in_cond)){
-    return -1;
-  }
-
-  // wait for worker thread shutdown
+  // wait for worker thread shutdown, it hands all remaining output to the sink thread
   if(pthread_join(worker, NULL)){
     return -1;
   }
+  stop_log_sink();
+  sink->close(sink);
 
-  
   /*
-   * free log message blocks and dispose of queues
-   * we lock the mutex again to ensure no one pushes any log messages on those queues
-   * while we are doing this.
+   * free the rings, threads that still hold a ring will claim
+   * a new one after the next start because the generation changed
    */
-  
-  if(pthread_mutex_lock(&in_mutex)){
-    return -1;
-  }
-
-  if(in_head != NULL){
-    print_messages(in_head);
-  }
-  
-  while(block != NULL){
-    struct log_msg_block * next = block->next;
-    free(block);
-    block = next;
-  }
-  in_head = NULL;
-  in_tail = NULL;
-  out_head = NULL;
-
-  if(pthread_mutex_unlock(&in_mutex)){
-    return -1;
+  pthread_key_delete(ring_key);
+  pthread_mutex_lock(&ring_mutex);
+  struct log_ring * ring = atomic_exchange(&rings, NULL);
+  while(ring != NULL){
+    struct log_ring * next = ring->next;
+    free_to_slab_pool(&ring_pool, ring, sizeof(struct log_ring));
+    ring = next;
   }
+  ring_count = 0;
+  pthread_mutex_unlock(&ring_mutex);
+  thread_ring = NULL;
+  free(format_ids);
+  format_ids = NULL;
+  format_ids_size = 0;
+  format_count = 0;
   
   return 0;
 }
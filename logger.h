@@ -18,6 +18,9 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 
 enum log_priority{
@@ -27,17 +30,138 @@ enum log_priority{
 		  LOG_PRIORITY_ERROR
 };
 
+/**
+ * Subsystems whose log level can be set separately
+ * A compilation unit selects its module by defining LOG_MODULE before its first include
+ */
+enum log_module{
+		LOG_MODULE_GENERAL,
+		LOG_MODULE_IPC,
+		LOG_MODULE_PROTOCOL,
+		LOG_MODULE_RESOURCE,
+		LOG_MODULE_SERVER,
+		LOG_MODULE_CLIENT,
+		LOG_MODULE_VORONOI,
+		LOG_MODULE_COUNT
+};
+
+#ifndef LOG_MODULE
+#define LOG_MODULE LOG_MODULE_GENERAL
+#endif
+
+/**
+ * Messages with a lower priority are removed by the compiler: 0 keeps all messages, 1 removes debug messages
+ * Configuring with --disable-debug-logging sets this to 1
+ */
+#ifndef LOG_COMPILE_MIN_PRIORITY
+#define LOG_COMPILE_MIN_PRIORITY 0
+#endif
+
+/**
+ * The minimum priority of every module for the current thread
+ * Derived from the thread's minimum priority and the module priorities,
+ * and derived again when the generation below no longer matches the one it was derived from
+ */
+extern __thread enum log_priority log_module_min_priorities[LOG_MODULE_COUNT];
+
+/**
+ * Incremented by every call to set_log_module_priority
+ */
+extern atomic_uint log_module_priority_generation;
+
+extern __thread unsigned int log_module_priority_seen;
+
+/**
+ * Derives the module priorities of the current thread again, called by LOG_ENABLED after a module priority changed
+ */
+void refresh_log_module_priorities();
+
+struct log_sink;
+
+/**
+ * How a logger writes its records
+ * TEXT writes one line per message, JSON one object per line with the time, thread id and module of the message
+ * and BINARY writes unformatted records, use log_decode to read them
+ */
+enum log_output_format{
+		       LOG_OUTPUT_TEXT,
+		       LOG_OUTPUT_JSON,
+		       LOG_OUTPUT_BINARY
+};
+
+/**
+ * What log_msg does when the ring of the calling thread is full or no ring is left for it
+ * DROP counts the message as dropped, BLOCK waits for the logger thread to make room
+ */
+enum log_overflow_policy{
+			 LOG_OVERFLOW_DROP,
+			 LOG_OVERFLOW_BLOCK
+};
+
+/**
+ * Sets the max number of threads that can log at the same time and the overflow policy
+ * Must be called before the logger is started
+ */
+int set_log_ring_policy(size_t max_rings, enum log_overflow_policy policy);
+
+/**
+ * Starts a logger writing text to the file, the file is not closed by the logger
+ */
 int start_logger(FILE * file);
 
-int log_msg(enum log_priority priority, const char * format, ...);
+/**
+ * Starts a logger writing to the sink, which is closed when the logger stops
+ * The sink is rotated once max_size bytes have been written to it or max_age seconds have passed, zero disables either
+ */
+int start_sink_logger(struct log_sink * sink, enum log_output_format format, size_t max_size, unsigned int max_age);
+
+/**
+ * Logs a message, formatting happens later on the logger thread
+ * so the format must have static storage duration
+ */
+int log_msg(enum log_module module, enum log_priority priority, const char * format, ...) __attribute__((format(printf, 3, 4)));
 
+/**
+ * Sets the minimum priority of the current thread for all modules without a priority of their own
+ */
 void set_min_log_priority(enum log_priority priority);
 
 enum log_priority get_min_log_priority();
 
+/**
+ * Sets the minimum priority of a module regardless of the thread's minimum priority
+ * Can be called from any thread at any time, other threads pick the change up the next time they log
+ */
+void set_log_module_priority(enum log_module module, enum log_priority priority);
+
+const char * get_log_module_name(enum log_module module);
+
+/**
+ * Returns the module with the given name or -1 if there is none
+ */
+int find_log_module(const char * name);
+
+/**
+ * Returns the number of messages dropped because the logging thread could not keep up
+ * or because all rings were in use
+ */
+size_t get_dropped_log_msg_count();
+
 int stop_logger();
 
-#define LOG_MSG(priority, ...) if(priority >= get_min_log_priority()) log_msg(priority, __VA_ARGS__)
+/**
+ * Checks the priority against the current thread's table, which is derived again first if a module priority changed
+ */
+static inline bool is_log_module_enabled(enum log_module module, enum log_priority priority){
+  if(__builtin_expect(atomic_load_explicit(&log_module_priority_generation, memory_order_relaxed) != log_module_priority_seen, 0)){
+    refresh_log_module_priorities();
+  }
+  return priority >= log_module_min_priorities[module];
+}
+
+#define LOG_ENABLED(priority) ((priority) >= LOG_COMPILE_MIN_PRIORITY && is_log_module_enabled(LOG_MODULE, priority))
+
+#define LOG_MSG(priority, ...) do{ if(LOG_ENABLED(priority)) log_msg(LOG_MODULE, priority, __VA_ARGS__); }while(0)
 
 #define LOG_DEBUG(...) LOG_MSG(LOG_PRIORITY_DEBUG, __VA_ARGS__)
 
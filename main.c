@@ -16,10 +16,13 @@
  */
 
 
+#include "log_sink.h"
 #include "logger.h"
+#include "memory.h"
 #include "program.h"
 #include "settings.h"
 #include "signal_utils.h"
+#include "slab.h"
 #include "status.h"
 
 #include <assert.h>
@@ -81,7 +84,7 @@ static bool test_voronoi_diagram(){
   }
 
   puts("result:");
-  print_edge_list(&el);
+  log_edge_list(&el);
   
   bool result = draw_edge_list(&el);
   
@@ -97,16 +100,35 @@ int main(int argc, char * const args[]){
     return EXIT_FAILURE;
   }
 
+  if(settings.track_alloc){
+    enable_alloc_tracking();
+  }
+
   if(init_signals()){
     fputs("could not initialize signal handler", stderr);
     return EXIT_FAILURE;
   }
   
-  if(start_logger(stdout)){
+  struct log_sink log_sink;
+  const char * log_path = settings.binary_log_path != NULL ? settings.binary_log_path : settings.log_path;
+  if(log_path == NULL){
+    init_fd_log_sink(&log_sink, STDOUT_FILENO);
+  }else if(init_file_log_sink(&log_sink, log_path, settings.log_keep, settings.log_fsync_policy)){
+    fputs("unable to open log file\n", stderr);
+    return EXIT_FAILURE;
+  }
+  
+  set_log_ring_policy(settings.log_rings, settings.log_overflow_policy);
+  if(start_sink_logger(&log_sink, settings.log_format, settings.log_rotate_size, settings.log_rotate_interval)){
     fputs("unable to start logger\n", stderr);
     return EXIT_FAILURE;
   }
   
+  for(int i = 0; i < LOG_MODULE_COUNT; ++i){
+    if(settings.module_log_priorities[i] >= 0){
+      set_log_module_priority((enum log_module)i, (enum log_priority)settings.module_log_priorities[i]);
+    }
+  }
   set_min_log_priority(settings.log_priority);
   
   log_program_settings(&settings);  
@@ -114,6 +136,8 @@ int main(int argc, char * const args[]){
   if(run_program_loop(&settings)){
     LOG_ERROR("program loop terminated with errors");
   }
+  log_slab_stats();
+  log_alloc_report(ALLOC_REPORT_LEN);
   
   stop_logger();
   
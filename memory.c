@@ -19,19 +19,170 @@
 #include "status.h"
 
 #include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 
-#define DEFAULT_MEMORY_BUFFER_CAP 1024
+#define DEFAULT_ARENA_BLOCK_CAP 4096
 
-struct memory_buffer_block{
-  char * data;
-  size_t left;
+/**
+ * Max number of call sites of malloc_checked and realloc_checked that are tracked
+ */
+#define MAX_ALLOC_SITES 512
+
+#define ALLOC_SITE_TABLE_SIZE (2 * MAX_ALLOC_SITES)
+
+struct arena_block{
   size_t cap;
-  struct memory_buffer_block * prev;
-  struct memory_buffer_block * next;
+  size_t used;
+  struct arena_block * next;
+  alignas(max_align_t) char data[];
+};
+
+struct alloc_site{
+  const char * file;
+  int line;
+  enum log_module module;
+};
+
+/**
+ * Call sites in the order they were first seen
+ */
+static struct alloc_site alloc_sites[MAX_ALLOC_SITES];
+
+static atomic_size_t alloc_site_count = 0;
+
+static atomic_bool alloc_sites_full = false;
+
+/**
+ * Open addressing table from call site to site index plus one, zero marks an empty slot
+ * Lookups do not lock, the mutex is only taken to add a site
+ */
+static atomic_int alloc_site_table[ALLOC_SITE_TABLE_SIZE];
+
+static pthread_mutex_t alloc_site_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Counters of a single thread, only the owner writes them
+ * A block is handed to the next thread when its owner exits, so blocks are never freed
+ */
+struct alloc_counters{
+  atomic_size_t counts[MAX_ALLOC_SITES];
+  atomic_size_t sizes[MAX_ALLOC_SITES];
+  atomic_bool owned;
+  struct alloc_counters * next;
 };
 
-void * malloc_checked(size_t amount){
+static _Atomic(struct alloc_counters *) counters = NULL;
+
+static __thread struct alloc_counters * thread_counters = NULL;
+
+static pthread_key_t counters_key;
+
+static atomic_bool tracking = false;
+
+static void release_alloc_counters(void * arg){
+  struct alloc_counters * c = arg;
+  atomic_store_explicit(&c->owned, false, memory_order_release);
+  thread_counters = NULL;
+}
+
+/**
+ * Returns the counters of the calling thread, these are not allocated with malloc_checked
+ */
+static struct alloc_counters * get_alloc_counters(){
+  if(thread_counters != NULL){
+    return thread_counters;
+  }
+  struct alloc_counters * c = atomic_load_explicit(&counters, memory_order_acquire);
+  while(c != NULL){
+    bool expected = false;
+    if(atomic_compare_exchange_strong_explicit(&c->owned, &expected, true, memory_order_acq_rel, memory_order_relaxed)){
+      break;
+    }
+    c = c->next;
+  }
+  if(c == NULL){
+    c = calloc(1, sizeof(struct alloc_counters));
+    if(c == NULL){
+      return NULL;
+    }
+    atomic_init(&c->owned, true);
+    c->next = atomic_load_explicit(&counters, memory_order_relaxed);
+    while(!atomic_compare_exchange_weak_explicit(&counters, &c->next, c, memory_order_release, memory_order_relaxed));
+  }
+  pthread_setspecific(counters_key, c);
+  thread_counters = c;
+  return c;
+}
+
+static size_t hash_alloc_site(const char * file, int line){
+  return (((uintptr_t)file >> 3) * 31 + (size_t)line) * 2654435761u;
+}
+
+/**
+ * Returns the index of a call site, adding it if needed, or -1 if there is no room for it
+ * Call sites are identified by the address of the file name, which is unique per compilation unit
+ */
+static int find_alloc_site(const char * file, int line, enum log_module module){
+  size_t start = hash_alloc_site(file, line) % ALLOC_SITE_TABLE_SIZE;
+  bool locked = false;
+  for(size_t n = 0; n < ALLOC_SITE_TABLE_SIZE; ++n){
+    size_t slot = (start + n) % ALLOC_SITE_TABLE_SIZE;
+    int entry = atomic_load_explicit(&alloc_site_table[slot], memory_order_acquire);
+    if(entry == 0 && !locked){
+      // check again while holding the mutex, another thread may be adding the site
+      pthread_mutex_lock(&alloc_site_mutex);
+      locked = true;
+      entry = atomic_load_explicit(&alloc_site_table[slot], memory_order_acquire);
+    }
+    if(entry == 0){
+      size_t index = atomic_load_explicit(&alloc_site_count, memory_order_relaxed);
+      if(index == MAX_ALLOC_SITES){
+	atomic_store(&alloc_sites_full, true);
+	break;
+      }
+      alloc_sites[index].file = file;
+      alloc_sites[index].line = line;
+      alloc_sites[index].module = module;
+      atomic_store_explicit(&alloc_site_count, index + 1, memory_order_release);
+      atomic_store_explicit(&alloc_site_table[slot], (int)index + 1, memory_order_release);
+      pthread_mutex_unlock(&alloc_site_mutex);
+      return (int)index;
+    }
+    const struct alloc_site * site = &alloc_sites[entry - 1];
+    if(site->file == file && site->line == line){
+      if(locked){
+	pthread_mutex_unlock(&alloc_site_mutex);
+      }
+      return entry - 1;
+    }
+  }
+  if(locked){
+    pthread_mutex_unlock(&alloc_site_mutex);
+  }
+  return -1;
+}
+
+static void track_alloc(const char * file, int line, enum log_module module, size_t size){
+  int site = find_alloc_site(file, line, module);
+  struct alloc_counters * c = get_alloc_counters();
+  if(site < 0 || c == NULL){
+    return;
+  }
+  // single writer, a plain load and store is enough
+  atomic_store_explicit(&c->counts[site], atomic_load_explicit(&c->counts[site], memory_order_relaxed) + 1, memory_order_relaxed);
+  atomic_store_explicit(&c->sizes[site], atomic_load_explicit(&c->sizes[site], memory_order_relaxed) + size, memory_order_relaxed);
+}
+
+void * malloc_checked_at(size_t amount, const char * file, int line, enum log_module module){
+  if(tracking){
+    track_alloc(file, line, module, amount);
+  }
   void * block = malloc(amount);
   if(block == NULL){
     set_status(STATUS_MALLOC_FAILED);
@@ -39,138 +190,205 @@ void * malloc_checked(size_t amount){
   return block;
 }
 
-void init_memory_buffer(struct memory_buffer * buf, size_t cap){
-  assert(buf != NULL);
-
-  if(cap == 0){
-    cap = DEFAULT_MEMORY_BUFFER_CAP;
+void * realloc_checked_at(void * data, size_t amount, const char * file, int line, enum log_module module){
+  if(tracking){
+    track_alloc(file, line, module, amount);
   }
-
-  buf->cap = cap;
-  buf->head = NULL;
-  buf->tail = NULL;
+  void * block = realloc(data, amount);
+  if(block == NULL){
+    set_status(STATUS_MALLOC_FAILED);
+  }
+  return block;
 }
 
-static void detach_block(struct memory_buffer * buf, struct memory_buffer_block * b){
-  assert(buf != NULL);
-  assert(b != NULL);
+void enable_alloc_tracking(){
+  pthread_key_create(&counters_key, release_alloc_counters);
+  atomic_store(&tracking, true);
+}
 
-  if(buf->head == b){
-    if(buf->tail == b){
-      buf->head = NULL;
-      buf->tail = NULL;
-    }else{
-      buf->head = b->next;
-      buf->head->prev = NULL;
+/**
+ * Sums the counters of all threads
+ */
+static void sum_alloc_counters(size_t * counts, size_t * sizes, size_t site_count){
+  for(size_t i = 0; i < site_count; ++i){
+    counts[i] = 0;
+    sizes[i] = 0;
+  }
+  struct alloc_counters * c = atomic_load_explicit(&counters, memory_order_acquire);
+  while(c != NULL){
+    for(size_t i = 0; i < site_count; ++i){
+      counts[i] += atomic_load_explicit(&c->counts[i], memory_order_relaxed);
+      sizes[i] += atomic_load_explicit(&c->sizes[i], memory_order_relaxed);
     }
-  }else if(buf->tail == b){
-    buf->tail = buf->tail->prev;
-    buf->tail->next = NULL;
-  }else{
-    b->prev->next = b->next;
-    b->next->prev = b->prev;
+    c = c->next;
   }
-  b->prev = NULL;
-  b->next = NULL;
 }
 
-static void insert_block(struct memory_buffer * buf, struct memory_buffer_block * b){
-  assert(buf != NULL);
-  assert(b != NULL);
+void log_alloc_report(size_t count){
+  if(!atomic_load(&tracking)){
+    return;
+  }
+  size_t site_count = atomic_load_explicit(&alloc_site_count, memory_order_acquire);
+  size_t counts[MAX_ALLOC_SITES];
+  size_t sizes[MAX_ALLOC_SITES];
+  sum_alloc_counters(counts, sizes, site_count);
 
-  struct memory_buffer_block * p = buf->head;
-  while(p != NULL && p->left > b->left){
-    p = p->next;
+  size_t module_counts[LOG_MODULE_COUNT] = {0};
+  size_t module_sizes[LOG_MODULE_COUNT] = {0};
+  for(size_t i = 0; i < site_count; ++i){
+    module_counts[alloc_sites[i].module] += counts[i];
+    module_sizes[alloc_sites[i].module] += sizes[i];
   }
-  if(p == NULL){
-    if(buf->head == NULL){
-      buf->head = b;
-      buf->tail = b;
-    }else{
-      buf->tail->next = b;
-      b->prev = buf->tail;
-      buf->tail = b;
+  LOG_INFO("allocations per module:");
+  for(int m = 0; m < LOG_MODULE_COUNT; ++m){
+    if(module_counts[m] > 0){
+      LOG_INFO("%s: %zu allocations, %zu bytes", get_log_module_name((enum log_module)m), module_counts[m], module_sizes[m]);
     }
-  }else{
-    p->prev->next = b;
-    b->prev = p->prev;
-    p->prev = b;
-    b->next = b;
+  }
+
+  // selection of the largest sites, the number of sites is small
+  LOG_INFO("top %zu allocation sites:", count);
+  bool reported[MAX_ALLOC_SITES] = {false};
+  for(size_t n = 0; n < count && n < site_count; ++n){
+    size_t max = site_count;
+    for(size_t i = 0; i < site_count; ++i){
+      if(!reported[i] && (max == site_count || sizes[i] > sizes[max])){
+	max = i;
+      }
+    }
+    reported[max] = true;
+    LOG_INFO("%s:%d (%s): %zu allocations, %zu bytes", alloc_sites[max].file, alloc_sites[max].line, get_log_module_name(alloc_sites[max].module), counts[max], sizes[max]);
+  }
+  if(atomic_load(&alloc_sites_full)){
+    LOG_WARNING("more than %d allocation sites, the remaining sites were not tracked", MAX_ALLOC_SITES);
   }
 }
 
-static struct memory_buffer_block * create_block(struct memory_buffer * buf, size_t len){
-  size_t cap = buf->cap;
-  if(cap < len){
-    cap = len;
+void init_arena(struct arena * arena, size_t block_cap){
+  assert(arena != NULL);
+
+  if(block_cap == 0){
+    block_cap = DEFAULT_ARENA_BLOCK_CAP;
   }
-  struct memory_buffer_block * b = malloc_checked(sizeof(struct memory_buffer_block));
-  if(b == NULL){
+  arena->block_cap = block_cap;
+  arena->head = NULL;
+  arena->current = NULL;
+}
+
+/**
+ * Returns the offset in the block at which an allocation fits or SIZE_MAX if it does not
+ */
+static size_t fit_in_arena_block(const struct arena_block * b, size_t size, size_t align){
+  uintptr_t pos = (uintptr_t)(b->data + b->used);
+  size_t offset = b->used + (size_t)((align - (pos & (align - 1))) & (align - 1));
+  if(offset > b->cap || b->cap - offset < size){
+    return SIZE_MAX;
+  }
+  return offset;
+}
+
+/**
+ * Creates a block that can hold the allocation and links it after the current block
+ */
+static struct arena_block * add_arena_block(struct arena * arena, size_t size, size_t align){
+  size_t cap = arena->block_cap;
+  // the data of a block is aligned to max_align_t, larger alignments may need padding
+  size_t min_cap = size + (align > alignof(max_align_t) ? align : 0);
+  if(min_cap < size){
+    set_status(STATUS_MALLOC_FAILED);
     return NULL;
   }
-  b->data = malloc_checked(cap);
-  if(b->data == NULL){
-    free(b);
+  if(cap < min_cap){
+    cap = min_cap;
+  }
+  struct arena_block * b = malloc_checked(sizeof(struct arena_block) + cap);
+  if(b == NULL){
     return NULL;
   }
   b->cap = cap;
-  b->left = cap;
-  b->prev = NULL;
-  b->next = NULL;
+  b->used = 0;
+  if(arena->current == NULL){
+    b->next = arena->head;
+    arena->head = b;
+  }else{
+    b->next = arena->current->next;
+    arena->current->next = b;
+  }
   return b;
 }
 
-static struct memory_buffer_block * find_block(struct memory_buffer * buf, size_t len){
-  struct memory_buffer_block * b = buf->head;
-  if(b == NULL || b->left < len){
-    return NULL;
-  }else{
-    while(b->next != NULL && b->next->left >= len){
-      b = b->next;
+void * alloc_from_arena(struct arena * arena, size_t size, size_t align){
+  assert(arena != NULL);
+  assert(align != 0 && (align & (align - 1)) == 0);
+
+  struct arena_block * b = arena->current;
+  size_t offset = b == NULL ? SIZE_MAX : fit_in_arena_block(b, size, align);
+  if(offset == SIZE_MAX){
+    // the free block after the current one is reused if it is large enough
+    struct arena_block * next = b == NULL ? arena->head : b->next;
+    if(next != NULL){
+      next->used = 0;
+      offset = fit_in_arena_block(next, size, align);
     }
-    return b;
+    if(offset == SIZE_MAX){
+      next = add_arena_block(arena, size, align);
+      if(next == NULL){
+	return NULL;
+      }
+      offset = fit_in_arena_block(next, size, align);
+      assert(offset != SIZE_MAX);
+    }
+    b = next;
+    arena->current = b;
   }
+  b->used = offset + size;
+  return b->data + offset;
 }
 
-static char * copy_to_block(struct memory_buffer_block * dest, const char * src, size_t len){
+void * copy_to_arena(struct arena * dest, const void * src, size_t len){
   assert(dest != NULL);
   assert(src != NULL);
-  assert(dest->left >= len);
-  char * pos = dest->data + dest->cap - dest->left;
-  memcpy(pos, src, len);
-  dest->left-=len;
+
+  void * pos = alloc_from_arena(dest, len, 1);
+  if(pos != NULL){
+    memcpy(pos, src, len);
+  }
   return pos;
 }
 
-void * copy_to_memory_buffer(struct memory_buffer * dest, const void * src, size_t len){
-  assert(dest != NULL);
-  assert(src != NULL);
-  assert(len != 0);
-  
-  struct memory_buffer_block * b = find_block(dest, len);
-  char * pos;
-  if(b == NULL){
-    b = create_block(dest, len);
-    if(b == NULL){
-      return NULL;
-    }
-    pos = copy_to_block(b, src, len);
-    insert_block(dest, b);
+struct arena_mark mark_arena(const struct arena * arena){
+  assert(arena != NULL);
+
+  struct arena_mark mark = {arena->current, arena->current == NULL ? 0 : arena->current->used};
+  return mark;
+}
+
+void rewind_arena(struct arena * arena, struct arena_mark mark){
+  assert(arena != NULL);
+
+  if(mark.block == NULL){
+    reset_arena(arena);
   }else{
-    detach_block(dest, b);
-    pos = copy_to_block(b, src, len);
-    insert_block(dest, b);
+    arena->current = mark.block;
+    mark.block->used = mark.used;
   }
-  return pos;
 }
 
-void dispose_memory_buffer(struct memory_buffer * buf){
-  assert(buf != NULL);
-  struct memory_buffer_block * b = buf->head;
+void reset_arena(struct arena * arena){
+  assert(arena != NULL);
+
+  arena->current = NULL;
+}
+
+void dispose_arena(struct arena * arena){
+  assert(arena != NULL);
+
+  struct arena_block * b = arena->head;
   while(b != NULL){
-    struct memory_buffer_block * n = b->next;
-    free(b->data);
+    struct arena_block * next = b->next;
     free(b);
-    b = n;
+    b = next;
   }
+  arena->head = NULL;
+  arena->current = NULL;
 }
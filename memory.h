@@ -18,23 +18,86 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
+#include "logger.h"
+
 #include <stdlib.h>
 
-void * malloc_checked(size_t size);
+/**
+ * Allocates memory and sets the status on failure
+ * When allocation tracking is enabled the allocation is counted for its call site and the module of the caller
+ */
+#define malloc_checked(size) malloc_checked_at((size), __FILE__, __LINE__, LOG_MODULE)
+
+#define realloc_checked(data, size) realloc_checked_at((data), (size), __FILE__, __LINE__, LOG_MODULE)
+
+void * malloc_checked_at(size_t size, const char * file, int line, enum log_module module);
+
+void * realloc_checked_at(void * data, size_t size, const char * file, int line, enum log_module module);
+
+/**
+ * Starts counting the allocations of every call site, should be called before other threads are started
+ * Counting only adds to counters of the calling thread, so it does not serialize allocating threads
+ */
+void enable_alloc_tracking();
+
+/**
+ * Number of call sites in the reports written on SIGUSR1 and at shutdown
+ */
+#define ALLOC_REPORT_LEN 10
 
-struct memory_buffer_block;
+/**
+ * Logs the call sites and modules with the most allocated bytes since tracking was enabled
+ */
+void log_alloc_report(size_t count);
+
+struct arena_block;
 
-struct memory_buffer{
-  size_t cap;
-  struct memory_buffer_block * head;
-  struct memory_buffer_block * tail;
+/**
+ * A bump pointer allocator, all memory is released at once by resetting or disposing the arena
+ * Blocks are kept after a reset or rewind so a scratch arena stops allocating once it has grown to its working set
+ */
+struct arena{
+  size_t block_cap;
+  struct arena_block * head;
+  /**
+   * The block allocations are taken from, the blocks after it are free
+   */
+  struct arena_block * current;
 };
 
-void init_memory_buffer(struct memory_buffer * buf, size_t cap);
+/**
+ * A position in an arena, rewinding to it releases everything allocated after it
+ */
+struct arena_mark{
+  struct arena_block * block;
+  size_t used;
+};
+
+/**
+ * Initializes an empty arena, a block cap of zero selects the default
+ */
+void init_arena(struct arena * arena, size_t block_cap);
+
+/**
+ * Allocates memory aligned to align, which must be a power of two
+ */
+void * alloc_from_arena(struct arena * arena, size_t size, size_t align);
 
-void * copy_to_memory_buffer(struct memory_buffer * dest, const void * src, size_t len);
+void * copy_to_arena(struct arena * dest, const void * src, size_t len);
+
+struct arena_mark mark_arena(const struct arena * arena);
+
+/**
+ * Releases all allocations made after the mark was taken
+ */
+void rewind_arena(struct arena * arena, struct arena_mark mark);
+
+/**
+ * Releases all allocations but keeps the blocks
+ */
+void reset_arena(struct arena * arena);
 
-void dispose_memory_buffer(struct memory_buffer * buf);
+void dispose_arena(struct arena * arena);
 
 
 #endif
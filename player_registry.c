@@ -0,0 +1,188 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#define LOG_MODULE LOG_MODULE_SERVER
+
+#include "logger.h"
+#include "player_registry.h"
+#include "status.h"
+#include "unicode.h"
+
+#include <assert.h>
+#include <string.h>
+
+int init_player_registry(struct player_registry * r){
+  assert(r != NULL);
+
+  // maps that were not initialized are empty, so a partially initialized registry can be disposed
+  memset(r, 0, sizeof(struct player_registry));
+  if(init_ptr_hash_map(&r->by_name, hash_map_hash_unicode_str, hash_map_eq_unicode_str, GAME_MAX_PLAYER_COUNT)
+     || init_ptr_hash_map(&r->by_channel, hash_map_hash_int, hash_map_eq_int, GAME_MAX_PLAYER_COUNT)
+     || init_ptr_hash_map(&r->by_token, hash_map_hash_str, hash_map_eq_str, GAME_MAX_PLAYER_COUNT)){
+    return -1;
+  }
+  return 0;
+}
+
+struct server_player * add_registry_player_at(struct player_registry * r, int id, const char32_t * name){
+  assert(r != NULL);
+  assert(id >= 0 && id < GAME_MAX_PLAYER_COUNT);
+  assert(!r->players[id].active);
+  assert(name != NULL);
+
+  if(get_from_ptr_hash_map(&r->by_name, name) != NULL){
+    set_status(STATUS_DUPLICATE_PLAYER_NAME);
+    return NULL;
+  }
+  struct server_player * p = &r->players[id];
+  unicode_strcpy(p->name, name);
+  if(insert_new_into_ptr_hash_map(&r->by_name, p->name, p)){
+    return NULL;
+  }
+  p->id = id;
+  p->active = true;
+  p->channel = -1;
+  p->session.token[0] = '\0';
+  ++r->count;
+  return p;
+}
+
+struct server_player * add_registry_player(struct player_registry * r, const char32_t * name){
+  assert(r != NULL);
+  assert(name != NULL);
+
+  if(r->count == GAME_MAX_PLAYER_COUNT){
+    set_status(STATUS_MAX_PLAYER_COUNT_REACHED);
+    return NULL;
+  }
+  for(int i = 0; i < GAME_MAX_PLAYER_COUNT; ++i){
+    if(!r->players[i].active){
+      return add_registry_player_at(r, i, name);
+    }
+  }
+  assert(false);
+  return NULL;
+}
+
+void remove_registry_player(struct player_registry * r, struct server_player * p){
+  assert(r != NULL);
+  assert(p != NULL);
+  assert(p->active);
+
+  set_registry_player_channel(r, p, -1);
+  if(p->session.token[0] != '\0' && get_from_ptr_hash_map(&r->by_token, p->session.token) == p){
+    remove_from_ptr_hash_map(&r->by_token, p->session.token);
+  }
+  remove_from_ptr_hash_map(&r->by_name, p->name);
+  p->active = false;
+  --r->count;
+}
+
+struct server_player * get_registry_player(struct player_registry * r, int id){
+  assert(r != NULL);
+
+  if(id < 0 || id >= GAME_MAX_PLAYER_COUNT || !r->players[id].active){
+    return NULL;
+  }
+  return &r->players[id];
+}
+
+struct server_player * find_registry_player_by_name(struct player_registry * r, const char32_t * name){
+  assert(r != NULL);
+  assert(name != NULL);
+
+  return get_from_ptr_hash_map(&r->by_name, name);
+}
+
+uint32_t get_registry_channel_players(struct player_registry * r, int channel){
+  assert(r != NULL);
+
+  struct registry_channel * c = get_from_ptr_hash_map(&r->by_channel, &channel);
+  return c == NULL ? 0 : c->players;
+}
+
+struct server_player * find_registry_player_by_token(struct player_registry * r, const char * token){
+  assert(r != NULL);
+  assert(token != NULL);
+
+  return get_from_ptr_hash_map(&r->by_token, token);
+}
+
+static void detach_registry_channel(struct player_registry * r, struct server_player * p){
+  struct registry_channel * c = get_from_ptr_hash_map(&r->by_channel, &p->channel);
+  assert(c != NULL);
+  c->players &= ~(((uint32_t)1) << p->id);
+  if(c->players == 0){
+    remove_from_ptr_hash_map(&r->by_channel, &c->channel);
+  }
+  p->channel = -1;
+}
+
+static int attach_registry_channel(struct player_registry * r, struct server_player * p, int channel){
+  struct registry_channel * c = get_from_ptr_hash_map(&r->by_channel, &channel);
+  if(c == NULL){
+    for(int i = 0; i < GAME_MAX_PLAYER_COUNT; ++i){
+      if(r->channels[i].players == 0){
+	c = &r->channels[i];
+	break;
+      }
+    }
+    assert(c != NULL);
+    c->channel = channel;
+    if(insert_new_into_ptr_hash_map(&r->by_channel, &c->channel, c)){
+      return -1;
+    }
+  }
+  c->players |= ((uint32_t)1) << p->id;
+  p->channel = channel;
+  return 0;
+}
+
+int set_registry_player_channel(struct player_registry * r, struct server_player * p, int channel){
+  assert(r != NULL);
+  assert(p != NULL);
+  assert(p->active);
+
+  if(p->channel == channel){
+    return 0;
+  }
+  if(p->channel != -1){
+    detach_registry_channel(r, p);
+  }
+  if(channel != -1 && attach_registry_channel(r, p, channel)){
+    LOG_ERROR("server: unable to attach player %d to channel %d", p->id, channel);
+    return -1;
+  }
+  return 0;
+}
+
+int index_registry_player_token(struct player_registry * r, struct server_player * p){
+  assert(r != NULL);
+  assert(p != NULL);
+  assert(p->active);
+  assert(p->session.token[0] != '\0');
+
+  return insert_new_into_ptr_hash_map(&r->by_token, p->session.token, p);
+}
+
+void dispose_player_registry(struct player_registry * r){
+  assert(r != NULL);
+
+  dispose_ptr_hash_map(&r->by_name);
+  dispose_ptr_hash_map(&r->by_channel);
+  dispose_ptr_hash_map(&r->by_token);
+}
@@ -0,0 +1,109 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PLAYER_REGISTRY_H
+#define PLAYER_REGISTRY_H
+
+#include "game.h"
+#include "hash_map.h"
+#include "server_session.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <uchar.h>
+
+struct server_player{
+  int id;
+  bool active;
+  char32_t name[GAME_MAX_PLAYER_NAME_LEN + 1];
+  /**
+   * Channel the player is indexed by, -1 while the player is detached
+   */
+  int channel;
+  struct server_session session;
+};
+
+/**
+ * The players attached to a channel, a connection can carry several local players
+ */
+struct registry_channel{
+  int channel;
+  /**
+   * Bit i is set if player i is attached, entries without players are free
+   */
+  uint32_t players;
+};
+
+/**
+ * The players of the server, indexed by id, name, channel and session token
+ * Player ids are slots in the player array, the other keys are looked up in hash maps
+ * whose keys point into the player records, or into the channel records for by_channel
+ */
+struct player_registry{
+  struct server_player players[GAME_MAX_PLAYER_COUNT];
+  size_t count;
+  /**
+   * Every player is attached to at most one channel, so there can be no more channels than players
+   */
+  struct registry_channel channels[GAME_MAX_PLAYER_COUNT];
+  struct ptr_hash_map by_name;
+  struct ptr_hash_map by_channel;
+  struct ptr_hash_map by_token;
+};
+
+/**
+ * On failure the registry must still be disposed
+ */
+int init_player_registry(struct player_registry * r);
+
+/**
+ * Adds a player in the first free slot and returns it, or NULL if the name is taken or the registry is full
+ * The player has no channel and no session token yet
+ */
+struct server_player * add_registry_player(struct player_registry * r, const char32_t * name);
+
+/**
+ * Adds a player in a given free slot, used when a snapshot is restored
+ */
+struct server_player * add_registry_player_at(struct player_registry * r, int id, const char32_t * name);
+
+void remove_registry_player(struct player_registry * r, struct server_player * p);
+
+struct server_player * get_registry_player(struct player_registry * r, int id);
+
+struct server_player * find_registry_player_by_name(struct player_registry * r, const char32_t * name);
+
+/**
+ * Returns the ids of the players attached to the channel as a bit mask
+ */
+uint32_t get_registry_channel_players(struct player_registry * r, int channel);
+
+struct server_player * find_registry_player_by_token(struct player_registry * r, const char * token);
+
+/**
+ * Moves a player to another channel, -1 removes the player from the channel index
+ */
+int set_registry_player_channel(struct player_registry * r, struct server_player * p, int channel);
+
+/**
+ * Indexes the session token, which must be set and must not change afterwards
+ */
+int index_registry_player_token(struct player_registry * r, struct server_player * p);
+
+void dispose_player_registry(struct player_registry * r);
+
+#endif
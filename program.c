@@ -18,6 +18,8 @@
 #include "client.h"
 #include "client_state.h"
 #include "ipc.h"
+#include "journal.h"
+#include "loadgen.h"
 #include "logger.h"
 #include "program.h"
 #include "resource.h"
@@ -29,6 +31,8 @@
 
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
 #include <unistd.h>
 
 static struct program_settings settings;
@@ -106,19 +110,51 @@ static bool is_running(){
   return result;
 }
 
+/**
+ * Appends the input of a server update to the journal
+ * Wake ups without a message flush the journal, so a crash loses little more than one tick of input
+ */
+static int journal_server_input(struct journal_writer * journal, const struct ipc_msg * msg, const struct timespec * now){
+  if(msg != NULL){
+    return append_journal_msg(journal, msg, now);
+  }
+  if(append_journal_tick(journal, now)){
+    return -1;
+  }
+  return flush_journal_writer(journal);
+}
+
 static void * run_server_loop(void * arg){
 
   init_thread();
 
-  init_server_state();
+  struct journal_writer journal;
+  bool journaling = false;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
   
   server_result = 0;
+  if(settings.journal_path != NULL){
+    if(open_journal_writer(&journal, settings.journal_path, &now)){
+      server_result = -1;
+    }else{
+      journaling = true;
+      set_server_state_journal(&journal);
+    }
+  }
+  
+  if(server_result == 0){
+    server_result = init_server_state(&now);
+  }
   
   if(server_result == 0){
     while(true){
       struct ipc_msg * msg;
+      struct timespec deadline;
 
-      if(receive_server_msg(&msg)){
+      // wake up for the next simulation tick even if no messages arrive
+      get_server_tick_deadline(&deadline);
+      if(timed_receive_server_msg(&msg, &deadline)){
 	if(get_status() == STATUS_IPC_QUEUE_STOPPED){
 	  LOG_INFO("server loop will exit because there are no more messages");
 	}else{
@@ -128,11 +164,20 @@ static void * run_server_loop(void * arg){
 	break;
       }
 
-      if(update_server_state(msg)){
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if(journaling && journal_server_input(&journal, msg, &now)){
+	LOG_ERROR("server: could not write journal, journaling stopped");
+	set_server_state_journal(NULL);
+	close_journal_writer(&journal);
+	journaling = false;
 	server_result = -1;
       }
       
-      if(discard_server_msg(msg)){
+      if(update_server_state(msg, &now)){
+	server_result = -1;
+      }
+      
+      if(msg != NULL && discard_server_msg(msg)){
 	LOG_ERROR("server loop will exit due to an error");
 	server_result = -1;
 	break;
@@ -141,26 +186,120 @@ static void * run_server_loop(void * arg){
   }
 
   dispose_server_state();
+
+  if(journaling){
+    set_server_state_journal(NULL);
+    if(close_journal_writer(&journal)){
+      server_result = -1;
+    }
+  }
   
   return (void *)&server_result;
 }
 
+static int replay_journal_record(const struct journal_record * record){
+  if(record->type == JOURNAL_RECORD_TICK){
+    return update_server_state(NULL, &record->time);
+  }
+  if(record->type == JOURNAL_RECORD_TOKEN){
+    LOG_ERROR("replay: unexpected session token in journal record %llu", (unsigned long long)record->seq);
+    set_status(STATUS_INVALID_JOURNAL);
+    return -1;
+  }
+  struct ipc_msg * msg = create_server_msg();
+  if(msg == NULL){
+    return -1;
+  }
+  msg->type = record->msg_type;
+  msg->sender = record->channel;
+  msg->payload = record->payload;
+  int result = update_server_state(msg, &record->time);
+  if(discard_server_msg(msg)){
+    result = -1;
+  }
+  return result;
+}
+
+/**
+ * Feeds a journal through the server state as fast as possible, without clients or sockets
+ * Errors while handling a record are counted but do not stop the replay, as in the server loop,
+ * unless the journal no longer matches what the server state does
+ */
+static int run_server_replay(){
+  struct journal_reader journal;
+  if(open_journal_reader(&journal, settings.replay_path)){
+    return -1;
+  }
+  if(init_headless_server()){
+    close_journal_reader(&journal);
+    return -1;
+  }
+  set_server_state_replay(&journal);
+
+  int result = init_server_state(&journal.start);
+  size_t record_count = 0;
+  size_t error_count = 0;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while(result == 0){
+    struct journal_record record;
+    int read = read_journal_record(&journal, &record);
+    if(read == 1){
+      break;
+    }
+    if(read == -1){
+      result = -1;
+      break;
+    }
+    ++record_count;
+    if(replay_journal_record(&record)){
+      if(get_status() == STATUS_INVALID_JOURNAL){
+	// the replay no longer follows the recorded run
+	result = -1;
+	break;
+      }
+      ++error_count;
+    }
+  }
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  
+  dispose_server_state();
+  set_server_state_replay(NULL);
+  if(dispose_server()){
+    result = -1;
+  }
+  close_journal_reader(&journal);
+
+  double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("replay: %zu records in %.3f s (%.0f records/s), %zu errors, %zu messages sent\n",
+	 record_count, elapsed, elapsed > 0.0 ? record_count / elapsed : 0.0, error_count, get_headless_server_sent_count());
+  return result;
+}
+
 static void * run_client_loop(void * arg){
 
   init_thread();
   
   LOG_DEBUG("client loop started");
   
-  init_client_state();
+  init_client_state(settings.player_names, settings.player_count);
   
   while(true){
     if(!is_running()){
       break;
     }
 
-    if(receive_client_messages()){
-      LOG_ERROR("client loop will exit due to an error");
-      client_result = -1;
+    // wake up for the next timer even if no messages arrive, stopping the client ends the wait
+    struct timespec deadline;
+    bool timed = get_client_state_deadline(&deadline);
+    if(wait_for_client_messages(timed ? &deadline : NULL)){
+      if(get_status() == STATUS_IPC_QUEUE_STOPPED){
+	LOG_INFO("client loop will exit because there are no more messages");
+      }else{
+	LOG_ERROR("client loop will exit due to an error");
+	client_result = -1;
+      }
       break;
     }
 
@@ -168,8 +307,6 @@ static void * run_client_loop(void * arg){
       client_result = -1;
       break;
     }
-    
-    sleep(1);
   }
 
   dispose_client_state();
@@ -260,6 +397,12 @@ int run_program_loop(const struct program_settings * s){
   if(init_resources(settings.resource_path, settings.language)){
     return -1;
   }
+
+  if(settings.replay_path != NULL){
+    int result = run_server_replay();
+    dispose_resources();
+    return result;
+  }
   
   LOG_DEBUG("starting program loop...");
   
@@ -296,10 +439,16 @@ int run_program_loop(const struct program_settings * s){
       result = -1;
     }
   }
+
+  if(settings.loadgen_count > 0){
+    if(start_loadgen(settings.loadgen_count, settings.ping_rate)){
+      result = -1;
+    }
+  }
   
   if(result == 0){
    
-    if(settings.server || settings.client){
+    if(settings.server || settings.client || settings.loadgen_count > 0){
 
       LOG_DEBUG("program loop started");
 
@@ -316,7 +465,7 @@ int run_program_loop(const struct program_settings * s){
       }
       LOG_DEBUG("stopping program loop...");
     }else{
-      LOG_DEBUG("neither client or server is configured to run -> shutting down");
+      LOG_DEBUG("neither client, server or load generator is configured to run -> shutting down");
     }
     
   }
@@ -337,6 +486,11 @@ int run_program_loop(const struct program_settings * s){
       result = -1;
     }
   }
+  if(settings.loadgen_count > 0){
+    if(stop_loadgen()){
+      result = -1;
+    }
+  }
   
   if(wait_for_program_stop()){
     result = -1;
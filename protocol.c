@@ -15,6 +15,8 @@
  *
  */
 
+#define LOG_MODULE LOG_MODULE_PROTOCOL
+
 #include "logger.h"
 #include "protocol.h"
 #include "status.h"
@@ -31,7 +33,14 @@ static const char * msg_headers[] = {
   "AUTHENTICATION REQUEST",
   "AUTHENTICATION RESPONSE",
   "CLOSE REQUEST",
-  "CLOSE RESPONSE"
+  "CLOSE RESPONSE",
+  "RESUME REQUEST",
+  "RESUME RESPONSE",
+  "ENTITY ENTER",
+  "ENTITY UPDATE",
+  "ENTITY LEAVE",
+  "PING REQUEST",
+  "PING RESPONSE"
 };
 
 const char * get_protocol_msg_type_label(enum protocol_msg_type type){
@@ -92,7 +101,11 @@ static int read_string(char * buf, size_t size, struct protocol_state * ps){
       LOG_ERROR("error reading byte sequence");
       set_status(STATUS_IO_ERROR);
       return -1;
-    }else if(result == 1){
+    }else if(result == 0){
+      LOG_DEBUG("end of stream while reading byte sequence");
+      set_status(STATUS_END_OF_STREAM);
+      return -1;
+    }else{
       if(c == '\n'){
 	buf[len] = '\0';
 	break;
@@ -138,16 +151,16 @@ static int read_int(int * dest, struct protocol_state * ps){
   return 0;
 }
 
-static int write_int(struct protocol_state * ps, int i){
-  assert(ps != NULL);
-  
-  int result = snprintf(ps->out_buf, PROTOCOL_STATE_OUT_BUF_LEN, "%d", i);
+/**
+ * Writes a value that was formatted into the output buffer, result is the return value of snprintf
+ */
+static int write_formatted(struct protocol_state * ps, int result){
   if(result == -1){
-    LOG_ERROR("error formatting int to byte sequence");
+    LOG_ERROR("error formatting value to byte sequence");
     set_status(STATUS_IO_ERROR);
     return -1;
   }else if(result >= PROTOCOL_STATE_OUT_BUF_LEN){
-    LOG_ERROR("error formatting int to byte sequence: string too long");
+    LOG_ERROR("error formatting value to byte sequence: string too long");
     set_status(STATUS_IO_ERROR);
     return -1;
   }else{
@@ -161,6 +174,57 @@ static int write_int(struct protocol_state * ps, int i){
   }
 }
 
+static int write_int(struct protocol_state * ps, int i){
+  assert(ps != NULL);
+  
+  return write_formatted(ps, snprintf(ps->out_buf, PROTOCOL_STATE_OUT_BUF_LEN, "%d", i));
+}
+
+static int read_uint(unsigned int * dest, struct protocol_state * ps){
+  assert(ps != NULL);
+  
+  if(read_string(ps->in_buf, PROTOCOL_STATE_IN_BUF_LEN, ps)){
+    return -1;
+  }
+
+  if(sscanf(ps->in_buf, "%u", dest) != 1){
+    LOG_ERROR("error reading unsigned int");
+    set_status(STATUS_PROTOCOL_ERROR);
+    return -1;
+  }
+  return 0;
+}
+
+static int write_uint(struct protocol_state * ps, unsigned int i){
+  assert(ps != NULL);
+  
+  return write_formatted(ps, snprintf(ps->out_buf, PROTOCOL_STATE_OUT_BUF_LEN, "%u", i));
+}
+
+static int read_double(double * dest, struct protocol_state * ps){
+  assert(ps != NULL);
+  
+  if(read_string(ps->in_buf, PROTOCOL_STATE_IN_BUF_LEN, ps)){
+    return -1;
+  }
+
+  if(sscanf(ps->in_buf, "%lf", dest) != 1){
+    LOG_ERROR("error reading double");
+    set_status(STATUS_PROTOCOL_ERROR);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Doubles are written with enough digits to be read back exactly
+ */
+static int write_double(struct protocol_state * ps, double d){
+  assert(ps != NULL);
+  
+  return write_formatted(ps, snprintf(ps->out_buf, PROTOCOL_STATE_OUT_BUF_LEN, "%.17g", d));
+}
+
 static int read_unicode_string(char32_t * buf, size_t size, struct protocol_state * ps){
   assert(buf != NULL);
   assert(ps != NULL);
@@ -181,7 +245,11 @@ static int read_unicode_string(char32_t * buf, size_t size, struct protocol_stat
 	  LOG_ERROR("error while reading UTF-8 sequence");
 	  set_status(STATUS_IO_ERROR);
 	  return -1;
-	}else if(result == 1){
+	}else if(result == 0){
+	  LOG_DEBUG("end of stream while reading UTF-8 sequence");
+	  set_status(STATUS_END_OF_STREAM);
+	  return -1;
+	}else{
 	  if(*in_buf == '\n'){
 	    eof = true;
 	    break;
@@ -300,7 +368,7 @@ static int read_auth_req_body(struct protocol_auth_req * msg, struct protocol_st
   assert(msg != NULL);
   assert(ps != NULL);
 
-  if(read_unicode_string(msg->name, GAME_MAX_PLAYER_NAME_LEN, ps)){
+  if(read_uint(&msg->correlation_id, ps) || read_unicode_string(msg->name, GAME_MAX_PLAYER_NAME_LEN, ps)){
     return -1;
   }
   
@@ -311,7 +379,7 @@ static int write_auth_req_body(struct protocol_state * ps, const struct protocol
   assert(ps != NULL);
   assert(msg != NULL);
 
-  if(write_unicode_string(ps, msg->name)){
+  if(write_uint(ps, msg->correlation_id) || write_unicode_string(ps, msg->name)){
     return -1;
   }
   return 0;
@@ -321,20 +389,26 @@ static int read_auth_res_body(struct protocol_auth_res * msg, struct protocol_st
   assert(msg != NULL);
   assert(ps != NULL);
   
-  if(read_int(&msg->id, ps)){
+  if(read_uint(&msg->correlation_id, ps) || read_int(&msg->id, ps)){
     return -1;
   }
-  return read_string(msg->reason, PROTOCOL_MAX_REASON_LEN, ps);
+  if(read_string(msg->reason, PROTOCOL_MAX_REASON_LEN, ps)){
+    return -1;
+  }
+  return read_string(msg->token, PROTOCOL_SESSION_TOKEN_LEN + 1, ps);
 }
 
 static int write_auth_res_body(struct protocol_state * ps, const struct protocol_auth_res * msg){
   assert(ps != NULL);
   assert(msg != NULL);
 
-  if(write_int(ps, msg->id)){
+  if(write_uint(ps, msg->correlation_id) || write_int(ps, msg->id)){
     return -1;
   }
-  return write_string(ps, msg->reason);
+  if(write_string(ps, msg->reason)){
+    return -1;
+  }
+  return write_string(ps, msg->token);
 }
 
 static int read_close_req_body(struct protocol_close_req * msg, struct protocol_state * ps){
@@ -372,6 +446,100 @@ static int write_close_res_body(struct protocol_state * ps, const struct protoco
 }
 
 
+static int read_resume_req_body(struct protocol_resume_req * msg, struct protocol_state * ps){
+  assert(msg != NULL);
+  assert(ps != NULL);
+
+  if(read_uint(&msg->correlation_id, ps) || read_string(msg->token, PROTOCOL_SESSION_TOKEN_LEN + 1, ps)){
+    return -1;
+  }
+  return read_int(&msg->last_seq, ps);
+}
+
+static int write_resume_req_body(struct protocol_state * ps, const struct protocol_resume_req * msg){
+  assert(ps != NULL);
+  assert(msg != NULL);
+
+  if(write_uint(ps, msg->correlation_id) || write_string(ps, msg->token)){
+    return -1;
+  }
+  return write_int(ps, msg->last_seq);
+}
+
+static int read_resume_res_body(struct protocol_resume_res * msg, struct protocol_state * ps){
+  assert(msg != NULL);
+  assert(ps != NULL);
+
+  if(read_uint(&msg->correlation_id, ps) || read_int(&msg->id, ps)){
+    return -1;
+  }
+  return read_string(msg->reason, PROTOCOL_MAX_REASON_LEN, ps);
+}
+
+static int write_resume_res_body(struct protocol_state * ps, const struct protocol_resume_res * msg){
+  assert(ps != NULL);
+  assert(msg != NULL);
+
+  if(write_uint(ps, msg->correlation_id) || write_int(ps, msg->id)){
+    return -1;
+  }
+  return write_string(ps, msg->reason);
+}
+
+static int read_entity_body(struct protocol_entity * msg, struct protocol_state * ps){
+  assert(msg != NULL);
+  assert(ps != NULL);
+
+  if(read_uint(&msg->id, ps) || read_int(&msg->owner, ps)){
+    return -1;
+  }
+  if(read_double(&msg->x, ps) || read_double(&msg->y, ps) || read_double(&msg->vx, ps) || read_double(&msg->vy, ps)){
+    return -1;
+  }
+  return read_int(&msg->health, ps);
+}
+
+static int write_entity_body(struct protocol_state * ps, const struct protocol_entity * msg){
+  assert(ps != NULL);
+  assert(msg != NULL);
+
+  if(write_uint(ps, msg->id) || write_int(ps, msg->owner)){
+    return -1;
+  }
+  if(write_double(ps, msg->x) || write_double(ps, msg->y) || write_double(ps, msg->vx) || write_double(ps, msg->vy)){
+    return -1;
+  }
+  return write_int(ps, msg->health);
+}
+
+static int read_entity_leave_body(struct protocol_entity_leave * msg, struct protocol_state * ps){
+  assert(msg != NULL);
+  assert(ps != NULL);
+
+  return read_uint(&msg->id, ps);
+}
+
+static int write_entity_leave_body(struct protocol_state * ps, const struct protocol_entity_leave * msg){
+  assert(ps != NULL);
+  assert(msg != NULL);
+
+  return write_uint(ps, msg->id);
+}
+
+static int read_ping_body(struct protocol_ping * msg, struct protocol_state * ps){
+  assert(msg != NULL);
+  assert(ps != NULL);
+
+  return read_double(&msg->time, ps);
+}
+
+static int write_ping_body(struct protocol_state * ps, const struct protocol_ping * msg){
+  assert(ps != NULL);
+  assert(msg != NULL);
+
+  return write_double(ps, msg->time);
+}
+
 int read_protocol_msg(struct protocol_state * ps, struct protocol_msg * msg, int fd){
   assert(msg != NULL);
   assert(ps != NULL);
@@ -381,6 +549,12 @@ int read_protocol_msg(struct protocol_state * ps, struct protocol_msg * msg, int
   if(read_msg_header(&msg->type, ps)){
     return -1;
   }
+  if(read_int(&msg->player, ps)){
+    return -1;
+  }
+  if(read_int(&msg->seq, ps)){
+    return -1;
+  }
   switch(msg->type){
   case PROTOCOL_MSG_TYPE_AUTH_REQ:
    return read_auth_req_body(&msg->auth_req, ps);
@@ -390,6 +564,20 @@ int read_protocol_msg(struct protocol_state * ps, struct protocol_msg * msg, int
     return read_close_req_body(&msg->close_req, ps);
   case PROTOCOL_MSG_TYPE_CLOSE_RES:
     return read_close_res_body(&msg->close_res, ps);
+  case PROTOCOL_MSG_TYPE_RESUME_REQ:
+    return read_resume_req_body(&msg->resume_req, ps);
+  case PROTOCOL_MSG_TYPE_RESUME_RES:
+    return read_resume_res_body(&msg->resume_res, ps);
+  case PROTOCOL_MSG_TYPE_ENTITY_ENTER:
+    return read_entity_body(&msg->entity_enter, ps);
+  case PROTOCOL_MSG_TYPE_ENTITY_UPDATE:
+    return read_entity_body(&msg->entity_update, ps);
+  case PROTOCOL_MSG_TYPE_ENTITY_LEAVE:
+    return read_entity_leave_body(&msg->entity_leave, ps);
+  case PROTOCOL_MSG_TYPE_PING_REQ:
+    return read_ping_body(&msg->ping_req, ps);
+  case PROTOCOL_MSG_TYPE_PING_RES:
+    return read_ping_body(&msg->ping_res, ps);
   }
   return 0;
 }
@@ -403,6 +591,12 @@ int write_protocol_msg(struct protocol_state * ps, int fd, const struct protocol
   if(write_msg_header(ps, msg_headers[(int)msg->type])){
     return -1;
   }
+  if(write_int(ps, msg->player)){
+    return -1;
+  }
+  if(write_int(ps, msg->seq)){
+    return -1;
+  }
   switch(msg->type){
   case PROTOCOL_MSG_TYPE_AUTH_REQ:
     return write_auth_req_body(ps, &msg->auth_req);
@@ -412,6 +606,20 @@ int write_protocol_msg(struct protocol_state * ps, int fd, const struct protocol
     return write_close_req_body(ps, &msg->close_req);
   case PROTOCOL_MSG_TYPE_CLOSE_RES:
     return write_close_res_body(ps, &msg->close_res);
+  case PROTOCOL_MSG_TYPE_RESUME_REQ:
+    return write_resume_req_body(ps, &msg->resume_req);
+  case PROTOCOL_MSG_TYPE_RESUME_RES:
+    return write_resume_res_body(ps, &msg->resume_res);
+  case PROTOCOL_MSG_TYPE_ENTITY_ENTER:
+    return write_entity_body(ps, &msg->entity_enter);
+  case PROTOCOL_MSG_TYPE_ENTITY_UPDATE:
+    return write_entity_body(ps, &msg->entity_update);
+  case PROTOCOL_MSG_TYPE_ENTITY_LEAVE:
+    return write_entity_leave_body(ps, &msg->entity_leave);
+  case PROTOCOL_MSG_TYPE_PING_REQ:
+    return write_ping_body(ps, &msg->ping_req);
+  case PROTOCOL_MSG_TYPE_PING_RES:
+    return write_ping_body(ps, &msg->ping_res);
   }
   return -1;
 }
@@ -423,27 +631,114 @@ void dispose_protocol_state(struct protocol_state * ps){
 }
 
 
-void init_protocol_auth_req(struct protocol_msg *msg, const char32_t * name){
+void init_protocol_auth_req(struct protocol_msg *msg, unsigned int correlation_id, const char32_t * name){
   assert(msg != NULL);
   assert(name != NULL);
 
   msg->type = PROTOCOL_MSG_TYPE_AUTH_REQ;
+  msg->player = -1;
+  msg->seq = 0;
   struct protocol_auth_req * body = &msg->auth_req;
-  
+
+  body->correlation_id = correlation_id;
   unicode_strcpy_checked(body->name, GAME_MAX_PLAYER_NAME_LEN, name);
 }
 
 
-void init_protocol_auth_res(struct protocol_msg * msg, int id, const char * reason){
-  assert(msg != NULL);
+void init_protocol_auth_res(struct protocol_msg * msg, unsigned int correlation_id, int id, const char * reason, const char * token){
   assert(msg != NULL);
+  assert(reason != NULL);
+  assert(token != NULL);
   assert(id >= -1);
   assert(strlen(reason) <= PROTOCOL_MAX_REASON_LEN);
+  assert(strlen(token) <= PROTOCOL_SESSION_TOKEN_LEN);
   
   msg->type = PROTOCOL_MSG_TYPE_AUTH_RES;
+  msg->player = id;
+  msg->seq = 0;
   struct protocol_auth_res * body = &msg->auth_res;
 
+  body->correlation_id = correlation_id;
   body->id = id;
   strcpy(body->reason, reason);
+  strcpy(body->token, token);
 }
 
+void init_protocol_resume_req(struct protocol_msg * msg, unsigned int correlation_id, const char * token, int last_seq){
+  assert(msg != NULL);
+  assert(token != NULL);
+  assert(strlen(token) <= PROTOCOL_SESSION_TOKEN_LEN);
+  assert(last_seq >= 0);
+
+  msg->type = PROTOCOL_MSG_TYPE_RESUME_REQ;
+  msg->player = -1;
+  msg->seq = 0;
+  struct protocol_resume_req * body = &msg->resume_req;
+
+  body->correlation_id = correlation_id;
+  strcpy(body->token, token);
+  body->last_seq = last_seq;
+}
+
+void init_protocol_resume_res(struct protocol_msg * msg, unsigned int correlation_id, int id, const char * reason){
+  assert(msg != NULL);
+  assert(reason != NULL);
+  assert(id >= -1);
+  assert(strlen(reason) <= PROTOCOL_MAX_REASON_LEN);
+
+  msg->type = PROTOCOL_MSG_TYPE_RESUME_RES;
+  msg->player = id;
+  msg->seq = 0;
+  struct protocol_resume_res * body = &msg->resume_res;
+
+  body->correlation_id = correlation_id;
+  body->id = id;
+  strcpy(body->reason, reason);
+}
+
+void init_protocol_entity_enter(struct protocol_msg * msg, int player, const struct protocol_entity * entity){
+  assert(msg != NULL);
+  assert(entity != NULL);
+
+  msg->type = PROTOCOL_MSG_TYPE_ENTITY_ENTER;
+  msg->player = player;
+  msg->seq = 0;
+  msg->entity_enter = *entity;
+}
+
+void init_protocol_entity_update(struct protocol_msg * msg, int player, const struct protocol_entity * entity){
+  assert(msg != NULL);
+  assert(entity != NULL);
+
+  msg->type = PROTOCOL_MSG_TYPE_ENTITY_UPDATE;
+  msg->player = player;
+  msg->seq = 0;
+  msg->entity_update = *entity;
+}
+
+void init_protocol_entity_leave(struct protocol_msg * msg, int player, unsigned int id){
+  assert(msg != NULL);
+
+  msg->type = PROTOCOL_MSG_TYPE_ENTITY_LEAVE;
+  msg->player = player;
+  msg->seq = 0;
+  msg->entity_leave.id = id;
+}
+
+void init_protocol_ping_req(struct protocol_msg * msg, double time){
+  assert(msg != NULL);
+
+  msg->type = PROTOCOL_MSG_TYPE_PING_REQ;
+  msg->player = -1;
+  msg->seq = 0;
+  msg->ping_req.time = time;
+}
+
+void init_protocol_ping_res(struct protocol_msg * msg, double time){
+  assert(msg != NULL);
+
+  msg->type = PROTOCOL_MSG_TYPE_PING_RES;
+  msg->player = -1;
+  msg->seq = 0;
+  msg->ping_res.time = time;
+}
@@ -31,6 +31,11 @@
 
 #define PROTOCOL_MAX_REASON_LEN 64
 
+/**
+ * Session tokens are sent as hexadecimal strings
+ */
+#define PROTOCOL_SESSION_TOKEN_LEN 32
+
 /**
  * Must be at least player max name len times 4 bytes
  */
@@ -40,18 +45,34 @@ enum protocol_msg_type{
 		       PROTOCOL_MSG_TYPE_AUTH_REQ,
 		       PROTOCOL_MSG_TYPE_AUTH_RES,
 		       PROTOCOL_MSG_TYPE_CLOSE_REQ,
-		       PROTOCOL_MSG_TYPE_CLOSE_RES
+		       PROTOCOL_MSG_TYPE_CLOSE_RES,
+		       PROTOCOL_MSG_TYPE_RESUME_REQ,
+		       PROTOCOL_MSG_TYPE_RESUME_RES,
+		       PROTOCOL_MSG_TYPE_ENTITY_ENTER,
+		       PROTOCOL_MSG_TYPE_ENTITY_UPDATE,
+		       PROTOCOL_MSG_TYPE_ENTITY_LEAVE,
+		       PROTOCOL_MSG_TYPE_PING_REQ,
+		       PROTOCOL_MSG_TYPE_PING_RES
 };
 
+#define PROTOCOL_MSG_TYPE_COUNT 11
+
 const char * get_protocol_msg_type_label(enum protocol_msg_type type);
 
+/**
+ * Requests carry a correlation id chosen by the client, the response to a request carries the same id
+ * so a client can have many requests in flight on a connection
+ */
 struct protocol_auth_req{
+  unsigned int correlation_id;
   char32_t name[GAME_MAX_PLAYER_NAME_LEN + 1];
 };
 
 struct protocol_auth_res{
+  unsigned int correlation_id;
   int id;
   char reason[PROTOCOL_MAX_REASON_LEN + 1];
+  char token[PROTOCOL_SESSION_TOKEN_LEN + 1];
 };
 
 struct protocol_close_req{
@@ -64,13 +85,67 @@ struct protocol_close_res{
 };
 
 
+/**
+ * Asks the server to reattach a player to a new connection
+ * last_seq is the sequence number of the last session message the client received
+ */
+struct protocol_resume_req{
+  unsigned int correlation_id;
+  char token[PROTOCOL_SESSION_TOKEN_LEN + 1];
+  int last_seq;
+};
+
+struct protocol_resume_res{
+  unsigned int correlation_id;
+  int id;
+  char reason[PROTOCOL_MAX_REASON_LEN + 1];
+};
+
+/**
+ * State of an entity as seen by a player
+ * Clients extrapolate the position from the velocity, so updates are only sent when the velocity or health changes
+ */
+struct protocol_entity{
+  unsigned int id;
+  int owner;
+  double x;
+  double y;
+  double vx;
+  double vy;
+  int health;
+};
+
+struct protocol_entity_leave{
+  unsigned int id;
+};
+
+/**
+ * The server answers a ping with the same time, so the sender can measure the round trip
+ */
+struct protocol_ping{
+  double time;
+};
+
+/**
+ * player and seq identify messages that belong to a player session
+ * messages outside of a session have player -1 and seq 0
+ */
 struct protocol_msg{
   enum protocol_msg_type type;
+  int player;
+  int seq;
   union{
     struct protocol_auth_req auth_req;
     struct protocol_auth_res auth_res;
     struct protocol_close_req close_req;
     struct protocol_close_res close_res;
+    struct protocol_resume_req resume_req;
+    struct protocol_resume_res resume_res;
+    struct protocol_entity entity_enter;
+    struct protocol_entity entity_update;
+    struct protocol_entity_leave entity_leave;
+    struct protocol_ping ping_req;
+    struct protocol_ping ping_res;
   };
 };
 
@@ -91,8 +166,22 @@ int write_protocol_msg(struct protocol_state * ps, int fd, const struct protocol
 
 void dispose_protocol_state(struct protocol_state * ps);
 
-void init_protocol_auth_req(struct protocol_msg *msg, const char32_t * name);
+void init_protocol_auth_req(struct protocol_msg *msg, unsigned int correlation_id, const char32_t * name);
+
+void init_protocol_auth_res(struct protocol_msg * msg, unsigned int correlation_id, int id, const char * reason, const char * token);
+
+void init_protocol_resume_req(struct protocol_msg * msg, unsigned int correlation_id, const char * token, int last_seq);
+
+void init_protocol_resume_res(struct protocol_msg * msg, unsigned int correlation_id, int id, const char * reason);
+
+void init_protocol_entity_enter(struct protocol_msg * msg, int player, const struct protocol_entity * entity);
+
+void init_protocol_entity_update(struct protocol_msg * msg, int player, const struct protocol_entity * entity);
+
+void init_protocol_entity_leave(struct protocol_msg * msg, int player, unsigned int id);
+
+void init_protocol_ping_req(struct protocol_msg * msg, double time);
 
-void init_protocol_auth_res(struct protocol_msg * msg, int id, const char * reason);
+void init_protocol_ping_res(struct protocol_msg * msg, double time);
 
 #endif
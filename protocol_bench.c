@@ -0,0 +1,630 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * Stand alone protocol benchmark and fuzzing harness
+ * Build with 'make protocol_bench'
+ *
+ * Every message type is encoded into an in memory stream which is then pushed through
+ * a pipe or socket pair by a writer thread and decoded with read_protocol_msg.
+ * In fuzz mode the encoded streams are mutated at random and the decoder must
+ * run through every one of them until it reports the end of the stream.
+ */
+
+#include "logger.h"
+#include "protocol.h"
+#include "status.h"
+#include "unicode.h"
+
+#include <assert.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_BENCH_MSG_COUNT 10000
+
+#define DEFAULT_FUZZ_ROUNDS 200
+
+/**
+ * Seconds a single decode run may take before the harness assumes the decoder hangs
+ */
+#define WATCHDOG_TIMEOUT 30
+
+enum transport{
+	       TRANSPORT_PIPE,
+	       TRANSPORT_SOCKET
+};
+
+static const char * transport_labels[] = {"pipe", "socketpair"};
+
+struct bench_settings{
+  size_t msg_count;
+  size_t fuzz_rounds;
+  unsigned int seed;
+  bool pipe;
+  bool socket;
+  bool verbose;
+};
+
+/**
+ * An encoded message stream
+ */
+struct stream{
+  char * data;
+  size_t len;
+};
+
+/**
+ * Argument for the writer thread
+ */
+struct writer{
+  int fd;
+  const struct stream * stream;
+  int result;
+};
+
+/**
+ * A few code points outside of the ASCII range to exercise the UTF-8 decoder
+ */
+static const char32_t wide_chars[] = {0xE9, 0x3B1, 0x4E2D, 0x1F600};
+
+static double get_seconds(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void handle_watchdog(int signal){
+  static const char text[] = "protocol bench: decoder did not terminate, aborting\n";
+  write(STDERR_FILENO, text, sizeof(text) - 1);
+  _exit(EXIT_FAILURE);
+}
+
+static void rand_token(char * dest){
+  static const char digits[] = "0123456789abcdef";
+  for(size_t i = 0; i < PROTOCOL_SESSION_TOKEN_LEN; ++i){
+    dest[i] = digits[rand() % 16];
+  }
+  dest[PROTOCOL_SESSION_TOKEN_LEN] = '\0';
+}
+
+static void rand_reason(char * dest){
+  size_t len = rand() % PROTOCOL_MAX_REASON_LEN;
+  for(size_t i = 0; i < len; ++i){
+    dest[i] = ' ' + rand() % ('~' - ' ');
+  }
+  dest[len] = '\0';
+}
+
+static void rand_name(char32_t * dest){
+  size_t len = 1 + rand() % (GAME_MAX_PLAYER_NAME_LEN - 2);
+  for(size_t i = 0; i < len; ++i){
+    if(rand() % 4 == 0){
+      dest[i] = wide_chars[rand() % (sizeof(wide_chars) / sizeof(char32_t))];
+    }else{
+      dest[i] = 'a' + rand() % 26;
+    }
+  }
+  dest[len] = 0;
+}
+
+static double rand_coord(){
+  return (double)rand() / RAND_MAX * GAME_MAP_WIDTH;
+}
+
+static void rand_entity(struct protocol_entity * dest){
+  dest->id = (unsigned int)rand();
+  dest->owner = rand() % GAME_MAX_PLAYER_COUNT;
+  dest->x = rand_coord();
+  dest->y = rand_coord();
+  dest->vx = rand_coord() - GAME_MAP_WIDTH / 2;
+  dest->vy = rand_coord() - GAME_MAP_WIDTH / 2;
+  dest->health = rand() % 100;
+}
+
+static bool is_same_entity(const struct protocol_entity * first, const struct protocol_entity * second){
+  return first->id == second->id && first->owner == second->owner
+    && first->x == second->x && first->y == second->y
+    && first->vx == second->vx && first->vy == second->vy
+    && first->health == second->health;
+}
+
+static void rand_msg(struct protocol_msg * msg, enum protocol_msg_type type){
+  assert(msg != NULL);
+
+  memset(msg, 0, sizeof(struct protocol_msg));
+  msg->type = type;
+  msg->player = rand() % (GAME_MAX_PLAYER_COUNT + 1) - 1;
+  msg->seq = rand();
+  switch(type){
+  case PROTOCOL_MSG_TYPE_AUTH_REQ:
+    msg->auth_req.correlation_id = (unsigned int)rand();
+    rand_name(msg->auth_req.name);
+    break;
+  case PROTOCOL_MSG_TYPE_AUTH_RES:
+    msg->auth_res.correlation_id = (unsigned int)rand();
+    msg->auth_res.id = rand() % (GAME_MAX_PLAYER_COUNT + 1) - 1;
+    rand_reason(msg->auth_res.reason);
+    rand_token(msg->auth_res.token);
+    break;
+  case PROTOCOL_MSG_TYPE_CLOSE_REQ:
+    rand_reason(msg->close_req.reason);
+    break;
+  case PROTOCOL_MSG_TYPE_CLOSE_RES:
+    msg->close_res.id = rand() % GAME_MAX_PLAYER_COUNT;
+    rand_reason(msg->close_res.reason);
+    break;
+  case PROTOCOL_MSG_TYPE_RESUME_REQ:
+    msg->resume_req.correlation_id = (unsigned int)rand();
+    rand_token(msg->resume_req.token);
+    msg->resume_req.last_seq = rand();
+    break;
+  case PROTOCOL_MSG_TYPE_RESUME_RES:
+    msg->resume_res.correlation_id = (unsigned int)rand();
+    msg->resume_res.id = rand() % (GAME_MAX_PLAYER_COUNT + 1) - 1;
+    rand_reason(msg->resume_res.reason);
+    break;
+  case PROTOCOL_MSG_TYPE_ENTITY_ENTER:
+    rand_entity(&msg->entity_enter);
+    break;
+  case PROTOCOL_MSG_TYPE_ENTITY_UPDATE:
+    rand_entity(&msg->entity_update);
+    break;
+  case PROTOCOL_MSG_TYPE_ENTITY_LEAVE:
+    msg->entity_leave.id = (unsigned int)rand();
+    break;
+  case PROTOCOL_MSG_TYPE_PING_REQ:
+    msg->ping_req.time = rand_coord();
+    break;
+  case PROTOCOL_MSG_TYPE_PING_RES:
+    msg->ping_res.time = rand_coord();
+    break;
+  }
+}
+
+static bool is_same_msg(const struct protocol_msg * first, const struct protocol_msg * second){
+  if(first->type != second->type || first->player != second->player || first->seq != second->seq){
+    return false;
+  }
+  switch(first->type){
+  case PROTOCOL_MSG_TYPE_AUTH_REQ:
+    return first->auth_req.correlation_id == second->auth_req.correlation_id && unicode_streq(first->auth_req.name, second->auth_req.name);
+  case PROTOCOL_MSG_TYPE_AUTH_RES:
+    return first->auth_res.correlation_id == second->auth_res.correlation_id
+      && first->auth_res.id == second->auth_res.id
+      && strcmp(first->auth_res.reason, second->auth_res.reason) == 0
+      && strcmp(first->auth_res.token, second->auth_res.token) == 0;
+  case PROTOCOL_MSG_TYPE_CLOSE_REQ:
+    return strcmp(first->close_req.reason, second->close_req.reason) == 0;
+  case PROTOCOL_MSG_TYPE_CLOSE_RES:
+    return first->close_res.id == second->close_res.id && strcmp(first->close_res.reason, second->close_res.reason) == 0;
+  case PROTOCOL_MSG_TYPE_RESUME_REQ:
+    return first->resume_req.correlation_id == second->resume_req.correlation_id
+      && first->resume_req.last_seq == second->resume_req.last_seq && strcmp(first->resume_req.token, second->resume_req.token) == 0;
+  case PROTOCOL_MSG_TYPE_RESUME_RES:
+    return first->resume_res.correlation_id == second->resume_res.correlation_id
+      && first->resume_res.id == second->resume_res.id && strcmp(first->resume_res.reason, second->resume_res.reason) == 0;
+  case PROTOCOL_MSG_TYPE_ENTITY_ENTER:
+    return is_same_entity(&first->entity_enter, &second->entity_enter);
+  case PROTOCOL_MSG_TYPE_ENTITY_UPDATE:
+    return is_same_entity(&first->entity_update, &second->entity_update);
+  case PROTOCOL_MSG_TYPE_ENTITY_LEAVE:
+    return first->entity_leave.id == second->entity_leave.id;
+  case PROTOCOL_MSG_TYPE_PING_REQ:
+    return first->ping_req.time == second->ping_req.time;
+  case PROTOCOL_MSG_TYPE_PING_RES:
+    return first->ping_res.time == second->ping_res.time;
+  }
+  return false;
+}
+
+/**
+ * Encodes the messages into a temporary file and loads the result into memory
+ * The time spent encoding is stored in seconds
+ */
+static int encode_stream(struct stream * dest, double * seconds, struct protocol_state * ps, const struct protocol_msg * msgs, size_t count){
+  assert(dest != NULL);
+
+  FILE * file = tmpfile();
+  if(file == NULL){
+    set_status(STATUS_IO_ERROR);
+    return -1;
+  }
+  int fd = fileno(file);
+
+  double start = get_seconds();
+  for(size_t i = 0; i < count; ++i){
+    if(write_protocol_msg(ps, fd, msgs + i)){
+      fclose(file);
+      return -1;
+    }
+  }
+  *seconds = get_seconds() - start;
+
+  off_t len = lseek(fd, 0, SEEK_END);
+  dest->data = malloc(len == 0 ? 1 : len);
+  if(dest->data == NULL){
+    set_status(STATUS_MALLOC_FAILED);
+    fclose(file);
+    return -1;
+  }
+  dest->len = 0;
+  lseek(fd, 0, SEEK_SET);
+  while(dest->len != (size_t)len){
+    ssize_t result = read(fd, dest->data + dest->len, len - dest->len);
+    if(result <= 0){
+      set_status(STATUS_IO_ERROR);
+      free(dest->data);
+      fclose(file);
+      return -1;
+    }
+    dest->len += result;
+  }
+  fclose(file);
+  return 0;
+}
+
+static void * run_writer(void * arg){
+  struct writer * w = (struct writer *)arg;
+  const char * pos = w->stream->data;
+  size_t left = w->stream->len;
+  w->result = 0;
+  while(left != 0){
+    ssize_t result = write(w->fd, pos, left);
+    if(result == -1){
+      w->result = -1;
+      break;
+    }
+    pos += result;
+    left -= result;
+  }
+  close(w->fd);
+  return NULL;
+}
+
+static int open_transport(int fds[2], enum transport transport){
+  if(transport == TRANSPORT_PIPE){
+    return pipe(fds);
+  }else{
+    return socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  }
+}
+
+/**
+ * Starts a writer thread that pushes the stream into a new transport
+ * and returns the file descriptor to read from
+ */
+static int start_writer(struct writer * w, pthread_t * thread, const struct stream * stream, enum transport transport){
+  int fds[2];
+  if(open_transport(fds, transport)){
+    set_status(STATUS_SOCKET_CREATION_FAILED);
+    return -1;
+  }
+  w->fd = fds[1];
+  w->stream = stream;
+  if(pthread_create(thread, NULL, run_writer, w)){
+    set_status(STATUS_CREATE_THREAD_FAILED);
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+  return fds[0];
+}
+
+static int bench_msg_type(const struct bench_settings * settings, struct protocol_state * ps, enum protocol_msg_type type, enum transport transport){
+  size_t count = settings->msg_count;
+  struct protocol_msg * msgs = malloc(sizeof(struct protocol_msg) * count);
+  if(msgs == NULL){
+    set_status(STATUS_MALLOC_FAILED);
+    return -1;
+  }
+  for(size_t i = 0; i < count; ++i){
+    rand_msg(msgs + i, type);
+  }
+
+  struct stream stream;
+  double encode_time;
+  if(encode_stream(&stream, &encode_time, ps, msgs, count)){
+    free(msgs);
+    return -1;
+  }
+
+  struct writer w;
+  pthread_t writer;
+  int fd = start_writer(&w, &writer, &stream, transport);
+  if(fd == -1){
+    free(stream.data);
+    free(msgs);
+    return -1;
+  }
+
+  alarm(WATCHDOG_TIMEOUT);
+  size_t mismatches = 0;
+  int result = 0;
+  struct protocol_msg msg;
+  double start = get_seconds();
+  for(size_t i = 0; i < count; ++i){
+    if(read_protocol_msg(ps, &msg, fd)){
+      fprintf(stderr, "decoding failed at message %zu: %s\n", i, get_status_msg(get_status()));
+      result = -1;
+      break;
+    }
+    if(!is_same_msg(&msg, msgs + i)){
+      ++mismatches;
+    }
+  }
+  double decode_time = get_seconds() - start;
+  alarm(0);
+
+  close(fd);
+  pthread_join(writer, NULL);
+
+  if(result == 0){
+    printf("%-24s %-10s %8zu %12.0f %10.2f %12.0f %10.2f %8zu\n",
+	   get_protocol_msg_type_label(type),
+	   transport_labels[(int)transport],
+	   count,
+	   count / encode_time,
+	   stream.len / encode_time / (1024 * 1024),
+	   count / decode_time,
+	   stream.len / decode_time / (1024 * 1024),
+	   mismatches);
+    if(mismatches != 0){
+      result = -1;
+    }
+  }
+
+  free(stream.data);
+  free(msgs);
+  return result;
+}
+
+static void mutate_stream(struct stream * dest, const struct stream * src){
+  memcpy(dest->data, src->data, src->len);
+  dest->len = src->len;
+
+  size_t mutations = 1 + rand() % 16;
+  for(size_t i = 0; i < mutations && dest->len != 0; ++i){
+    size_t pos = rand() % dest->len;
+    switch(rand() % 5){
+    case 0:
+      // flip a bit
+      dest->data[pos] ^= (char)(1 << (rand() % 8));
+      break;
+    case 1:
+      // random byte
+      dest->data[pos] = (char)rand();
+      break;
+    case 2:
+      // drop a delimiter or any other byte
+      memmove(dest->data + pos, dest->data + pos + 1, dest->len - pos - 1);
+      --dest->len;
+      break;
+    case 3:
+      // duplicate a byte, the buffer has room for one extra byte per mutation
+      memmove(dest->data + pos + 1, dest->data + pos, dest->len - pos);
+      ++dest->len;
+      break;
+    default:
+      // truncate
+      dest->len = pos;
+      break;
+    }
+  }
+}
+
+/**
+ * Decodes the stream until it ends, every call must either consume input or fail
+ */
+static int fuzz_stream(struct protocol_state * ps, const struct stream * stream, enum transport transport, size_t * decoded, size_t * rejected){
+  struct writer w;
+  pthread_t writer;
+  int fd = start_writer(&w, &writer, stream, transport);
+  if(fd == -1){
+    return -1;
+  }
+
+  alarm(WATCHDOG_TIMEOUT);
+  struct protocol_msg msg;
+  while(true){
+    if(read_protocol_msg(ps, &msg, fd)){
+      if(get_status() == STATUS_END_OF_STREAM){
+	break;
+      }
+      ++*rejected;
+    }else{
+      ++*decoded;
+    }
+  }
+  alarm(0);
+
+  close(fd);
+  pthread_join(writer, NULL);
+  return 0;
+}
+
+static int fuzz(const struct bench_settings * settings, struct protocol_state * ps, enum transport transport){
+  // a small stream mixing every message type serves as the seed corpus
+  size_t count = 64;
+  struct protocol_msg msgs[64];
+  for(size_t i = 0; i < count; ++i){
+    rand_msg(msgs + i, (enum protocol_msg_type)(rand() % PROTOCOL_MSG_TYPE_COUNT));
+  }
+  struct stream seed;
+  double encode_time;
+  if(encode_stream(&seed, &encode_time, ps, msgs, count)){
+    return -1;
+  }
+
+  struct stream mutated;
+  mutated.data = malloc(seed.len + 16);
+  if(mutated.data == NULL){
+    set_status(STATUS_MALLOC_FAILED);
+    free(seed.data);
+    return -1;
+  }
+
+  size_t decoded = 0;
+  size_t rejected = 0;
+  size_t bytes = 0;
+  int result = 0;
+  double start = get_seconds();
+  for(size_t round = 0; round < settings->fuzz_rounds; ++round){
+    mutate_stream(&mutated, &seed);
+    bytes += mutated.len;
+    if(fuzz_stream(ps, &mutated, transport, &decoded, &rejected)){
+      result = -1;
+      break;
+    }
+  }
+  double time = get_seconds() - start;
+
+  if(result == 0){
+    printf("fuzz %-10s rounds: %zu, decoded: %zu, rejected: %zu, %.2f MiB/s\n",
+	   transport_labels[(int)transport],
+	   settings->fuzz_rounds,
+	   decoded,
+	   rejected,
+	   bytes / time / (1024 * 1024));
+  }
+  free(mutated.data);
+  free(seed.data);
+  return result;
+}
+
+static int run_transport(const struct bench_settings * settings, enum transport transport){
+  struct protocol_state ps;
+  if(init_protocol_state(&ps)){
+    return -1;
+  }
+
+  int result = 0;
+  for(int type = 0; type < PROTOCOL_MSG_TYPE_COUNT; ++type){
+    if(bench_msg_type(settings, &ps, (enum protocol_msg_type)type, transport)){
+      result = -1;
+    }
+  }
+  if(settings->fuzz_rounds != 0){
+    if(fuzz(settings, &ps, transport)){
+      result = -1;
+    }
+  }
+
+  dispose_protocol_state(&ps);
+  return result;
+}
+
+static void print_usage(const char * name){
+  fprintf(stderr,
+	  "usage: %s [options]\n"
+	  "  -n, --count N       messages per type and transport (default %d)\n"
+	  "  -f, --fuzz N        fuzzing rounds per transport, 0 disables fuzzing (default %d)\n"
+	  "  -s, --seed N        random seed\n"
+	  "  -t, --transport T   pipe, socket or all (default all)\n"
+	  "  -v, --verbose       print decoder log messages to stderr\n",
+	  name, DEFAULT_BENCH_MSG_COUNT, DEFAULT_FUZZ_ROUNDS);
+}
+
+static int parse_args(struct bench_settings * settings, int arg_count, char * const args[]){
+  struct option options[] = {
+			     {"count", required_argument, NULL, 'n'},
+			     {"fuzz", required_argument, NULL, 'f'},
+			     {"seed", required_argument, NULL, 's'},
+			     {"transport", required_argument, NULL, 't'},
+			     {"verbose", no_argument, NULL, 'v'},
+			     {NULL, 0, NULL, 0}
+  };
+
+  int index = 0;
+  while(true){
+    int c = getopt_long(arg_count, args, "n:f:s:t:v", options, &index);
+    if(c == -1){
+      break;
+    }else if(c == 'n'){
+      settings->msg_count = strtoul(optarg, NULL, 10);
+    }else if(c == 'f'){
+      settings->fuzz_rounds = strtoul(optarg, NULL, 10);
+    }else if(c == 's'){
+      settings->seed = strtoul(optarg, NULL, 10);
+    }else if(c == 't'){
+      if(strcmp(optarg, "pipe") == 0){
+	settings->socket = false;
+      }else if(strcmp(optarg, "socket") == 0){
+	settings->pipe = false;
+      }else if(strcmp(optarg, "all") != 0){
+	return -1;
+      }
+    }else if(c == 'v'){
+      settings->verbose = true;
+    }else{
+      return -1;
+    }
+  }
+  if(settings->msg_count == 0){
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char * const args[]){
+  struct bench_settings settings = {DEFAULT_BENCH_MSG_COUNT, DEFAULT_FUZZ_ROUNDS, (unsigned int)time(NULL), true, true, false};
+  if(parse_args(&settings, argc, args)){
+    print_usage(args[0]);
+    return EXIT_FAILURE;
+  }
+
+  // the decoder logs every rejected message, keep that out of the measurements unless asked for
+  FILE * log_file = settings.verbose ? stderr : fopen("/dev/null", "w");
+  if(log_file == NULL || start_logger(log_file)){
+    fputs("unable to start logger\n", stderr);
+    return EXIT_FAILURE;
+  }
+  set_min_log_priority(settings.verbose ? LOG_PRIORITY_DEBUG : LOG_PRIORITY_ERROR);
+
+  signal(SIGALRM, handle_watchdog);
+  signal(SIGPIPE, SIG_IGN);
+  srand(settings.seed);
+
+  printf("seed: %u\n", settings.seed);
+  printf("%-24s %-10s %8s %12s %10s %12s %10s %8s\n", "type", "transport", "count", "enc msg/s", "enc MiB/s", "dec msg/s", "dec MiB/s", "errors");
+
+  int result = 0;
+  if(settings.pipe && run_transport(&settings, TRANSPORT_PIPE)){
+    result = -1;
+  }
+  if(settings.socket && run_transport(&settings, TRANSPORT_SOCKET)){
+    result = -1;
+  }
+
+  stop_logger();
+  if(log_file != stderr){
+    fclose(log_file);
+  }
+
+  if(result){
+    fprintf(stderr, "protocol bench failed: %s\n", get_status_msg(get_status()));
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
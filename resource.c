@@ -15,6 +15,8 @@
  *
  */
 
+#define LOG_MODULE LOG_MODULE_RESOURCE
+
 #include "hash_map.h"
 #include "logger.h"
 #include "memory.h"
@@ -28,6 +30,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <iconv.h>
+#include <stdalign.h>
 #include <stdbool.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -37,20 +40,22 @@
 
 #define MISSING_LABEL_PLACEHOLDER U"<MISSING LABEL>"
 
-static struct memory_buffer key_buf;
-static struct memory_buffer label_buf;
-static struct ptr_hash_map label_map;
+/**
+ * Holds the keys and labels, they live until the resources are disposed
+ */
+static struct arena label_arena;
+DEFINE_HASH_MAP(label_map, const char *, const char32_t *, hash_map_hash_str, hash_map_eq_str)
+
+static struct label_map labels;
 
 static struct deserializer deserializer;
 
 static int init_buffers(){
-  init_memory_buffer(&key_buf, 0);
-  init_memory_buffer(&label_buf, 0);
+  init_arena(&label_arena, 0);
 
-  if(init_ptr_hash_map(&label_map, hash_map_hash_str, hash_map_eq_str, 0)){
+  if(init_label_map(&labels, 0)){
     LOG_ERROR("could not create label hash map");
-    dispose_memory_buffer(&key_buf);
-    dispose_memory_buffer(&label_buf);
+    dispose_arena(&label_arena);
     return -1;
   }
   return 0;
@@ -58,9 +63,9 @@ static int init_buffers(){
 
 static char * add_key(const char * key){
   assert(key != NULL);
-  char * result = copy_to_memory_buffer(&key_buf, key, strlen(key) + 1);
+  char * result = copy_to_arena(&label_arena, key, strlen(key) + 1);
   if(result == NULL){
-    LOG_ERROR("could not allocate resource key on buffer");
+    LOG_ERROR("could not allocate resource key");
     return NULL;
   }
   return result;
@@ -71,17 +76,19 @@ static int add_label(const char * key, const char32_t * value){
   assert(value != NULL);
 
   char * nkey = add_key(key);
-  if(key == NULL){
+  if(nkey == NULL){
     return -1;
   }
 
-  char32_t * label = copy_to_memory_buffer(&label_buf, value, (unicode_strlen(value) + 1) * sizeof(char32_t));
+  size_t len = (unicode_strlen(value) + 1) * sizeof(char32_t);
+  char32_t * label = alloc_from_arena(&label_arena, len, alignof(char32_t));
   if(label == NULL){
-    LOG_ERROR("could not allocate label on buffer");
+    LOG_ERROR("could not allocate label");
     return -1;
   }
+  memcpy(label, value, len);
 
-  if(insert_new_into_ptr_hash_map(&label_map, nkey, label)){
+  if(insert_new_into_label_map(&labels, nkey, label)){
     if(get_status() == STATUS_DUPLICATE_KEY){
       LOG_WARNING("duplicate label key %s", nkey);
     }else{
@@ -94,9 +101,8 @@ static int add_label(const char * key, const char32_t * value){
 }
 
 static void dispose_buffers(){
-  dispose_ptr_hash_map(&label_map);
-  dispose_memory_buffer(&label_buf);
-  dispose_memory_buffer(&key_buf);
+  dispose_label_map(&labels);
+  dispose_arena(&label_arena);
 }
 
 static int load_resources(char * path, bool (*filter_fn)(const char *), int (load_fn)(const char *)){
@@ -286,11 +292,11 @@ int init_resources(const char * resource_path, const char * language){
 const char32_t * get_resource_label(const char * key){
   assert(key != NULL);
 
-  char32_t * label = get_from_ptr_hash_map(&label_map, key);
+  const char32_t ** label = get_from_label_map(&labels, key);
   if(label == NULL){
     return MISSING_LABEL_PLACEHOLDER;
   }else{
-    return label;
+    return *label;
   }
 }
 
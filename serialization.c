@@ -15,6 +15,8 @@
  *
  */
 
+#define LOG_MODULE LOG_MODULE_PROTOCOL
+
 #include "logger.h"
 #include "memory.h"
 #include "serialization.h"
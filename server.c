@@ -15,6 +15,8 @@
  *
  */
 
+#define LOG_MODULE LOG_MODULE_SERVER
+
 #include "deque.h"
 #include "ipc.h"
 #include "logger.h"
@@ -26,6 +28,7 @@
 #include <errno.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
@@ -41,6 +44,12 @@ static pthread_t listen_worker;
 static struct ipc_alloc alloc;
 static struct ipc_multiplex multiplex;
 
+/**
+ * A headless server has no clients: outbound messages are counted and dropped
+ */
+static bool headless;
+static size_t headless_sent_count;
+
 
 int init_server(){
   LOG_INFO("initializing server...");
@@ -51,11 +60,25 @@ int init_server(){
   if(init_ipc_multiplex(&multiplex, &alloc)){
     return -1;
   }
+  headless = false;
   
   LOG_INFO("server initialized");
   return 0;
 }
 
+int init_headless_server(){
+  if(init_server()){
+    return -1;
+  }
+  headless = true;
+  headless_sent_count = 0;
+  return 0;
+}
+
+size_t get_headless_server_sent_count(){
+  return headless_sent_count;
+}
+
 static void * run_listener(void * arg){
   while(true){
     int con_socket = accept(listen_socket, NULL, NULL);
@@ -67,6 +90,11 @@ static void * run_listener(void * arg){
 	LOG_ERROR("error while accepting connection: %s", strerror(errno));
       }
     }else{
+      // messages are written field by field, without this they wait for the client's delayed acknowledgement
+      int opt_val = 1;
+      if(setsockopt(con_socket, IPPROTO_TCP, TCP_NODELAY, &opt_val, sizeof(opt_val)) == -1){
+	LOG_WARNING("could not disable coalescing on connection: %s", strerror(errno));
+      }
       if(open_ipc_channel(&multiplex, con_socket) == -1){
 	LOG_WARNING("maximum number of clients reached: refusing connection");
 	close(con_socket);
@@ -221,9 +249,20 @@ int receive_server_msg(struct ipc_msg ** msg){
   return receive_from_ipc_multiplex(msg, &multiplex);
 }
 
+int timed_receive_server_msg(struct ipc_msg ** msg, const struct timespec * deadline){
+  assert(msg != NULL);
+  assert(deadline != NULL);
+
+  return timed_receive_from_ipc_multiplex(msg, &multiplex, deadline);
+}
+
 int send_server_msg(int to, struct ipc_msg * msg){
   assert(msg != NULL);
   msg->recipient = to;
+  if(headless){
+    ++headless_sent_count;
+    return destroy_ipc_msg(msg);
+  }
   return send_to_ipc_multiplex(&multiplex, msg);
 }
 
@@ -235,3 +274,21 @@ int discard_server_msg(struct ipc_msg * msg){
   assert(msg != NULL);
   return destroy_ipc_msg(msg);
 }
+
+int close_server_channel(int id){
+  assert(id >= 0 && id < MAX_IPC_CHANNELS);
+
+  if(headless){
+    return 0;
+  }
+  
+  int fd = multiplex.channels[id].fd;
+  int result = close_ipc_channel(&multiplex, id);
+  
+  if(close(fd)){
+    LOG_ERROR("could not close socket for channel %d: %s", id, strerror(errno));
+    set_status(STATUS_SOCKET_ERROR);
+    result = -1;
+  }
+  return result;
+}
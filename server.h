@@ -22,16 +22,27 @@
 
 int init_server();
 
+/**
+ * Initializes a server that is never started, used to replay a journal without clients
+ */
+int init_headless_server();
+
+size_t get_headless_server_sent_count();
+
 int start_server();
 
 int receive_server_msg(struct ipc_msg ** msg);
 
+int timed_receive_server_msg(struct ipc_msg ** msg, const struct timespec * deadline);
+
 int send_server_msg(int to, struct ipc_msg * msg);
 
 struct ipc_msg * create_server_msg();
 
 int discard_server_msg(struct ipc_msg * msg);
 
+int close_server_channel(int id);
+
 int stop_server();
 
 int dispose_server();
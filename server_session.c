@@ -0,0 +1,166 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#define LOG_MODULE LOG_MODULE_SERVER
+
+#include "logger.h"
+#include "server.h"
+#include "server_session.h"
+#include "status.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+int create_server_session_token(char * dest){
+  unsigned char bytes[PROTOCOL_SESSION_TOKEN_LEN / 2];
+  if(getentropy(bytes, sizeof(bytes))){
+    LOG_ERROR("could not generate session token");
+    set_status(STATUS_IO_ERROR);
+    return -1;
+  }
+  for(size_t i = 0; i < sizeof(bytes); ++i){
+    sprintf(dest + i * 2, "%02x", bytes[i]);
+  }
+  return 0;
+}
+
+int open_server_session(struct server_session * s, int player, int channel, const char * token){
+  assert(s != NULL);
+  assert(player >= 0);
+  assert(channel >= 0);
+  assert(token != NULL);
+  assert(strlen(token) == PROTOCOL_SESSION_TOKEN_LEN);
+
+  strcpy(s->token, token);
+  s->player = player;
+  s->channel = channel;
+  s->next_seq = 1;
+  s->replay_len = 0;
+  return 0;
+}
+
+static struct protocol_msg * get_replay_msg(struct server_session * s, int seq){
+  assert(seq > 0);
+  return &s->replay[(seq - 1) % SERVER_SESSION_REPLAY_LEN];
+}
+
+int send_server_session_msg(struct server_session * s, struct ipc_msg * msg){
+  assert(s != NULL);
+  assert(msg != NULL);
+
+  msg->payload.player = s->player;
+  msg->payload.seq = s->next_seq;
+  ++s->next_seq;
+
+  *get_replay_msg(s, msg->payload.seq) = msg->payload;
+  if(s->replay_len != SERVER_SESSION_REPLAY_LEN){
+    ++s->replay_len;
+  }
+  
+  if(s->channel == -1){
+    // kept for replay only
+    return discard_server_msg(msg);
+  }
+  return send_server_msg(s->channel, msg);
+}
+
+void detach_server_session(struct server_session * s, const struct timespec * now){
+  assert(s != NULL);
+  assert(now != NULL);
+
+  s->channel = -1;
+  s->detached_at = *now;
+}
+
+bool is_server_session_attached(const struct server_session * s){
+  assert(s != NULL);
+  return s->channel != -1;
+}
+
+bool is_server_session_expired(const struct server_session * s, const struct timespec * now){
+  assert(s != NULL);
+  assert(now != NULL);
+
+  if(s->channel != -1){
+    return false;
+  }
+  return now->tv_sec - s->detached_at.tv_sec >= SERVER_SESSION_GRACE_PERIOD;
+}
+
+int resume_server_session(struct server_session * s, int channel, int last_seq){
+  assert(s != NULL);
+  assert(channel >= 0);
+
+  // the client must not have missed more messages than the replay buffer holds
+  int first_seq = s->next_seq - (int)s->replay_len;
+  if(last_seq < first_seq - 1 || last_seq >= s->next_seq){
+    LOG_DEBUG("server: can not resume session for player %d: last seen message %d, replay available from %d", s->player, last_seq, first_seq);
+    set_status(STATUS_SESSION_REPLAY_UNAVAILABLE);
+    return -1;
+  }
+  s->channel = channel;
+  return 0;
+}
+
+int replay_server_session(struct server_session * s, int last_seq){
+  assert(s != NULL);
+  assert(s->channel != -1);
+
+  for(int seq = last_seq + 1; seq < s->next_seq; ++seq){
+    struct ipc_msg * msg = create_server_msg();
+    if(msg == NULL){
+      return -1;
+    }
+    msg->payload = *get_replay_msg(s, seq);
+    if(send_server_msg(s->channel, msg)){
+      return -1;
+    }
+  }
+  LOG_DEBUG("server: replayed %d messages for player %d", s->next_seq - last_seq - 1, s->player);
+  return 0;
+}
+
+size_t copy_server_session_replay(const struct server_session * s, struct protocol_msg * dest){
+  assert(s != NULL);
+  assert(dest != NULL);
+
+  int first_seq = s->next_seq - (int)s->replay_len;
+  for(int seq = first_seq; seq < s->next_seq; ++seq){
+    dest[seq - first_seq] = s->replay[(seq - 1) % SERVER_SESSION_REPLAY_LEN];
+  }
+  return s->replay_len;
+}
+
+void restore_server_session(struct server_session * s, int player, const char * token, int next_seq, const struct protocol_msg * replay, size_t replay_len, const struct timespec * now){
+  assert(s != NULL);
+  assert(token != NULL);
+  assert(replay != NULL || replay_len == 0);
+  assert(replay_len <= SERVER_SESSION_REPLAY_LEN);
+  assert(next_seq - (int)replay_len >= 1);
+
+  s->player = player;
+  strcpy(s->token, token);
+  s->next_seq = next_seq;
+  s->replay_len = replay_len;
+  int first_seq = next_seq - (int)replay_len;
+  for(size_t i = 0; i < replay_len; ++i){
+    *get_replay_msg(s, first_seq + i) = replay[i];
+  }
+  detach_server_session(s, now);
+}
@@ -0,0 +1,85 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SERVER_SESSION_H
+#define SERVER_SESSION_H
+
+#include "ipc.h"
+#include "protocol.h"
+
+#include <stdbool.h>
+#include <time.h>
+
+/**
+ * Number of outbound messages kept per session for replay after a reconnect
+ */
+#define SERVER_SESSION_REPLAY_LEN 64
+
+/**
+ * Seconds a detached session is kept before its player is dropped
+ */
+#define SERVER_SESSION_GRACE_PERIOD 30
+
+/**
+ * Server side state of a player session
+ * Every message sent through the session gets the next sequence number
+ * and a copy is kept in a ring buffer so that it can be sent again
+ * when the client reconnects after losing its connection
+ */
+struct server_session{
+  int player;
+  int channel;
+  char token[PROTOCOL_SESSION_TOKEN_LEN + 1];
+  int next_seq;
+  struct timespec detached_at;
+  struct protocol_msg replay[SERVER_SESSION_REPLAY_LEN];
+  size_t replay_len;
+};
+
+/**
+ * Creates a random session token of PROTOCOL_SESSION_TOKEN_LEN characters
+ */
+int create_server_session_token(char * dest);
+
+int open_server_session(struct server_session * s, int player, int channel, const char * token);
+
+int send_server_session_msg(struct server_session * s, struct ipc_msg * msg);
+
+/**
+ * Times are CLOCK_MONOTONIC times passed in by the server state, so a replayed journal expires sessions at the same point
+ */
+void detach_server_session(struct server_session * s, const struct timespec * now);
+
+bool is_server_session_attached(const struct server_session * s);
+
+bool is_server_session_expired(const struct server_session * s, const struct timespec * now);
+
+int resume_server_session(struct server_session * s, int channel, int last_seq);
+
+int replay_server_session(struct server_session * s, int last_seq);
+
+/**
+ * Copies the messages kept for replay to dest, oldest first, and returns their number
+ */
+size_t copy_server_session_replay(const struct server_session * s, struct protocol_msg * dest);
+
+/**
+ * Restores a session from a snapshot, the session starts detached
+ */
+void restore_server_session(struct server_session * s, int player, const char * token, int next_seq, const struct protocol_msg * replay, size_t replay_len, const struct timespec * now);
+
+#endif
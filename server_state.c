@@ -15,57 +15,194 @@
  *
  */
 
+#define LOG_MODULE LOG_MODULE_SERVER
+
+#include "interest.h"
+#include "journal.h"
 #include "logger.h"
+#include "memory.h"
+#include "player_registry.h"
+#include "program.h"
 #include "protocol.h"
 #include "server.h"
+#include "server_session.h"
 #include "server_state.h"
+#include "snapshot.h"
+#include "spatial_index.h"
 #include "status.h"
 #include "unicode.h"
+#include "voronoi.h"
+#include "world.h"
 
 #include <assert.h>
+#include <math.h>
+#include <stdalign.h>
 #include <string.h>
+#include <unistd.h>
 
 #define SERVER_STATE_COUNT 1
 
-struct server_player{
-  int id;
+#define SERVER_TICK_NSEC (1000000000L / SERVER_TICK_RATE)
+
+/**
+ * Maximum number of ticks run in a single update when the server falls behind
+ */
+#define SERVER_MAX_CATCH_UP_TICKS 5
+
+#define SERVER_UNIT_HEALTH 100
+
+#define SERVER_UNIT_SPEED 10.0
+
+/**
+ * Number of faces in each direction of the map
+ */
+#define SERVER_MAP_COLS 10
+#define SERVER_MAP_ROWS 10
+
+/**
+ * Number of ticks between two snapshots
+ */
+#define SERVER_SNAPSHOT_INTERVAL (10 * SERVER_TICK_RATE)
+
+static enum server_state state;
+
+static struct player_registry players;
+
+static struct world world;
+
+static struct edge_list map;
+
+static struct spatial_index spatial_index;
+
+static struct interest interest;
+
+/**
+ * Scratch memory of a single update, it is reset at the start of every update
+ */
+static struct arena scratch;
+
+static struct timespec next_tick;
+
+static unsigned int ticks_since_snapshot;
+
+/**
+ * Time of the update being handled, every time dependent decision uses it so a replay makes the same decisions
+ */
+static struct timespec current_time;
+
+static struct journal_writer * journal;
+
+/**
+ * Session tokens are taken from the replayed journal instead of being generated
+ */
+static struct journal_reader * replay;
+
+/**
+ * A partially initialized state must never overwrite a snapshot
+ */
+static bool initialized;
+
+struct snapshot_server{
+  uint32_t state;
+  uint32_t reserved;
+};
+
+/**
+ * The messages kept for replay follow in a separate section, in the order of the players
+ */
+struct snapshot_player{
+  int32_t id;
+  int32_t next_seq;
+  uint32_t replay_len;
+  char token[PROTOCOL_SESSION_TOKEN_LEN + 1];
   char32_t name[GAME_MAX_PLAYER_NAME_LEN + 1];
 };
 
-static enum server_state state;
+static void add_tick(struct timespec * t){
+  t->tv_nsec += SERVER_TICK_NSEC;
+  if(t->tv_nsec >= 1000000000L){
+    t->tv_nsec -= 1000000000L;
+    ++t->tv_sec;
+  }
+}
 
-static struct server_player players[GAME_MAX_PLAYER_COUNT];
-static size_t player_count;
+static bool is_tick_due(const struct timespec * now){
+  return now->tv_sec > next_tick.tv_sec || (now->tv_sec == next_tick.tv_sec && now->tv_nsec >= next_tick.tv_nsec);
+}
 
-static int add_server_player(const char32_t * name){
-  if(state ==  SERVER_STATE_WAITING_FOR_PLAYERS){
+/**
+ * Places the units of a player in a ring around a spawn point
+ */
+static int spawn_server_units(int player){
+  double angle = 2.0 * M_PI * player / GAME_MAX_PLAYER_COUNT;
+  double cx = GAME_MAP_WIDTH / 2.0 + GAME_MAP_WIDTH / 3.0 * cos(angle);
+  double cy = GAME_MAP_HEIGHT / 2.0 + GAME_MAP_HEIGHT / 3.0 * sin(angle);
+  for(int i = 0; i < SERVER_UNITS_PER_PLAYER; ++i){
+    double a = 2.0 * M_PI * i / SERVER_UNITS_PER_PLAYER;
+    unsigned int entity = create_world_entity(&world, player, cx + 20.0 * cos(a), cy + 20.0 * sin(a), SERVER_UNIT_SPEED * cos(a), SERVER_UNIT_SPEED * sin(a), SERVER_UNIT_HEALTH);
+    if(entity == WORLD_NULL_ENTITY){
+      LOG_ERROR("server: could not spawn units for player %d", player);
+      destroy_world_entities_of(&world, player);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static struct server_player * add_server_player(const char32_t * name){
+  if(state != SERVER_STATE_WAITING_FOR_PLAYERS){
     set_status(STATUS_INVALID_SERVER_STATE);
-    return -1;
+    return NULL;
   }
-  
-  if(player_count == GAME_MAX_PLAYER_COUNT){
-    set_status(STATUS_MAX_PLAYER_COUNT_REACHED);
-    return -1;
+  return add_registry_player(&players, name);
+}
+
+static void remove_server_player(struct server_player * p){
+  assert(p != NULL);
+  assert(p->active);
+
+  destroy_world_entities_of(&world, p->id);
+  reset_interest_player(&interest, p->id);
+  remove_registry_player(&players, p);
+}
+
+/**
+ * Drops players whose connection has been lost for longer than the grace period
+ */
+static void expire_server_players(){
+  for(int i = 0; i < GAME_MAX_PLAYER_COUNT; ++i){
+    struct server_player * p = &players.players[i];
+    if(p->active && is_server_session_expired(&p->session, &current_time)){
+      LOG_INFO("server: session of player %d expired", i);
+      remove_server_player(p);
+    }
   }
-  bool valid = true;
-  for(int i = 0; i < player_count; ++i){
-    if(unicode_streq(name, players[i].name) == 0){
-      valid = false;
+}
+
+static int next_session_token(char * dest){
+  if(replay != NULL){
+    struct journal_record record;
+    int result = read_journal_record(replay, &record);
+    if(result == 0 && record.type == JOURNAL_RECORD_TOKEN){
+      strcpy(dest, record.token);
+      return 0;
+    }
+    if(result >= 0){
+      LOG_ERROR("server: journal does not contain the expected session token");
+      set_status(STATUS_INVALID_JOURNAL);
     }
+    return -1;
   }
-  if(valid){
-    unicode_strcpy(players[player_count].name, name);
-    int id = (int)player_count;
-    players[player_count].id = id;
-    ++player_count;
-    return id;
-  }else{
-    set_status(STATUS_DUPLICATE_PLAYER_NAME);
+  if(create_server_session_token(dest)){
     return -1;
   }
+  if(journal != NULL && append_journal_token(journal, dest)){
+    return -1;
+  }
+  return 0;
 }
 
-static int handle_auth_req(const struct protocol_auth_req * req){
+static int handle_auth_req(int sender, const struct protocol_auth_req * req){
   assert(req != NULL);
   LOG_DEBUG("server: handle authentication request");
   struct ipc_msg * msg = create_server_msg();
@@ -74,9 +211,23 @@ static int handle_auth_req(const struct protocol_auth_req * req){
   }
   
   const char * reason;
-  int result = add_server_player(req->name);
-  if(result > 0){
-    reason = "";
+  struct server_player * p = add_server_player(req->name);
+  if(p != NULL){
+    char token[PROTOCOL_SESSION_TOKEN_LEN + 1];
+    if(next_session_token(token)
+       || open_server_session(&p->session, p->id, sender, token)
+       || index_registry_player_token(&players, p)
+       || set_registry_player_channel(&players, p, sender)
+       || spawn_server_units(p->id)){
+      LOG_ERROR("server: unable to open a session for player %d", p->id);
+      remove_server_player(p);
+      // the client still gets an answer, the error is reported after it is sent
+      init_protocol_auth_res(&msg->payload, req->correlation_id, -1, "unexpected error", "");
+      send_server_msg(sender, msg);
+      return -1;
+    }
+    init_protocol_auth_res(&msg->payload, req->correlation_id, p->id, "", p->session.token);
+    return send_server_session_msg(&p->session, msg);
   }else{
     switch(get_status()){
     case STATUS_INVALID_SERVER_STATE:
@@ -97,22 +248,343 @@ static int handle_auth_req(const struct protocol_auth_req * req){
       break;
     }
   }
-  init_protocol_auth_res(&msg->payload, result, reason);
-  return send_server_msg(0, msg);
+  init_protocol_auth_res(&msg->payload, req->correlation_id, -1, reason, "");
+  return send_server_msg(sender, msg);
+}
+
+static int handle_resume_req(int sender, const struct protocol_resume_req * req){
+  assert(req != NULL);
+  LOG_DEBUG("server: handle resume request");
+  struct ipc_msg * msg = create_server_msg();
+  if(msg == NULL){
+    return -1;
+  }
+
+  struct server_player * p = find_registry_player_by_token(&players, req->token);
+  if(p == NULL){
+    LOG_DEBUG("server: resume rejected: unknown session");
+    init_protocol_resume_res(&msg->payload, req->correlation_id, -1, "invalid session");
+    return send_server_msg(sender, msg);
+  }
+
+  if(resume_server_session(&p->session, sender, req->last_seq) || set_registry_player_channel(&players, p, sender)){
+    // the client has to authenticate again, so the name must become available
+    LOG_DEBUG("server: resume rejected: missed messages no longer available");
+    remove_server_player(p);
+    init_protocol_resume_res(&msg->payload, req->correlation_id, -1, "session messages unavailable");
+    return send_server_msg(sender, msg);
+  }
+
+  LOG_DEBUG("server: player %d resumed session on channel %d", p->id, sender);
+  // the client drops what it knew about the world, so everything visible is sent again
+  reset_interest_player(&interest, p->id);
+  init_protocol_resume_res(&msg->payload, req->correlation_id, p->id, "");
+  if(send_server_msg(sender, msg)){
+    return -1;
+  }
+  return replay_server_session(&p->session, req->last_seq);
+}
+
+/**
+ * Pings are answered on the connection they arrived on, they need no session
+ */
+static int handle_ping_req(int sender, const struct protocol_ping * req){
+  assert(req != NULL);
+  struct ipc_msg * msg = create_server_msg();
+  if(msg == NULL){
+    return -1;
+  }
+  init_protocol_ping_res(&msg->payload, req->time);
+  return send_server_msg(sender, msg);
+}
+
+static int handle_disconnect(int channel){
+  // every local player of the connection is detached, the channel id is reused for the next connection
+  uint32_t mask = get_registry_channel_players(&players, channel);
+  for(int i = 0; i < GAME_MAX_PLAYER_COUNT; ++i){
+    if(mask & (((uint32_t)1) << i)){
+      struct server_player * p = &players.players[i];
+      LOG_DEBUG("server: player %d detached, session kept for %d seconds", p->id, SERVER_SESSION_GRACE_PERIOD);
+      detach_server_session(&p->session, &current_time);
+      set_registry_player_channel(&players, p, -1);
+    }
+  }
+  return close_server_channel(channel);
+}
+
+/**
+ * Sends an interest event to the attached sessions of the players in the mask
+ * These messages are not sequenced: they are not replayed since the player's view is sent again after a reconnect
+ */
+static int send_interest_msg(uint32_t mask, const struct protocol_msg * payload){
+  int result = 0;
+  for(int i = 0; i < GAME_MAX_PLAYER_COUNT; ++i){
+    struct server_player * p = &players.players[i];
+    if((mask & (((uint32_t)1) << i)) == 0 || !p->active || !is_server_session_attached(&p->session)){
+      continue;
+    }
+    struct ipc_msg * msg = create_server_msg();
+    if(msg == NULL){
+      return -1;
+    }
+    msg->payload = *payload;
+    msg->payload.player = i;
+    if(send_server_msg(p->session.channel, msg)){
+      result = -1;
+    }
+  }
+  return result;
+}
+
+static int write_server_snapshot(struct snapshot_writer * w){
+  struct snapshot_server server = {state, 0};
+  if(write_snapshot_section(w, SNAPSHOT_SECTION_SERVER, &server, sizeof(server), 1)){
+    return -1;
+  }
+
+  struct snapshot_player records[GAME_MAX_PLAYER_COUNT];
+  struct arena_mark mark = mark_arena(&scratch);
+  struct protocol_msg * replay = alloc_from_arena(&scratch, sizeof(struct protocol_msg) * GAME_MAX_PLAYER_COUNT * SERVER_SESSION_REPLAY_LEN, alignof(struct protocol_msg));
+  if(replay == NULL){
+    return -1;
+  }
+  size_t count = 0;
+  size_t replay_len = 0;
+  for(int i = 0; i < GAME_MAX_PLAYER_COUNT; ++i){
+    const struct server_player * p = &players.players[i];
+    if(p->active){
+      struct snapshot_player * record = &records[count++];
+      memset(record, 0, sizeof(struct snapshot_player));
+      record->id = i;
+      record->next_seq = p->session.next_seq;
+      strcpy(record->token, p->session.token);
+      unicode_strcpy(record->name, p->name);
+      record->replay_len = copy_server_session_replay(&p->session, replay + replay_len);
+      replay_len += record->replay_len;
+    }
+  }
+  int result = 0;
+  if(write_snapshot_section(w, SNAPSHOT_SECTION_PLAYERS, records, sizeof(struct snapshot_player), count)
+     || write_snapshot_section(w, SNAPSHOT_SECTION_REPLAY, replay, sizeof(struct protocol_msg), replay_len)
+     || write_edge_list_snapshot(w, &map)
+     || write_world_snapshot(w, &world)){
+    result = -1;
+  }
+  rewind_arena(&scratch, mark);
+  return result;
+}
+
+static int save_server_state(const char * path){
+  struct snapshot_writer w;
+  if(open_snapshot_writer(&w, path)){
+    return -1;
+  }
+  if(write_server_snapshot(&w)){
+    abort_snapshot_writer(&w);
+    return -1;
+  }
+  return close_snapshot_writer(&w);
+}
+
+/**
+ * Names in a snapshot are read from the mapped file, so their terminator is searched within the record only
+ * A terminated name is never longer than GAME_MAX_PLAYER_NAME_LEN
+ */
+static bool has_name_terminator(const char32_t * name){
+  for(size_t i = 0; i <= GAME_MAX_PLAYER_NAME_LEN; ++i){
+    if(name[i] == 0){
+      return true;
+    }
+  }
+  return false;
+}
+
+static int read_server_snapshot(struct snapshot_reader * r){
+  size_t count;
+  const struct snapshot_server * server = read_snapshot_section(r, SNAPSHOT_SECTION_SERVER, sizeof(struct snapshot_server), &count);
+  if(server == NULL){
+    return -1;
+  }
+  if(count != 1 || server->state >= SERVER_STATE_COUNT){
+    LOG_ERROR("server: snapshot contains an invalid server state");
+    set_status(STATUS_INVALID_SNAPSHOT);
+    return -1;
+  }
+  state = (enum server_state)server->state;
+
+  const struct snapshot_player * records = read_snapshot_section(r, SNAPSHOT_SECTION_PLAYERS, sizeof(struct snapshot_player), &count);
+  if(records == NULL){
+    return -1;
+  }
+  size_t replay_count;
+  const struct protocol_msg * replay = read_snapshot_section(r, SNAPSHOT_SECTION_REPLAY, sizeof(struct protocol_msg), &replay_count);
+  if(replay == NULL){
+    return -1;
+  }
+  for(size_t i = 0; i < count; ++i){
+    const struct snapshot_player * record = &records[i];
+    if(record->id < 0 || record->id >= GAME_MAX_PLAYER_COUNT || players.players[record->id].active
+       || record->replay_len > SERVER_SESSION_REPLAY_LEN || record->replay_len > replay_count
+       || record->next_seq - (int)record->replay_len < 1
+       || memchr(record->token, '\0', sizeof(record->token)) == NULL
+       || !has_name_terminator(record->name)){
+      LOG_ERROR("server: snapshot contains an invalid player");
+      set_status(STATUS_INVALID_SNAPSHOT);
+      return -1;
+    }
+    struct server_player * p = add_registry_player_at(&players, record->id, record->name);
+    if(p == NULL){
+      LOG_ERROR("server: snapshot contains a duplicate player");
+      set_status(STATUS_INVALID_SNAPSHOT);
+      return -1;
+    }
+    // players have to resume their session within the grace period
+    restore_server_session(&p->session, record->id, record->token, record->next_seq, replay, record->replay_len, &current_time);
+    if(index_registry_player_token(&players, p)){
+      return -1;
+    }
+    replay += record->replay_len;
+    replay_count -= record->replay_len;
+  }
+
+  if(read_edge_list_snapshot(r, &map) || read_world_snapshot(r, &world)){
+    return -1;
+  }
+  return 0;
+}
+
+static int restore_server_state(const char * path){
+  struct snapshot_reader r;
+  if(open_snapshot_reader(&r, path)){
+    return -1;
+  }
+  int result = read_server_snapshot(&r);
+  close_snapshot_reader(&r);
+  if(result == 0){
+    LOG_INFO("server: restored %zu players and %zu entities from snapshot %s", players.count, world.count, path);
+  }
+  return result;
+}
+
+/**
+ * Runs the simulation ticks that are due
+ * If the server falls too far behind the missed ticks are dropped instead of running them all at once
+ */
+static void tick_server_state(){
+  int ticks = 0;
+  while(is_tick_due(&current_time)){
+    if(ticks == SERVER_MAX_CATCH_UP_TICKS){
+      LOG_WARNING("server: simulation is falling behind, skipping ticks");
+      next_tick = current_time;
+      add_tick(&next_tick);
+      break;
+    }
+    update_world(&world, 1.0 / SERVER_TICK_RATE, GAME_MAP_WIDTH, GAME_MAP_HEIGHT);
+    add_tick(&next_tick);
+    ++ticks;
+  }
+
+  const char * snapshot_path = get_program_settings()->snapshot_path;
+  ticks_since_snapshot += ticks;
+  // a replay must not overwrite the snapshot it started from
+  if(snapshot_path != NULL && replay == NULL && ticks_since_snapshot >= SERVER_SNAPSHOT_INTERVAL){
+    ticks_since_snapshot = 0;
+    if(save_server_state(snapshot_path)){
+      LOG_ERROR("server: could not write snapshot");
+    }
+  }
+
+  if(ticks > 0){
+    if(update_spatial_index_entities(&spatial_index, &world)){
+      LOG_ERROR("server: could not update spatial index");
+    }else if(update_interest(&interest, &spatial_index, &world, send_interest_msg)){
+      LOG_ERROR("server: could not send world updates");
+    }
+  }
 }
 
-int init_server_state(){
-  memset(players, 0, sizeof(players));
-  player_count = 0;
+void set_server_state_journal(struct journal_writer * w){
+  journal = w;
+}
+
+void set_server_state_replay(struct journal_reader * r){
+  replay = r;
+}
+
+int init_server_state(const struct timespec * now){
+  assert(now != NULL);
+  
+  initialized = false;
+  current_time = *now;
   state = SERVER_STATE_WAITING_FOR_PLAYERS;
+  // on failure the partially initialized state is released by dispose_server_state
+  init_arena(&scratch, 0);
+  init_edge_list(&map);
+  if(init_player_registry(&players)){
+    LOG_ERROR("server: could not initialize player registry");
+    return -1;
+  }
+  if(init_world(&world)){
+    LOG_ERROR("server: could not initialize world");
+    return -1;
+  }
+  const char * snapshot_path = get_program_settings()->snapshot_path;
+  if(snapshot_path != NULL && access(snapshot_path, F_OK) == 0){
+    if(restore_server_state(snapshot_path)){
+      LOG_ERROR("server: could not restore snapshot %s", snapshot_path);
+      return -1;
+    }
+  }else if(create_lattice_voronoi_diagram(&map, SERVER_MAP_COLS, SERVER_MAP_ROWS, GAME_MAP_WIDTH, GAME_MAP_HEIGHT)){
+    LOG_ERROR("server: could not create map");
+    return -1;
+  }
+  if(init_spatial_index(&spatial_index, &map, GAME_MAP_WIDTH, GAME_MAP_HEIGHT)){
+    LOG_ERROR("server: could not create spatial index");
+    return -1;
+  }
+  if(init_interest(&interest, &spatial_index)){
+    LOG_ERROR("server: could not initialize interest management");
+    return -1;
+  }
+  next_tick = *now;
+  add_tick(&next_tick);
+  ticks_since_snapshot = 0;
+  initialized = true;
   return 0;
 }
 
-int update_server_state(const struct ipc_msg * msg){
+void get_server_tick_deadline(struct timespec * deadline){
+  assert(deadline != NULL);
+  *deadline = next_tick;
+}
+
+int update_server_state(const struct ipc_msg * msg, const struct timespec * now){
+  assert(now != NULL);
+
+  current_time = *now;
+  reset_arena(&scratch);
+  
+  expire_server_players();
+
+  tick_server_state();
+  
+  if(msg == NULL){
+    return 0;
+  }
+  
+  if(msg->type == IPC_MSG_TYPE_DISCONNECTED){
+    LOG_DEBUG("server: channel %d disconnected", msg->sender);
+    return handle_disconnect(msg->sender);
+  }
+  
   LOG_DEBUG("server: message received: %s", get_protocol_msg_type_label(msg->payload.type));
   switch(msg->payload.type){
   case PROTOCOL_MSG_TYPE_AUTH_REQ:
-    return handle_auth_req(&msg->payload.auth_req);
+    return handle_auth_req(msg->sender, &msg->payload.auth_req);
+  case PROTOCOL_MSG_TYPE_RESUME_REQ:
+    return handle_resume_req(msg->sender, &msg->payload.resume_req);
+  case PROTOCOL_MSG_TYPE_PING_REQ:
+    return handle_ping_req(msg->sender, &msg->payload.ping_req);
   default:
     LOG_ERROR("server: unexpected message: %s", get_protocol_msg_type_label(msg->payload.type));
     set_status(STATUS_PROTOCOL_ERROR);
@@ -121,5 +593,16 @@ int update_server_state(const struct ipc_msg * msg){
 }
 
 int dispose_server_state(){
+  const char * snapshot_path = get_program_settings()->snapshot_path;
+  if(initialized && snapshot_path != NULL && replay == NULL && save_server_state(snapshot_path)){
+    LOG_ERROR("server: could not write snapshot");
+  }
+  initialized = false;
+  dispose_interest(&interest);
+  dispose_spatial_index(&spatial_index);
+  dispose_edge_list(&map);
+  dispose_world(&world);
+  dispose_player_registry(&players);
+  dispose_arena(&scratch);
   return 0;
 }
@@ -20,13 +20,51 @@
 
 #include "ipc.h"
 
+#include <time.h>
+
+/**
+ * Number of simulation ticks per second
+ */
+#define SERVER_TICK_RATE 20
+
+/**
+ * Number of units every player starts with
+ */
+#define SERVER_UNITS_PER_PLAYER 256
+
 enum server_state{
   SERVER_STATE_WAITING_FOR_PLAYERS
 };
 
-int init_server_state();
+struct journal_writer;
+
+struct journal_reader;
+
+/**
+ * Session tokens handed out by the server state are appended to the journal
+ */
+void set_server_state_journal(struct journal_writer * journal);
 
-int update_server_state(const struct ipc_msg * msg);
+/**
+ * Session tokens are read from the replayed journal and no snapshots are written
+ */
+void set_server_state_replay(struct journal_reader * journal);
+
+/**
+ * now is the CLOCK_MONOTONIC time the server state starts at
+ */
+int init_server_state(const struct timespec * now);
+
+/**
+ * Returns the time (CLOCK_MONOTONIC) at which the next simulation tick is due
+ */
+void get_server_tick_deadline(struct timespec * deadline);
+
+/**
+ * Handles a message and runs the simulation ticks that are due at time now
+ * msg can be NULL if only the simulation needs to be advanced
+ */
+int update_server_state(const struct ipc_msg * msg, const struct timespec * now);
 
 int dispose_server_state();
 
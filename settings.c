@@ -19,12 +19,22 @@
 #include "status.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <getopt.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 static const char * verbosity_args[] = {"debug", "info", "warning", "error"};
 
+static const char * log_fsync_args[] = {"never", "rotate", "batch"};
+
+static const char * log_format_args[] = {"text", "json", "binary"};
+
+static const char * log_overflow_args[] = {"drop", "block"};
+
 void log_program_settings(const struct program_settings * settings){
   assert(settings != NULL);
   LOG_INFO("program settings:");
@@ -32,12 +42,181 @@ void log_program_settings(const struct program_settings * settings){
   LOG_INFO("client %s", settings->client ? "enabled" : "disabled");
   LOG_INFO("interrupt %s", !settings->daemon ? "enabled" : "disabled");  
   LOG_INFO("verbosity: %s", verbosity_args[(int)settings->log_priority]);
+  for(int i = 0; i < LOG_MODULE_COUNT; ++i){
+    if(settings->module_log_priorities[i] >= 0){
+      LOG_INFO("verbosity of %s: %s", get_log_module_name((enum log_module)i), verbosity_args[settings->module_log_priorities[i]]);
+    }
+  }
+  if(settings->snapshot_path != NULL){
+    LOG_INFO("snapshot: %s", settings->snapshot_path);
+  }
+  if(settings->journal_path != NULL){
+    LOG_INFO("journal: %s", settings->journal_path);
+  }
+  if(settings->replay_path != NULL){
+    LOG_INFO("replay: %s", settings->replay_path);
+  }
+  if(settings->binary_log_path != NULL){
+    LOG_INFO("binary log: %s", settings->binary_log_path);
+  }
+  if(settings->log_path != NULL){
+    LOG_INFO("log file: %s", settings->log_path);
+  }
+  LOG_INFO("log format: %s", log_format_args[(int)settings->log_format]);
+  if(settings->binary_log_path != NULL || settings->log_path != NULL){
+    LOG_INFO("log rotation: %zu bytes, %u seconds, %u files kept, fsync %s", settings->log_rotate_size, settings->log_rotate_interval, settings->log_keep, log_fsync_args[(int)settings->log_fsync_policy]);
+  }
+  LOG_INFO("log rings: %u, overflow %s", settings->log_rings, log_overflow_args[(int)settings->log_overflow_policy]);
+  LOG_INFO("allocation tracking %s", settings->track_alloc ? "enabled" : "disabled");
+  if(settings->client){
+    for(size_t i = 0; i < settings->player_count; ++i){
+      LOG_INFO("local player: %s", settings->player_names[i]);
+    }
+  }
+  if(settings->loadgen_count > 0){
+    LOG_INFO("load generator: %zu connections, %g pings per second", settings->loadgen_count, settings->ping_rate);
+  }
 }
 
-static int parse_verbosity(struct program_settings * settings, const char * verbosity){
+static int find_verbosity(const char * verbosity, size_t len){
   for(int i = 0; i <= (int)LOG_PRIORITY_ERROR; ++i){
-    if(strcmp(verbosity, verbosity_args[i]) == 0){
-      settings->log_priority = (enum log_priority)i;
+    if(strlen(verbosity_args[i]) == len && strncmp(verbosity, verbosity_args[i], len) == 0){
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int parse_verbosity(struct program_settings * settings, const char * verbosity){
+  int priority = find_verbosity(verbosity, strlen(verbosity));
+  if(priority < 0){
+    return -1;
+  }
+  settings->log_priority = (enum log_priority)priority;
+  return 0;
+}
+
+/**
+ * Parses a module verbosity of the form module=verbosity
+ */
+static int parse_module_verbosity(struct program_settings * settings, const char * arg){
+  const char * separator = strchr(arg, '=');
+  if(separator == NULL){
+    return -1;
+  }
+  char module_name[32];
+  size_t len = separator - arg;
+  if(len >= sizeof(module_name)){
+    return -1;
+  }
+  memcpy(module_name, arg, len);
+  module_name[len] = '\0';
+  int module = find_log_module(module_name);
+  int priority = find_verbosity(separator + 1, strlen(separator + 1));
+  if(module < 0 || priority < 0){
+    return -1;
+  }
+  settings->module_log_priorities[module] = priority;
+  return 0;
+}
+
+static int parse_loadgen_count(struct program_settings * settings, const char * count){
+  char * end;
+  errno = 0;
+  unsigned long value = strtoul(count, &end, 10);
+  if(errno != 0 || end == count || *end != '\0' || value == 0 || count[0] == '-'){
+    return -1;
+  }
+  settings->loadgen_count = value;
+  return 0;
+}
+
+static int parse_player_name(struct program_settings * settings, const char * name){
+  size_t len = strlen(name);
+  if(settings->player_count == GAME_MAX_PLAYER_COUNT || len == 0 || len > GAME_MAX_PLAYER_NAME_LEN){
+    return -1;
+  }
+  settings->player_names[settings->player_count++] = name;
+  return 0;
+}
+
+static int parse_ping_rate(struct program_settings * settings, const char * rate){
+  char * end;
+  errno = 0;
+  double value = strtod(rate, &end);
+  if(errno != 0 || end == rate || *end != '\0' || !(value >= 0.0)){
+    return -1;
+  }
+  settings->ping_rate = value;
+  return 0;
+}
+
+/**
+ * Parses a size in bytes with an optional k, m or g suffix
+ */
+static int parse_log_rotate_size(struct program_settings * settings, const char * size){
+  char * end;
+  errno = 0;
+  unsigned long long value = strtoull(size, &end, 10);
+  if(errno != 0 || end == size || size[0] == '-'){
+    return -1;
+  }
+  unsigned int shift = 0;
+  if(*end == 'k'){
+    shift = 10;
+  }else if(*end == 'm'){
+    shift = 20;
+  }else if(*end == 'g'){
+    shift = 30;
+  }
+  if(shift > 0){
+    ++end;
+  }
+  if(*end != '\0' || value > (SIZE_MAX >> shift)){
+    return -1;
+  }
+  settings->log_rotate_size = (size_t)value << shift;
+  return 0;
+}
+
+static int parse_unsigned_int(unsigned int * dest, const char * arg){
+  char * end;
+  errno = 0;
+  unsigned long value = strtoul(arg, &end, 10);
+  if(errno != 0 || end == arg || *end != '\0' || arg[0] == '-' || value > UINT_MAX){
+    return -1;
+  }
+  *dest = (unsigned int)value;
+  return 0;
+}
+
+static int parse_log_fsync(struct program_settings * settings, const char * policy){
+  for(int i = 0; i <= (int)LOG_FSYNC_BATCH; ++i){
+    if(strcmp(policy, log_fsync_args[i]) == 0){
+      settings->log_fsync_policy = (enum log_fsync_policy)i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static int parse_log_overflow(struct program_settings * settings, const char * policy){
+  for(int i = 0; i <= (int)LOG_OVERFLOW_BLOCK; ++i){
+    if(strcmp(policy, log_overflow_args[i]) == 0){
+      settings->log_overflow_policy = (enum log_overflow_policy)i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Parses the format of text logs, binary logs are requested with --binary_log
+ */
+static int parse_log_format(struct program_settings * settings, const char * format){
+  for(int i = 0; i < (int)LOG_OUTPUT_BINARY; ++i){
+    if(strcmp(format, log_format_args[i]) == 0){
+      settings->log_format = (enum log_output_format)i;
       return 0;
     }
   }
@@ -51,41 +230,147 @@ static int parse_args(struct program_settings * settings, int arg_count, char *
 
   struct option options[] = {
 			     {"client", no_argument, NULL, 'c'},
+			     {"binary_log", required_argument, NULL, 'B'},
 			     {"daemon", no_argument, NULL, 'd'},
+			     {"log_file", required_argument, NULL, 'o'},
+			     {"log_format", required_argument, NULL, 'f'},
+			     {"log_fsync", required_argument, NULL, 'F'},
+			     {"log_keep", required_argument, NULL, 'k'},
+			     {"log_rotate_interval", required_argument, NULL, 'i'},
+			     {"log_rotate_size", required_argument, NULL, 'z'},
+			     {"journal", required_argument, NULL, 'j'},
 			     {"language", required_argument, NULL, 'l'},
+			     {"loadgen", required_argument, NULL, 'L'},
+			     {"log_module", required_argument, NULL, 'M'},
+			     {"log_overflow", required_argument, NULL, 'O'},
+			     {"log_rings", required_argument, NULL, 'n'},
+			     {"ping_rate", required_argument, NULL, 'p'},
+			     {"player", required_argument, NULL, 'P'},
+			     {"replay", required_argument, NULL, 'R'},
 			     {"resource_path", required_argument, NULL, 'r'},
 			     {"server", no_argument, NULL, 's'},
+			     {"snapshot", required_argument, NULL, 'S'},
+			     {"track_alloc", no_argument, NULL, 'T'},
 			     {"verbosity", required_argument, NULL, 'v'},
 			     {NULL, 0, NULL, 0}
   };
 
   int index = 0;
   while(true){
-    int c = getopt_long(arg_count, args, "cdl:r:sv:", options, &index);
+    int c = getopt_long(arg_count, args, "B:cdf:F:i:j:k:l:L:M:n:o:O:p:P:r:R:sS:Tv:z:", options, &index);
     if(c == -1){
       break;
     }else if(c == '?'){
       fputs("invalid program argument\n", stderr);
       set_status(STATUS_INVALID_PROGRAM_ARGUMENT);
       return -1;
+    }else if(c == 'B'){
+      settings->binary_log_path = optarg;
     }else if(c == 'c'){
       settings->client = true;
     }else if(c == 'd'){
       settings->daemon = true;
+    }else if(c == 'f'){
+      if(parse_log_format(settings, optarg)){
+	fputs("invalid program argument: invalid log format\n", stderr);
+	set_status(STATUS_INVALID_PROGRAM_ARGUMENT);
+	return -1;
+      }
+    }else if(c == 'F'){
+      if(parse_log_fsync(settings, optarg)){
+	fputs("invalid program argument: invalid log fsync policy\n", stderr);
+	set_status(STATUS_INVALID_PROGRAM_ARGUMENT);
+	return -1;
+      }
+    }else if(c == 'i'){
+      if(parse_unsigned_int(&settings->log_rotate_interval, optarg)){
+	fputs("invalid program argument: invalid log rotation interval\n", stderr);
+	set_status(STATUS_INVALID_PROGRAM_ARGUMENT);
+	return -1;
+      }
+    }else if(c == 'j'){
+      settings->journal_path = optarg;
+    }else if(c == 'k'){
+      if(parse_unsigned_int(&settings->log_keep, optarg)){
+	fputs("invalid program argument: invalid number of log files to keep\n", stderr);
+	set_status(STATUS_INVALID_PROGRAM_ARGUMENT);
+	return -1;
+      }
     }else if(c == 'l'){
       settings->language = optarg;
+    }else if(c == 'L'){
+      if(parse_loadgen_count(settings, optarg)){
+	fputs("invalid program argument: invalid load generator connection count\n", stderr);
+	set_status(STATUS_INVALID_PROGRAM_ARGUMENT);
+	return -1;
+      }
+    }else if(c == 'M'){
+      if(parse_module_verbosity(settings, optarg)){
+	fputs("invalid program argument: invalid module verbosity\n", stderr);
+	set_status(STATUS_INVALID_PROGRAM_ARGUMENT);
+	return -1;
+      }
+    }else if(c == 'n'){
+      if(parse_unsigned_int(&settings->log_rings, optarg) || settings->log_rings == 0){
+	fputs("invalid program argument: invalid number of log rings\n", stderr);
+	set_status(STATUS_INVALID_PROGRAM_ARGUMENT);
+	return -1;
+      }
+    }else if(c == 'o'){
+      settings->log_path = optarg;
+    }else if(c == 'O'){
+      if(parse_log_overflow(settings, optarg)){
+	fputs("invalid program argument: invalid log overflow policy\n", stderr);
+	set_status(STATUS_INVALID_PROGRAM_ARGUMENT);
+	return -1;
+      }
+    }else if(c == 'p'){
+      if(parse_ping_rate(settings, optarg)){
+	fputs("invalid program argument: invalid ping rate\n", stderr);
+	set_status(STATUS_INVALID_PROGRAM_ARGUMENT);
+	return -1;
+      }
+    }else if(c == 'P'){
+      if(parse_player_name(settings, optarg)){
+	fputs("invalid program argument: invalid player name or too many players\n", stderr);
+	set_status(STATUS_INVALID_PROGRAM_ARGUMENT);
+	return -1;
+      }
     }else if(c == 'r'){
       settings->resource_path = optarg;
+    }else if(c == 'R'){
+      settings->replay_path = optarg;
     }else if(c == 's'){
       settings->server = true;
+    }else if(c == 'S'){
+      settings->snapshot_path = optarg;
+    }else if(c == 'T'){
+      settings->track_alloc = true;
     }else if(c == 'v'){
       if(parse_verbosity(settings, optarg)){
 	fputs("invalid program argument: invalid verbosity\n", stderr);
 	set_status(STATUS_INVALID_PROGRAM_ARGUMENT);
 	return -1;
       }
+    }else if(c == 'z'){
+      if(parse_log_rotate_size(settings, optarg)){
+	fputs("invalid program argument: invalid log rotation size\n", stderr);
+	set_status(STATUS_INVALID_PROGRAM_ARGUMENT);
+	return -1;
+      }
     }
   }
+  if(settings->binary_log_path != NULL){
+    if(settings->log_path != NULL || settings->log_format != LOG_OUTPUT_TEXT){
+      fputs("invalid program argument: a binary log can not be combined with a log file or log format\n", stderr);
+      set_status(STATUS_INVALID_PROGRAM_ARGUMENT);
+      return -1;
+    }
+    settings->log_format = LOG_OUTPUT_BINARY;
+  }
+  if(settings->player_count == 0){
+    settings->player_names[settings->player_count++] = "player1";
+  }
   return 0;
 }
 
@@ -98,6 +383,25 @@ int load_program_settings(struct program_settings * settings, int arg_count, cha
   settings->log_priority = LOG_PRIORITY_ERROR;
   settings->language = NULL;
   settings->resource_path = NULL;
+  settings->snapshot_path = NULL;
+  settings->journal_path = NULL;
+  settings->replay_path = NULL;
+  settings->binary_log_path = NULL;
+  settings->log_path = NULL;
+  settings->log_format = LOG_OUTPUT_TEXT;
+  settings->log_rotate_size = 0;
+  settings->log_rotate_interval = 0;
+  settings->log_keep = 5;
+  settings->log_fsync_policy = LOG_FSYNC_NEVER;
+  settings->log_rings = 128;
+  settings->log_overflow_policy = LOG_OVERFLOW_DROP;
+  settings->track_alloc = false;
+  settings->player_count = 0;
+  settings->loadgen_count = 0;
+  settings->ping_rate = 10.0;
+  for(int i = 0; i < LOG_MODULE_COUNT; ++i){
+    settings->module_log_priorities[i] = -1;
+  }
   
   return parse_args(settings, arg_count, args);
 }
@@ -18,9 +18,12 @@
 #ifndef SETTINGS_H
 #define SETTINGS_H
 
+#include "game.h"
+#include "log_sink.h"
 #include "logger.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 
 struct program_settings{
   bool server;
@@ -28,7 +31,43 @@ struct program_settings{
   bool daemon;
   const char * language;
   const char * resource_path;
+  const char * snapshot_path;
+  const char * journal_path;
+  const char * replay_path;
+  const char * binary_log_path;
+  const char * log_path;
+  enum log_output_format log_format;
+
+  /**
+   * Rotation of the log file, zero disables rotation by size or age
+   */
+  size_t log_rotate_size;
+  unsigned int log_rotate_interval;
+  unsigned int log_keep;
+  enum log_fsync_policy log_fsync_policy;
+
+  /**
+   * Max number of threads logging at the same time and what to do when they log faster than the logger writes
+   */
+  unsigned int log_rings;
+  enum log_overflow_policy log_overflow_policy;
+  /**
+   * Whether allocations are counted per call site, see enable_alloc_tracking
+   */
+  bool track_alloc;
+  /**
+   * Names of the local players the client authenticates over its connection
+   */
+  const char * player_names[GAME_MAX_PLAYER_COUNT];
+  size_t player_count;
+  size_t loadgen_count;
+  double ping_rate;
   enum log_priority log_priority;
+  
+  /**
+   * Minimum priority per module, -1 if the module uses the verbosity
+   */
+  int module_log_priorities[LOG_MODULE_COUNT];
 };
 
 int load_program_settings(struct program_settings * settings, int arg_count, char * const args[]);
@@ -22,8 +22,10 @@
  * Failure will likely bring the program down anyway
  */
 
+#include "memory.h"
 #include "program.h"
 #include "status.h"
+#include "thread_utils.h"
 
 #include <pthread.h>
 #include <signal.h>
@@ -34,6 +36,7 @@ static void init_signal_mask(sigset_t * mask){
   sigemptyset(mask);
   sigaddset(mask, SIGQUIT);
   sigaddset(mask, SIGPIPE);
+  sigaddset(mask, SIGUSR1);
 }
 
 int init_signals(){
@@ -54,6 +57,8 @@ int init_signals(){
 }
 
 static void * run_signal_worker(){
+  init_thread();
+  
   /*
    * unblock signals for this specific thread
    * Note that error handling is rather pointless here
@@ -71,6 +76,9 @@ static void * run_signal_worker(){
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
     if(signal == SIGQUIT){
       request_program_stop();
+    }else if(signal == SIGUSR1){
+      // the logger runs by now, a report does not stop the program
+      log_alloc_report(ALLOC_REPORT_LEN);
     }else if(signal == SIGPIPE){
       // happens when server or client writes to socket that is disconnected from the other end
       // ignore
@@ -0,0 +1,359 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "logger.h"
+#include "memory.h"
+#include "slab.h"
+#include "status.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * Slabs are aligned to their size so the slab of an object is found by masking its address
+ */
+#define SLAB_SIZE (256 * 1024)
+
+/**
+ * Eight classes of 16 bytes up to 128 bytes, then four classes per power of two
+ */
+#define SLAB_CLASS_COUNT 40
+
+/**
+ * Max number of objects per size class in a thread cache, half of it is moved at once
+ */
+#define SLAB_CACHE_LEN 32
+
+struct slab{
+  struct slab * prev;
+  struct slab * next;
+  /**
+   * Freed objects, linked through their first bytes
+   */
+  void * free;
+  /**
+   * Offset of the first slot that has never been handed out
+   */
+  size_t bump;
+  size_t used;
+};
+
+/**
+ * Offset of the first slot in a slab, keeps the slots aligned to 64 bytes
+ */
+#define SLAB_HEADER_SIZE ((sizeof(struct slab) + 63) & ~(size_t)63)
+
+struct slab_class{
+  pthread_mutex_t mutex;
+  size_t size;
+  size_t cap;
+  /**
+   * Slabs with at least one free slot
+   */
+  struct slab * partial;
+  /**
+   * One empty slab is kept so that a class that is used in bursts does not allocate a slab every time
+   */
+  struct slab * empty;
+};
+
+struct slab_cache{
+  void * objects[SLAB_CACHE_LEN];
+  size_t len;
+};
+
+static struct slab_class classes[SLAB_CLASS_COUNT];
+
+static pthread_once_t classes_once = PTHREAD_ONCE_INIT;
+
+static pthread_key_t cache_key;
+
+static __thread struct slab_cache caches[SLAB_CLASS_COUNT];
+
+static __thread bool cache_registered = false;
+
+static _Atomic(struct slab_pool *) pools = NULL;
+
+static atomic_size_t slab_size = 0;
+
+static size_t get_slab_class_size(int c){
+  if(c < 8){
+    return 16 * (size_t)(c + 1);
+  }
+  size_t base = (size_t)128 << ((c - 8) / 4);
+  return base + (base / 4) * (size_t)((c - 8) % 4 + 1);
+}
+
+static int get_slab_class(size_t size){
+  assert(size != 0 && size <= SLAB_MAX_SIZE);
+  if(size <= 128){
+    return (int)((size + 15) / 16) - 1;
+  }
+  // the size lies in (2^(bits - 1), 2^bits]
+  int bits = 64 - __builtin_clzll((unsigned long long)(size - 1));
+  size_t base = (size_t)1 << (bits - 1);
+  return 8 + (bits - 8) * 4 + (int)((size - 1 - base) / (base / 4));
+}
+
+static void flush_slab_caches(void * arg);
+
+static void init_slab_classes(){
+  for(int c = 0; c < SLAB_CLASS_COUNT; ++c){
+    pthread_mutex_init(&classes[c].mutex, NULL);
+    classes[c].size = get_slab_class_size(c);
+    classes[c].cap = (SLAB_SIZE - SLAB_HEADER_SIZE) / classes[c].size;
+    classes[c].partial = NULL;
+    classes[c].empty = NULL;
+  }
+  pthread_key_create(&cache_key, flush_slab_caches);
+}
+
+static struct slab * get_slab(void * data){
+  return (struct slab *)((uintptr_t)data & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+static void link_partial_slab(struct slab_class * cls, struct slab * s){
+  s->prev = NULL;
+  s->next = cls->partial;
+  if(cls->partial != NULL){
+    cls->partial->prev = s;
+  }
+  cls->partial = s;
+}
+
+static void unlink_partial_slab(struct slab_class * cls, struct slab * s){
+  if(s->prev == NULL){
+    cls->partial = s->next;
+  }else{
+    s->prev->next = s->next;
+  }
+  if(s->next != NULL){
+    s->next->prev = s->prev;
+  }
+}
+
+/**
+ * Returns a slab with a free slot, the mutex of the class has to be held
+ */
+static struct slab * get_partial_slab(struct slab_class * cls){
+  if(cls->partial != NULL){
+    return cls->partial;
+  }
+  struct slab * s = cls->empty;
+  if(s != NULL){
+    cls->empty = NULL;
+  }else{
+    if(posix_memalign((void **)&s, SLAB_SIZE, SLAB_SIZE)){
+      set_status(STATUS_MALLOC_FAILED);
+      return NULL;
+    }
+    atomic_fetch_add_explicit(&slab_size, SLAB_SIZE, memory_order_relaxed);
+  }
+  s->free = NULL;
+  s->bump = SLAB_HEADER_SIZE;
+  s->used = 0;
+  link_partial_slab(cls, s);
+  return s;
+}
+
+/**
+ * Takes up to count objects from the slabs of a class, the mutex of the class has to be held
+ */
+static size_t take_slab_objects(struct slab_class * cls, void ** dest, size_t count){
+  size_t taken = 0;
+  while(taken < count){
+    struct slab * s = get_partial_slab(cls);
+    if(s == NULL){
+      break;
+    }
+    while(taken < count && s->used < cls->cap){
+      if(s->free != NULL){
+	dest[taken] = s->free;
+	s->free = *(void **)s->free;
+      }else{
+	dest[taken] = (char *)s + s->bump;
+	s->bump += cls->size;
+      }
+      ++s->used;
+      ++taken;
+    }
+    if(s->used == cls->cap){
+      unlink_partial_slab(cls, s);
+    }
+  }
+  return taken;
+}
+
+/**
+ * Returns objects to their slabs and frees slabs that become empty, the mutex of the class has to be held
+ */
+static void put_slab_objects(struct slab_class * cls, void ** src, size_t count){
+  for(size_t i = 0; i < count; ++i){
+    struct slab * s = get_slab(src[i]);
+    if(s->used == cls->cap){
+      link_partial_slab(cls, s);
+    }
+    *(void **)src[i] = s->free;
+    s->free = src[i];
+    --s->used;
+    if(s->used == 0){
+      unlink_partial_slab(cls, s);
+      if(cls->empty == NULL){
+	cls->empty = s;
+      }else{
+	free(s);
+	atomic_fetch_sub_explicit(&slab_size, SLAB_SIZE, memory_order_relaxed);
+      }
+    }
+  }
+}
+
+/**
+ * Returns the objects in the caches of an exiting thread to their slabs
+ */
+static void flush_slab_caches(void * arg){
+  for(int c = 0; c < SLAB_CLASS_COUNT; ++c){
+    struct slab_cache * cache = &caches[c];
+    if(cache->len > 0){
+      pthread_mutex_lock(&classes[c].mutex);
+      put_slab_objects(&classes[c], cache->objects, cache->len);
+      pthread_mutex_unlock(&classes[c].mutex);
+      cache->len = 0;
+    }
+  }
+  cache_registered = false;
+}
+
+static void register_slab_pool(struct slab_pool * pool){
+  bool expected = false;
+  if(atomic_compare_exchange_strong(&pool->registered, &expected, true)){
+    pool->next = atomic_load_explicit(&pools, memory_order_relaxed);
+    while(!atomic_compare_exchange_weak_explicit(&pools, &pool->next, pool, memory_order_release, memory_order_relaxed));
+  }
+}
+
+static void count_slab_alloc(struct slab_pool * pool, size_t size){
+  if(!atomic_load_explicit(&pool->registered, memory_order_relaxed)){
+    register_slab_pool(pool);
+  }
+  size_t live = atomic_fetch_add_explicit(&pool->live, 1, memory_order_relaxed) + 1;
+  size_t peak = atomic_load_explicit(&pool->peak, memory_order_relaxed);
+  while(live > peak && !atomic_compare_exchange_weak_explicit(&pool->peak, &peak, live, memory_order_relaxed, memory_order_relaxed));
+  atomic_fetch_add_explicit(&pool->reserved, size, memory_order_relaxed);
+}
+
+static void count_slab_free(struct slab_pool * pool, size_t size){
+  atomic_fetch_sub_explicit(&pool->live, 1, memory_order_relaxed);
+  atomic_fetch_sub_explicit(&pool->reserved, size, memory_order_relaxed);
+}
+
+void * alloc_from_slab_pool(struct slab_pool * pool, size_t size){
+  assert(pool != NULL);
+  assert(size != 0);
+
+  if(size > SLAB_MAX_SIZE){
+    void * data = malloc_checked(size);
+    if(data != NULL){
+      count_slab_alloc(pool, size);
+    }
+    return data;
+  }
+  pthread_once(&classes_once, init_slab_classes);
+  int c = get_slab_class(size);
+  struct slab_class * cls = &classes[c];
+  void * data = NULL;
+  if(pool->thread_cache){
+    struct slab_cache * cache = &caches[c];
+    if(cache->len == 0){
+      if(!cache_registered){
+	// the value only serves to run the destructor when the thread exits
+	pthread_setspecific(cache_key, caches);
+	cache_registered = true;
+      }
+      pthread_mutex_lock(&cls->mutex);
+      cache->len = take_slab_objects(cls, cache->objects, SLAB_CACHE_LEN / 2);
+      pthread_mutex_unlock(&cls->mutex);
+    }
+    if(cache->len > 0){
+      data = cache->objects[--cache->len];
+    }
+  }else{
+    pthread_mutex_lock(&cls->mutex);
+    take_slab_objects(cls, &data, 1);
+    pthread_mutex_unlock(&cls->mutex);
+  }
+  if(data != NULL){
+    count_slab_alloc(pool, cls->size);
+  }
+  return data;
+}
+
+void free_to_slab_pool(struct slab_pool * pool, void * data, size_t size){
+  assert(pool != NULL);
+
+  if(data == NULL){
+    return;
+  }
+  if(size > SLAB_MAX_SIZE){
+    free(data);
+    count_slab_free(pool, size);
+    return;
+  }
+  int c = get_slab_class(size);
+  struct slab_class * cls = &classes[c];
+  count_slab_free(pool, cls->size);
+  if(pool->thread_cache && cache_registered){
+    struct slab_cache * cache = &caches[c];
+    if(cache->len == SLAB_CACHE_LEN){
+      pthread_mutex_lock(&cls->mutex);
+      put_slab_objects(cls, cache->objects + SLAB_CACHE_LEN / 2, SLAB_CACHE_LEN / 2);
+      pthread_mutex_unlock(&cls->mutex);
+      cache->len = SLAB_CACHE_LEN / 2;
+    }
+    cache->objects[cache->len++] = data;
+  }else{
+    pthread_mutex_lock(&cls->mutex);
+    put_slab_objects(cls, &data, 1);
+    pthread_mutex_unlock(&cls->mutex);
+  }
+}
+
+void get_slab_pool_stats(struct slab_pool * pool, struct slab_stats * stats){
+  assert(pool != NULL);
+  assert(stats != NULL);
+
+  stats->live = atomic_load_explicit(&pool->live, memory_order_relaxed);
+  stats->peak = atomic_load_explicit(&pool->peak, memory_order_relaxed);
+  stats->reserved = atomic_load_explicit(&pool->reserved, memory_order_relaxed);
+}
+
+size_t get_slab_size(){
+  return atomic_load_explicit(&slab_size, memory_order_relaxed);
+}
+
+void log_slab_stats(){
+  LOG_INFO("slabs: %zu bytes", get_slab_size());
+  struct slab_pool * pool = atomic_load_explicit(&pools, memory_order_acquire);
+  while(pool != NULL){
+    struct slab_stats stats;
+    get_slab_pool_stats(pool, &stats);
+    LOG_INFO("slab pool %s: %zu live objects, peak %zu, %zu bytes reserved", pool->name, stats.live, stats.peak, stats.reserved);
+    pool = pool->next;
+  }
+}
@@ -0,0 +1,81 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Allocations up to this size are taken from slabs, larger ones from malloc
+ */
+#define SLAB_MAX_SIZE 32768
+
+/**
+ * A named user of the slab allocator
+ * Pools of all sizes share the slabs of a size class, a pool only keeps statistics
+ * Pools must have static storage duration, they are registered for reporting on their first allocation
+ */
+struct slab_pool{
+  const char * name;
+  /**
+   * Whether frees and allocations go through a small per thread cache before taking the lock of the size class
+   */
+  bool thread_cache;
+  atomic_bool registered;
+  atomic_size_t live;
+  atomic_size_t peak;
+  /**
+   * Bytes of the slots taken by live objects, including the rounding to the size class
+   */
+  atomic_size_t reserved;
+  struct slab_pool * next;
+};
+
+#define SLAB_POOL_INITIALIZER(name, thread_cache) {name, thread_cache, false, 0, 0, 0, NULL}
+
+struct slab_stats{
+  size_t live;
+  size_t peak;
+  size_t reserved;
+};
+
+/**
+ * Allocates an object, the memory is aligned like malloc's
+ */
+void * alloc_from_slab_pool(struct slab_pool * pool, size_t size);
+
+/**
+ * Frees an object, size must be the size it was allocated with
+ */
+void free_to_slab_pool(struct slab_pool * pool, void * data, size_t size);
+
+void get_slab_pool_stats(struct slab_pool * pool, struct slab_stats * stats);
+
+/**
+ * Returns the number of bytes held by all slabs
+ */
+size_t get_slab_size();
+
+/**
+ * Logs the statistics of all pools that have been used
+ */
+void log_slab_stats();
+
+#endif
@@ -0,0 +1,575 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#define LOG_MODULE LOG_MODULE_SERVER
+
+#include "game.h"
+#include "logger.h"
+#include "memory.h"
+#include "snapshot.h"
+#include "status.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SNAPSHOT_MAGIC "GAMESNAP"
+
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+
+#define SNAPSHOT_ALIGNMENT 8
+
+/**
+ * Marks a missing reference in the edge list records
+ */
+#define SNAPSHOT_NULL_INDEX -1
+
+struct snapshot_header{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+};
+
+struct snapshot_section_header{
+  uint32_t type;
+  uint32_t record_size;
+  uint64_t count;
+};
+
+struct snapshot_vertex{
+  double x;
+  double y;
+};
+
+struct snapshot_half_edge{
+  int64_t vertex;
+  int64_t twin;
+  int64_t face;
+  int64_t prev;
+  int64_t next;
+};
+
+struct snapshot_face{
+  double x;
+  double y;
+  int64_t head;
+  int64_t tail;
+};
+
+struct snapshot_world{
+  uint64_t count;
+  uint64_t slot_count;
+  uint32_t free_slot;
+  uint32_t reserved;
+};
+
+static size_t align_snapshot_size(size_t size){
+  return (size + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+}
+
+static int write_snapshot_bytes(struct snapshot_writer * w, const void * data, size_t size){
+  if(size != 0 && fwrite(data, size, 1, w->file) != 1){
+    LOG_ERROR("could not write snapshot %s", w->tmp_path);
+    set_status(STATUS_IO_ERROR);
+    return -1;
+  }
+  return 0;
+}
+
+int open_snapshot_writer(struct snapshot_writer * w, const char * path){
+  assert(w != NULL);
+  assert(path != NULL);
+
+  size_t len = strlen(path);
+  w->path = malloc_checked(len + 1);
+  w->tmp_path = malloc_checked(len + 5);
+  if(w->path == NULL || w->tmp_path == NULL){
+    free(w->path);
+    free(w->tmp_path);
+    return -1;
+  }
+  strcpy(w->path, path);
+  strcpy(w->tmp_path, path);
+  strcat(w->tmp_path, ".tmp");
+  
+  w->file = fopen(w->tmp_path, "wb");
+  if(w->file == NULL){
+    LOG_ERROR("could not open snapshot file %s", w->tmp_path);
+    set_status(STATUS_IO_ERROR);
+    free(w->path);
+    free(w->tmp_path);
+    return -1;
+  }
+
+  struct snapshot_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.byte_order = SNAPSHOT_BYTE_ORDER;
+  if(write_snapshot_bytes(w, &header, sizeof(header))){
+    abort_snapshot_writer(w);
+    return -1;
+  }
+  return 0;
+}
+
+int write_snapshot_section(struct snapshot_writer * w, enum snapshot_section_type type, const void * records, size_t record_size, size_t count){
+  assert(w != NULL);
+  assert(w->file != NULL);
+  assert(records != NULL || count == 0);
+
+  struct snapshot_section_header header = {type, record_size, count};
+  if(write_snapshot_bytes(w, &header, sizeof(header)) || write_snapshot_bytes(w, records, record_size * count)){
+    return -1;
+  }
+  static const char padding[SNAPSHOT_ALIGNMENT] = {0};
+  size_t size = record_size * count;
+  return write_snapshot_bytes(w, padding, align_snapshot_size(size) - size);
+}
+
+int close_snapshot_writer(struct snapshot_writer * w){
+  assert(w != NULL);
+  assert(w->file != NULL);
+
+  if(fflush(w->file) || fsync(fileno(w->file))){
+    LOG_ERROR("could not flush snapshot %s", w->tmp_path);
+    set_status(STATUS_IO_ERROR);
+    abort_snapshot_writer(w);
+    return -1;
+  }
+  fclose(w->file);
+  w->file = NULL;
+  
+  int result = 0;
+  if(rename(w->tmp_path, w->path)){
+    LOG_ERROR("could not replace snapshot %s", w->path);
+    set_status(STATUS_IO_ERROR);
+    unlink(w->tmp_path);
+    result = -1;
+  }
+  free(w->path);
+  free(w->tmp_path);
+  return result;
+}
+
+void abort_snapshot_writer(struct snapshot_writer * w){
+  assert(w != NULL);
+
+  if(w->file != NULL){
+    fclose(w->file);
+    w->file = NULL;
+  }
+  unlink(w->tmp_path);
+  free(w->path);
+  free(w->tmp_path);
+}
+
+int open_snapshot_reader(struct snapshot_reader * r, const char * path){
+  assert(r != NULL);
+  assert(path != NULL);
+
+  int fd = open(path, O_RDONLY);
+  if(fd == -1){
+    LOG_ERROR("could not open snapshot %s", path);
+    set_status(STATUS_IO_ERROR);
+    return -1;
+  }
+  struct stat st;
+  if(fstat(fd, &st)){
+    LOG_ERROR("could not read size of snapshot %s", path);
+    set_status(STATUS_IO_ERROR);
+    close(fd);
+    return -1;
+  }
+  if((size_t)st.st_size < sizeof(struct snapshot_header)){
+    LOG_ERROR("snapshot %s is too small", path);
+    set_status(STATUS_INVALID_SNAPSHOT);
+    close(fd);
+    return -1;
+  }
+  void * data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping stays valid after the file is closed
+  close(fd);
+  if(data == MAP_FAILED){
+    LOG_ERROR("could not map snapshot %s", path);
+    set_status(STATUS_IO_ERROR);
+    return -1;
+  }
+  r->data = data;
+  r->size = st.st_size;
+  r->pos = sizeof(struct snapshot_header);
+
+  const struct snapshot_header * header = data;
+  if(memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 || header->byte_order != SNAPSHOT_BYTE_ORDER){
+    LOG_ERROR("%s is not a snapshot for this platform", path);
+    set_status(STATUS_INVALID_SNAPSHOT);
+    close_snapshot_reader(r);
+    return -1;
+  }
+  if(header->version != SNAPSHOT_VERSION){
+    LOG_ERROR("snapshot %s has version %u, expected %u", path, header->version, SNAPSHOT_VERSION);
+    set_status(STATUS_INVALID_SNAPSHOT);
+    close_snapshot_reader(r);
+    return -1;
+  }
+  return 0;
+}
+
+const void * read_snapshot_section(struct snapshot_reader * r, enum snapshot_section_type type, size_t record_size, size_t * count){
+  assert(r != NULL);
+  assert(r->data != NULL);
+  assert(count != NULL);
+
+  if(r->size - r->pos < sizeof(struct snapshot_section_header)){
+    LOG_ERROR("snapshot ends before section %d", (int)type);
+    set_status(STATUS_INVALID_SNAPSHOT);
+    return NULL;
+  }
+  const struct snapshot_section_header * header = (const void *)(r->data + r->pos);
+  if(header->type != type || header->record_size != record_size){
+    LOG_ERROR("unexpected snapshot section %u with records of %u bytes, expected section %d", header->type, header->record_size, (int)type);
+    set_status(STATUS_INVALID_SNAPSHOT);
+    return NULL;
+  }
+  size_t available = r->size - r->pos - sizeof(struct snapshot_section_header);
+  if(record_size != 0 && header->count > available / record_size){
+    LOG_ERROR("snapshot section %d is truncated", (int)type);
+    set_status(STATUS_INVALID_SNAPSHOT);
+    return NULL;
+  }
+  const void * records = r->data + r->pos + sizeof(struct snapshot_section_header);
+  size_t size = align_snapshot_size(record_size * header->count);
+  r->pos += sizeof(struct snapshot_section_header) + (size > available ? available : size);
+  *count = header->count;
+  return records;
+}
+
+void close_snapshot_reader(struct snapshot_reader * r){
+  assert(r != NULL);
+
+  if(r->data != NULL){
+    munmap((void *)r->data, r->size);
+    r->data = NULL;
+  }
+}
+
+static int64_t get_vertex_index(const struct vertex * v){
+  return v == NULL ? SNAPSHOT_NULL_INDEX : (int64_t)v->id;
+}
+
+static int64_t get_half_edge_index(const struct half_edge * he){
+  return he == NULL ? SNAPSHOT_NULL_INDEX : (int64_t)he->id;
+}
+
+static int64_t get_face_index(const struct face * f){
+  return f == NULL ? SNAPSHOT_NULL_INDEX : (int64_t)f->id;
+}
+
+/**
+ * Writes the elements of a deque as records, converting every element with the given function
+ */
+static int write_deque_section(struct snapshot_writer * w, enum snapshot_section_type type, struct deque * d, size_t record_size, void (*convert)(void *, const void *)){
+  struct snapshot_section_header header = {type, record_size, d->len};
+  if(write_snapshot_bytes(w, &header, sizeof(header))){
+    return -1;
+  }
+  union{
+    struct snapshot_vertex vertex;
+    struct snapshot_half_edge half_edge;
+    struct snapshot_face face;
+  } record;
+  assert(record_size <= sizeof(record));
+  void * data;
+  size_t len;
+  for(size_t b = 0; (len = get_deque_block(d, b, &data)) > 0; ++b){
+    const char * elem = data;
+    for(size_t i = 0; i < len; ++i){
+      convert(&record, elem + i * d->elem_size);
+      if(write_snapshot_bytes(w, &record, record_size)){
+	return -1;
+      }
+    }
+  }
+  static const char padding[SNAPSHOT_ALIGNMENT] = {0};
+  size_t size = record_size * d->len;
+  return write_snapshot_bytes(w, padding, align_snapshot_size(size) - size);
+}
+
+static void convert_vertex(void * dest, const void * src){
+  const struct vertex * v = src;
+  struct snapshot_vertex * record = dest;
+  record->x = v->x;
+  record->y = v->y;
+}
+
+static void convert_half_edge(void * dest, const void * src){
+  const struct half_edge * he = src;
+  struct snapshot_half_edge * record = dest;
+  record->vertex = get_vertex_index(he->vertex);
+  record->twin = get_half_edge_index(he->twin);
+  record->face = get_face_index(he->face);
+  record->prev = get_half_edge_index(he->prev);
+  record->next = get_half_edge_index(he->next);
+}
+
+static void convert_face(void * dest, const void * src){
+  const struct face * f = src;
+  struct snapshot_face * record = dest;
+  record->x = f->x;
+  record->y = f->y;
+  record->head = get_half_edge_index(f->head);
+  record->tail = get_half_edge_index(f->tail);
+}
+
+int write_edge_list_snapshot(struct snapshot_writer * w, struct edge_list * el){
+  assert(w != NULL);
+  assert(el != NULL);
+
+  if(write_deque_section(w, SNAPSHOT_SECTION_VERTICES, &el->vertices, sizeof(struct snapshot_vertex), convert_vertex)){
+    return -1;
+  }
+  if(write_deque_section(w, SNAPSHOT_SECTION_HALF_EDGES, &el->half_edges, sizeof(struct snapshot_half_edge), convert_half_edge)){
+    return -1;
+  }
+  // faces are stored in id order, which is also the order of the face list
+  return write_deque_section(w, SNAPSHOT_SECTION_FACES, &el->faces, sizeof(struct snapshot_face), convert_face);
+}
+
+static bool is_valid_index(int64_t index, size_t count){
+  return index == SNAPSHOT_NULL_INDEX || (index >= 0 && (uint64_t)index < count);
+}
+
+/**
+ * Elements are restored into empty deques, so the index of a record is its index in the deque
+ */
+static void * get_indexed(struct deque * elements, int64_t index){
+  return index == SNAPSHOT_NULL_INDEX ? NULL : get_deque_at(elements, (size_t)index);
+}
+
+static int fix_edge_list_pointers(struct edge_list * el, const struct snapshot_half_edge * half_edges, size_t half_edge_count, const struct snapshot_face * faces, size_t face_count, size_t vertex_count){
+  for(size_t i = 0; i < half_edge_count; ++i){
+    const struct snapshot_half_edge * record = &half_edges[i];
+    if(!is_valid_index(record->vertex, vertex_count) || !is_valid_index(record->twin, half_edge_count)
+       || !is_valid_index(record->face, face_count) || !is_valid_index(record->prev, half_edge_count)
+       || !is_valid_index(record->next, half_edge_count)){
+      LOG_ERROR("snapshot contains an invalid reference in half edge %zu", i);
+      set_status(STATUS_INVALID_SNAPSHOT);
+      return -1;
+    }
+    struct half_edge * he = get_deque_at(&el->half_edges, i);
+    he->vertex = get_indexed(&el->vertices, record->vertex);
+    he->twin = get_indexed(&el->half_edges, record->twin);
+    he->face = get_indexed(&el->faces, record->face);
+    he->prev = get_indexed(&el->half_edges, record->prev);
+    he->next = get_indexed(&el->half_edges, record->next);
+  }
+  for(size_t i = 0; i < face_count; ++i){
+    const struct snapshot_face * record = &faces[i];
+    if(!is_valid_index(record->head, half_edge_count) || !is_valid_index(record->tail, half_edge_count)){
+      LOG_ERROR("snapshot contains an invalid reference in face %zu", i);
+      set_status(STATUS_INVALID_SNAPSHOT);
+      return -1;
+    }
+    struct face * f = get_deque_at(&el->faces, i);
+    f->head = get_indexed(&el->half_edges, record->head);
+    f->tail = get_indexed(&el->half_edges, record->tail);
+  }
+  return 0;
+}
+
+int read_edge_list_snapshot(struct snapshot_reader * r, struct edge_list * el){
+  assert(r != NULL);
+  assert(el != NULL);
+  assert(el->head == NULL);
+  assert(el->vertices.len == 0 && el->half_edges.len == 0 && el->faces.len == 0);
+
+  size_t vertex_count;
+  const struct snapshot_vertex * vertices = read_snapshot_section(r, SNAPSHOT_SECTION_VERTICES, sizeof(struct snapshot_vertex), &vertex_count);
+  if(vertices == NULL){
+    return -1;
+  }
+  size_t half_edge_count;
+  const struct snapshot_half_edge * half_edges = read_snapshot_section(r, SNAPSHOT_SECTION_HALF_EDGES, sizeof(struct snapshot_half_edge), &half_edge_count);
+  if(half_edges == NULL){
+    return -1;
+  }
+  size_t face_count;
+  const struct snapshot_face * faces = read_snapshot_section(r, SNAPSHOT_SECTION_FACES, sizeof(struct snapshot_face), &face_count);
+  if(faces == NULL){
+    return -1;
+  }
+
+  for(size_t i = 0; i < vertex_count; ++i){
+    struct vertex * v = emplace_vertex(el);
+    if(v == NULL){
+      return -1;
+    }
+    v->x = vertices[i].x;
+    v->y = vertices[i].y;
+  }
+  for(size_t i = 0; i < half_edge_count; ++i){
+    if(emplace_half_edge(el) == NULL){
+      return -1;
+    }
+  }
+  for(size_t i = 0; i < face_count; ++i){
+    struct face * f = emplace_face(el);
+    if(f == NULL){
+      return -1;
+    }
+    f->x = faces[i].x;
+    f->y = faces[i].y;
+  }
+
+  return fix_edge_list_pointers(el, half_edges, half_edge_count, faces, face_count, vertex_count);
+}
+
+int write_world_snapshot(struct snapshot_writer * w, const struct world * world){
+  assert(w != NULL);
+  assert(world != NULL);
+
+  struct snapshot_world header = {world->count, world->slot_count, world->free_slot, 0};
+  if(write_snapshot_section(w, SNAPSHOT_SECTION_WORLD, &header, sizeof(header), 1)){
+    return -1;
+  }
+  // the columns are written as they are, in the order of the struct
+  if(write_snapshot_section(w, SNAPSHOT_SECTION_ENTITIES, world->entities, sizeof(unsigned int), world->count)
+     || write_snapshot_section(w, SNAPSHOT_SECTION_ENTITIES, world->x, sizeof(double), world->count)
+     || write_snapshot_section(w, SNAPSHOT_SECTION_ENTITIES, world->y, sizeof(double), world->count)
+     || write_snapshot_section(w, SNAPSHOT_SECTION_ENTITIES, world->vx, sizeof(double), world->count)
+     || write_snapshot_section(w, SNAPSHOT_SECTION_ENTITIES, world->vy, sizeof(double), world->count)
+     || write_snapshot_section(w, SNAPSHOT_SECTION_ENTITIES, world->owner, sizeof(int), world->count)
+     || write_snapshot_section(w, SNAPSHOT_SECTION_ENTITIES, world->health, sizeof(int), world->count)){
+    return -1;
+  }
+  if(write_snapshot_section(w, SNAPSHOT_SECTION_SLOTS, world->slots, sizeof(unsigned int), world->slot_count)
+     || write_snapshot_section(w, SNAPSHOT_SECTION_SLOTS, world->generations, sizeof(unsigned int), world->slot_count)){
+    return -1;
+  }
+  return 0;
+}
+
+static int read_world_column(struct snapshot_reader * r, enum snapshot_section_type type, void * dest, size_t size, size_t expected){
+  size_t count;
+  const void * data = read_snapshot_section(r, type, size, &count);
+  if(data == NULL){
+    return -1;
+  }
+  if(count != expected){
+    LOG_ERROR("snapshot column has %zu entries, expected %zu", count, expected);
+    set_status(STATUS_INVALID_SNAPSHOT);
+    return -1;
+  }
+  memcpy(dest, data, size * count);
+  return 0;
+}
+
+static bool mark_world_slot(uint64_t * used, unsigned int slot){
+  uint64_t bit = ((uint64_t)1) << (slot & 63);
+  if(used[slot >> 6] & bit){
+    return false;
+  }
+  used[slot >> 6] |= bit;
+  return true;
+}
+
+/**
+ * Checks that the columns read from a snapshot are consistent before the world uses them
+ * Every entity must own the slot pointing back to it, the free list must only link unused slots
+ * and owners must be valid player ids since they are used as bit positions in interest masks
+ */
+static int validate_world_columns(const struct world * world, size_t n, size_t slots, unsigned int free_slot){
+  uint64_t * used = malloc_checked(sizeof(uint64_t) * ((slots + 63) / 64));
+  if(used == NULL){
+    return -1;
+  }
+  memset(used, 0, sizeof(uint64_t) * ((slots + 63) / 64));
+
+  int result = 0;
+  for(size_t i = 0; i < n && result == 0; ++i){
+    unsigned int slot = world->entities[i] & WORLD_ENTITY_INDEX_MASK;
+    if(slot >= slots || world->slots[slot] != i || (world->entities[i] >> WORLD_ENTITY_INDEX_BITS) != world->generations[slot]
+       || !mark_world_slot(used, slot)){
+      LOG_ERROR("snapshot entity %zu does not match its slot", i);
+      result = -1;
+    }else if(world->owner[i] < 0 || world->owner[i] >= GAME_MAX_PLAYER_COUNT){
+      LOG_ERROR("snapshot entity %zu has an invalid owner %d", i, world->owner[i]);
+      result = -1;
+    }
+  }
+  // marking the free slots as used also stops a cycle in the list
+  unsigned int slot = free_slot;
+  while(slot != WORLD_ENTITY_INDEX_MASK && result == 0){
+    if(slot >= slots || !mark_world_slot(used, slot)){
+      LOG_ERROR("snapshot contains an invalid free slot list");
+      result = -1;
+    }else{
+      slot = world->slots[slot];
+    }
+  }
+  free(used);
+  if(result){
+    set_status(STATUS_INVALID_SNAPSHOT);
+  }
+  return result;
+}
+
+int read_world_snapshot(struct snapshot_reader * r, struct world * world){
+  assert(r != NULL);
+  assert(world != NULL);
+  assert(world->count == 0);
+
+  size_t count;
+  const struct snapshot_world * header = read_snapshot_section(r, SNAPSHOT_SECTION_WORLD, sizeof(struct snapshot_world), &count);
+  if(header == NULL){
+    return -1;
+  }
+  if(count != 1 || header->count > header->slot_count || header->slot_count > WORLD_MAX_ENTITY_COUNT
+     || (header->free_slot != WORLD_ENTITY_INDEX_MASK && header->free_slot >= header->slot_count)){
+    LOG_ERROR("snapshot contains an invalid world header");
+    set_status(STATUS_INVALID_SNAPSHOT);
+    return -1;
+  }
+  if(reserve_world(world, header->count, header->slot_count)){
+    return -1;
+  }
+  size_t n = header->count;
+  size_t slots = header->slot_count;
+  if(read_world_column(r, SNAPSHOT_SECTION_ENTITIES, world->entities, sizeof(unsigned int), n)
+     || read_world_column(r, SNAPSHOT_SECTION_ENTITIES, world->x, sizeof(double), n)
+     || read_world_column(r, SNAPSHOT_SECTION_ENTITIES, world->y, sizeof(double), n)
+     || read_world_column(r, SNAPSHOT_SECTION_ENTITIES, world->vx, sizeof(double), n)
+     || read_world_column(r, SNAPSHOT_SECTION_ENTITIES, world->vy, sizeof(double), n)
+     || read_world_column(r, SNAPSHOT_SECTION_ENTITIES, world->owner, sizeof(int), n)
+     || read_world_column(r, SNAPSHOT_SECTION_ENTITIES, world->health, sizeof(int), n)
+     || read_world_column(r, SNAPSHOT_SECTION_SLOTS, world->slots, sizeof(unsigned int), slots)
+     || read_world_column(r, SNAPSHOT_SECTION_SLOTS, world->generations, sizeof(unsigned int), slots)
+     || validate_world_columns(world, n, slots, header->free_slot)){
+    world->count = 0;
+    return -1;
+  }
+  world->count = n;
+  world->slot_count = slots;
+  world->free_slot = header->free_slot;
+  return 0;
+}
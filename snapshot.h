@@ -0,0 +1,95 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "edge_list.h"
+#include "world.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define SNAPSHOT_VERSION 2
+
+/**
+ * A snapshot is a header followed by sections of fixed size records
+ * Every section starts with a section header and is padded to 8 bytes,
+ * so the records can be used in place when the file is mapped into memory
+ */
+enum snapshot_section_type{
+			   SNAPSHOT_SECTION_SERVER,
+			   SNAPSHOT_SECTION_PLAYERS,
+			   SNAPSHOT_SECTION_REPLAY,
+			   SNAPSHOT_SECTION_VERTICES,
+			   SNAPSHOT_SECTION_HALF_EDGES,
+			   SNAPSHOT_SECTION_FACES,
+			   SNAPSHOT_SECTION_WORLD,
+			   SNAPSHOT_SECTION_ENTITIES,
+			   SNAPSHOT_SECTION_SLOTS
+};
+
+struct snapshot_writer{
+  FILE * file;
+  char * path;
+  char * tmp_path;
+};
+
+struct snapshot_reader{
+  const char * data;
+  size_t size;
+  size_t pos;
+};
+
+/**
+ * Snapshots are written to a temporary file that replaces the target when the writer is closed,
+ * so a crash while writing never leaves a truncated snapshot behind
+ */
+int open_snapshot_writer(struct snapshot_writer * w, const char * path);
+
+int write_snapshot_section(struct snapshot_writer * w, enum snapshot_section_type type, const void * records, size_t record_size, size_t count);
+
+int close_snapshot_writer(struct snapshot_writer * w);
+
+void abort_snapshot_writer(struct snapshot_writer * w);
+
+int open_snapshot_reader(struct snapshot_reader * r, const char * path);
+
+/**
+ * Returns the records of the next section, which point into the mapped file
+ * The section must have the expected type and record size
+ */
+const void * read_snapshot_section(struct snapshot_reader * r, enum snapshot_section_type type, size_t record_size, size_t * count);
+
+void close_snapshot_reader(struct snapshot_reader * r);
+
+int write_edge_list_snapshot(struct snapshot_writer * w, struct edge_list * el);
+
+/**
+ * Rebuilds an edge list, turning the stored indices back into pointers
+ * The edge list must be empty
+ */
+int read_edge_list_snapshot(struct snapshot_reader * r, struct edge_list * el);
+
+int write_world_snapshot(struct snapshot_writer * w, const struct world * world);
+
+/**
+ * Restores the world, the world must be initialized and empty
+ */
+int read_world_snapshot(struct snapshot_reader * r, struct world * world);
+
+#endif
@@ -0,0 +1,356 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "logger.h"
+#include "memory.h"
+#include "spatial_index.h"
+#include "status.h"
+
+#include <assert.h>
+#include <math.h>
+
+static size_t clamp_cell(double value, double size, size_t count){
+  if(value <= 0.0){
+    return 0;
+  }
+  size_t cell = (size_t)(value / size);
+  return cell >= count ? count - 1 : cell;
+}
+
+/**
+ * Sorts items into buckets with a counting sort
+ * start must have room for bucket_count + 1 entries and receives the offset of every bucket
+ */
+static void bucket_items(const size_t * buckets, size_t item_count, size_t * start, size_t bucket_count, size_t * dest){
+  for(size_t i = 0; i <= bucket_count; ++i){
+    start[i] = 0;
+  }
+  for(size_t i = 0; i < item_count; ++i){
+    ++start[buckets[i] + 1];
+  }
+  for(size_t i = 0; i < bucket_count; ++i){
+    start[i + 1] += start[i];
+  }
+  // use the start of every bucket as a cursor, which leaves it at the start of the next bucket
+  for(size_t i = 0; i < item_count; ++i){
+    dest[start[buckets[i]]++] = i;
+  }
+  for(size_t i = bucket_count; i > 0; --i){
+    start[i] = start[i - 1];
+  }
+  start[0] = 0;
+}
+
+static int init_site_grid(struct spatial_index * si){
+  double aspect = si->width / si->height;
+  si->cols = (size_t)ceil(sqrt(si->face_count * aspect));
+  if(si->cols == 0){
+    si->cols = 1;
+  }
+  si->rows = (si->face_count + si->cols - 1) / si->cols;
+  if(si->rows == 0){
+    si->rows = 1;
+  }
+  si->cell_width = si->width / si->cols;
+  si->cell_height = si->height / si->rows;
+
+  size_t cell_count = si->cols * si->rows;
+  size_t * cells = malloc_checked(sizeof(size_t) * si->face_count);
+  si->cell_start = malloc_checked(sizeof(size_t) * (cell_count + 1));
+  si->cell_faces = malloc_checked(sizeof(size_t) * si->face_count);
+  if(cells == NULL || si->cell_start == NULL || si->cell_faces == NULL){
+    free(cells);
+    return -1;
+  }
+  for(size_t i = 0; i < si->face_count; ++i){
+    size_t col = clamp_cell(si->site_x[i], si->cell_width, si->cols);
+    size_t row = clamp_cell(si->site_y[i], si->cell_height, si->rows);
+    cells[i] = row * si->cols + col;
+  }
+  bucket_items(cells, si->face_count, si->cell_start, cell_count, si->cell_faces);
+  free(cells);
+  return 0;
+}
+
+static bool has_neighbour(const struct spatial_index * si, size_t start, size_t end, size_t face){
+  for(size_t i = start; i < end; ++i){
+    if(si->neighbours[i] == face){
+      return true;
+    }
+  }
+  return false;
+}
+
+static int init_adjacency(struct spatial_index * si, const struct edge_list * el){
+  // the number of half edges bounds the number of neighbours
+  size_t cap = el->half_edges.len;
+  si->neighbour_start = malloc_checked(sizeof(size_t) * (si->face_count + 1));
+  si->neighbours = malloc_checked(sizeof(size_t) * (cap == 0 ? 1 : cap));
+  if(si->neighbour_start == NULL || si->neighbours == NULL){
+    return -1;
+  }
+
+  size_t len = 0;
+  for(const struct face * f = el->head; f != NULL; f = f->next){
+    size_t start = len;
+    si->neighbour_start[f->id] = start;
+    const struct half_edge * he = f->head;
+    // open faces end in NULL, closed faces loop back to the head
+    for(size_t steps = 0; he != NULL && steps < cap; ++steps){
+      if(he->twin != NULL && he->twin->face != NULL && he->twin->face != f && !has_neighbour(si, start, len, he->twin->face->id)){
+	si->neighbours[len++] = he->twin->face->id;
+      }
+      he = he->next;
+      if(he == f->head){
+	break;
+      }
+    }
+  }
+  si->neighbour_start[si->face_count] = len;
+  return 0;
+}
+
+int init_spatial_index(struct spatial_index * si, const struct edge_list * el, double width, double height){
+  assert(si != NULL);
+  assert(el != NULL);
+  assert(width > 0);
+  assert(height > 0);
+
+  si->width = width;
+  si->height = height;
+  si->face_count = el->faces.len;
+  si->site_x = NULL;
+  si->site_y = NULL;
+  si->cell_start = NULL;
+  si->cell_faces = NULL;
+  si->neighbour_start = NULL;
+  si->neighbours = NULL;
+  si->entity_count = 0;
+  si->entity_cap = 0;
+  si->entity_faces = NULL;
+  si->face_entity_start = NULL;
+  si->face_entities = NULL;
+  si->entity_cols = (size_t)ceil(width / SPATIAL_INDEX_ENTITY_CELL_SIZE);
+  si->entity_rows = (size_t)ceil(height / SPATIAL_INDEX_ENTITY_CELL_SIZE);
+  si->entity_cells = NULL;
+  si->cell_entity_start = NULL;
+  si->cell_entities = NULL;
+
+  if(si->face_count == 0){
+    LOG_ERROR("can not create a spatial index without faces");
+    set_status(STATUS_NOT_FOUND);
+    return -1;
+  }
+  
+  si->site_x = malloc_checked(sizeof(double) * si->face_count);
+  si->site_y = malloc_checked(sizeof(double) * si->face_count);
+  si->face_entity_start = malloc_checked(sizeof(size_t) * (si->face_count + 1));
+  si->cell_entity_start = malloc_checked(sizeof(size_t) * (si->entity_cols * si->entity_rows + 1));
+  if(si->site_x == NULL || si->site_y == NULL || si->face_entity_start == NULL || si->cell_entity_start == NULL){
+    dispose_spatial_index(si);
+    return -1;
+  }
+  for(const struct face * f = el->head; f != NULL; f = f->next){
+    assert(f->id < si->face_count);
+    si->site_x[f->id] = f->x;
+    si->site_y[f->id] = f->y;
+  }
+
+  if(init_site_grid(si) || init_adjacency(si, el) || update_spatial_index_entities(si, NULL)){
+    dispose_spatial_index(si);
+    return -1;
+  }
+  return 0;
+}
+
+static void find_nearest_in_cell(const struct spatial_index * si, size_t col, size_t row, double x, double y, size_t * best, double * best_dist){
+  size_t cell = row * si->cols + col;
+  for(size_t i = si->cell_start[cell]; i < si->cell_start[cell + 1]; ++i){
+    size_t face = si->cell_faces[i];
+    double dx = si->site_x[face] - x;
+    double dy = si->site_y[face] - y;
+    double dist = dx * dx + dy * dy;
+    if(dist < *best_dist){
+      *best_dist = dist;
+      *best = face;
+    }
+  }
+}
+
+size_t locate_spatial_index_face(const struct spatial_index * si, double x, double y){
+  assert(si != NULL);
+  assert(si->face_count > 0);
+
+  long col = clamp_cell(x, si->cell_width, si->cols);
+  long row = clamp_cell(y, si->cell_height, si->rows);
+  long max_ring = si->cols > si->rows ? si->cols : si->rows;
+  double min_cell = si->cell_width < si->cell_height ? si->cell_width : si->cell_height;
+  size_t best = 0;
+  double best_dist = INFINITY;
+
+  // search rings of cells around the cell of the point until no closer site can exist
+  for(long r = 0; r <= max_ring; ++r){
+    for(long j = row - r; j <= row + r; ++j){
+      if(j < 0 || j >= (long)si->rows){
+	continue;
+      }
+      bool edge_row = j == row - r || j == row + r;
+      for(long i = col - r; i <= col + r; i += (edge_row || r == 0) ? 1 : 2 * r){
+	if(i >= 0 && i < (long)si->cols){
+	  find_nearest_in_cell(si, i, j, x, y, &best, &best_dist);
+	}
+      }
+    }
+    double reach = r * min_cell;
+    if(best_dist <= reach * reach){
+      break;
+    }
+  }
+  return best;
+}
+
+const size_t * get_spatial_index_neighbours(const struct spatial_index * si, size_t face, size_t * count){
+  assert(si != NULL);
+  assert(face < si->face_count);
+  assert(count != NULL);
+
+  *count = si->neighbour_start[face + 1] - si->neighbour_start[face];
+  return si->neighbours + si->neighbour_start[face];
+}
+
+static int ensure_entity_cap(struct spatial_index * si, size_t count){
+  if(count <= si->entity_cap){
+    return 0;
+  }
+  size_t cap = si->entity_cap == 0 ? WORLD_INITIAL_CAPACITY : si->entity_cap;
+  while(cap < count){
+    cap *= 2;
+  }
+  size_t * entity_faces = realloc_checked(si->entity_faces, sizeof(size_t) * cap);
+  if(entity_faces == NULL){
+    return -1;
+  }
+  si->entity_faces = entity_faces;
+  size_t * face_entities = realloc_checked(si->face_entities, sizeof(size_t) * cap);
+  if(face_entities == NULL){
+    return -1;
+  }
+  si->face_entities = face_entities;
+  size_t * entity_cells = realloc_checked(si->entity_cells, sizeof(size_t) * cap);
+  if(entity_cells == NULL){
+    return -1;
+  }
+  si->entity_cells = entity_cells;
+  size_t * cell_entities = realloc_checked(si->cell_entities, sizeof(size_t) * cap);
+  if(cell_entities == NULL){
+    return -1;
+  }
+  si->cell_entities = cell_entities;
+  si->entity_cap = cap;
+  return 0;
+}
+
+int update_spatial_index_entities(struct spatial_index * si, const struct world * w){
+  assert(si != NULL);
+
+  size_t count = w == NULL ? 0 : w->count;
+  if(ensure_entity_cap(si, count)){
+    return -1;
+  }
+  si->entity_count = count;
+  for(size_t i = 0; i < count; ++i){
+    si->entity_faces[i] = locate_spatial_index_face(si, w->x[i], w->y[i]);
+    size_t col = clamp_cell(w->x[i], SPATIAL_INDEX_ENTITY_CELL_SIZE, si->entity_cols);
+    size_t row = clamp_cell(w->y[i], SPATIAL_INDEX_ENTITY_CELL_SIZE, si->entity_rows);
+    si->entity_cells[i] = row * si->entity_cols + col;
+  }
+  bucket_items(si->entity_faces, count, si->face_entity_start, si->face_count, si->face_entities);
+  bucket_items(si->entity_cells, count, si->cell_entity_start, si->entity_cols * si->entity_rows, si->cell_entities);
+  return 0;
+}
+
+const size_t * get_spatial_index_face_entities(const struct spatial_index * si, size_t face, size_t * count){
+  assert(si != NULL);
+  assert(face < si->face_count);
+  assert(count != NULL);
+
+  *count = si->face_entity_start[face + 1] - si->face_entity_start[face];
+  return si->face_entities + si->face_entity_start[face];
+}
+
+size_t query_spatial_index_range(const struct spatial_index * si, const struct world * w, double x, double y, double radius, size_t * dest, size_t cap){
+  assert(si != NULL);
+  assert(w != NULL);
+  assert(w->count == si->entity_count);
+  assert(dest != NULL || cap == 0);
+
+  size_t min_col = clamp_cell(x - radius, SPATIAL_INDEX_ENTITY_CELL_SIZE, si->entity_cols);
+  size_t max_col = clamp_cell(x + radius, SPATIAL_INDEX_ENTITY_CELL_SIZE, si->entity_cols);
+  size_t min_row = clamp_cell(y - radius, SPATIAL_INDEX_ENTITY_CELL_SIZE, si->entity_rows);
+  size_t max_row = clamp_cell(y + radius, SPATIAL_INDEX_ENTITY_CELL_SIZE, si->entity_rows);
+  double r2 = radius * radius;
+  size_t found = 0;
+  
+  for(size_t row = min_row; row <= max_row; ++row){
+    for(size_t col = min_col; col <= max_col; ++col){
+      size_t cell = row * si->entity_cols + col;
+      for(size_t i = si->cell_entity_start[cell]; i < si->cell_entity_start[cell + 1]; ++i){
+	size_t e = si->cell_entities[i];
+	double dx = w->x[e] - x;
+	double dy = w->y[e] - y;
+	if(dx * dx + dy * dy <= r2){
+	  if(found < cap){
+	    dest[found] = e;
+	  }
+	  ++found;
+	}
+      }
+    }
+  }
+  return found;
+}
+
+void dispose_spatial_index(struct spatial_index * si){
+  assert(si != NULL);
+
+  free(si->site_x);
+  free(si->site_y);
+  free(si->cell_start);
+  free(si->cell_faces);
+  free(si->neighbour_start);
+  free(si->neighbours);
+  free(si->entity_faces);
+  free(si->face_entity_start);
+  free(si->face_entities);
+  free(si->entity_cells);
+  free(si->cell_entity_start);
+  free(si->cell_entities);
+  si->site_x = NULL;
+  si->site_y = NULL;
+  si->cell_start = NULL;
+  si->cell_faces = NULL;
+  si->neighbour_start = NULL;
+  si->neighbours = NULL;
+  si->entity_faces = NULL;
+  si->face_entity_start = NULL;
+  si->face_entities = NULL;
+  si->entity_cells = NULL;
+  si->cell_entity_start = NULL;
+  si->cell_entities = NULL;
+  si->entity_count = 0;
+  si->entity_cap = 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include "edge_list.h"
+#include "world.h"
+
+#include <stddef.h>
+
+/**
+ * Size of the grid cells used to bucket entities
+ */
+#define SPATIAL_INDEX_ENTITY_CELL_SIZE 25.0
+
+/**
+ * A uniform grid over the map for point location and range queries
+ * Since the map faces are Voronoi cells, the face containing a point is the face with the nearest site,
+ * so point location is a nearest site search in the grid cells around the point
+ * Face adjacency is derived from the half edge twins and stored as one flat array per index
+ * Entities are bucketed per face and per grid cell every time update_spatial_index_entities is called
+ */
+struct spatial_index{
+  double width;
+  double height;
+
+  size_t face_count;
+  double * site_x;
+  double * site_y;
+
+  // sites bucketed in a grid with roughly one site per cell
+  size_t cols;
+  size_t rows;
+  double cell_width;
+  double cell_height;
+  size_t * cell_start;
+  size_t * cell_faces;
+
+  // face adjacency, the neighbours of face i are neighbours[neighbour_start[i]..neighbour_start[i+1]]
+  size_t * neighbour_start;
+  size_t * neighbours;
+
+  // entity buckets, these contain indices into the component columns of the world
+  size_t entity_count;
+  size_t entity_cap;
+  size_t * entity_faces;
+  size_t * face_entity_start;
+  size_t * face_entities;
+  size_t entity_cols;
+  size_t entity_rows;
+  size_t * entity_cells;
+  size_t * cell_entity_start;
+  size_t * cell_entities;
+};
+
+int init_spatial_index(struct spatial_index * si, const struct edge_list * el, double width, double height);
+
+/**
+ * Returns the id of the face that contains the point
+ * Points outside of the map are located in the nearest face
+ */
+size_t locate_spatial_index_face(const struct spatial_index * si, double x, double y);
+
+const size_t * get_spatial_index_neighbours(const struct spatial_index * si, size_t face, size_t * count);
+
+/**
+ * Rebuilds the entity buckets, this must be called after the world has changed
+ */
+int update_spatial_index_entities(struct spatial_index * si, const struct world * w);
+
+const size_t * get_spatial_index_face_entities(const struct spatial_index * si, size_t face, size_t * count);
+
+/**
+ * Writes the indices of at most cap entities within the radius around the point to dest
+ * Returns the total number of entities found, which can be larger than cap
+ */
+size_t query_spatial_index_range(const struct spatial_index * si, const struct world * w, double x, double y, double radius, size_t * dest, size_t cap);
+
+void dispose_spatial_index(struct spatial_index * si);
+
+#endif
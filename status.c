@@ -60,7 +60,12 @@ static const char * status_msg[] = {
 				    "file path too long",
 				    "invalid file path",
 				    "value not found",
-				    "duplicate key"
+				    "duplicate key",
+				    "invalid or expired session",
+				    "missed session messages are no longer available",
+				    "maximum entity count reached",
+				    "invalid snapshot file",
+				    "invalid journal file"
 };
 
 _Thread_local enum status_code cur_status = STATUS_OK;
@@ -61,7 +61,12 @@ enum status_code{
 		 STATUS_PATH_TOO_LONG,
 		 STATUS_INVALID_PATH,
 		 STATUS_NOT_FOUND,
-		 STATUS_DUPLICATE_KEY
+		 STATUS_DUPLICATE_KEY,
+		 STATUS_INVALID_SESSION,
+		 STATUS_SESSION_REPLAY_UNAVAILABLE,
+		 STATUS_MAX_ENTITY_COUNT_REACHED,
+		 STATUS_INVALID_SNAPSHOT,
+		 STATUS_INVALID_JOURNAL
 };
 
 const char * get_status_msg(enum status_code sc);
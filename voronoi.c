@@ -15,14 +15,23 @@
  *
  */
 
+#define LOG_MODULE LOG_MODULE_VORONOI
+
 #include "linear.h"
+#include "logger.h"
+#include "memory.h"
 #include "random.h"
+#include "slab.h"
 #include "status.h"
 #include "voronoi.h"
 
 #include <assert.h>
 #include <math.h>
-#include <stdio.h>
+
+/**
+ * The beach line and events only live while a diagram is created
+ */
+static struct slab_pool diagram_pool = SLAB_POOL_INITIALIZER("voronoi", true);
 
 static void init_diagram(struct diagram * diag, struct edge_list * el, double width, double height){
   assert(diag != NULL);
@@ -30,8 +39,8 @@ static void init_diagram(struct diagram * diag, struct edge_list * el, double wi
 
   diag->el = el;
   
-  init_deque(&diag->nodes, sizeof(struct node), 0);
-  init_deque(&diag->events, sizeof(struct event), 0);
+  init_node_deque(&diag->nodes, 0, &diagram_pool);
+  init_event_deque(&diag->events, 0, &diagram_pool);
 
   diag->width = width;
   diag->height = height;
@@ -42,8 +51,8 @@ static void init_diagram(struct diagram * diag, struct edge_list * el, double wi
 static void dispose_diagram(struct diagram * diag){
   assert(diag != NULL);
 
-  dispose_deque(&diag->nodes);
-  dispose_deque(&diag->events);
+  dispose_node_deque(&diag->nodes);
+  dispose_event_deque(&diag->events);
 }
 
 static double get_priority(struct event * event){
@@ -192,6 +201,8 @@ static void copy_event(struct diagram * diag, struct event * dest, struct event
     dest->type = EVENT_TYPE_ADD_ARC;
   }else{
     dest->remove_arc = src->remove_arc;
+    // the source is removed, so its arc has to point to the copy
+    dest->remove_arc.node->arc.event = dest;
   }
 }
 
@@ -204,9 +215,11 @@ static void remove_event(struct diagram * diag, struct event * event){
     }else{
       replace_event(diag, event, event->right);
     }
+    remove_from_event_deque(&diag->events, event);
   }else{
     if(event->right == NULL){
       replace_event(diag, event, event->left);
+      remove_from_event_deque(&diag->events, event);
     }else{
       struct event * next = get_next_event(event);
       assert(next != NULL);
@@ -288,22 +301,25 @@ static void replace_child(struct diagram * diag, struct node * parent, struct no
 }
 
 
-static void print_node(struct node * node){
+static void log_node(struct node * node){
   assert(node != NULL);
   if(node->type == NODE_TYPE_ARC){
     struct face * f = node->arc.face;
-    printf("arc node (%.2f, %.2f)\n", f->x, f->y); 
+    LOG_DEBUG("arc node (%.2f, %.2f)", f->x, f->y);
   }else{
-    printf("half edge node (%.2f, %.2f) + k (%.2f, %.2f)\n", node->half_edge.x, node->half_edge.y, node->half_edge.dx, node->half_edge.dy);
+    LOG_DEBUG("half edge node (%.2f, %.2f) + k (%.2f, %.2f)", node->half_edge.x, node->half_edge.y, node->half_edge.dx, node->half_edge.dy);
   }
 }
 
-static void print_nodes(struct diagram * diag){
+static void log_nodes(struct diagram * diag){
   assert(diag != NULL);
-  puts("nodes:");
+  if(!LOG_ENABLED(LOG_PRIORITY_DEBUG)){
+    return;
+  }
+  LOG_DEBUG("nodes:");
   struct node * node = get_first_node(diag);
   while(node != NULL){
-    print_node(node);
+    log_node(node);
     node = get_next_node(node);
   }
 }
@@ -334,7 +350,7 @@ static bool add_faces(struct diagram * diag, size_t face_count){
     f->x = pts[i*2];
     f->y = pts[i*2+1];
 
-    struct event * e = emplace_onto_deque(&diag->events);
+    struct event * e = emplace_onto_event_deque(&diag->events);
     if(e == NULL){
       return true;
     }
@@ -433,6 +449,7 @@ static bool check_for_remove_events(struct diagram * diag, struct node * node, d
   //remove previous event
   if(node->arc.event != NULL){
     remove_event(diag, node->arc.event);
+    node->arc.event = NULL;
   }
   
   struct node * left = get_prev_node(node);
@@ -446,9 +463,9 @@ static bool check_for_remove_events(struct diagram * diag, struct node * node, d
   }
   assert(right->type == NODE_TYPE_HALF_EDGE);
 
-  printf("check for removal of arc for site (%.2f, %.2f)\n", node->arc.face->x, node->arc.face->y);
-  printf("left half edge: (%.2f, %2.f) + k (%.2f, %.2f)\n", left->half_edge.x, left->half_edge.y, left->half_edge.dx, left->half_edge.dy);
-  printf("right half edge: (%.2f, %2.f) + k (%.2f, %.2f)\n", right->half_edge.x, right->half_edge.y, right->half_edge.dx, right->half_edge.dy);
+  LOG_DEBUG("check for removal of arc for site (%.2f, %.2f)", node->arc.face->x, node->arc.face->y);
+  LOG_DEBUG("left half edge: (%.2f, %2.f) + k (%.2f, %.2f)", left->half_edge.x, left->half_edge.y, left->half_edge.dx, left->half_edge.dy);
+  LOG_DEBUG("right half edge: (%.2f, %2.f) + k (%.2f, %.2f)", right->half_edge.x, right->half_edge.y, right->half_edge.dx, right->half_edge.dy);
 
   
   
@@ -457,7 +474,7 @@ static bool check_for_remove_events(struct diagram * diag, struct node * node, d
   set_linear2_col(&sys, 1, - right->half_edge.dx, - right->half_edge.dy);
   set_linear2_col(&sys, 2, left->half_edge.x - right->half_edge.x, left->half_edge.y - right->half_edge.y);
   if(solve_linear2(&sys)){
-    print_linear2(&sys);
+    log_linear2(&sys);
     return true;
   }
 
@@ -470,9 +487,9 @@ static bool check_for_remove_events(struct diagram * diag, struct node * node, d
   
   //only interested if the sides actually converge
   if(sys.vars[0] >= 0 && sys.vars[1] >= 0 && ey > sy){
-    printf("arc for site (%.2f, %.2f) will be removed at y = %.4f with intersection (%.2f, %2.f)\n", node->arc.face->x, node->arc.face->y, ey, x, y);
+    LOG_DEBUG("arc for site (%.2f, %.2f) will be removed at y = %.4f with intersection (%.2f, %2.f)", node->arc.face->x, node->arc.face->y, ey, x, y);
     
-    struct event * event = emplace_onto_deque(&diag->events);
+    struct event * event = emplace_onto_event_deque(&diag->events);
     if(event == NULL){
       return true;
     }
@@ -557,7 +574,7 @@ static bool split_node(struct diagram * diag, struct node * split, struct node *
   assert(node->right == NULL);
 
 
-  printf("create half edges between (%.4f, %.4f) and (%.4f, %.4f)\n", split->arc.face->x, split->arc.face->y, node->arc.face->x, node->arc.face->y);
+  LOG_DEBUG("create half edges between (%.4f, %.4f) and (%.4f, %.4f)", split->arc.face->x, split->arc.face->y, node->arc.face->x, node->arc.face->y);
 
   double ly = node->arc.face->y;
   double x = node->arc.face->x;
@@ -584,7 +601,7 @@ static bool split_node(struct diagram * diag, struct node * split, struct node *
   //printf("seeking orthogonal vector to (%.4f,%.4f) -> (%.4f, %.4f)\n", mx, my, dx, dy);
   assert(dx * mx + dy * my == 0);
   
-  struct node * copy = emplace_onto_deque(&diag->nodes);
+  struct node * copy = emplace_onto_node_deque(&diag->nodes);
   if(copy == NULL){
     return true;
   }
@@ -595,7 +612,7 @@ static bool split_node(struct diagram * diag, struct node * split, struct node *
   copy->left = NULL;
   copy->right = NULL;
  
-  struct node * le = emplace_onto_deque(&diag->nodes);
+  struct node * le = emplace_onto_node_deque(&diag->nodes);
   if(le == NULL){
     return true;
   }
@@ -605,12 +622,12 @@ static bool split_node(struct diagram * diag, struct node * split, struct node *
   le->half_edge.dx =  - dx; // the inverse of the direction vector
   assert(le->half_edge.dx <= 0); // left edge must point to the left
   le->half_edge.dy =  - dy;
-  printf("create two half edges from (%.4f, %.4f) in direction (%.4f, %.4f)\n", x, y, dx, dy); 
+  LOG_DEBUG("create two half edges from (%.4f, %.4f) in direction (%.4f, %.4f)", x, y, dx, dy);
   replace_child(diag, split->parent, split, le);
   le->left = split;
   split->parent = le;
 
-  struct node * re = emplace_onto_deque(&diag->nodes);
+  struct node * re = emplace_onto_node_deque(&diag->nodes);
   if(re == NULL){
     return true;
   }
@@ -627,8 +644,8 @@ static bool split_node(struct diagram * diag, struct node * split, struct node *
   re->right = copy;
   copy->parent = re;
 
-  puts("situation before check for remove events:");
-  print_nodes(diag);
+  LOG_DEBUG("situation before check for remove events:");
+  log_nodes(diag);
   
   if(check_for_remove_events(diag, split, ly)){
     return true;
@@ -676,7 +693,7 @@ static bool handle_add_arc_event(struct diagram * diag, struct face * face){
   assert(diag != NULL);
   assert(face != NULL);
 
-  struct node * node = emplace_onto_deque(&diag->nodes);
+  struct node * node = emplace_onto_node_deque(&diag->nodes);
   if(node == NULL){
     return true;
   }
@@ -788,8 +805,8 @@ static bool handle_remove_arc_event(struct diagram * diag, struct node * node, d
   struct half_edge * left_he = le->half_edge.half_edge;
   struct half_edge * right_he = re->half_edge.half_edge;
   
-  printf("edge intersection: (%.4f, %.4f) and (%.4f,%.4f) to (%.4f,%.4f)\n", le->half_edge.x, le->half_edge.y, re->half_edge.x, re->half_edge.y, x, y);
-  printf("create new edge between sites (%.4f, %.4f) and (%.4f,%.4f)\n", la->arc.face->x, la->arc.face->y, ra->arc.face->x, ra->arc.face->y);
+  LOG_DEBUG("edge intersection: (%.4f, %.4f) and (%.4f,%.4f) to (%.4f,%.4f)", le->half_edge.x, le->half_edge.y, re->half_edge.x, re->half_edge.y, x, y);
+  LOG_DEBUG("create new edge between sites (%.4f, %.4f) and (%.4f,%.4f)", la->arc.face->x, la->arc.face->y, ra->arc.face->x, ra->arc.face->y);
 
   //one of the edges must be the parent of the arc to be removed
   assert(node->parent == le || node->parent == re);
@@ -809,6 +826,9 @@ static bool handle_remove_arc_event(struct diagram * diag, struct node * node, d
   }else{
     replace_node(parent, parent->left);
   }
+  // both nodes have left the beach line, their slots are reused by the next nodes
+  remove_from_node_deque(&diag->nodes, node);
+  remove_from_node_deque(&diag->nodes, parent);
 
   //calculate a new edge and store it on the ancestor
   struct face * lf = la->arc.face;
@@ -860,29 +880,32 @@ static bool handle_remove_arc_event(struct diagram * diag, struct node * node, d
 }
 
 
-static void print_event(struct event * event){
+static void log_event(struct event * event){
   assert(event != NULL);
   
   if(event->type == EVENT_TYPE_ADD_ARC){
     struct face * face = event->add_arc.face;
     assert(face != NULL);
-    printf("add arc event for site (%.2f, %.2f)\n", face->x, face->y);
+    LOG_DEBUG("add arc event for site (%.2f, %.2f)", face->x, face->y);
   }else{
     struct node * node = event->remove_arc.node;
     assert(node != NULL);
     assert(node->type == NODE_TYPE_ARC);
     struct face * face = node->arc.face;
-    printf("remove arc event for site (%.2f, %.2f)\n", face->x, face->y); 
+    LOG_DEBUG("remove arc event for site (%.2f, %.2f)", face->x, face->y);
   }
 }
 
-static void print_events(struct diagram * diag){
+static void log_events(struct diagram * diag){
   assert(diag != NULL);
+  if(!LOG_ENABLED(LOG_PRIORITY_DEBUG)){
+    return;
+  }
 
-  puts("events:");
+  LOG_DEBUG("events:");
   struct event * e = get_first_event(diag);
   while(e != NULL){
-    print_event(e);
+    log_event(e);
     e = get_next_event(e);
   }
 }
@@ -891,8 +914,8 @@ static bool handle_event(struct diagram * diag, struct event * event){
   assert(diag != NULL);
   assert(event != NULL);
   
-  printf("handle event at y = %.4f\n", get_priority(event));
-  print_event(event);
+  LOG_DEBUG("handle event at y = %.4f", get_priority(event));
+  log_event(event);
 
   if(event->type == EVENT_TYPE_ADD_ARC){
     return handle_add_arc_event(diag, event->add_arc.face);
@@ -958,11 +981,11 @@ static bool close_open_faces(struct diagram * diag){
   return false;
 }
 
-static void print_diagram(struct diagram * diag){
+static void log_diagram(struct diagram * diag){
   assert(diag != NULL);
-  print_events(diag);
-  print_nodes(diag);
-  print_edge_list(diag->el);
+  log_events(diag);
+  log_nodes(diag);
+  log_edge_list(diag->el);
 }
 
 bool create_voronoi_diagram(struct edge_list * result, size_t face_count, double width, double height){
@@ -975,30 +998,139 @@ bool create_voronoi_diagram(struct edge_list * result, size_t face_count, double
     return true;
   }
 
-  print_diagram(&diag);
+  log_diagram(&diag);
 
   struct event * event;
   while((event = pop_event(&diag)) != NULL){
     if(handle_event(&diag, event)){
       return true;
     }
-    puts("nodes after event:");
-    print_nodes(&diag);
+    remove_from_event_deque(&diag.events, event);
+    LOG_DEBUG("nodes after event:");
+    log_nodes(&diag);
   }
 
   if(close_open_half_edges(&diag)){
     return true;
   }
 
-  puts("before bounds:");
-  print_edge_list(diag.el);
+  LOG_DEBUG("before bounds:");
+  log_edge_list(diag.el);
   
   if(close_open_faces(&diag)){
     return true;
   }
   
-  print_diagram(&diag);
+  log_diagram(&diag);
 
   dispose_diagram(&diag);
   return false;
 }
+
+static struct vertex * get_lattice_vertex(struct vertex ** vertices, size_t cols, size_t i, size_t j){
+  return vertices[j * (cols + 1) + i];
+}
+
+static bool add_lattice_faces(struct edge_list * el, struct vertex ** vertices, struct half_edge ** edges, size_t cols, size_t rows, double width, double height){
+  double cw = width / cols;
+  double ch = height / rows;
+  
+  for(size_t j = 0; j <= rows; ++j){
+    for(size_t i = 0; i <= cols; ++i){
+      struct vertex * v = emplace_vertex(el);
+      if(v == NULL){
+	return true;
+      }
+      v->x = i == cols ? width : i * cw;
+      v->y = j == rows ? height : j * ch;
+      vertices[j * (cols + 1) + i] = v;
+    }
+  }
+
+  for(size_t j = 0; j < rows; ++j){
+    for(size_t i = 0; i < cols; ++i){
+      struct face * f = emplace_face(el);
+      if(f == NULL){
+	return true;
+      }
+      f->x = (i + 0.5) * cw;
+      f->y = (j + 0.5) * ch;
+
+      struct vertex * corners[] = {
+				   get_lattice_vertex(vertices, cols, i, j),
+				   get_lattice_vertex(vertices, cols, i + 1, j),
+				   get_lattice_vertex(vertices, cols, i + 1, j + 1),
+				   get_lattice_vertex(vertices, cols, i, j + 1)
+      };
+      struct half_edge ** cell = &edges[(j * cols + i) * 4];
+      for(size_t e = 0; e < 4; ++e){
+	cell[e] = emplace_half_edge(el);
+	if(cell[e] == NULL){
+	  return true;
+	}
+	cell[e]->vertex = corners[e];
+	cell[e]->face = f;
+      }
+      for(size_t e = 0; e < 4; ++e){
+	cell[e]->next = cell[(e + 1) % 4];
+	cell[e]->prev = cell[(e + 3) % 4];
+      }
+      f->head = cell[0];
+      f->tail = cell[3];
+    }
+  }
+
+  for(size_t j = 0; j < rows; ++j){
+    for(size_t i = 0; i < cols; ++i){
+      struct half_edge ** cell = &edges[(j * cols + i) * 4];
+      if(i + 1 < cols){
+	struct half_edge * left = edges[(j * cols + i + 1) * 4 + 3];
+	cell[1]->twin = left;
+	left->twin = cell[1];
+      }
+      if(j + 1 < rows){
+	struct half_edge * bottom = edges[((j + 1) * cols + i) * 4];
+	cell[2]->twin = bottom;
+	bottom->twin = cell[2];
+      }
+      // edges on the bounds get a twin without a face
+      for(size_t e = 0; e < 4; ++e){
+	bool bound = (e == 0 && j == 0) || (e == 1 && i + 1 == cols) || (e == 2 && j + 1 == rows) || (e == 3 && i == 0);
+	if(bound){
+	  struct half_edge * twin = emplace_half_edge(el);
+	  if(twin == NULL){
+	    return true;
+	  }
+	  twin->vertex = cell[(e + 1) % 4]->vertex;
+	  twin->twin = cell[e];
+	  cell[e]->twin = twin;
+	}
+      }
+    }
+  }
+  return false;
+}
+
+bool create_lattice_voronoi_diagram(struct edge_list * el, size_t cols, size_t rows, double width, double height){
+  assert(el != NULL);
+  assert(cols > 0);
+  assert(rows > 0);
+  assert(width > 0);
+  assert(height > 0);
+
+  struct vertex ** vertices = malloc_checked(sizeof(struct vertex *) * (cols + 1) * (rows + 1));
+  if(vertices == NULL){
+    return true;
+  }
+  // the half edges of every cell in the order bottom, right, top, left
+  struct half_edge ** edges = malloc_checked(sizeof(struct half_edge *) * cols * rows * 4);
+  if(edges == NULL){
+    free(vertices);
+    return true;
+  }
+
+  bool result = add_lattice_faces(el, vertices, edges, cols, rows, width, height);
+  free(edges);
+  free(vertices);
+  return result;
+}
@@ -80,10 +80,14 @@ struct node{
   };
 };
 
+DEFINE_DEQUE(node_deque, struct node)
+
+DEFINE_DEQUE(event_deque, struct event)
+
 struct diagram{
   struct edge_list * el;
-  struct deque nodes;
-  struct deque events;
+  struct node_deque nodes;
+  struct event_deque events;
 
   double width;
   double height;
@@ -93,4 +97,9 @@ struct diagram{
 
 bool create_voronoi_diagram(struct edge_list * el, size_t face_count, double width, double height);
 
+/**
+ * Creates the diagram of sites placed on a regular lattice, so every face is a rectangular cell
+ */
+bool create_lattice_voronoi_diagram(struct edge_list * el, size_t cols, size_t rows, double width, double height);
+
 #endif
@@ -0,0 +1,292 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "memory.h"
+#include "status.h"
+#include "world.h"
+
+#include <assert.h>
+
+#define WORLD_GENERATION_MASK (0xFFFFFFFFu >> WORLD_ENTITY_INDEX_BITS)
+
+/**
+ * Marks the end of the free slot list
+ */
+#define WORLD_NO_SLOT WORLD_ENTITY_INDEX_MASK
+
+static int grow_column(void ** column, size_t size, size_t cap){
+  void * data = realloc_checked(*column, size * cap);
+  if(data == NULL){
+    return -1;
+  }
+  *column = data;
+  return 0;
+}
+
+static int resize_columns(struct world * w, size_t cap){
+  // columns that were already grown stay valid on failure, only the capacity is not updated
+  if(grow_column((void **)&w->entities, sizeof(unsigned int), cap)
+     || grow_column((void **)&w->x, sizeof(double), cap)
+     || grow_column((void **)&w->y, sizeof(double), cap)
+     || grow_column((void **)&w->vx, sizeof(double), cap)
+     || grow_column((void **)&w->vy, sizeof(double), cap)
+     || grow_column((void **)&w->owner, sizeof(int), cap)
+     || grow_column((void **)&w->health, sizeof(int), cap)){
+    return -1;
+  }
+  w->cap = cap;
+  return 0;
+}
+
+static int grow_columns(struct world * w){
+  return resize_columns(w, w->cap == 0 ? WORLD_INITIAL_CAPACITY : w->cap * 2);
+}
+
+static int resize_slots(struct world * w, size_t cap){
+  if(grow_column((void **)&w->slots, sizeof(unsigned int), cap)
+     || grow_column((void **)&w->generations, sizeof(unsigned int), cap)){
+    return -1;
+  }
+  w->slot_cap = cap;
+  return 0;
+}
+
+static int grow_slots(struct world * w){
+  size_t cap = w->slot_cap == 0 ? WORLD_INITIAL_CAPACITY : w->slot_cap * 2;
+  if(cap > WORLD_MAX_ENTITY_COUNT){
+    cap = WORLD_MAX_ENTITY_COUNT;
+  }
+  return resize_slots(w, cap);
+}
+
+static unsigned int acquire_slot(struct world * w){
+  unsigned int slot;
+  if(w->free_slot != WORLD_NO_SLOT){
+    slot = w->free_slot;
+    w->free_slot = w->slots[slot];
+  }else{
+    if(w->slot_count == w->slot_cap){
+      if(w->slot_cap == WORLD_MAX_ENTITY_COUNT){
+	set_status(STATUS_MAX_ENTITY_COUNT_REACHED);
+	return WORLD_NO_SLOT;
+      }
+      if(grow_slots(w)){
+	return WORLD_NO_SLOT;
+      }
+    }
+    slot = w->slot_count++;
+    w->generations[slot] = 0;
+  }
+  return slot;
+}
+
+int init_world(struct world * w){
+  assert(w != NULL);
+
+  w->count = 0;
+  w->cap = 0;
+  w->entities = NULL;
+  w->x = NULL;
+  w->y = NULL;
+  w->vx = NULL;
+  w->vy = NULL;
+  w->owner = NULL;
+  w->health = NULL;
+
+  w->slots = NULL;
+  w->generations = NULL;
+  w->slot_count = 0;
+  w->slot_cap = 0;
+  w->free_slot = WORLD_NO_SLOT;
+
+  if(grow_columns(w) || grow_slots(w)){
+    dispose_world(w);
+    return -1;
+  }
+  return 0;
+}
+
+int reserve_world(struct world * w, size_t cap, size_t slot_cap){
+  assert(w != NULL);
+
+  if(slot_cap > WORLD_MAX_ENTITY_COUNT){
+    set_status(STATUS_MAX_ENTITY_COUNT_REACHED);
+    return -1;
+  }
+  if(cap > w->cap && resize_columns(w, cap)){
+    return -1;
+  }
+  if(slot_cap > w->slot_cap && resize_slots(w, slot_cap)){
+    return -1;
+  }
+  return 0;
+}
+
+unsigned int create_world_entity(struct world * w, int owner, double x, double y, double vx, double vy, int health){
+  assert(w != NULL);
+
+  if(w->count == w->cap && grow_columns(w)){
+    return WORLD_NULL_ENTITY;
+  }
+  unsigned int slot = acquire_slot(w);
+  if(slot == WORLD_NO_SLOT){
+    return WORLD_NULL_ENTITY;
+  }
+  
+  unsigned int entity = (w->generations[slot] << WORLD_ENTITY_INDEX_BITS) | slot;
+  size_t index = w->count++;
+  w->slots[slot] = index;
+  w->entities[index] = entity;
+  w->x[index] = x;
+  w->y[index] = y;
+  w->vx[index] = vx;
+  w->vy[index] = vy;
+  w->owner[index] = owner;
+  w->health[index] = health;
+  return entity;
+}
+
+long get_world_entity_index(const struct world * w, unsigned int entity){
+  assert(w != NULL);
+
+  unsigned int slot = entity & WORLD_ENTITY_INDEX_MASK;
+  if(entity == WORLD_NULL_ENTITY || slot >= w->slot_count){
+    return -1;
+  }
+  // a free slot holds the next free slot, which never refers to an entry with this id
+  unsigned int index = w->slots[slot];
+  if(index < w->count && w->entities[index] == entity){
+    return index;
+  }
+  return -1;
+}
+
+bool is_world_entity_alive(const struct world * w, unsigned int entity){
+  return get_world_entity_index(w, entity) >= 0;
+}
+
+static void remove_world_entity_at(struct world * w, size_t index){
+  assert(index < w->count);
+  
+  unsigned int slot = w->entities[index] & WORLD_ENTITY_INDEX_MASK;
+  size_t last = --w->count;
+
+  // move the last entity into the hole to keep the columns dense
+  if(index != last){
+    w->entities[index] = w->entities[last];
+    w->x[index] = w->x[last];
+    w->y[index] = w->y[last];
+    w->vx[index] = w->vx[last];
+    w->vy[index] = w->vy[last];
+    w->owner[index] = w->owner[last];
+    w->health[index] = w->health[last];
+    w->slots[w->entities[index] & WORLD_ENTITY_INDEX_MASK] = index;
+  }
+
+  w->generations[slot] = (w->generations[slot] + 1) & WORLD_GENERATION_MASK;
+  w->slots[slot] = w->free_slot;
+  w->free_slot = slot;
+}
+
+int destroy_world_entity(struct world * w, unsigned int entity){
+  assert(w != NULL);
+
+  long index = get_world_entity_index(w, entity);
+  if(index < 0){
+    set_status(STATUS_NOT_FOUND);
+    return -1;
+  }
+  remove_world_entity_at(w, index);
+  return 0;
+}
+
+size_t destroy_world_entities_of(struct world * w, int owner){
+  assert(w != NULL);
+
+  size_t removed = 0;
+  size_t i = 0;
+  while(i < w->count){
+    if(w->owner[i] == owner){
+      // the last entity moved into i, so examine the same index again
+      remove_world_entity_at(w, i);
+      ++removed;
+    }else{
+      ++i;
+    }
+  }
+  return removed;
+}
+
+void update_world(struct world * w, double dt, double width, double height){
+  assert(w != NULL);
+
+  const size_t count = w->count;
+  double * restrict x = w->x;
+  double * restrict y = w->y;
+  double * restrict vx = w->vx;
+  double * restrict vy = w->vy;
+
+  for(size_t i = 0; i < count; ++i){
+    x[i] += vx[i] * dt;
+    y[i] += vy[i] * dt;
+  }
+  
+  for(size_t i = 0; i < count; ++i){
+    if(x[i] < 0.0){
+      x[i] = -x[i];
+      vx[i] = -vx[i];
+    }else if(x[i] > width){
+      x[i] = 2.0 * width - x[i];
+      vx[i] = -vx[i];
+    }
+    if(y[i] < 0.0){
+      y[i] = -y[i];
+      vy[i] = -vy[i];
+    }else if(y[i] > height){
+      y[i] = 2.0 * height - y[i];
+      vy[i] = -vy[i];
+    }
+  }
+}
+
+void dispose_world(struct world * w){
+  assert(w != NULL);
+
+  free(w->entities);
+  free(w->x);
+  free(w->y);
+  free(w->vx);
+  free(w->vy);
+  free(w->owner);
+  free(w->health);
+  free(w->slots);
+  free(w->generations);
+  w->entities = NULL;
+  w->x = NULL;
+  w->y = NULL;
+  w->vx = NULL;
+  w->vy = NULL;
+  w->owner = NULL;
+  w->health = NULL;
+  w->slots = NULL;
+  w->generations = NULL;
+  w->count = 0;
+  w->cap = 0;
+  w->slot_count = 0;
+  w->slot_cap = 0;
+  w->free_slot = WORLD_NO_SLOT;
+}
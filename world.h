@@ -0,0 +1,100 @@
+/*
+ * This file is part of game.
+ *
+ * game is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *    game is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with game.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef WORLD_H
+#define WORLD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * An entity id consists of a slot index in the lower bits and a generation counter in the upper bits
+ * The generation is incremented every time a slot is reused so stale ids can be detected
+ */
+#define WORLD_ENTITY_INDEX_BITS 20
+#define WORLD_ENTITY_INDEX_MASK ((1u << WORLD_ENTITY_INDEX_BITS) - 1)
+#define WORLD_MAX_ENTITY_COUNT WORLD_ENTITY_INDEX_MASK
+
+/**
+ * An id that never refers to a live entity
+ */
+#define WORLD_NULL_ENTITY 0xFFFFFFFFu
+
+/**
+ * Initial capacity of the component columns
+ */
+#define WORLD_INITIAL_CAPACITY 1024
+
+/**
+ * Stores all game entities
+ * Components are kept in parallel arrays (one column per component) that are densely packed:
+ * the live entities always occupy indices [0, count), so a tick iterates over contiguous memory
+ * The slot table maps entity ids to dense indices and links the unused slots in a free list
+ */
+struct world{
+  size_t count;
+  size_t cap;
+
+  // dense component columns
+  unsigned int * entities;
+  double * x;
+  double * y;
+  double * vx;
+  double * vy;
+  int * owner;
+  int * health;
+
+  // sparse slot table
+  unsigned int * slots;
+  unsigned int * generations;
+  size_t slot_count;
+  size_t slot_cap;
+  unsigned int free_slot;
+};
+
+int init_world(struct world * w);
+
+/**
+ * Makes room for at least cap entities and slot_cap slots
+ */
+int reserve_world(struct world * w, size_t cap, size_t slot_cap);
+
+unsigned int create_world_entity(struct world * w, int owner, double x, double y, double vx, double vy, int health);
+
+bool is_world_entity_alive(const struct world * w, unsigned int entity);
+
+/**
+ * Returns the index of the entity in the component columns or -1 if the entity is not alive
+ * The index is only valid until the next entity is destroyed
+ */
+long get_world_entity_index(const struct world * w, unsigned int entity);
+
+int destroy_world_entity(struct world * w, unsigned int entity);
+
+/**
+ * Destroys all entities owned by a player
+ */
+size_t destroy_world_entities_of(struct world * w, int owner);
+
+/**
+ * Advances the simulation by dt seconds, bouncing entities off the map edges
+ */
+void update_world(struct world * w, double dt, double width, double height);
+
+void dispose_world(struct world * w);
+
+#endif